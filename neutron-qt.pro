@@ -165,6 +165,7 @@ DEPENDPATH += src src/json src/qt
 
 HEADERS += src/activemasternode.h \
     src/addrdb.h \
+    src/addressindex.h \
     src/addrman.h \
     src/alert.h \
     src/allocators.h \
@@ -172,12 +173,17 @@ HEADERS += src/activemasternode.h \
     src/base58.h \
     src/bignum.h \
     src/bitcoinrpc.h \
+    src/blockcache.h \
+    src/blockdownload.h \
+    src/blockfile.h \
     src/chainparams.h \
+    src/chainstate.h \
     src/checkpoints.h \
     src/clientversion.h \
     src/crypter.h \
     src/compat.h \
     src/coincontrol.h \
+    src/coins.h \
     src/darksend.h \
     src/db.h \
     src/init.h \
@@ -194,13 +200,19 @@ HEADERS += src/activemasternode.h \
     src/netbase.h \
     src/noui.h \
     src/pbkdf2.h \
+    src/orphanblocks.h \
     src/protocol.h \
+    src/prune.h \
     src/random.h \
     src/robinhood.h \
     src/scheduler.h \
     src/script.h \
+    src/scriptcheck.h \
+    src/sigcache.h \
+    src/ecverify.h \
     src/scrypt.h \
     src/serialize.h \
+    src/spentindex.h \
     src/spork.h \
     src/streams.h \
     src/strlcpy.h \
@@ -208,7 +220,9 @@ HEADERS += src/activemasternode.h \
     src/threadinterrupt.h \
     src/threadsafety.h \
     src/timedata.h \
+    src/timestampindex.h \
     src/txdb.h \
+    src/txdbstats.h \
     src/txmempool.h \
     src/uint256.h \
     src/ui_interface.h \
@@ -275,12 +289,18 @@ HEADERS += src/activemasternode.h \
 
 SOURCES += src/activemasternode.cpp \
     src/addrdb.cpp \
+    src/addressindex.cpp \
     src/addrman.cpp \
     src/alert.cpp \
     src/backtrace.cpp \
     src/bitcoinrpc.cpp \
+    src/blockcache.cpp \
+    src/blockdownload.cpp \
+    src/blockfile.cpp \
     src/chainparams.cpp \
+    src/chainstate.cpp \
     src/checkpoints.cpp \
+    src/coins.cpp \
     src/clientversion.cpp \
     src/crypter.cpp \
     src/darksend.cpp \
@@ -298,7 +318,9 @@ SOURCES += src/activemasternode.cpp \
     src/netaddress.cpp \
     src/netbase.cpp \
     src/noui.cpp \
+    src/orphanblocks.cpp \
     src/protocol.cpp \
+    src/prune.cpp \
     src/pbkdf2.cpp \
     src/random.cpp \
     src/rpcblockchain.cpp \
@@ -310,14 +332,20 @@ SOURCES += src/activemasternode.cpp \
     src/rpcwallet.cpp \
     src/scheduler.cpp \
     src/script.cpp \
+    src/scriptcheck.cpp \
+    src/sigcache.cpp \
+    src/ecverify.cpp \
     src/scrypt.cpp \
     src/scrypt-arm.S \
     src/scrypt-x86.S \
     src/scrypt-x86_64.S \
+    src/spentindex.cpp \
     src/spork.cpp \
     src/sync.cpp \
     src/threadinterrupt.cpp \
     src/timedata.cpp \
+    src/timestampindex.cpp \
+    src/txdbstats.cpp \
     src/txmempool.cpp \
     src/ui_interface.cpp \
     src/util.cpp \
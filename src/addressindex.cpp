@@ -0,0 +1,286 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+#include "collectionhashing.h"
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <atomic>
+#include <map>
+
+#include <boost/thread.hpp>
+
+using namespace std;
+
+extern std::atomic<bool> fRequestShutdown;
+
+bool fAddressIndex = DEFAULT_ADDRESSINDEX;
+
+// Blocks indexed per step by a thread of BuildAddressIndex()
+static const unsigned int ADDRESSINDEX_BUILD_BATCH = 256;
+
+bool GetAddressKey(const CScript& script, unsigned char& nType, uint160& hashBytes)
+{
+    CTxDestination dest;
+
+    if (!ExtractDestination(script, dest))
+        return false;
+
+    if (const CKeyID* keyID = boost::get<CKeyID>(&dest))
+    {
+        nType = ADDRESS_PUBKEYHASH;
+        hashBytes = *keyID;
+        return true;
+    }
+
+    if (const CScriptID* scriptID = boost::get<CScriptID>(&dest))
+    {
+        nType = ADDRESS_SCRIPTHASH;
+        hashBytes = *scriptID;
+        return true;
+    }
+
+    return false;
+}
+
+// The output spent by an input and, if pnHeightPrev is set, the height it was
+// created at. Outputs of transactions in the same block are taken from
+// mapBlockTx, the others from the coins view or, when already spent there, from
+// the transaction index.
+static bool GetPrevOutput(CTxDB& txdb, const COutPoint& prevout, const map<uint256, const CTransaction*>& mapBlockTx,
+                          int nHeight, bool fUseCoins, CTxOut& out, int* pnHeightPrev)
+{
+    auto it = mapBlockTx.find(prevout.hash);
+
+    if (it != mapBlockTx.end())
+    {
+        if (prevout.n >= it->second->vout.size())
+            return false;
+
+        out = it->second->vout[prevout.n];
+
+        if (pnHeightPrev)
+            *pnHeightPrev = nHeight;
+
+        return true;
+    }
+
+    CCoin coin;
+
+    if (fUseCoins && txdb.GetCoin(prevout, coin))
+    {
+        out = coin.out;
+
+        if (pnHeightPrev)
+            *pnHeightPrev = coin.nHeight;
+
+        return true;
+    }
+
+    CTransaction txPrev;
+    CTxIndex txindex;
+
+    if (!txdb.ReadDiskTx(prevout.hash, txPrev, txindex) || prevout.n >= txPrev.vout.size())
+        return false;
+
+    out = txPrev.vout[prevout.n];
+
+    if (pnHeightPrev)
+    {
+        CBlock blockPrev;
+
+        if (!blockPrev.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false))
+            return false;
+
+        auto mi = mapBlockIndex.find(blockPrev.GetHash());
+        *pnHeightPrev = mi == mapBlockIndex.end() ? -1 : mi->second->nHeight;
+    }
+
+    return true;
+}
+
+// The records a block adds to the index. The outputs it spends are listed in
+// pvSpentUnspent if given, in the order they are spent.
+static bool GetBlockAddressEntries(CTxDB& txdb, const CBlock& block, int nHeight, bool fUseCoins,
+                                   vector<CAddressIndexEntry>& vIndex, vector<CAddressUnspentEntry>& vUnspent,
+                                   vector<CAddressUnspentEntry>* pvSpentUnspent)
+{
+    map<uint256, const CTransaction*> mapBlockTx;
+
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+    {
+        uint256 txhash = tx.GetHash();
+        unsigned char nType;
+        uint160 hashBytes;
+
+        if (!tx.IsCoinBase())
+        {
+            for (unsigned int i = 0; i < tx.vin.size(); i++)
+            {
+                const COutPoint& prevout = tx.vin[i].prevout;
+                CTxOut out;
+                int nHeightPrev = -1;
+
+                if (!GetPrevOutput(txdb, prevout, mapBlockTx, nHeight, fUseCoins, out,
+                                   pvSpentUnspent ? &nHeightPrev : NULL))
+                {
+                    return error("%s : cannot find output %s:%u spent by %s", __func__,
+                                 prevout.hash.ToString(), prevout.n, txhash.ToString());
+                }
+
+                if (!GetAddressKey(out.scriptPubKey, nType, hashBytes))
+                    continue;
+
+                vIndex.push_back(make_pair(CAddressIndexKey(nType, hashBytes, nHeight, txhash, i, true), -out.nValue));
+
+                if (pvSpentUnspent)
+                {
+                    pvSpentUnspent->push_back(make_pair(CAddressUnspentKey(nType, hashBytes, prevout.hash, prevout.n),
+                                                        CAddressUnspentValue(out.nValue, out.scriptPubKey, nHeightPrev)));
+                }
+            }
+        }
+
+        for (unsigned int i = 0; i < tx.vout.size(); i++)
+        {
+            const CTxOut& out = tx.vout[i];
+
+            if (out.IsEmpty() || !GetAddressKey(out.scriptPubKey, nType, hashBytes))
+                continue;
+
+            vIndex.push_back(make_pair(CAddressIndexKey(nType, hashBytes, nHeight, txhash, i, false), out.nValue));
+            vUnspent.push_back(make_pair(CAddressUnspentKey(nType, hashBytes, txhash, i),
+                                         CAddressUnspentValue(out.nValue, out.scriptPubKey, nHeight)));
+        }
+
+        mapBlockTx[txhash] = &tx;
+    }
+
+    return true;
+}
+
+bool UpdateAddressIndex(CTxDB& txdb, const CBlock& block, const CBlockIndex* pindex, bool fConnect)
+{
+    vector<CAddressIndexEntry> vIndex;
+    vector<CAddressUnspentEntry> vUnspent;
+    vector<CAddressUnspentEntry> vSpentUnspent;
+
+    // The coins view still has the outputs spent by a block that is being
+    // connected, but not those of a block that is being disconnected
+    if (!GetBlockAddressEntries(txdb, block, pindex->nHeight, fConnect, vIndex, vUnspent, &vSpentUnspent))
+        return false;
+
+    BOOST_FOREACH(const CAddressIndexEntry& entry, vIndex)
+    {
+        if (!(fConnect ? txdb.WriteAddressIndex(entry.first, entry.second) : txdb.EraseAddressIndex(entry.first)))
+            return error("%s : cannot update the address index", __func__);
+    }
+
+    // Outputs created and spent within the block end up deleted either way
+    if (fConnect)
+    {
+        BOOST_FOREACH(const CAddressUnspentEntry& entry, vUnspent)
+            txdb.WriteAddressUnspent(entry.first, entry.second);
+
+        BOOST_FOREACH(const CAddressUnspentEntry& entry, vSpentUnspent)
+            txdb.EraseAddressUnspent(entry.first);
+    }
+    else
+    {
+        BOOST_FOREACH(const CAddressUnspentEntry& entry, vSpentUnspent)
+            txdb.WriteAddressUnspent(entry.first, entry.second);
+
+        BOOST_FOREACH(const CAddressUnspentEntry& entry, vUnspent)
+            txdb.EraseAddressUnspent(entry.first);
+    }
+
+    return true;
+}
+
+bool BuildAddressIndex(int nThreads)
+{
+    int64_t nStart = GetTimeMillis();
+    vector<const CBlockIndex*> vChain;
+
+    for (const CBlockIndex* pindex = pindexGenesisBlock; pindex; pindex = pindex->pnext)
+        vChain.push_back(pindex);
+
+    LogPrintf("%s : indexing %u blocks with %d threads\n", __func__, vChain.size(), nThreads);
+
+    // Every block is indexed on its own, so the blocks can be handed out in any
+    // order. Whether an output is still unspent is known from the transaction
+    // index of the fully connected chain.
+    std::atomic<unsigned int> nNext(0);
+    std::atomic<uint64_t> nRecords(0);
+    std::atomic<bool> fFailed(false);
+    boost::thread_group threadGroup;
+
+    for (int i = 0; i < nThreads; i++)
+    {
+        threadGroup.create_thread([&]() {
+            RenameThread("neutron-addrindex");
+            CTxDB txdb;
+
+            while (!fFailed && !fRequestShutdown)
+            {
+                unsigned int nFirst = nNext.fetch_add(ADDRESSINDEX_BUILD_BATCH);
+
+                if (nFirst >= vChain.size())
+                    break;
+
+                unsigned int nLast = min((unsigned int) vChain.size(), nFirst + ADDRESSINDEX_BUILD_BATCH);
+                vector<CAddressIndexEntry> vIndex;
+                vector<CAddressUnspentEntry> vUnspent;
+
+                for (unsigned int n = nFirst; n < nLast; n++)
+                {
+                    CBlock block;
+                    vector<CAddressUnspentEntry> vOutputs;
+
+                    if (!block.ReadFromDisk(vChain[n]) ||
+                        !GetBlockAddressEntries(txdb, block, vChain[n]->nHeight, false, vIndex, vOutputs, NULL))
+                    {
+                        LogPrintf("BuildAddressIndex : cannot index block %d\n", vChain[n]->nHeight);
+                        fFailed = true;
+                        return;
+                    }
+
+                    BOOST_FOREACH(const CAddressUnspentEntry& entry, vOutputs)
+                    {
+                        CTxIndex txindex;
+
+                        if (txdb.ReadTxIndex(entry.first.txhash, txindex) &&
+                            entry.first.nIndex < txindex.vSpent.size() && txindex.vSpent[entry.first.nIndex].IsNull())
+                        {
+                            vUnspent.push_back(entry);
+                        }
+                    }
+                }
+
+                if (!txdb.WriteAddressIndexBatch(vIndex, vUnspent))
+                {
+                    fFailed = true;
+                    return;
+                }
+
+                nRecords += vIndex.size() + vUnspent.size();
+            }
+        });
+    }
+
+    threadGroup.join_all();
+
+    if (fFailed)
+        return false;
+
+    // A partial index must not be taken for a complete one
+    if (fRequestShutdown)
+        return error("%s : interrupted after %u records", __func__, (uint64_t) nRecords);
+
+    LogPrintf("%s : wrote %u records in %dms\n", __func__, (uint64_t) nRecords, GetTimeMillis() - nStart);
+    return true;
+}
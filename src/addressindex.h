@@ -0,0 +1,162 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NEUTRON_ADDRESSINDEX_H
+#define NEUTRON_ADDRESSINDEX_H
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "script.h"
+#include "serialize.h"
+#include "uint256.h"
+
+class CBlock;
+class CBlockIndex;
+class CTxDB;
+
+enum AddressType
+{
+    ADDRESS_NONE = 0,
+    ADDRESS_PUBKEYHASH = 1,
+    ADDRESS_SCRIPTHASH = 2,
+};
+
+/** Maintain the address index (-addressindex) */
+static const bool DEFAULT_ADDRESSINDEX = false;
+extern bool fAddressIndex;
+
+static inline void WriteAddressIndexBE32(unsigned char* ptr, uint32_t x)
+{
+    ptr[0] = x >> 24;
+    ptr[1] = x >> 16;
+    ptr[2] = x >> 8;
+    ptr[3] = x;
+}
+
+static inline uint32_t ReadAddressIndexBE32(const unsigned char* ptr)
+{
+    return ((uint32_t) ptr[0] << 24) | ((uint32_t) ptr[1] << 16) | ((uint32_t) ptr[2] << 8) | ptr[3];
+}
+
+/** An output received by or spent from an address. The fields are stored
+ * big-endian, so the records of an address are ordered by height on disk and
+ * a height range is a contiguous range of keys.
+ */
+class CAddressIndexKey
+{
+public:
+    unsigned char nType;
+    uint160 hashBytes;
+    int nHeight;
+    uint256 txhash;
+    unsigned int nIndex; // output index, or input index if fSpending
+    bool fSpending;
+
+    CAddressIndexKey() : nType(ADDRESS_NONE), hashBytes(0), nHeight(0), txhash(0), nIndex(0), fSpending(false) {}
+
+    CAddressIndexKey(unsigned char nTypeIn, const uint160& hashBytesIn, int nHeightIn, const uint256& txhashIn,
+                     unsigned int nIndexIn, bool fSpendingIn) :
+        nType(nTypeIn), hashBytes(hashBytesIn), nHeight(nHeightIn), txhash(txhashIn), nIndex(nIndexIn),
+        fSpending(fSpendingIn) {}
+
+    unsigned int GetSerializeSize(int, int=0) const
+    {
+        return 1 + 20 + 4 + 32 + 4 + 1;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int, int=0) const
+    {
+        unsigned char buf[4];
+        s.write((const char*) &nType, 1);
+        s.write((const char*) hashBytes.begin(), 20);
+        WriteAddressIndexBE32(buf, nHeight);
+        s.write((const char*) buf, 4);
+        s.write((const char*) txhash.begin(), 32);
+        WriteAddressIndexBE32(buf, nIndex);
+        s.write((const char*) buf, 4);
+        unsigned char f = fSpending;
+        s.write((const char*) &f, 1);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int, int=0)
+    {
+        unsigned char buf[4];
+        s.read((char*) &nType, 1);
+        s.read((char*) hashBytes.begin(), 20);
+        s.read((char*) buf, 4);
+        nHeight = ReadAddressIndexBE32(buf);
+        s.read((char*) txhash.begin(), 32);
+        s.read((char*) buf, 4);
+        nIndex = ReadAddressIndexBE32(buf);
+        unsigned char f;
+        s.read((char*) &f, 1);
+        fSpending = f != 0;
+    }
+};
+
+/** An output currently unspent at an address */
+class CAddressUnspentKey
+{
+public:
+    unsigned char nType;
+    uint160 hashBytes;
+    uint256 txhash;
+    unsigned int nIndex;
+
+    CAddressUnspentKey() : nType(ADDRESS_NONE), hashBytes(0), txhash(0), nIndex(0) {}
+
+    CAddressUnspentKey(unsigned char nTypeIn, const uint160& hashBytesIn, const uint256& txhashIn,
+                       unsigned int nIndexIn) :
+        nType(nTypeIn), hashBytes(hashBytesIn), txhash(txhashIn), nIndex(nIndexIn) {}
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nType);
+        READWRITE(hashBytes);
+        READWRITE(txhash);
+        READWRITE(nIndex);
+    )
+};
+
+class CAddressUnspentValue
+{
+public:
+    int64_t nValue;
+    CScript script;
+    int nHeight;
+
+    CAddressUnspentValue() : nValue(0), nHeight(0) {}
+
+    CAddressUnspentValue(int64_t nValueIn, const CScript& scriptIn, int nHeightIn) :
+        nValue(nValueIn), script(scriptIn), nHeight(nHeightIn) {}
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nValue);
+        READWRITE(script);
+        READWRITE(nHeight);
+    )
+};
+
+typedef std::pair<CAddressIndexKey, int64_t> CAddressIndexEntry;
+typedef std::pair<CAddressUnspentKey, CAddressUnspentValue> CAddressUnspentEntry;
+
+/** The index type and hash of the address a script pays to, false if it does not pay to an address */
+bool GetAddressKey(const CScript& script, unsigned char& nType, uint160& hashBytes);
+
+/** Add (fConnect) or remove the address index records of a block, in the
+ * transaction of txdb. Has to run before the spent outputs leave the coins view.
+ */
+bool UpdateAddressIndex(CTxDB& txdb, const CBlock& block, const CBlockIndex* pindex, bool fConnect);
+
+/** Index the whole best chain from scratch, spread over nThreads threads */
+bool BuildAddressIndex(int nThreads);
+
+#endif // NEUTRON_ADDRESSINDEX_H
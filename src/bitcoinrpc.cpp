@@ -385,12 +385,23 @@ static const CRPCCommand vRPCCommands[] =
     { "clearbanned",            &clearbanned,            true,       false },
 
     /* Block chain and UTXO */
+    { "dumpchainstate",         &dumpchainstate,         true,       false },
+    { "getaddressbalance",      &getaddressbalance,      true,       false },
+    { "getaddressdeltas",       &getaddressdeltas,       true,       false },
+    { "getaddresstxids",        &getaddresstxids,        true,       false },
+    { "getaddressutxos",        &getaddressutxos,        true,       false },
     { "getbestblockhash",       &getbestblockhash,       true,       false },
     { "getblockcount",          &getblockcount,          true,       false },
     { "getblock",               &getblock,               true,       false },
+    { "getblockcacheinfo",      &getblockcacheinfo,      true,       false },
+    { "getsigcacheinfo",        &getsigcacheinfo,        true,       false },
     { "getblockhash",           &getblockhash,           true,       false },
+    { "getblockhashes",         &getblockhashes,         true,       false },
+    { "getdbstats",             &getdbstats,             true,       false },
     { "getdifficulty",          &getdifficulty,          true,       false },
     { "getrawmempool",          &getrawmempool,          true,       false },
+    { "getspentinfo",           &getspentinfo,           true,       false },
+    { "loadchainstate",         &loadchainstate,         true,       false },
 
     /* Mining */
     { "getblocktemplate",       &getblocktemplate,       true,       false },
@@ -0,0 +1,143 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+
+CBlockCache blockcache(DEFAULT_BLOCK_CACHE * 1048576);
+
+CBlockCache::CBlockCache(size_t nMaxBytesIn) : nBytes(0), nMaxBytes(nMaxBytesIn), nHits(0), nMisses(0)
+{
+}
+
+CBlockRef CBlockCache::Touch(map<uint256, CEntry>::iterator it)
+{
+    listLRU.splice(listLRU.begin(), listLRU, it->second.itLRU);
+    nHits++;
+
+    return it->second.block;
+}
+
+void CBlockCache::Erase(map<uint256, CEntry>::iterator it)
+{
+    nBytes -= it->second.nSize;
+    mapBlockPos.erase(it->second.pos);
+    listLRU.erase(it->second.itLRU);
+    mapBlocks.erase(it);
+}
+
+CBlockRef CBlockCache::Get(const uint256& hash)
+{
+    LOCK(cs_blockcache);
+    map<uint256, CEntry>::iterator it = mapBlocks.find(hash);
+
+    if (it == mapBlocks.end())
+    {
+        nMisses++;
+        return CBlockRef();
+    }
+
+    return Touch(it);
+}
+
+CBlockRef CBlockCache::Peek(const uint256& hash) const
+{
+    LOCK(cs_blockcache);
+    map<uint256, CEntry>::const_iterator it = mapBlocks.find(hash);
+
+    return it == mapBlocks.end() ? CBlockRef() : it->second.block;
+}
+
+CBlockRef CBlockCache::Peek(unsigned int nFile, unsigned int nBlockPos) const
+{
+    LOCK(cs_blockcache);
+    map<pair<unsigned int, unsigned int>, uint256>::const_iterator mi = mapBlockPos.find(make_pair(nFile, nBlockPos));
+
+    if (mi == mapBlockPos.end())
+        return CBlockRef();
+
+    return mapBlocks.find(mi->second)->second.block;
+}
+
+void CBlockCache::Insert(const uint256& hash, const CBlockRef& block, unsigned int nFile, unsigned int nBlockPos)
+{
+    size_t nSize = ::GetSerializeSize(*block, SER_NETWORK, PROTOCOL_VERSION);
+
+    LOCK(cs_blockcache);
+
+    if (nSize > nMaxBytes || mapBlocks.count(hash))
+        return;
+
+    while (nBytes + nSize > nMaxBytes && !listLRU.empty())
+        Erase(mapBlocks.find(listLRU.back()));
+
+    listLRU.push_front(hash);
+
+    CEntry& entry = mapBlocks[hash];
+    entry.block = block;
+    entry.pos = make_pair(nFile, nBlockPos);
+    entry.nSize = nSize;
+    entry.itLRU = listLRU.begin();
+
+    mapBlockPos[entry.pos] = hash;
+    nBytes += nSize;
+}
+
+void CBlockCache::Clear()
+{
+    LOCK(cs_blockcache);
+    mapBlocks.clear();
+    mapBlockPos.clear();
+    listLRU.clear();
+    nBytes = 0;
+}
+
+void CBlockCache::SetMaxBytes(size_t nMaxBytesIn)
+{
+    LOCK(cs_blockcache);
+    nMaxBytes = nMaxBytesIn;
+
+    while (nBytes > nMaxBytes && !listLRU.empty())
+        Erase(mapBlocks.find(listLRU.back()));
+}
+
+void CBlockCache::GetStats(uint64_t& nHitsRet, uint64_t& nMissesRet, size_t& nEntriesRet,
+                           size_t& nBytesRet, size_t& nMaxBytesRet) const
+{
+    LOCK(cs_blockcache);
+    nHitsRet = nHits;
+    nMissesRet = nMisses;
+    nEntriesRet = mapBlocks.size();
+    nBytesRet = nBytes;
+    nMaxBytesRet = nMaxBytes;
+}
+
+CBlockRef ReadBlockShared(const CBlockIndex* pindex)
+{
+    uint256 hash = pindex->GetBlockHash();
+    CBlockRef block = blockcache.Get(hash);
+
+    if (block)
+        return block;
+
+    shared_ptr<CBlock> blockNew = make_shared<CBlock>();
+
+    if (!blockNew->ReadFromDisk(pindex->nFile, pindex->nBlockPos, true))
+        return CBlockRef();
+
+    if (blockNew->GetHash() != hash)
+    {
+        error("%s : GetHash() doesn't match index", __func__);
+        return CBlockRef();
+    }
+
+    // Shared read-only from here on
+    blockNew->CacheHashes();
+    blockcache.Insert(hash, blockNew, pindex->nFile, pindex->nBlockPos);
+    return blockNew;
+}
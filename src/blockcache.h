@@ -0,0 +1,83 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NEUTRON_BLOCKCACHE_H
+#define NEUTRON_BLOCKCACHE_H
+
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <utility>
+
+#include "sync.h"
+#include "uint256.h"
+
+class CBlock;
+class CBlockIndex;
+
+/** Blocks handed out by the cache are shared and must not be modified */
+typedef std::shared_ptr<const CBlock> CBlockRef;
+
+/** Size-bounded LRU cache of deserialized blocks, keyed by block hash. Blocks
+ * can also be looked up by their position in the block files, for the callers
+ * that only know a CDiskTxPos.
+ */
+class CBlockCache
+{
+private:
+    struct CEntry
+    {
+        CBlockRef block;
+        std::pair<unsigned int, unsigned int> pos;
+        size_t nSize;
+        std::list<uint256>::iterator itLRU;
+    };
+
+    mutable CCriticalSection cs_blockcache;
+    std::map<uint256, CEntry> mapBlocks;
+    std::map<std::pair<unsigned int, unsigned int>, uint256> mapBlockPos;
+    std::list<uint256> listLRU; // most recently used first
+    size_t nBytes;
+    size_t nMaxBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    CBlockRef Touch(std::map<uint256, CEntry>::iterator it);
+    void Erase(std::map<uint256, CEntry>::iterator it);
+
+public:
+    CBlockCache(size_t nMaxBytesIn);
+
+    // Counted in the statistics and refreshes the block's place in the LRU
+    CBlockRef Get(const uint256& hash);
+
+    // Use a cached block if there is one, without counting or refreshing it, for
+    // the readers that should not decide what the cache keeps
+    CBlockRef Peek(const uint256& hash) const;
+    CBlockRef Peek(unsigned int nFile, unsigned int nBlockPos) const;
+
+    void Insert(const uint256& hash, const CBlockRef& block, unsigned int nFile, unsigned int nBlockPos);
+
+    // Drop every block, e.g. once the block files they were read from are gone
+    void Clear();
+    void SetMaxBytes(size_t nMaxBytesIn);
+
+    void GetStats(uint64_t& nHitsRet, uint64_t& nMissesRet, size_t& nEntriesRet,
+                  size_t& nBytesRet, size_t& nMaxBytesRet) const;
+};
+
+extern CBlockCache blockcache;
+
+static const int64_t DEFAULT_BLOCK_CACHE = 32; // MiB
+
+/** Shared copy of the block behind pindex, from the cache or read from disk
+ * and added to it. Returns NULL if the block cannot be read. For the paths that
+ * serve blocks to peers and RPC clients; everything else reads through
+ * CBlock::ReadFromDisk(), which leaves the cache alone.
+ */
+CBlockRef ReadBlockShared(const CBlockIndex* pindex);
+
+#endif // NEUTRON_BLOCKCACHE_H
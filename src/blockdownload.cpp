@@ -0,0 +1,634 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockdownload.h"
+#include "bignum.h"
+#include "checkpoints.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "protocol.h"
+#include "sync.h"
+#include "timedata.h"
+#include "util.h"
+
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <map>
+#include <set>
+
+using namespace std;
+
+extern CBigNum bnProofOfWorkLimit;
+
+bool fHeadersFirst = DEFAULT_HEADERSFIRST;
+
+// Guards the state below. No other lock is taken while it is held, callers
+// take cs_main first where they need it.
+static CCriticalSection cs_blockdownload;
+
+// The header chain is the block pindexHeadersBase, which is known, followed by
+// the headers in dequeHeaders, whose blocks are not
+static CBlockIndex* pindexHeadersBase = NULL;
+static deque<uint256> dequeHeaders;
+
+// The peer each header of dequeHeaders came from
+static deque<NodeId> dequeHeaderPeers;
+
+// The peer the headers are fetched from, and when it was last asked for them
+static NodeId nSyncPeer = -1;
+static int64_t nSyncRequestTime = 0;
+
+// Peers that have no more headers to give
+static set<NodeId> setHeadersDone;
+
+struct CBlockRequest
+{
+    NodeId node;
+    NodeId nAnnouncer; // the peer the header came from
+    int64_t nTime;
+};
+
+static map<uint256, CBlockRequest> mapBlocksInFlight;
+static map<NodeId, int> mapPeerBlocksInFlight;
+
+// Blocks a peer did not deliver although it did not announce them, they are
+// asked from other peers
+static set<pair<uint256, NodeId> > setNotFound;
+
+// Blocks received ahead of their parent, by the hash of the parent
+static map<uint256, CBlock*> mapDownloadedBlocks;
+static set<uint256> setDownloadedBlocks;
+
+// Since when every block in the window has been requested or received
+static int64_t nWindowFullSince = 0;
+
+static uint256 GetHeadersTip()
+{
+    return dequeHeaders.empty() ? pindexHeadersBase->GetBlockHash() : dequeHeaders.back();
+}
+
+// Start the header chain over at pindexBase, dropping the blocks held for it
+static void ResetHeaders(CBlockIndex* pindexBase)
+{
+    pindexHeadersBase = pindexBase;
+    dequeHeaders.clear();
+    dequeHeaderPeers.clear();
+    setNotFound.clear();
+
+    for (map<uint256, CBlock*>::iterator mi = mapDownloadedBlocks.begin(); mi != mapDownloadedBlocks.end(); ++mi)
+        delete (*mi).second;
+
+    mapDownloadedBlocks.clear();
+    setDownloadedBlocks.clear();
+    nWindowFullSince = 0;
+}
+
+static void ReleaseBlockRequest(map<uint256, CBlockRequest>::iterator mi)
+{
+    if (--mapPeerBlocksInFlight[(*mi).second.node] <= 0)
+        mapPeerBlocksInFlight.erase((*mi).second.node);
+
+    mapBlocksInFlight.erase(mi);
+}
+
+// Drop the headers from position nPos on, with the blocks held for them
+static void TruncateHeaders(unsigned int nPos)
+{
+    set<uint256> setDropped(dequeHeaders.begin() + nPos, dequeHeaders.end());
+    dequeHeaders.erase(dequeHeaders.begin() + nPos, dequeHeaders.end());
+    dequeHeaderPeers.erase(dequeHeaderPeers.begin() + nPos, dequeHeaderPeers.end());
+
+    for (map<uint256, CBlock*>::iterator mi = mapDownloadedBlocks.begin(); mi != mapDownloadedBlocks.end(); )
+    {
+        uint256 hash = (*mi).second->GetHash();
+
+        if (setDropped.count(hash))
+        {
+            setDownloadedBlocks.erase(hash);
+            delete (*mi).second;
+            mapDownloadedBlocks.erase(mi++);
+        }
+        else
+            ++mi;
+    }
+
+    for (map<uint256, CBlockRequest>::iterator mi = mapBlocksInFlight.begin(); mi != mapBlocksInFlight.end(); )
+    {
+        if (setDropped.count((*mi).first))
+            ReleaseBlockRequest(mi++);
+        else
+            ++mi;
+    }
+
+    for (set<pair<uint256, NodeId> >::iterator it = setNotFound.begin(); it != setNotFound.end(); )
+    {
+        if (setDropped.count((*it).first))
+            setNotFound.erase(it++);
+        else
+            ++it;
+    }
+
+    nWindowFullSince = 0;
+}
+
+// Drop the headers a peer sent, nothing else vouches for them. Later headers
+// build on them and go too.
+static void DropHeadersFrom(NodeId id)
+{
+    deque<NodeId>::iterator it = find(dequeHeaderPeers.begin(), dequeHeaderPeers.end(), id);
+
+    if (it == dequeHeaderPeers.end())
+        return;
+
+    unsigned int nPos = it - dequeHeaderPeers.begin();
+    LogPrintf("%s : dropping %u headers from peer %d\n", __func__, dequeHeaders.size() - nPos, id);
+    TruncateHeaders(nPos);
+}
+
+// Ask another peer for a block that one which did not announce it held up
+static void RetryBlockRequest(map<uint256, CBlockRequest>::iterator mi)
+{
+    setNotFound.insert(make_pair((*mi).first, (*mi).second.node));
+    ReleaseBlockRequest(mi);
+}
+
+// What a header alone can be checked for. The kernel of a proof-of-stake block
+// is only known from its coinstake; stake blocks are made with nNonce 0, a
+// header with any other nonce in the proof-of-work era must carry the work.
+static bool CheckBlockHeader(const CBlock& header, int nHeight, string& strError)
+{
+    uint256 hash = header.GetHash();
+
+    if (!Checkpoints::CheckHardened(nHeight, hash))
+    {
+        strError = strprintf("header %d %s conflicts with a checkpoint", nHeight, hash.ToString());
+        return false;
+    }
+
+    CBigNum bnTarget;
+    bnTarget.SetCompact(header.nBits);
+    CBigNum bnLimit = GetPOSLimit(nHeight);
+
+    if (nHeight <= LAST_POW_BLOCK && bnProofOfWorkLimit > bnLimit)
+        bnLimit = bnProofOfWorkLimit;
+
+    if (bnTarget <= 0 || bnTarget > bnLimit)
+    {
+        strError = strprintf("header %d %s has nBits 0x%08x out of range", nHeight, hash.ToString(), header.nBits);
+        return false;
+    }
+
+    if (nHeight <= LAST_POW_BLOCK && header.nNonce != 0 && hash > bnTarget.getuint256())
+    {
+        strError = strprintf("header %d %s does not match nBits 0x%08x", nHeight, hash.ToString(), header.nBits);
+        return false;
+    }
+
+    return true;
+}
+
+// Locator of the header chain tip, stepping back exponentially through the
+// headers and then through the block index like CBlockLocator::Set()
+static CBlockLocator GetHeadersLocator()
+{
+    vector<uint256> vHave;
+    int nStep = 1;
+    int nPos = dequeHeaders.size() - 1;
+
+    for (; nPos >= 0; nPos -= nStep)
+    {
+        vHave.push_back(dequeHeaders[nPos]);
+
+        if (vHave.size() > 10)
+            nStep *= 2;
+    }
+
+    const CBlockIndex* pindex = pindexHeadersBase;
+
+    // nPos is at or below -1 here, the steps carry over into the block index
+    for (int i = 0; pindex && i < -1 - nPos; i++)
+        pindex = pindex->pprev;
+
+    while (pindex)
+    {
+        vHave.push_back(pindex->GetBlockHash());
+
+        for (int i = 0; pindex && i < nStep; i++)
+            pindex = pindex->pprev;
+
+        if (vHave.size() > 10)
+            nStep *= 2;
+    }
+
+    vHave.push_back(!fTestNet ? hashGenesisBlock : hashGenesisBlockTestNet);
+
+    return CBlockLocator(vHave);
+}
+
+void ProcessBlockHeaders(CNode* pfrom, const vector<CBlock>& vHeaders)
+{
+    string strError;
+    int nMisbehavior = 0;
+
+    {
+        LOCK(cs_blockdownload);
+
+        // Only the sync peer is asked for headers
+        if (pfrom->GetId() != nSyncPeer || !pindexHeadersBase)
+            return;
+
+        nSyncRequestTime = 0;
+
+        if (vHeaders.size() > MAX_HEADERS_RESULTS)
+        {
+            strError = strprintf("headers message size() = %u", vHeaders.size());
+            nMisbehavior = 20;
+        }
+
+        // A short reply is the end of the peer's chain
+        if (vHeaders.size() < MAX_HEADERS_RESULTS)
+            setHeadersDone.insert(pfrom->GetId());
+
+        for (unsigned int i = 0; i < vHeaders.size() && strError.empty(); i++)
+        {
+            const CBlock& header = vHeaders[i];
+            uint256 hash = header.GetHash();
+
+            if (header.hashPrevBlock != GetHeadersTip())
+            {
+                auto mi = mapBlockIndex.find(header.hashPrevBlock);
+
+                if (mi == mapBlockIndex.end())
+                {
+                    strError = strprintf("header %s does not connect", hash.ToString());
+                    nMisbehavior = 20;
+                    break;
+                }
+
+                // The peer follows another branch from a known block
+                ResetHeaders((*mi).second);
+            }
+
+            auto mi = mapBlockIndex.find(hash);
+
+            if (mi != mapBlockIndex.end())
+            {
+                ResetHeaders((*mi).second);
+                continue;
+            }
+
+            if (header.GetBlockTime() > FutureDrift(GetAdjustedTime()))
+            {
+                // Possibly our clock, stop here without blaming the peer
+                setHeadersDone.insert(pfrom->GetId());
+                break;
+            }
+
+            if (!CheckBlockHeader(header, pindexHeadersBase->nHeight + dequeHeaders.size() + 1, strError))
+            {
+                nMisbehavior = 100;
+                ResetHeaders(pindexHeadersBase);
+                setHeadersDone.insert(pfrom->GetId());
+                break;
+            }
+
+            dequeHeaders.push_back(hash);
+            dequeHeaderPeers.push_back(pfrom->GetId());
+        }
+
+        if (setHeadersDone.count(pfrom->GetId()))
+            nSyncPeer = -1;
+
+        if (fDebug)
+        {
+            LogPrintf("%s : %u headers from peer %d, header chain at %d\n", __func__, vHeaders.size(),
+                      pfrom->GetId(), pindexHeadersBase->nHeight + dequeHeaders.size());
+        }
+    }
+
+    if (!strError.empty())
+    {
+        LogPrintf("%s : peer %d: %s\n", __func__, pfrom->GetId(), strError);
+
+        if (nMisbehavior)
+            pfrom->Misbehaving(strError, nMisbehavior);
+    }
+}
+
+void SendBlockDownloadRequests(CNode* pto)
+{
+    if (!fHeadersFirst || fReindex || !pto->fSuccessfullyConnected || pto->fDisconnect || pto->fClient ||
+        !(pto->nServices & NODE_NETWORK))
+        return;
+
+    int64_t nNow = GetTime();
+    NodeId id = pto->GetId();
+    LOCK(cs_blockdownload);
+
+    if (!pindexHeadersBase)
+        pindexHeadersBase = pindexBest;
+
+    // Move the base along as the blocks are accepted
+    while (!dequeHeaders.empty())
+    {
+        auto mi = mapBlockIndex.find(dequeHeaders.front());
+
+        if (mi == mapBlockIndex.end())
+            break;
+
+        pindexHeadersBase = (*mi).second;
+        setNotFound.erase(setNotFound.lower_bound(make_pair(dequeHeaders.front(), numeric_limits<NodeId>::min())),
+                          setNotFound.upper_bound(make_pair(dequeHeaders.front(), numeric_limits<NodeId>::max())));
+        dequeHeaders.pop_front();
+        dequeHeaderPeers.pop_front();
+    }
+
+    // Blocks that arrived by relay overtake an exhausted header chain
+    if (dequeHeaders.empty() && pindexBest->nHeight > pindexHeadersBase->nHeight)
+        pindexHeadersBase = pindexBest;
+
+    int nHeadersHeight = pindexHeadersBase->nHeight + dequeHeaders.size();
+
+    // Headers
+    if (nSyncPeer != -1 && nSyncRequestTime && nNow - nSyncRequestTime > HEADERS_RESPONSE_TIMEOUT)
+    {
+        LogPrintf("%s : peer %d did not answer getheaders, switching sync peer\n", __func__, nSyncPeer);
+        setHeadersDone.insert(nSyncPeer);
+        nSyncPeer = -1;
+        nSyncRequestTime = 0;
+    }
+
+    if (nSyncPeer == -1 && !setHeadersDone.count(id) && pto->nStartingHeight > nHeadersHeight)
+    {
+        if (fDebug)
+            LogPrintf("%s : fetching headers from peer %d at height %d\n", __func__, id, pto->nStartingHeight);
+
+        nSyncPeer = id;
+    }
+
+    if (nSyncPeer == id && !nSyncRequestTime && nHeadersHeight < nBestHeight + MAX_HEADERS_AHEAD)
+    {
+        pto->PushMessage(NetMsgType::GETHEADERS, GetHeadersLocator(), uint256(0));
+        nSyncRequestTime = nNow;
+    }
+
+    // Blocks
+    int nWindow = min((int) dequeHeaders.size(), BLOCK_DOWNLOAD_WINDOW);
+
+    // Only a peer that announced a block is to blame for not delivering it,
+    // another peer may just not have it
+    for (map<uint256, CBlockRequest>::iterator mi = mapBlocksInFlight.begin(); mi != mapBlocksInFlight.end(); )
+    {
+        if ((*mi).second.node != id || nNow - (*mi).second.nTime <= BLOCK_DOWNLOAD_TIMEOUT)
+        {
+            ++mi;
+            continue;
+        }
+
+        if ((*mi).second.nAnnouncer == id)
+        {
+            LogPrintf("%s : peer %d timed out on block %s, disconnecting\n", __func__, id,
+                      (*mi).first.ToString());
+            pto->fDisconnect = true;
+            return;
+        }
+
+        if (fDebug)
+            LogPrintf("%s : peer %d timed out on block %s, asking another peer\n", __func__, id, (*mi).first.ToString());
+
+        RetryBlockRequest(mi++);
+    }
+
+    if (nWindow > 0 && (int) (mapBlocksInFlight.size() + setDownloadedBlocks.size()) >= nWindow)
+    {
+        if (!nWindowFullSince)
+            nWindowFullSince = nNow;
+
+        // The window cannot move on without the next block, its peer stalls the download
+        auto mi = mapBlocksInFlight.find(dequeHeaders.front());
+
+        if (mi != mapBlocksInFlight.end() && (*mi).second.node == id && nNow - nWindowFullSince > BLOCK_STALLING_TIMEOUT)
+        {
+            if ((*mi).second.nAnnouncer == id)
+            {
+                LogPrintf("%s : peer %d stalls the download at block %d, disconnecting\n", __func__, id,
+                          pindexHeadersBase->nHeight + 1);
+                pto->fDisconnect = true;
+                return;
+            }
+
+            if (fDebug)
+                LogPrintf("%s : peer %d stalls the download at block %d, asking another peer\n", __func__, id,
+                          pindexHeadersBase->nHeight + 1);
+
+            RetryBlockRequest(mi);
+            nWindowFullSince = nNow;
+        }
+    }
+    else
+        nWindowFullSince = 0;
+
+    int& nInFlight = mapPeerBlocksInFlight[id];
+    vector<CInv> vGetData;
+
+    for (int i = 0; i < nWindow && nInFlight < MAX_BLOCKS_IN_FLIGHT_PER_PEER; i++)
+    {
+        const uint256& hash = dequeHeaders[i];
+
+        if (mapBlocksInFlight.count(hash) || setDownloadedBlocks.count(hash) || setNotFound.count(make_pair(hash, id)))
+            continue;
+
+        // Not there yet on the peer's chain, unless the peer sent the header
+        if (pto->nStartingHeight < pindexHeadersBase->nHeight + i + 1 && dequeHeaderPeers[i] != id)
+            continue;
+
+        CBlockRequest request;
+        request.node = id;
+        request.nAnnouncer = dequeHeaderPeers[i];
+        request.nTime = nNow;
+        mapBlocksInFlight[hash] = request;
+        nInFlight++;
+
+        vGetData.push_back(CInv(MSG_BLOCK, hash));
+    }
+
+    if (!nInFlight)
+        mapPeerBlocksInFlight.erase(id);
+
+    if (!vGetData.empty())
+    {
+        if (fDebugNet)
+            LogPrintf("%s : requesting %u blocks from peer %d\n", __func__, vGetData.size(), id);
+
+        pto->PushMessage(NetMsgType::GETDATA, vGetData);
+    }
+}
+
+bool IsBlockInFlight(const uint256& hash)
+{
+    LOCK(cs_blockdownload);
+
+    return mapBlocksInFlight.count(hash) || setDownloadedBlocks.count(hash);
+}
+
+bool MarkBlockReceived(const uint256& hash)
+{
+    LOCK(cs_blockdownload);
+
+    auto mi = mapBlocksInFlight.find(hash);
+
+    if (mi == mapBlocksInFlight.end())
+        return false;
+
+    ReleaseBlockRequest(mi);
+
+    return true;
+}
+
+void BlockNotFound(CNode* pfrom, const uint256& hash)
+{
+    NodeId id = pfrom->GetId();
+    string strError;
+
+    {
+        LOCK(cs_blockdownload);
+
+        auto mi = mapBlocksInFlight.find(hash);
+
+        if (mi == mapBlocksInFlight.end() || (*mi).second.node != id)
+            return;
+
+        if ((*mi).second.nAnnouncer != id)
+        {
+            RetryBlockRequest(mi);
+            return;
+        }
+
+        // The peer sent the header of a block it does not have
+        ReleaseBlockRequest(mi);
+        DropHeadersFrom(id);
+        setHeadersDone.insert(id);
+
+        if (nSyncPeer == id)
+        {
+            nSyncPeer = -1;
+            nSyncRequestTime = 0;
+        }
+
+        strError = strprintf("announced block %s not found", hash.ToString());
+    }
+
+    LogPrintf("%s : peer %d: %s\n", __func__, id, strError);
+    pfrom->Misbehaving(strError, 100);
+}
+
+bool StoreDownloadedBlock(const CBlock& block)
+{
+    uint256 hash = block.GetHash();
+    LOCK(cs_blockdownload);
+
+    if (setDownloadedBlocks.count(hash))
+        return true;
+
+    // Only blocks that were asked for are held, which bounds them by the window
+    if (!mapBlocksInFlight.count(hash) || mapDownloadedBlocks.count(block.hashPrevBlock))
+        return false;
+
+    mapDownloadedBlocks[block.hashPrevBlock] = new CBlock(block);
+    setDownloadedBlocks.insert(hash);
+
+    return true;
+}
+
+CBlock* TakeDownloadedBlock(const uint256& hashPrev)
+{
+    LOCK(cs_blockdownload);
+
+    auto mi = mapDownloadedBlocks.find(hashPrev);
+
+    if (mi == mapDownloadedBlocks.end())
+        return NULL;
+
+    CBlock* pblock = (*mi).second;
+    mapDownloadedBlocks.erase(mi);
+    setDownloadedBlocks.erase(pblock->GetHash());
+
+    return pblock;
+}
+
+void BlockDownloadFailed(const uint256& hash)
+{
+    LOCK(cs_blockdownload);
+
+    if (find(dequeHeaders.begin(), dequeHeaders.end(), hash) == dequeHeaders.end())
+        return;
+
+    LogPrintf("%s : block %s of the header chain was rejected, dropping %u headers\n", __func__,
+              hash.ToString(), dequeHeaders.size());
+
+    ResetHeaders(pindexHeadersBase);
+
+    // The sync peer sent a chain that is not valid, let another peer try
+    NodeId nBadPeer = nSyncPeer;
+    setHeadersDone.clear();
+
+    if (nBadPeer != -1)
+        setHeadersDone.insert(nBadPeer);
+
+    nSyncPeer = -1;
+    nSyncRequestTime = 0;
+}
+
+void BlockDownloadPeerDisconnected(NodeId id)
+{
+    LOCK(cs_blockdownload);
+
+    for (map<uint256, CBlockRequest>::iterator mi = mapBlocksInFlight.begin(); mi != mapBlocksInFlight.end(); )
+    {
+        if ((*mi).second.node == id)
+            ReleaseBlockRequest(mi++);
+        else
+            ++mi;
+    }
+
+    for (set<pair<uint256, NodeId> >::iterator it = setNotFound.begin(); it != setNotFound.end(); )
+    {
+        if ((*it).second == id)
+            setNotFound.erase(it++);
+        else
+            ++it;
+    }
+
+    // Nobody else may be able to deliver the blocks of its headers, the
+    // next sync peer fetches them again
+    DropHeadersFrom(id);
+    setHeadersDone.erase(id);
+
+    if (nSyncPeer == id)
+    {
+        nSyncPeer = -1;
+        nSyncRequestTime = 0;
+    }
+}
+
+int GetBestHeaderHeight()
+{
+    LOCK(cs_blockdownload);
+
+    if (!pindexHeadersBase)
+        return -1;
+
+    return pindexHeadersBase->nHeight + dequeHeaders.size();
+}
+
+int GetBlocksInFlight(NodeId id)
+{
+    LOCK(cs_blockdownload);
+
+    auto mi = mapPeerBlocksInFlight.find(id);
+
+    return mi == mapPeerBlocksInFlight.end() ? 0 : (*mi).second;
+}
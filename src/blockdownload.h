@@ -0,0 +1,90 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NEUTRON_BLOCKDOWNLOAD_H
+#define NEUTRON_BLOCKDOWNLOAD_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "net.h"
+#include "uint256.h"
+
+class CBlock;
+
+/** Headers-first synchronization (-headersfirst). The header chain ahead of
+ * the best block is fetched from one peer with getheaders and checked as far as
+ * a header allows: linkage, checkpoints, timestamps and the target limit; the
+ * proof of a proof-of-stake block is only known from its transactions. The
+ * blocks on it are then requested from every suitable peer over a window that
+ * moves along with the best block. Blocks that arrive ahead of their parent
+ * are held by the download rather than in the orphan pool.
+ */
+static const bool DEFAULT_HEADERSFIRST = true;
+extern bool fHeadersFirst;
+
+/** Headers per getheaders reply, see the GETHEADERS handler */
+static const unsigned int MAX_HEADERS_RESULTS = 2000;
+
+/** Headers fetched beyond the best block before the blocks catch up */
+static const int MAX_HEADERS_AHEAD = 16 * MAX_HEADERS_RESULTS;
+
+/** Blocks past the best block that may be requested */
+static const int BLOCK_DOWNLOAD_WINDOW = 1024;
+
+/** Blocks requested from one peer at a time */
+static const int MAX_BLOCKS_IN_FLIGHT_PER_PEER = 16;
+
+/** Seconds a peer may hold up the whole window with the next block needed.
+ * A peer that announced the block is disconnected after that, any other
+ * peer's request is moved to another peer.
+ */
+static const int64_t BLOCK_STALLING_TIMEOUT = 10;
+
+/** Seconds before any block request, or a getheaders, is given up on */
+static const int64_t BLOCK_DOWNLOAD_TIMEOUT = 120;
+static const int64_t HEADERS_RESPONSE_TIMEOUT = 60;
+
+/** Add the headers received from pfrom to the header chain. Requires cs_main. */
+void ProcessBlockHeaders(CNode* pfrom, const std::vector<CBlock>& vHeaders);
+
+/** Send pto the getheaders and getdata of the download that are due, and
+ * disconnect it if it stalls the download. Requires cs_main.
+ */
+void SendBlockDownloadRequests(CNode* pto);
+
+/** Whether the block is being downloaded from some peer */
+bool IsBlockInFlight(const uint256& hash);
+
+/** A block arrived, release its request. Returns whether it had been requested. */
+bool MarkBlockReceived(const uint256& hash);
+
+/** A peer replied notfound to a block request. The block is asked from
+ * another peer, or, if pfrom sent its header, the headers of pfrom are
+ * dropped and pfrom is punished.
+ */
+void BlockNotFound(CNode* pfrom, const uint256& hash);
+
+/** Hold a block of the header chain whose parent has not been accepted yet.
+ * Returns false if the block is not wanted by the download.
+ */
+bool StoreDownloadedBlock(const CBlock& block);
+
+/** The held block that builds on hashPrev, or NULL. The caller takes ownership. */
+CBlock* TakeDownloadedBlock(const uint256& hashPrev);
+
+/** A block was rejected, abandon the header chain if it is part of it */
+void BlockDownloadFailed(const uint256& hash);
+
+/** Release what a peer that went away was asked for */
+void BlockDownloadPeerDisconnected(NodeId id);
+
+/** Height of the best header known, -1 if no headers are held */
+int GetBestHeaderHeight();
+
+/** Blocks requested from a peer and not received yet */
+int GetBlocksInFlight(NodeId id);
+
+#endif // NEUTRON_BLOCKDOWNLOAD_H
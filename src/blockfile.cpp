@@ -0,0 +1,223 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfile.h"
+#include "main.h"
+#include "sync.h"
+#include "util.h"
+#include "validation.h"
+
+#include <map>
+#include <vector>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Upper bound on the number of block files kept open at the same time
+static const unsigned int MAX_BLOCKFILE_HANDLES = 64;
+
+class CBlockFileHandle
+{
+public:
+    CCriticalSection cs;
+    unsigned int nFile;
+    uint64_t nLastUsed;
+
+    // Mapping of the file as large as it was when it was last mapped. Readers
+    // hold on to their own reference, so a remap never pulls the range from
+    // under them.
+    shared_ptr<boost::interprocess::mapped_region> region;
+    bool fMapFailed;
+
+#ifdef WIN32
+    FILE* file;
+#else
+    int fd;
+#endif
+
+    CBlockFileHandle(unsigned int nFileIn) : nFile(nFileIn), nLastUsed(0)
+    {
+        // Block files are up to 2GB each, that does not fit many times into a
+        // 32-bit address space
+        fMapFailed = sizeof(void*) < 8;
+#ifdef WIN32
+        file = NULL;
+#else
+        fd = -1;
+#endif
+    }
+
+    ~CBlockFileHandle()
+    {
+#ifdef WIN32
+        if (file)
+            fclose(file);
+#else
+        if (fd >= 0)
+            close(fd);
+#endif
+    }
+
+    // Map the file again if the current mapping ends before nEnd, returns
+    // NULL if the range has to be read from the descriptor instead
+    shared_ptr<boost::interprocess::mapped_region> Map(uint64_t nEnd)
+    {
+        LOCK(cs);
+
+        if (fMapFailed)
+            return shared_ptr<boost::interprocess::mapped_region>();
+
+        if (!region || region->get_size() < nEnd)
+        {
+            try
+            {
+                boost::interprocess::file_mapping mapping(BlockFilePath(nFile).string().c_str(),
+                                                          boost::interprocess::read_only);
+                region = make_shared<boost::interprocess::mapped_region>(mapping, boost::interprocess::read_only);
+            }
+            catch (const std::exception& e)
+            {
+                LogPrintf("%s : cannot map blk%04u.dat, reading it instead: %s\n", __func__, nFile, e.what());
+                region.reset();
+                fMapFailed = true;
+            }
+        }
+
+        if (!region || region->get_size() < nEnd)
+            return shared_ptr<boost::interprocess::mapped_region>();
+
+        return region;
+    }
+
+    bool ReadAt(uint64_t nPos, char* pch, size_t nSize)
+    {
+#ifdef WIN32
+        LOCK(cs);
+
+        if (!file)
+            file = fopen(BlockFilePath(nFile).string().c_str(), "rb");
+
+        if (!file || fseek(file, nPos, SEEK_SET) != 0)
+            return false;
+
+        return fread(pch, 1, nSize, file) == nSize;
+#else
+        {
+            LOCK(cs);
+
+            if (fd < 0)
+                fd = open(BlockFilePath(nFile).string().c_str(), O_RDONLY);
+
+            if (fd < 0)
+                return false;
+        }
+
+        while (nSize > 0)
+        {
+            ssize_t nRead = pread(fd, pch, nSize, nPos);
+
+            if (nRead <= 0)
+                return false;
+
+            pch += nRead;
+            nPos += nRead;
+            nSize -= nRead;
+        }
+
+        return true;
+#endif
+    }
+};
+
+static CCriticalSection cs_blockfiles;
+static map<unsigned int, shared_ptr<CBlockFileHandle> > mapBlockFiles;
+static uint64_t nBlockFileUses = 0;
+
+static shared_ptr<CBlockFileHandle> GetBlockFileHandle(unsigned int nFile)
+{
+    LOCK(cs_blockfiles);
+
+    shared_ptr<CBlockFileHandle>& handle = mapBlockFiles[nFile];
+
+    if (!handle)
+        handle = make_shared<CBlockFileHandle>(nFile);
+
+    handle->nLastUsed = ++nBlockFileUses;
+    shared_ptr<CBlockFileHandle> ret = handle;
+
+    // Drop the least recently used file, it stays open until its last reader is done
+    if (mapBlockFiles.size() > MAX_BLOCKFILE_HANDLES)
+    {
+        map<unsigned int, shared_ptr<CBlockFileHandle> >::iterator itOldest = mapBlockFiles.begin();
+
+        for (map<unsigned int, shared_ptr<CBlockFileHandle> >::iterator it = mapBlockFiles.begin(); it != mapBlockFiles.end(); ++it)
+        {
+            if (it->second->nLastUsed < itOldest->second->nLastUsed)
+                itOldest = it;
+        }
+
+        mapBlockFiles.erase(itOldest);
+    }
+
+    return ret;
+}
+
+bool ReadBlockFileData(unsigned int nFile, unsigned int nBlockPos, unsigned int nOffset, CBlockFileData& data)
+{
+    if ((nFile < 1) || (nFile == (unsigned int) -1))
+        return false;
+
+    // Every block is preceded by the message start and its size, see CBlock::WriteToDisk()
+    if (nBlockPos < sizeof(pchMessageStart) + sizeof(unsigned int) || nOffset < nBlockPos)
+        return error("%s : invalid position %u:%u in blk%04u.dat", __func__, nBlockPos, nOffset, nFile);
+
+    shared_ptr<CBlockFileHandle> handle = GetBlockFileHandle(nFile);
+    shared_ptr<boost::interprocess::mapped_region> region = handle->Map(nBlockPos);
+    unsigned int nSize;
+
+    if (region)
+        memcpy(&nSize, (const char*) region->get_address() + nBlockPos - sizeof(nSize), sizeof(nSize));
+    else if (!handle->ReadAt(nBlockPos - sizeof(nSize), (char*) &nSize, sizeof(nSize)))
+        return error("%s : cannot read block size at %u in blk%04u.dat", __func__, nBlockPos, nFile);
+
+    if (nSize > MAX_BLOCK_SIZE || nOffset >= (uint64_t) nBlockPos + nSize)
+        return error("%s : invalid block size %u at %u in blk%04u.dat", __func__, nSize, nBlockPos, nFile);
+
+    uint64_t nEnd = (uint64_t) nBlockPos + nSize;
+
+    if (region && region->get_size() < nEnd)
+        region = handle->Map(nEnd);
+
+    if (region)
+    {
+        data.pbegin = (const char*) region->get_address() + nOffset;
+        data.pend = (const char*) region->get_address() + nEnd;
+        data.hold = region;
+        return true;
+    }
+
+    shared_ptr<vector<char> > buffer = make_shared<vector<char> >(nEnd - nOffset);
+
+    if (!handle->ReadAt(nOffset, buffer->data(), buffer->size()))
+        return error("%s : cannot read %u bytes at %u in blk%04u.dat", __func__, buffer->size(), nOffset, nFile);
+
+    data.pbegin = buffer->data();
+    data.pend = buffer->data() + buffer->size();
+    data.hold = buffer;
+    return true;
+}
+
+void CloseBlockFileReaders()
+{
+    LOCK(cs_blockfiles);
+    mapBlockFiles.clear();
+}
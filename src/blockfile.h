@@ -0,0 +1,43 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NEUTRON_BLOCKFILE_H
+#define NEUTRON_BLOCKFILE_H
+
+#include <stddef.h>
+#include <memory>
+
+/** Bytes of a block file handed out by ReadBlockFileData(). The range either
+ * points straight into a memory-mapped block file or into a private buffer;
+ * in both cases it stays valid for as long as this object is alive.
+ */
+class CBlockFileData
+{
+private:
+    std::shared_ptr<const void> hold;
+    const char* pbegin;
+    const char* pend;
+
+    friend bool ReadBlockFileData(unsigned int nFile, unsigned int nBlockPos, unsigned int nOffset,
+                                  CBlockFileData& data);
+
+public:
+    CBlockFileData() : pbegin(NULL), pend(NULL) {}
+
+    const char* begin() const { return pbegin; }
+    const char* end() const   { return pend; }
+    size_t size() const       { return pend - pbegin; }
+};
+
+/** Read the part of the block stored at nBlockPos of blkNNNN.dat that starts at
+ * nOffset, up to the end of the block. Block files are kept memory-mapped where
+ * possible, with positioned reads on a pooled descriptor as the fallback.
+ */
+bool ReadBlockFileData(unsigned int nFile, unsigned int nBlockPos, unsigned int nOffset, CBlockFileData& data);
+
+/** Unmap and close every block file held by the reader */
+void CloseBlockFileReaders();
+
+#endif // NEUTRON_BLOCKFILE_H
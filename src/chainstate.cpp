@@ -0,0 +1,441 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainstate.h"
+#include "checkpoints.h"
+#include "coins.h"
+#include "hash.h"
+#include "main.h"
+#include "prune.h"
+#include "streams.h"
+#include "txdb.h"
+#include "util.h"
+#include "validation.h"
+
+#include <atomic>
+
+#include <boost/filesystem.hpp>
+
+using namespace std;
+
+extern std::atomic<bool> fRequestShutdown;
+
+// Block files are copied and hashed in pieces of this size
+static const size_t CHAINSTATE_COPY_CHUNK = 1048576;
+
+static boost::filesystem::path ManifestPath(const boost::filesystem::path& dir)
+{
+    return dir / "manifest.dat";
+}
+
+static boost::filesystem::path RecordsPath(const boost::filesystem::path& dir)
+{
+    return dir / "txdb.dat";
+}
+
+static boost::filesystem::path SnapshotBlockFilePath(const boost::filesystem::path& dir, unsigned int nFile)
+{
+    return dir / strprintf("blk%04u.dat", nFile);
+}
+
+// Holds the content hash of the snapshot the chain was last loaded from
+static boost::filesystem::path LoadedPath()
+{
+    return GetDataDir() / "chainstate.loaded";
+}
+
+uint64_t CChainStateManifest::GetBlockFileBytes() const
+{
+    uint64_t nBytes = 0;
+
+    BOOST_FOREACH(uint64_t nSize, vBlockFileSizes)
+        nBytes += nSize;
+
+    return nBytes;
+}
+
+// The content hash covers the records and the block files in snapshot order,
+// followed by the manifest fields that describe them
+static void HashManifest(CHashWriter& hasher, const CChainStateManifest& manifest)
+{
+    hasher << manifest.nVersion << manifest.hashBestChain << manifest.nHeight << manifest.nTime
+           << manifest.nRecords << manifest.vBlockFileSizes;
+}
+
+// Hash the first nSize bytes of pathFrom, copying them to pathTo unless it is empty
+static bool CopyAndHash(const boost::filesystem::path& pathFrom, const boost::filesystem::path& pathTo,
+                        uint64_t nSize, CHashWriter& hasher, string& strError)
+{
+    CAutoFile filein(fopen(pathFrom.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    CAutoFile fileout(pathTo.empty() ? NULL : fopen(pathTo.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+
+    if (filein.IsNull() || (!pathTo.empty() && fileout.IsNull()))
+    {
+        strError = strprintf("cannot open %s", (filein.IsNull() ? pathFrom : pathTo).string());
+        return false;
+    }
+
+    vector<char> vchBuf(CHAINSTATE_COPY_CHUNK);
+
+    while (nSize > 0)
+    {
+        size_t nChunk = min(nSize, (uint64_t) vchBuf.size());
+
+        if (fread(vchBuf.data(), 1, nChunk, filein.Get()) != nChunk)
+        {
+            strError = strprintf("%s is truncated", pathFrom.string());
+            return false;
+        }
+
+        hasher.write(vchBuf.data(), nChunk);
+
+        if (!fileout.IsNull() && fwrite(vchBuf.data(), 1, nChunk, fileout.Get()) != nChunk)
+        {
+            strError = strprintf("cannot write %s", pathTo.string());
+            return false;
+        }
+
+        nSize -= nChunk;
+
+        if (fRequestShutdown)
+        {
+            strError = "shutdown requested";
+            return false;
+        }
+    }
+
+    if (!fileout.IsNull())
+    {
+        fflush(fileout.Get());
+        FileCommit(fileout.Get());
+    }
+
+    return true;
+}
+
+bool DumpChainState(const boost::filesystem::path& dir, CChainStateManifest& manifest, string& strError)
+{
+    manifest.SetNull();
+
+    // The copy needs every block the database refers to
+    if (nPruneTarget || HavePrunedBlockFiles())
+    {
+        strError = "not available in prune mode";
+        return false;
+    }
+
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(dir, ec);
+
+    if (ec || boost::filesystem::exists(ManifestPath(dir)))
+    {
+        strError = ec ? ec.message() : strprintf("%s already holds a snapshot", dir.string());
+        return false;
+    }
+
+    CAutoFile fileout(fopen(RecordsPath(dir).string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+
+    if (fileout.IsNull())
+    {
+        strError = strprintf("cannot open %s", RecordsPath(dir).string());
+        return false;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    CTxDB txdb;
+    const leveldb::Snapshot* snapshot = NULL;
+
+    {
+        LOCK(cs_main);
+
+        // The unspent outputs only held in memory belong in the snapshot too,
+        // and the blocks have to be on disk before the size of their files is taken
+        if (!FlushCoinsTip(txdb, true) || !(snapshot = txdb.GetSnapshot()))
+        {
+            strError = "cannot flush the database";
+            return false;
+        }
+
+        manifest.hashBestChain = hashBestChain;
+        manifest.nHeight = nBestHeight;
+        manifest.nTime = GetTime();
+
+        // New blocks are only appended from here on, the sizes bound what the
+        // database snapshot can refer to
+        for (unsigned int nFile = 1; boost::filesystem::exists(BlockFilePath(nFile)); nFile++)
+            manifest.vBlockFileSizes.push_back(boost::filesystem::file_size(BlockFilePath(nFile), ec));
+    }
+
+    LogPrintf("%s : snapshot of block %d %s taken, copying the database\n", __func__, manifest.nHeight,
+              manifest.hashBestChain.ToString());
+
+    CHashWriter hasher(SER_GETHASH, 0);
+    bool fFailed = false;
+
+    bool fOk = txdb.ScanSnapshot(snapshot, [&](const leveldb::Slice& key, const leveldb::Slice& value) {
+        string strKey = key.ToString();
+        string strValue = value.ToString();
+
+        try
+        {
+            fileout << strKey << strValue;
+        }
+        catch (const std::exception&)
+        {
+            fFailed = true;
+            return false;
+        }
+
+        hasher << strKey << strValue;
+        manifest.nRecords++;
+
+        return !fRequestShutdown;
+    });
+
+    if (!fOk || fFailed || fRequestShutdown)
+    {
+        strError = strprintf("cannot write %s", RecordsPath(dir).string());
+        return false;
+    }
+
+    fflush(fileout.Get());
+    FileCommit(fileout.Get());
+    fileout.fclose();
+
+    for (unsigned int i = 0; i < manifest.vBlockFileSizes.size(); i++)
+    {
+        if (!CopyAndHash(BlockFilePath(i + 1), SnapshotBlockFilePath(dir, i + 1), manifest.vBlockFileSizes[i],
+                         hasher, strError))
+            return false;
+    }
+
+    HashManifest(hasher, manifest);
+    manifest.hashContent = hasher.GetHash();
+
+    // The manifest goes last, a directory without one holds no usable snapshot
+    boost::filesystem::path pathTmp = ManifestPath(dir).string() + ".tmp";
+
+    try
+    {
+        CAutoFile file(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+
+        if (file.IsNull())
+            throw runtime_error("cannot open " + pathTmp.string());
+
+        file << manifest;
+        fflush(file.Get());
+        FileCommit(file.Get());
+        file.fclose();
+
+        boost::filesystem::rename(pathTmp, ManifestPath(dir));
+    }
+    catch (const std::exception& e)
+    {
+        strError = strprintf("cannot write the manifest: %s", e.what());
+        return false;
+    }
+
+    LogPrintf("%s : wrote %u records and %u block files (%uMiB) to %s in %dms, content hash %s\n", __func__,
+              manifest.nRecords, manifest.vBlockFileSizes.size(), (unsigned int) (manifest.GetBlockFileBytes() / 1048576),
+              dir.string(), GetTimeMillis() - nStart, manifest.hashContent.ToString());
+    return true;
+}
+
+// Read the snapshot in dir and check it against its manifest. With pwriter
+// the records go into the new database and the block files into the data
+// directory as they are read.
+static bool ReadManifest(const boost::filesystem::path& dir, CChainStateManifest& manifest, string& strError)
+{
+    manifest.SetNull();
+
+    try
+    {
+        CAutoFile file(fopen(ManifestPath(dir).string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+
+        if (file.IsNull())
+            throw runtime_error("cannot open " + ManifestPath(dir).string());
+
+        file >> manifest;
+    }
+    catch (const std::exception& e)
+    {
+        strError = strprintf("cannot read the manifest: %s", e.what());
+        return false;
+    }
+
+    return true;
+}
+
+static bool ReadChainState(const boost::filesystem::path& dir, const uint256& hashAssumed, CTxDBBulkWriter* pwriter,
+                           CChainStateManifest& manifest, string& strError)
+{
+    if (!ReadManifest(dir, manifest, strError))
+        return false;
+
+    if (manifest.nVersion != CHAINSTATE_SNAPSHOT_VERSION)
+    {
+        strError = strprintf("unknown snapshot version %d", manifest.nVersion);
+        return false;
+    }
+
+    if (!Checkpoints::CheckHardened(manifest.nHeight, manifest.hashBestChain))
+    {
+        strError = strprintf("block %s conflicts with a checkpoint", manifest.hashBestChain.ToString());
+        return false;
+    }
+
+    // Only the content hash is trusted, everything read below has to match it
+    if ((hashAssumed == 0 || manifest.hashContent != hashAssumed) &&
+        !Checkpoints::CheckChainState(manifest.hashBestChain, manifest.hashContent))
+    {
+        strError = strprintf("content hash %s is not a known snapshot, see -assumechainstate",
+                             manifest.hashContent.ToString());
+        return false;
+    }
+
+    CHashWriter hasher(SER_GETHASH, 0);
+
+    try
+    {
+        CAutoFile filein(fopen(RecordsPath(dir).string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+
+        if (filein.IsNull())
+            throw runtime_error("cannot open " + RecordsPath(dir).string());
+
+        string strKey;
+        string strValue;
+
+        for (uint64_t n = 0; n < manifest.nRecords; n++)
+        {
+            filein >> strKey >> strValue;
+            hasher << strKey << strValue;
+
+            if (pwriter && !pwriter->Put(strKey, strValue))
+                throw runtime_error("cannot write to the database");
+
+            if (fRequestShutdown)
+                throw runtime_error("shutdown requested");
+        }
+
+        if (fgetc(filein.Get()) != EOF)
+            throw runtime_error("more records than listed in the manifest");
+    }
+    catch (const std::exception& e)
+    {
+        strError = strprintf("cannot read the records: %s", e.what());
+        return false;
+    }
+
+    for (unsigned int i = 0; i < manifest.vBlockFileSizes.size(); i++)
+    {
+        if (!CopyAndHash(SnapshotBlockFilePath(dir, i + 1), pwriter ? BlockFilePath(i + 1) : boost::filesystem::path(),
+                         manifest.vBlockFileSizes[i], hasher, strError))
+            return false;
+    }
+
+    HashManifest(hasher, manifest);
+
+    if (hasher.GetHash() != manifest.hashContent)
+    {
+        strError = "content hash mismatch, the snapshot is damaged";
+        return false;
+    }
+
+    return true;
+}
+
+bool VerifyChainState(const boost::filesystem::path& dir, const uint256& hashAssumed,
+                      CChainStateManifest& manifest, string& strError)
+{
+    return ReadChainState(dir, hashAssumed, NULL, manifest, strError);
+}
+
+// Remove the block files and the cached block index of the chain being replaced
+static void RemoveChainFiles()
+{
+    boost::system::error_code ec;
+
+    for (unsigned int nFile = 1; boost::filesystem::exists(BlockFilePath(nFile)); nFile++)
+        boost::filesystem::remove(BlockFilePath(nFile), ec);
+
+    // See CTxDB::LoadBlockIndexSnapshot()
+    boost::filesystem::remove(GetDataDir() / "blkindex.snapshot", ec);
+    boost::filesystem::remove(LoadedPath(), ec);
+}
+
+bool IsChainStateLoaded(const boost::filesystem::path& dir)
+{
+    CChainStateManifest manifest;
+    string strError;
+    uint256 hashLoaded;
+
+    if (!ReadManifest(dir, manifest, strError))
+        return false;
+
+    try
+    {
+        CAutoFile file(fopen(LoadedPath().string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+
+        if (file.IsNull())
+            return false;
+
+        file >> hashLoaded;
+    }
+    catch (const std::exception& e)
+    {
+        return false;
+    }
+
+    return hashLoaded == manifest.hashContent;
+}
+
+bool LoadChainState(const boost::filesystem::path& dir, const uint256& hashAssumed,
+                    CChainStateManifest& manifest, string& strError)
+{
+    int64_t nStart = GetTimeMillis();
+    LogPrintf("%s : loading the chain state snapshot in %s\n", __func__, dir.string());
+
+    // Nothing is replaced before the whole snapshot has been verified
+    if (!ReadChainState(dir, hashAssumed, NULL, manifest, strError))
+        return false;
+
+    CTxDBBulkWriter writer;
+
+    if (!writer.IsOpen())
+    {
+        strError = "cannot create the database";
+        return false;
+    }
+
+    RemoveChainFiles();
+
+    if (!ReadChainState(dir, hashAssumed, &writer, manifest, strError) || !writer.Commit())
+    {
+        if (strError.empty())
+            strError = "cannot write the database";
+
+        // Leave an empty chain behind rather than a partial one
+        writer.Abort();
+        RemoveChainFiles();
+        return false;
+    }
+
+    // The snapshot may stay in the configuration, it is not loaded again
+    CAutoFile file(fopen(LoadedPath().string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+
+    if (!file.IsNull())
+    {
+        file << manifest.hashContent;
+        fflush(file.Get());
+        FileCommit(file.Get());
+    }
+    else
+        LogPrintf("%s : cannot write %s\n", __func__, LoadedPath().string());
+
+    LogPrintf("%s : loaded %u records and %u block files up to block %d %s in %dms\n", __func__, manifest.nRecords,
+              manifest.vBlockFileSizes.size(), manifest.nHeight, manifest.hashBestChain.ToString(),
+              GetTimeMillis() - nStart);
+    return true;
+}
@@ -0,0 +1,89 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NEUTRON_CHAINSTATE_H
+#define NEUTRON_CHAINSTATE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+#include "serialize.h"
+#include "uint256.h"
+
+static const int CHAINSTATE_SNAPSHOT_VERSION = 1;
+
+/** Describes a chain state snapshot, a directory holding a copy of the
+ * transaction database (txdb.dat) and of the block files it refers to, taken
+ * at hashBestChain. hashContent covers the manifest fields above it, every
+ * database record and every byte of the block files.
+ */
+class CChainStateManifest
+{
+public:
+    int nVersion;
+    uint256 hashBestChain;
+    int nHeight;
+    int64_t nTime; // when the snapshot was taken
+    uint64_t nRecords;
+    std::vector<uint64_t> vBlockFileSizes; // blk0001.dat onwards
+    uint256 hashContent;
+
+    CChainStateManifest()
+    {
+        SetNull();
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(this->nVersion);
+        READWRITE(hashBestChain);
+        READWRITE(nHeight);
+        READWRITE(nTime);
+        READWRITE(nRecords);
+        READWRITE(vBlockFileSizes);
+        READWRITE(hashContent);
+    )
+
+    void SetNull()
+    {
+        nVersion = CHAINSTATE_SNAPSHOT_VERSION;
+        hashBestChain = 0;
+        nHeight = -1;
+        nTime = 0;
+        nRecords = 0;
+        vBlockFileSizes.clear();
+        hashContent = 0;
+    }
+
+    uint64_t GetBlockFileBytes() const;
+};
+
+/** Write a snapshot of the chain state into the empty or missing directory dir.
+ * The chain is only locked while the database snapshot is taken, the copy is
+ * made while the node carries on.
+ */
+bool DumpChainState(const boost::filesystem::path& dir, CChainStateManifest& manifest, std::string& strError);
+
+/** Read the whole snapshot in dir and check its content hash. It has to be a
+ * published snapshot (Checkpoints::CheckChainState()) unless its content hash
+ * is hashAssumed.
+ */
+bool VerifyChainState(const boost::filesystem::path& dir, const uint256& hashAssumed,
+                      CChainStateManifest& manifest, std::string& strError);
+
+/** Replace the transaction database and the block files with the verified
+ * snapshot in dir (-loadchainstate). Runs at startup, before the database is
+ * opened.
+ */
+bool LoadChainState(const boost::filesystem::path& dir, const uint256& hashAssumed,
+                    CChainStateManifest& manifest, std::string& strError);
+
+/** Whether the snapshot in dir is the one LoadChainState() last loaded here */
+bool IsChainStateLoaded(const boost::filesystem::path& dir);
+
+#endif // NEUTRON_CHAINSTATE_H
@@ -11,6 +11,7 @@
 #include "collectionhashing.h"
 #include "txdb.h"
 #include "main.h"
+#include "orphanblocks.h"
 #include "uint256.h"
 
 static const int nCheckpointSpan = 10;
@@ -64,6 +65,11 @@ namespace Checkpoints
     // TestNet has no checkpoints
     static MapCheckpoints mapCheckpointsTestnet = boost::assign::map_list_of(0, hashGenesisBlockTestNet);
 
+    // Content hashes of the chain state snapshots published with a release (see
+    // chainstate.h), by the best block of the snapshot. A snapshot that is not
+    // listed here is only loaded with -assumechainstate.
+    static std::map<uint256, uint256> mapChainStates;
+
     bool CheckHardened(int nHeight, const uint256& hash)
     {
         MapCheckpoints& checkpoints = (fTestNet ? mapCheckpointsTestnet : mapCheckpoints);
@@ -97,6 +103,13 @@ namespace Checkpoints
         return NULL;
     }
 
+    bool CheckChainState(const uint256& hashBlock, const uint256& hashContent)
+    {
+        std::map<uint256, uint256>::const_iterator i = mapChainStates.find(hashBlock);
+
+        return i != mapChainStates.end() && i->second == hashContent;
+    }
+
     // ppcoin: synchronized checkpoint (centrally broadcasted)
     uint256 hashSyncCheckpoint = 0;
     uint256 hashPendingCheckpoint = 0;
@@ -301,8 +314,8 @@ namespace Checkpoints
             return false;
         if (hashBlock == hashPendingCheckpoint)
             return true;
-        if (mapOrphanBlocks.count(hashPendingCheckpoint)
-            && hashBlock == WantedByOrphan(mapOrphanBlocks[hashPendingCheckpoint]))
+        if (orphanblocks.Contains(hashPendingCheckpoint)
+            && hashBlock == orphanblocks.GetWanted(hashPendingCheckpoint))
             return true;
         return false;
     }
@@ -351,7 +364,7 @@ namespace Checkpoints
     void AskForPendingSyncCheckpoint(CNode* pfrom)
     {
         LOCK(cs_hashSyncCheckpoint);
-        if (pfrom && hashPendingCheckpoint != 0 && (!mapBlockIndex.count(hashPendingCheckpoint)) && (!mapOrphanBlocks.count(hashPendingCheckpoint)))
+        if (pfrom && hashPendingCheckpoint != 0 && (!mapBlockIndex.count(hashPendingCheckpoint)) && (!orphanblocks.Contains(hashPendingCheckpoint)))
             pfrom->AskFor(CInv(MSG_BLOCK, hashPendingCheckpoint));
     }
 
@@ -458,7 +471,7 @@ bool CSyncCheckpoint::ProcessSyncCheckpoint(CNode* pfrom)
             pfrom->PushGetBlocks(pindexBest, hashCheckpoint);
             // ask directly as well in case rejected earlier by duplicate
             // proof-of-stake because getblocks may not get it this time
-            pfrom->AskFor(CInv(MSG_BLOCK, mapOrphanBlocks.count(hashCheckpoint)? WantedByOrphan(mapOrphanBlocks[hashCheckpoint]) : hashCheckpoint));
+            pfrom->AskFor(CInv(MSG_BLOCK, orphanblocks.Contains(hashCheckpoint)? orphanblocks.GetWanted(hashCheckpoint) : hashCheckpoint));
         }
 
         return false;
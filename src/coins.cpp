@@ -0,0 +1,207 @@
+// Copyright (c) 2012-2015 The Bitcoin Core developers
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "txdb.h"
+#include "util.h"
+
+using namespace std;
+
+CCoinsViewCache* pcoinsTip = NULL;
+int64_t nCoinCacheUsage = 32 * 1048576;
+
+CCoinsViewCache::CCoinsViewCache(CCoinsViewCache* pbaseIn) : pbase(pbaseIn), nCachedUsage(0)
+{
+    hashBlock = 0;
+}
+
+size_t CCoinsViewCache::EntryUsage(const CCoin& coin)
+{
+    // Node allocation, the bucket pointer in the table and the script on the heap
+    return sizeof(CoinsMap::value_type) + 2 * sizeof(void*) + coin.out.scriptPubKey.capacity();
+}
+
+CCoinsViewCache::CCoinsCacheEntry& CCoinsViewCache::Modify(const COutPoint& outpoint)
+{
+    CoinsMap::iterator it = mapCoins.find(outpoint);
+
+    if (it == mapCoins.end())
+        return mapCoins[outpoint];
+
+    nCachedUsage -= EntryUsage(it->second.coin);
+    return it->second;
+}
+
+bool CCoinsViewCache::GetCoin(CTxDB& txdb, const COutPoint& outpoint, CCoin& coin)
+{
+    LOCK(cs_coins);
+    CoinsMap::const_iterator it = mapCoins.find(outpoint);
+
+    if (it != mapCoins.end())
+    {
+        if (it->second.coin.IsSpent())
+            return false;
+
+        coin = it->second.coin;
+        return true;
+    }
+
+    if (pbase)
+        return pbase->GetCoin(txdb, outpoint, coin);
+
+    if (!txdb.ReadCoin(outpoint, coin))
+        return false;
+
+    // Keep a clean copy around, the output is likely to be spent soon
+    mapCoins[outpoint].coin = coin;
+    nCachedUsage += EntryUsage(coin);
+
+    return true;
+}
+
+void CCoinsViewCache::AddCoin(const COutPoint& outpoint, const CCoin& coin)
+{
+    LOCK(cs_coins);
+    CCoinsCacheEntry& entry = Modify(outpoint);
+
+    entry.coin = coin;
+    entry.nFlags |= COIN_DIRTY;
+    nCachedUsage += EntryUsage(entry.coin);
+}
+
+void CCoinsViewCache::AddCoins(const CTransaction& tx, int nHeight)
+{
+    uint256 hash = tx.GetHash();
+
+    // Empty outputs (such as the first output of a coinstake) can never be spent
+    // in practice, so they are not worth keeping in the set
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+    {
+        if (!tx.vout[i].IsEmpty())
+            AddCoin(COutPoint(hash, i), CCoin(tx, i, nHeight));
+    }
+}
+
+void CCoinsViewCache::SpendCoin(const COutPoint& outpoint)
+{
+    LOCK(cs_coins);
+    CCoinsCacheEntry& entry = Modify(outpoint);
+
+    entry.coin.SetNull();
+    entry.nFlags |= COIN_DIRTY;
+    nCachedUsage += EntryUsage(entry.coin);
+}
+
+void CCoinsViewCache::UpdateCoins(const CTransaction& tx, int nHeight)
+{
+    if (!tx.IsCoinBase())
+    {
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            SpendCoin(txin.prevout);
+    }
+
+    AddCoins(tx, nHeight);
+}
+
+void CCoinsViewCache::SetBestBlock(const uint256& hashBlockIn)
+{
+    LOCK(cs_coins);
+    hashBlock = hashBlockIn;
+}
+
+uint256 CCoinsViewCache::GetBestBlock() const
+{
+    LOCK(cs_coins);
+    return hashBlock;
+}
+
+void CCoinsViewCache::BatchWrite(CoinsMap& mapChildCoins, const uint256& hashBlockIn)
+{
+    LOCK(cs_coins);
+
+    for (CoinsMap::iterator it = mapChildCoins.begin(); it != mapChildCoins.end(); ++it)
+    {
+        if (!(it->second.nFlags & COIN_DIRTY))
+            continue;
+
+        CCoinsCacheEntry& entry = Modify(it->first);
+        entry.coin = it->second.coin;
+        entry.nFlags |= COIN_DIRTY;
+        nCachedUsage += EntryUsage(entry.coin);
+    }
+
+    if (hashBlockIn != 0)
+        hashBlock = hashBlockIn;
+}
+
+bool CCoinsViewCache::Flush(CTxDB& txdb)
+{
+    LOCK(cs_coins);
+
+    if (pbase)
+        pbase->BatchWrite(mapCoins, hashBlock);
+    else
+    {
+        vector<pair<COutPoint, CCoin> > vWrite;
+        vector<COutPoint> vErase;
+
+        for (CoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it)
+        {
+            if (!(it->second.nFlags & COIN_DIRTY))
+                continue;
+
+            if (it->second.coin.IsSpent())
+                vErase.push_back(it->first);
+            else
+                vWrite.push_back(make_pair(it->first, it->second.coin));
+        }
+
+        if (!txdb.WriteCoins(vWrite, vErase, hashBlock))
+            return error("%s : failed to write %u coins", __func__, vWrite.size() + vErase.size());
+    }
+
+    mapCoins.clear();
+    nCachedUsage = 0;
+
+    return true;
+}
+
+size_t CCoinsViewCache::DynamicMemoryUsage() const
+{
+    LOCK(cs_coins);
+    return nCachedUsage;
+}
+
+unsigned int CCoinsViewCache::GetCacheSize() const
+{
+    LOCK(cs_coins);
+    return mapCoins.size();
+}
+
+bool FlushCoinsTip(CTxDB& txdb, bool fForce)
+{
+    if (!pcoinsTip)
+        return true;
+
+    size_t nUsage = pcoinsTip->DynamicMemoryUsage();
+
+    if (!fForce && nUsage <= (size_t) nCoinCacheUsage)
+        return true;
+
+    int64_t nStart = GetTimeMillis();
+    unsigned int nCoins = pcoinsTip->GetCacheSize();
+
+    if (!pcoinsTip->Flush(txdb))
+        return false;
+
+    if (fDebug)
+    {
+        LogPrintf("%s : flushed %u coins (%uKiB) in %dms\n", __func__, nCoins,
+                  (unsigned int) (nUsage / 1024), GetTimeMillis() - nStart);
+    }
+
+    return true;
+}
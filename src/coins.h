@@ -0,0 +1,95 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2015 The Bitcoin Core developers
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NEUTRON_COINS_H
+#define NEUTRON_COINS_H
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "main.h"
+#include "robinhood.h"
+#include "sync.h"
+
+class CTxDB;
+
+struct COutPointHasher
+{
+    size_t operator()(const COutPoint& outpoint) const
+    {
+        return robin_hood::hash_bytes(outpoint.hash.begin(), outpoint.hash.size()) ^
+               (outpoint.n * UINT64_C(0x9E3779B97F4A7C15));
+    }
+};
+
+/** A write-back cache of unspent transaction outputs keyed by outpoint. A view
+ * either sits on top of another view or, when it has no base, on top of the coin
+ * records in the transaction database. Changes are kept in memory until Flush()
+ * pushes them down one level; reads that miss are answered by the level below.
+ */
+class CCoinsViewCache
+{
+private:
+    enum
+    {
+        COIN_DIRTY = (1 << 0), // differs from the level below
+    };
+
+    struct CCoinsCacheEntry
+    {
+        CCoin coin;
+        unsigned char nFlags;
+
+        CCoinsCacheEntry() : nFlags(0) {}
+    };
+
+    typedef robin_hood::unordered_node_map<COutPoint, CCoinsCacheEntry, COutPointHasher> CoinsMap;
+
+    CCoinsViewCache* pbase;
+    mutable CCriticalSection cs_coins;
+    CoinsMap mapCoins;
+    size_t nCachedUsage;
+    uint256 hashBlock;
+
+    static size_t EntryUsage(const CCoin& coin);
+    CCoinsCacheEntry& Modify(const COutPoint& outpoint);
+    void BatchWrite(CoinsMap& mapChildCoins, const uint256& hashBlockIn);
+
+public:
+    CCoinsViewCache(CCoinsViewCache* pbaseIn = NULL);
+
+    // Retrieve an unspent output. Returns false if the output is spent or unknown.
+    bool GetCoin(CTxDB& txdb, const COutPoint& outpoint, CCoin& coin);
+
+    void AddCoin(const COutPoint& outpoint, const CCoin& coin);
+    void AddCoins(const CTransaction& tx, int nHeight);
+    void SpendCoin(const COutPoint& outpoint);
+
+    // Spend the inputs of a transaction connected at nHeight and add its outputs
+    void UpdateCoins(const CTransaction& tx, int nHeight);
+
+    // The block up to which the cached changes are valid
+    void SetBestBlock(const uint256& hashBlockIn);
+    uint256 GetBestBlock() const;
+
+    // Push all modifications down to the base view, or to the database when there is none
+    bool Flush(CTxDB& txdb);
+
+    size_t DynamicMemoryUsage() const;
+    unsigned int GetCacheSize() const;
+};
+
+/** The coins view backed by the database, representing the state at hashBestChain */
+extern CCoinsViewCache* pcoinsTip;
+
+/** Memory budget of pcoinsTip, in bytes, before it is flushed to the database */
+extern int64_t nCoinCacheUsage;
+
+bool FlushCoinsTip(CTxDB& txdb, bool fForce);
+
+#endif // NEUTRON_COINS_H
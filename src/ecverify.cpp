@@ -0,0 +1,809 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "ecverify.h"
+
+#include <stdint.h>
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+// Numbers are four 64 bit limbs, least significant first. Field elements
+// are kept fully reduced modulo p = 2^256 - 2^32 - 977 and scalars modulo
+// the group order n, so that equal values have equal limbs.
+
+struct CFieldElem
+{
+    uint64_t d[4];
+};
+
+struct CScalar
+{
+    uint64_t d[4];
+};
+
+// Jacobian coordinates: (x / z^2, y / z^3)
+struct CPoint
+{
+    CFieldElem x, y, z;
+    bool fInfinity;
+};
+
+struct CAffinePoint
+{
+    CFieldElem x, y;
+};
+
+static const uint64_t FIELD_P[4] = { 0xFFFFFFFEFFFFFC2FULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL };
+static const uint64_t FIELD_C = 0x1000003D1ULL; // 2^256 - p
+static const uint64_t ORDER_N[4] = { 0xBFD25E8CD0364141ULL, 0xBAAEDCE6AF48A03BULL, 0xFFFFFFFFFFFFFFFEULL, 0xFFFFFFFFFFFFFFFFULL };
+static const uint64_t ORDER_C[3] = { 0x402DA1732FC9BEBFULL, 0x4551231950B75FC4ULL, 0x1ULL }; // 2^256 - n
+
+static const CAffinePoint GENERATOR = {
+    {{ 0x59F2815B16F81798ULL, 0x029BFCDB2DCE28D9ULL, 0x55A06295CE870B07ULL, 0x79BE667EF9DCBBACULL }},
+    {{ 0x9C47D08FFB10D4B8ULL, 0xFD17B448A6855419ULL, 0x5DA4FBFC0E1108A8ULL, 0x483ADA7726A3C465ULL }}
+};
+
+static inline void Mul64(uint64_t a, uint64_t b, uint64_t& lo, uint64_t& hi)
+{
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 r = (unsigned __int128) a * b;
+    lo = (uint64_t) r;
+    hi = (uint64_t) (r >> 64);
+#else
+    uint64_t a0 = (uint32_t) a, a1 = a >> 32, b0 = (uint32_t) b, b1 = b >> 32;
+    uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    uint64_t mid = (p00 >> 32) + (uint32_t) p01 + (uint32_t) p10;
+    lo = (mid << 32) | (uint32_t) p00;
+    hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+#endif
+}
+
+static inline uint64_t AddCarry(uint64_t a, uint64_t b, uint64_t& carry)
+{
+    uint64_t r = a + carry;
+    uint64_t c = r < carry;
+    r += b;
+    carry = c + (r < b);
+    return r;
+}
+
+static inline uint64_t SubBorrow(uint64_t a, uint64_t b, uint64_t& borrow)
+{
+    uint64_t r = a - b;
+    uint64_t c = a < b;
+    uint64_t r2 = r - borrow;
+    borrow = c + (r < borrow);
+    return r2;
+}
+
+// r[0..na+nb) = a * b
+static inline void MulLimbs(const uint64_t* a, int na, const uint64_t* b, int nb, uint64_t* r)
+{
+    for (int i = 0; i < na + nb; i++)
+        r[i] = 0;
+
+    for (int i = 0; i < na; i++)
+    {
+        uint64_t carry = 0;
+
+        for (int j = 0; j < nb; j++)
+        {
+            // a * b + carry + r fits 128 bits, hi can't overflow
+            uint64_t lo, hi;
+            Mul64(a[i], b[j], lo, hi);
+            lo += carry;
+            hi += lo < carry;
+            r[i + j] += lo;
+            hi += r[i + j] < lo;
+            carry = hi;
+        }
+
+        r[i + nb] = carry;
+    }
+}
+
+static inline int CompareLimbs(const uint64_t a[4], const uint64_t b[4])
+{
+    for (int i = 3; i >= 0; i--)
+    {
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static inline bool IsZero(const uint64_t a[4])
+{
+    return (a[0] | a[1] | a[2] | a[3]) == 0;
+}
+
+// 32 big endian bytes
+static inline void SetBytes(uint64_t r[4], const unsigned char* p)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        r[3 - i] = 0;
+
+        for (int j = 0; j < 8; j++)
+            r[3 - i] = (r[3 - i] << 8) | p[8 * i + j];
+    }
+}
+
+//
+// Field arithmetic
+//
+
+static inline void FieldSetInt(CFieldElem& r, uint64_t n)
+{
+    r.d[0] = n;
+    r.d[1] = r.d[2] = r.d[3] = 0;
+}
+
+static inline bool FieldEqual(const CFieldElem& a, const CFieldElem& b)
+{
+    return CompareLimbs(a.d, b.d) == 0;
+}
+
+// Subtracts p from r when r + carry * 2^256 is at least p, for values below 2p
+static inline void FieldReduceOnce(CFieldElem& r, uint64_t carry)
+{
+    if (carry || CompareLimbs(r.d, FIELD_P) >= 0)
+    {
+        uint64_t c = 0;
+        r.d[0] = AddCarry(r.d[0], FIELD_C, c);
+        r.d[1] = AddCarry(r.d[1], 0, c);
+        r.d[2] = AddCarry(r.d[2], 0, c);
+        r.d[3] = AddCarry(r.d[3], 0, c);
+    }
+}
+
+static inline void FieldAdd(CFieldElem& r, const CFieldElem& a, const CFieldElem& b)
+{
+    uint64_t c = 0;
+
+    for (int i = 0; i < 4; i++)
+        r.d[i] = AddCarry(a.d[i], b.d[i], c);
+
+    FieldReduceOnce(r, c);
+}
+
+static inline void FieldSub(CFieldElem& r, const CFieldElem& a, const CFieldElem& b)
+{
+    uint64_t borrow = 0;
+
+    for (int i = 0; i < 4; i++)
+        r.d[i] = SubBorrow(a.d[i], b.d[i], borrow);
+
+    // Adding p modulo 2^256 is subtracting 2^256 - p, the wrapped value is larger
+    if (borrow)
+    {
+        borrow = 0;
+        r.d[0] = SubBorrow(r.d[0], FIELD_C, borrow);
+        r.d[1] = SubBorrow(r.d[1], 0, borrow);
+        r.d[2] = SubBorrow(r.d[2], 0, borrow);
+        r.d[3] = SubBorrow(r.d[3], 0, borrow);
+    }
+}
+
+static inline void FieldNeg(CFieldElem& r, const CFieldElem& a)
+{
+    CFieldElem zero;
+    FieldSetInt(zero, 0);
+    FieldSub(r, zero, a);
+}
+
+static void FieldMul(CFieldElem& r, const CFieldElem& a, const CFieldElem& b)
+{
+    uint64_t t[8];
+    MulLimbs(a.d, 4, b.d, 4, t);
+
+    // t = H * 2^256 + L = L + H * (2^256 - p) modulo p
+    uint64_t x[4], carry = 0;
+
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t lo, hi;
+        Mul64(t[4 + i], FIELD_C, lo, hi);
+        lo += carry;
+        hi += lo < carry;
+        x[i] = t[i] + lo;
+        hi += x[i] < lo;
+        carry = hi;
+    }
+
+    // Once more for the 34 bits above 2^256
+    uint64_t lo, hi, c = 0;
+    Mul64(carry, FIELD_C, lo, hi);
+    r.d[0] = AddCarry(x[0], lo, c);
+    r.d[1] = AddCarry(x[1], hi, c);
+    r.d[2] = AddCarry(x[2], 0, c);
+    r.d[3] = AddCarry(x[3], 0, c);
+
+    FieldReduceOnce(r, c);
+}
+
+static inline void FieldSqr(CFieldElem& r, const CFieldElem& a)
+{
+    FieldMul(r, a, a);
+}
+
+//
+// Scalar arithmetic
+//
+
+static void ScalarReduce(CScalar& r, const uint64_t t[8])
+{
+    uint64_t x[8];
+    int nLimbs = 8;
+
+    for (int i = 0; i < 8; i++)
+        x[i] = t[i];
+
+    // x = H * 2^256 + L = L + H * (2^256 - n) modulo n, until H is gone
+    while (true)
+    {
+        while (nLimbs > 4 && x[nLimbs - 1] == 0)
+            nLimbs--;
+
+        if (nLimbs <= 4)
+            break;
+
+        uint64_t y[8];
+        MulLimbs(x + 4, nLimbs - 4, ORDER_C, 3, y);
+
+        int nProduct = nLimbs - 4 + 3;
+        uint64_t c = 0;
+
+        for (int i = 0; i < 4; i++)
+            x[i] = AddCarry(x[i], y[i], c);
+
+        for (int i = 4; i < nProduct; i++)
+            x[i] = AddCarry(0, y[i], c);
+
+        x[nProduct] = c;
+        nLimbs = nProduct + 1;
+    }
+
+    for (int i = 0; i < 4; i++)
+        r.d[i] = x[i];
+
+    // Below 2^256 < 2n
+    if (CompareLimbs(r.d, ORDER_N) >= 0)
+    {
+        uint64_t borrow = 0;
+
+        for (int i = 0; i < 4; i++)
+            r.d[i] = SubBorrow(r.d[i], ORDER_N[i], borrow);
+    }
+}
+
+static inline void ScalarMul(CScalar& r, const CScalar& a, const CScalar& b)
+{
+    uint64_t t[8];
+    MulLimbs(a.d, 4, b.d, 4, t);
+    ScalarReduce(r, t);
+}
+
+//
+// Exponentiation, with a 4 bit window
+//
+
+template<typename T, void (*Mul)(T&, const T&, const T&)>
+static void Pow(T& r, const T& a, const uint64_t e[4])
+{
+    T table[16];
+    table[1] = a;
+
+    for (int i = 2; i < 16; i++)
+        Mul(table[i], table[i - 1], a);
+
+    bool fStarted = false;
+
+    for (int i = 63; i >= 0; i--)
+    {
+        if (fStarted)
+        {
+            for (int j = 0; j < 4; j++)
+                Mul(r, r, r);
+        }
+
+        int nNibble = (e[i / 16] >> (4 * (i % 16))) & 15;
+
+        if (nNibble)
+        {
+            if (fStarted)
+                Mul(r, r, table[nNibble]);
+            else
+                r = table[nNibble];
+
+            fStarted = true;
+        }
+    }
+}
+
+static void FieldInv(CFieldElem& r, const CFieldElem& a)
+{
+    static const uint64_t e[4] = { 0xFFFFFFFEFFFFFC2DULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL }; // p - 2
+    Pow<CFieldElem, FieldMul>(r, a, e);
+}
+
+// A square root of a, if there is one, as p = 3 mod 4
+static bool FieldSqrt(CFieldElem& r, const CFieldElem& a)
+{
+    static const uint64_t e[4] = { 0xFFFFFFFFBFFFFF0CULL, 0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL, 0x3FFFFFFFFFFFFFFFULL }; // (p + 1) / 4
+    CFieldElem check;
+    Pow<CFieldElem, FieldMul>(r, a, e);
+    FieldSqr(check, r);
+
+    return FieldEqual(check, a);
+}
+
+static void ScalarInv(CScalar& r, const CScalar& a)
+{
+    static const uint64_t e[4] = { 0xBFD25E8CD036413FULL, 0xBAAEDCE6AF48A03BULL, 0xFFFFFFFFFFFFFFFEULL, 0xFFFFFFFFFFFFFFFFULL }; // n - 2
+    Pow<CScalar, ScalarMul>(r, a, e);
+}
+
+//
+// Group operations, on y^2 = x^3 + 7
+//
+
+static inline void PointSetAffine(CPoint& r, const CAffinePoint& a)
+{
+    r.x = a.x;
+    r.y = a.y;
+    FieldSetInt(r.z, 1);
+    r.fInfinity = false;
+}
+
+static void PointDouble(CPoint& r, const CPoint& a)
+{
+    if (a.fInfinity)
+    {
+        r = a;
+        return;
+    }
+
+    // dbl-2009-l, there are no points with y = 0
+    CFieldElem A, B, C, D, E, F, t, x3, y3, z3;
+    FieldSqr(A, a.x);
+    FieldSqr(B, a.y);
+    FieldSqr(C, B);
+    FieldAdd(t, a.x, B);
+    FieldSqr(D, t);
+    FieldSub(D, D, A);
+    FieldSub(D, D, C);
+    FieldAdd(D, D, D);
+    FieldAdd(E, A, A);
+    FieldAdd(E, E, A);
+    FieldSqr(F, E);
+    FieldSub(x3, F, D);
+    FieldSub(x3, x3, D);
+    FieldAdd(C, C, C);
+    FieldAdd(C, C, C);
+    FieldAdd(C, C, C);
+    FieldSub(t, D, x3);
+    FieldMul(y3, E, t);
+    FieldSub(y3, y3, C);
+    FieldMul(z3, a.y, a.z);
+    FieldAdd(z3, z3, z3);
+
+    r.x = x3;
+    r.y = y3;
+    r.z = z3;
+    r.fInfinity = false;
+}
+
+static void PointAdd(CPoint& r, const CPoint& a, const CPoint& b)
+{
+    if (a.fInfinity)
+    {
+        r = b;
+        return;
+    }
+
+    if (b.fInfinity)
+    {
+        r = a;
+        return;
+    }
+
+    // add-2007-bl
+    CFieldElem z1z1, z2z2, u1, u2, s1, s2, h, i, j, rr, v, t, x3, y3, z3;
+    FieldSqr(z1z1, a.z);
+    FieldSqr(z2z2, b.z);
+    FieldMul(u1, a.x, z2z2);
+    FieldMul(u2, b.x, z1z1);
+    FieldMul(s1, a.y, b.z);
+    FieldMul(s1, s1, z2z2);
+    FieldMul(s2, b.y, a.z);
+    FieldMul(s2, s2, z1z1);
+    FieldSub(h, u2, u1);
+    FieldSub(rr, s2, s1);
+
+    if (IsZero(h.d))
+    {
+        if (IsZero(rr.d))
+            PointDouble(r, a);
+        else
+            r.fInfinity = true;
+
+        return;
+    }
+
+    FieldAdd(i, h, h);
+    FieldSqr(i, i);
+    FieldMul(j, h, i);
+    FieldAdd(rr, rr, rr);
+    FieldMul(v, u1, i);
+    FieldSqr(x3, rr);
+    FieldSub(x3, x3, j);
+    FieldSub(x3, x3, v);
+    FieldSub(x3, x3, v);
+    FieldSub(t, v, x3);
+    FieldMul(y3, rr, t);
+    FieldMul(t, s1, j);
+    FieldAdd(t, t, t);
+    FieldSub(y3, y3, t);
+    FieldAdd(z3, a.z, b.z);
+    FieldSqr(z3, z3);
+    FieldSub(z3, z3, z1z1);
+    FieldSub(z3, z3, z2z2);
+    FieldMul(z3, z3, h);
+
+    r.x = x3;
+    r.y = y3;
+    r.z = z3;
+    r.fInfinity = false;
+}
+
+static void PointAddAffine(CPoint& r, const CPoint& a, const CAffinePoint& b)
+{
+    if (a.fInfinity)
+    {
+        PointSetAffine(r, b);
+        return;
+    }
+
+    // madd-2007-bl
+    CFieldElem z1z1, u2, s2, h, hh, i, j, rr, v, t, x3, y3, z3;
+    FieldSqr(z1z1, a.z);
+    FieldMul(u2, b.x, z1z1);
+    FieldMul(s2, b.y, a.z);
+    FieldMul(s2, s2, z1z1);
+    FieldSub(h, u2, a.x);
+    FieldSub(rr, s2, a.y);
+
+    if (IsZero(h.d))
+    {
+        if (IsZero(rr.d))
+            PointDouble(r, a);
+        else
+            r.fInfinity = true;
+
+        return;
+    }
+
+    FieldSqr(hh, h);
+    FieldAdd(i, hh, hh);
+    FieldAdd(i, i, i);
+    FieldMul(j, h, i);
+    FieldAdd(rr, rr, rr);
+    FieldMul(v, a.x, i);
+    FieldSqr(x3, rr);
+    FieldSub(x3, x3, j);
+    FieldSub(x3, x3, v);
+    FieldSub(x3, x3, v);
+    FieldSub(t, v, x3);
+    FieldMul(y3, rr, t);
+    FieldMul(t, a.y, j);
+    FieldAdd(t, t, t);
+    FieldSub(y3, y3, t);
+    FieldAdd(z3, a.z, h);
+    FieldSqr(z3, z3);
+    FieldSub(z3, z3, z1z1);
+    FieldSub(z3, z3, hh);
+
+    r.x = x3;
+    r.y = y3;
+    r.z = z3;
+    r.fInfinity = false;
+}
+
+static void PointToAffine(CAffinePoint& r, const CPoint& a)
+{
+    CFieldElem zInv, zInv2, zInv3;
+    FieldInv(zInv, a.z);
+    FieldSqr(zInv2, zInv);
+    FieldMul(zInv3, zInv2, zInv);
+    FieldMul(r.x, a.x, zInv2);
+    FieldMul(r.y, a.y, zInv3);
+}
+
+//
+// Scalar multiplication
+//
+
+// j * 16^i * G for every 4 bit window i of a scalar, built on first use
+static const unsigned int GEN_WINDOWS = 64;
+
+struct CGeneratorTable
+{
+    CAffinePoint points[GEN_WINDOWS][15];
+
+    CGeneratorTable()
+    {
+        CPoint base;
+        PointSetAffine(base, GENERATOR);
+
+        for (unsigned int i = 0; i < GEN_WINDOWS; i++)
+        {
+            CPoint multiple = base;
+
+            for (unsigned int j = 0; j < 15; j++)
+            {
+                PointToAffine(points[i][j], multiple);
+                PointAdd(multiple, multiple, base);
+            }
+
+            base = multiple;
+        }
+    }
+};
+
+static const CGeneratorTable& GetGeneratorTable()
+{
+    static const CGeneratorTable* ptable = new CGeneratorTable();
+    return *ptable;
+}
+
+// Width 5 NAF of a scalar: odd digits in [-15, 15] with at least four zeros
+// between any two, wnaf has 257 entries
+static void GetWNAF(int* wnaf, const CScalar& a)
+{
+    static const int WINDOW = 5;
+    int nCarry = 0;
+
+    for (int i = 0; i < 257; i++)
+        wnaf[i] = 0;
+
+    for (int nBit = 0; nBit < 256; )
+    {
+        if ((int) ((a.d[nBit / 64] >> (nBit % 64)) & 1) == nCarry)
+        {
+            nBit++;
+            continue;
+        }
+
+        int nNow = min(WINDOW, 256 - nBit);
+        uint64_t nBits = a.d[nBit / 64] >> (nBit % 64);
+
+        if (nBit % 64 + nNow > 64)
+            nBits |= a.d[nBit / 64 + 1] << (64 - nBit % 64);
+
+        int nWord = (int) (nBits & ((1 << nNow) - 1)) + nCarry;
+        nCarry = (nWord >> (WINDOW - 1)) & 1;
+        wnaf[nBit] = nWord - (nCarry << WINDOW);
+        nBit += nNow;
+    }
+
+    wnaf[256] = nCarry;
+}
+
+// u1 * G + u2 * Q
+static void MultiplyAdd(CPoint& r, const CScalar& u1, const CScalar& u2, const CAffinePoint& q)
+{
+    // Odd multiples of Q for the NAF digits
+    CPoint table[8], q2;
+    PointSetAffine(table[0], q);
+    PointDouble(q2, table[0]);
+
+    for (int i = 1; i < 8; i++)
+        PointAdd(table[i], table[i - 1], q2);
+
+    int wnaf[257];
+    GetWNAF(wnaf, u2);
+
+    r.fInfinity = true;
+
+    for (int i = 256; i >= 0; i--)
+    {
+        PointDouble(r, r);
+
+        if (wnaf[i] > 0)
+            PointAdd(r, r, table[(wnaf[i] - 1) / 2]);
+        else if (wnaf[i] < 0)
+        {
+            CPoint neg = table[(-wnaf[i] - 1) / 2];
+            FieldNeg(neg.y, neg.y);
+            PointAdd(r, r, neg);
+        }
+    }
+
+    // The generator needs no doublings with its multiples at hand
+    const CGeneratorTable& gen = GetGeneratorTable();
+
+    for (unsigned int i = 0; i < GEN_WINDOWS; i++)
+    {
+        int nNibble = (u1.d[i / 16] >> (4 * (i % 16))) & 15;
+
+        if (nNibble)
+            PointAddAffine(r, r, gen.points[i][nNibble - 1]);
+    }
+}
+
+//
+// Encodings
+//
+
+static bool ParsePubKey(CAffinePoint& r, const vector<unsigned char>& vchPubKey)
+{
+    CFieldElem seven, rhs;
+    FieldSetInt(seven, 7);
+
+    if (vchPubKey.size() == 33 && (vchPubKey[0] == 0x02 || vchPubKey[0] == 0x03))
+    {
+        SetBytes(r.x.d, &vchPubKey[1]);
+
+        if (CompareLimbs(r.x.d, FIELD_P) >= 0)
+            return false;
+
+        FieldSqr(rhs, r.x);
+        FieldMul(rhs, rhs, r.x);
+        FieldAdd(rhs, rhs, seven);
+
+        // y = 0 has no odd counterpart, OpenSSL decides that case
+        if (!FieldSqrt(r.y, rhs) || IsZero(r.y.d))
+            return false;
+
+        if ((r.y.d[0] & 1) != (vchPubKey[0] & 1))
+            FieldNeg(r.y, r.y);
+
+        return true;
+    }
+
+    if (vchPubKey.size() == 65 && vchPubKey[0] == 0x04)
+    {
+        SetBytes(r.x.d, &vchPubKey[1]);
+        SetBytes(r.y.d, &vchPubKey[33]);
+
+        if (CompareLimbs(r.x.d, FIELD_P) >= 0 || CompareLimbs(r.y.d, FIELD_P) >= 0)
+            return false;
+
+        CFieldElem lhs;
+        FieldSqr(lhs, r.y);
+        FieldSqr(rhs, r.x);
+        FieldMul(rhs, rhs, r.x);
+        FieldAdd(rhs, rhs, seven);
+
+        return FieldEqual(lhs, rhs);
+    }
+
+    return false;
+}
+
+// A DER integer at vch[0], positive, minimally encoded and at most 32 bytes
+// long without the sign byte. Returns its total length or 0.
+static unsigned int ParseInteger(uint64_t r[4], const unsigned char* vch, unsigned int nAvail)
+{
+    if (nAvail < 3 || vch[0] != 0x02)
+        return 0;
+
+    unsigned int nLen = vch[1];
+
+    if (nLen == 0 || nLen >= 0x80 || nLen > nAvail - 2)
+        return 0;
+
+    const unsigned char* p = vch + 2;
+
+    if (p[0] & 0x80)
+        return 0;
+
+    if (nLen > 1 && p[0] == 0x00 && !(p[1] & 0x80))
+        return 0;
+
+    unsigned int nValue = nLen;
+
+    if (p[0] == 0x00 && nLen > 1)
+    {
+        p++;
+        nValue--;
+    }
+
+    if (nValue > 32)
+        return 0;
+
+    unsigned char buf[32] = {};
+
+    for (unsigned int i = 0; i < nValue; i++)
+        buf[32 - nValue + i] = p[i];
+
+    SetBytes(r, buf);
+
+    return 2 + nLen;
+}
+
+static bool ParseSignature(CScalar& r, CScalar& s, const vector<unsigned char>& vchSig)
+{
+    unsigned int nSize = vchSig.size();
+
+    if (nSize < 8 || vchSig[0] != 0x30 || vchSig[1] >= 0x80 || vchSig[1] != nSize - 2)
+        return false;
+
+    unsigned int nLenR = ParseInteger(r.d, &vchSig[2], nSize - 2);
+
+    if (nLenR == 0)
+        return false;
+
+    unsigned int nLenS = ParseInteger(s.d, &vchSig[2 + nLenR], nSize - 2 - nLenR);
+
+    return nLenS != 0 && 2 + nLenR + nLenS == nSize;
+}
+
+}
+
+bool ECDSAVerify(const vector<unsigned char>& vchPubKey, const uint256& hash,
+                 const vector<unsigned char>& vchSig, bool& fValidRet)
+{
+    CAffinePoint q;
+    CScalar r, s;
+
+    if (!ParsePubKey(q, vchPubKey) || !ParseSignature(r, s, vchSig))
+        return false;
+
+    fValidRet = false;
+
+    if (IsZero(r.d) || IsZero(s.d) || CompareLimbs(r.d, ORDER_N) >= 0 || CompareLimbs(s.d, ORDER_N) >= 0)
+        return true;
+
+    // The hash is read as big endian, like OpenSSL reads the digest bytes
+    uint64_t e[8] = {};
+    SetBytes(e, hash.begin());
+
+    CScalar m, w, u1, u2;
+    ScalarReduce(m, e);
+    ScalarInv(w, s);
+    ScalarMul(u1, m, w);
+    ScalarMul(u2, r, w);
+
+    CPoint point;
+    MultiplyAdd(point, u1, u2, q);
+
+    if (point.fInfinity)
+        return true;
+
+    // x mod n == r without leaving Jacobian coordinates: x = X / Z^2 is r or
+    // r + n, the latter only if it is still below p
+    CFieldElem xr, zz, t;
+    FieldSqr(zz, point.z);
+
+    for (int i = 0; i < 4; i++)
+        xr.d[i] = r.d[i];
+
+    FieldMul(t, xr, zz);
+
+    if (FieldEqual(t, point.x))
+    {
+        fValidRet = true;
+        return true;
+    }
+
+    uint64_t c = 0;
+
+    for (int i = 0; i < 4; i++)
+        xr.d[i] = AddCarry(xr.d[i], ORDER_N[i], c);
+
+    if (c == 0 && CompareLimbs(xr.d, FIELD_P) < 0)
+    {
+        FieldMul(t, xr, zz);
+        fValidRet = FieldEqual(t, point.x);
+    }
+
+    return true;
+}
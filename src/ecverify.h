@@ -0,0 +1,24 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NEUTRON_ECVERIFY_H
+#define NEUTRON_ECVERIFY_H
+
+#include <vector>
+
+#include "uint256.h"
+
+/** ECDSA verification over secp256k1 without OpenSSL, the way
+ * ECDSA_verify() verifies hash as a 32 byte big endian number. Handles
+ * compressed and uncompressed public keys on the curve and strict DER
+ * signatures with values of at most 32 bytes, which is what scripts allow.
+ * Returns false for anything else, leaving the decision to OpenSSL so that
+ * every input gets the same result as before; otherwise returns true with
+ * the outcome in fValidRet.
+ */
+bool ECDSAVerify(const std::vector<unsigned char>& vchPubKey, const uint256& hash,
+                 const std::vector<unsigned char>& vchSig, bool& fValidRet);
+
+#endif // NEUTRON_ECVERIFY_H
@@ -12,9 +12,20 @@
 #include "netbase.h"
 #include "noui.h"
 #include "init.h"
+#include "addressindex.h"
+#include "blockcache.h"
+#include "blockdownload.h"
+#include "blockfile.h"
+#include "chainstate.h"
+#include "orphanblocks.h"
+#include "prune.h"
 #include "rpc/register.h"
 #include "script/standard.h"
 #include "scheduler.h"
+#include "scriptcheck.h"
+#include "sigcache.h"
+#include "spentindex.h"
+#include "timestampindex.h"
 #include "util.h"
 #include "utiltime.h"
 #include "ui_interface.h"
@@ -149,6 +160,7 @@ bool PrepareShutdown()
 
     nTransactionsUpdated++;
     CTxDB().Close();
+    CloseBlockFileReaders();
     bitdb.Flush(false);
     LogPrintf("%s: call ConnMan::reset\n", __func__);
     g_connman.reset();
@@ -311,10 +323,7 @@ int main(int argc, char* argv[])
 
     fRet = AppInit(argc, argv);
 
-    if (fRet && fDaemon)
-        return 0;
-
-    return 1;
+    return fRet ? 0 : 1;
 }
 #endif
 
@@ -340,6 +349,11 @@ std::string HelpMessage()
         "  -datadir=<dir>         " + _("Specify data directory") + "\n" +
         "  -wallet=<dir>          " + _("Specify wallet file (within data directory)") + "\n" +
         "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 64)") + "\n" +
+        "  -dbflushinterval=<n>   " + _("Sync new blocks and index changes to disk at least every <n> seconds (default: 60, 0 = every block)") + "\n" +
+        "  -dbbackend=<name>      " + _("Where to keep the transaction database, leveldb or memory (default: leveldb)") + "\n" +
+        "  -blockcache=<n>        " + _("Set the size of the cache of recently used blocks in megabytes (default: 32)") + "\n" +
+        "  -maxsigcachesize=<n>   " + strprintf(_("Set the size of the cache of valid signatures in megabytes, up to %u (default: %u)"), MAX_SIG_CACHE_SIZE, DEFAULT_MAX_SIG_CACHE_SIZE) + "\n" +
+        "  -maxorphanblocks=<n>   " + strprintf(_("Keep at most <n> megabytes of blocks whose parent is unknown (default: %u)"), DEFAULT_MAX_ORPHAN_BLOCKS) + "\n" +
         "  -dblogsize=<n>         " + _("Set database disk log size in megabytes (default: 100)") + "\n" +
         "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n" +
         "  -proxy=<ip:port>       " + _("Connect through socks proxy") + "\n" +
@@ -372,6 +386,8 @@ std::string HelpMessage()
         "  -detachdb              " + _("Detach block and address databases. Increases shutdown time (default: 0)") + "\n" +
         "  -paytxfee=<amt>        " + _("Fee per KB to add to transactions you send") + "\n" +
         "  -mininput=<amt>        " + _("When creating transactions, ignore inputs with value less than this (default: 0.01)") + "\n" +
+        "  -par=<n>               " + strprintf(_("Set the number of script verification threads (up to %d, 0 = one per core, <0 = leave that many cores free, default: %d)"), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS) + "\n" +
+        "  -headersfirst          " + strprintf(_("Download the header chain first and its blocks from several peers at once (default: %u)"), DEFAULT_HEADERSFIRST) + "\n" +
         "  -maxtipage=<n>         " + strprintf(_("Maximum tip age in seconds to consider node in initial block download (default: %u)"), DEFAULT_MAX_TIP_AGE) + "\n" +
 #ifdef QT_GUI
         "  -server                " + _("Accept command line and JSON-RPC commands") + "\n" +
@@ -405,6 +421,14 @@ std::string HelpMessage()
         "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 500, 0 = all)") + "\n" +
         "  -checklevel=<n>        " + _("How thorough the block verification is (0-6, default: 1)") + "\n" +
         "  -loadblock=<file>      " + _("Imports blocks from external blk000?.dat file") + "\n" +
+        "  -reindex               " + _("Rebuild the block index and transaction database from the blk000?.dat files, on the command line only") + "\n" +
+        "  -loadchainstate=<dir>  " + _("Replace the transaction database and block files with the chain state snapshot in <dir>") + "\n" +
+        "  -assumechainstate=<hash> " + _("Accept a chain state snapshot with this content hash besides the published ones") + "\n" +
+        "  -dumpchainstate=<dir>  " + _("Write a chain state snapshot to <dir> and exit") + "\n" +
+        "  -addressindex          " + _("Maintain an index of the outputs received and spent by each address (default: 0)") + "\n" +
+        "  -spentindex            " + _("Maintain an index of the inputs that spend each output (default: 0)") + "\n" +
+        "  -timestampindex        " + _("Maintain an index of blocks by their timestamp (default: 0)") + "\n" +
+        "  -prune=<n>             " + _("Delete the oldest block files to keep them within <n> megabytes (default: 0 = off, minimum: 512)") + "\n" +
 
         "\n" + _("Block creation options:") + "\n" +
         "  -blockminsize=<n>      "   + _("Set minimum block size in bytes (default: 0)") + "\n" +
@@ -491,6 +515,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     nNodeLifespan = GetArg("-addrlifespan", 7);
     fUseFastIndex = GetBoolArg("-fastindex", true);
+    fHeadersFirst = GetBoolArg("-headersfirst", DEFAULT_HEADERSFIRST);
     nMinerSleep = GetArg("-minersleep", 500);
 
     CheckpointsMode = Checkpoints::STRICT;
@@ -645,6 +670,17 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     nMaxTipAge = GetArg("-maxtipage", DEFAULT_MAX_TIP_AGE);
 
+    // -par=0 means one thread per core, a negative value leaves that many cores free
+    nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
+
+    if (nScriptCheckThreads <= 0)
+        nScriptCheckThreads += boost::thread::hardware_concurrency();
+
+    if (nScriptCheckThreads <= 1)
+        nScriptCheckThreads = 0;
+    else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
+        nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
+
 
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
 
@@ -698,6 +734,15 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("[AppInit2] Default data directory %s\n", GetDefaultDataDir().string().c_str());
     LogPrintf("[AppInit2] Used data directory %s\n", strDataDir.c_str());
 
+    if (nScriptCheckThreads)
+    {
+        LogPrintf("[AppInit2] Using %d threads for script verification\n", nScriptCheckThreads);
+
+        // The thread connecting a block is one of them
+        for (int i = 0; i < nScriptCheckThreads - 1; i++)
+            threadGroup.create_thread(&ThreadScriptCheck);
+    }
+
     std::ostringstream strErrors;
 
     if (mapArgs.count("-sporkkey"))
@@ -909,6 +954,34 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         return InitError(msg);
     }
 
+    if (!SetTxDBBackend(GetArg("-dbbackend", DEFAULT_TXDB_BACKEND)))
+        return InitError(strprintf(_("Unknown database backend: %s"), GetArg("-dbbackend", DEFAULT_TXDB_BACKEND)));
+
+    if (mapArgs.count("-loadchainstate"))
+    {
+        if (GetBoolArg("-reindex"))
+            return InitError(_("-loadchainstate cannot be combined with -reindex"));
+
+        boost::filesystem::path dirSnapshot = boost::filesystem::system_complete(mapArgs["-loadchainstate"]);
+
+        if (IsChainStateLoaded(dirSnapshot))
+            LogPrintf("Chain state snapshot in %s already loaded, ignoring -loadchainstate\n", dirSnapshot.string());
+        else
+        {
+            uiInterface.InitMessage(_("Loading chain state snapshot..."));
+
+            uint256 hashAssumed = 0;
+            CChainStateManifest manifest;
+            string strError;
+
+            if (mapArgs.count("-assumechainstate"))
+                hashAssumed.SetHex(mapArgs["-assumechainstate"]);
+
+            if (!LoadChainState(dirSnapshot, hashAssumed, manifest, strError))
+                return InitError(strprintf(_("Cannot load the chain state snapshot: %s"), strError));
+        }
+    }
+
     if (GetBoolArg("-loadblockindextest"))
     {
         CTxDB txdb("r");
@@ -917,11 +990,71 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         return false;
     }
 
+    nDBFlushInterval = max((int64_t) 0, GetArg("-dbflushinterval", DEFAULT_DB_FLUSH_INTERVAL));
+    blockcache.SetMaxBytes(max((int64_t) 0, GetArg("-blockcache", DEFAULT_BLOCK_CACHE)) * 1048576);
+    orphanblocks.SetMaxBytes(max((int64_t) 1, GetArg("-maxorphanblocks", DEFAULT_MAX_ORPHAN_BLOCKS)) * 1048576);
+
+    // Values above the bound are most likely entry counts from an old configuration
+    int64_t nSigCacheMB = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE);
+
+    if (nSigCacheMB < 0 || nSigCacheMB > MAX_SIG_CACHE_SIZE)
+        return InitError(strprintf(_("-maxsigcachesize is in megabytes now, rather than entries, and has to be from 0 to %d"), MAX_SIG_CACHE_SIZE));
+
+    sigcache.SetMaxBytes(nSigCacheMB * 1048576);
+
+    fReindex = GetBoolArg("-reindex");
+
+    // Left in the configuration file it would rebuild the database on every start,
+    // only the command line starts a reindex. An interrupted one resumes by itself.
+    if (fReindex)
+    {
+        map<string, string> mapConfig;
+        map<string, vector<string> > mapMultiConfig;
+        ReadConfigFile(mapConfig, mapMultiConfig);
+
+        if (mapMultiArgs["-reindex"].size() <= mapMultiConfig["-reindex"].size())
+        {
+            fReindex = false;
+            InitWarning(_("Warning: -reindex in the configuration file is ignored, pass it on the command line to rebuild the database once."));
+        }
+    }
+    fAddressIndex = GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
+    fSpentIndex = GetBoolArg("-spentindex", DEFAULT_SPENTINDEX);
+    fTimestampIndex = GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
+
+    int64_t nPruneMB = GetArg("-prune", 0);
+
+    if (nPruneMB < 0 || (nPruneMB > 0 && (uint64_t) nPruneMB < MIN_PRUNE_TARGET_MB))
+        return InitError(strprintf(_("Prune target has to be at least %uMiB"), MIN_PRUNE_TARGET_MB));
+
+    // The address index looks up spent outputs in their blocks when a block is disconnected
+    if (nPruneMB > 0 && fAddressIndex)
+        return InitError(_("Prune mode is incompatible with -addressindex"));
+
+    nPruneTarget = (uint64_t) nPruneMB * 1048576;
+
+    // Peers cannot download the whole chain from a pruned node
+    if (nPruneTarget)
+        nLocalServices &= ~(uint64_t) NODE_NETWORK;
+
     uiInterface.InitMessage(_("Loading block index..."));
     nStart = GetTimeMillis();
 
     if (!LoadBlockIndex())
+    {
+        // An interrupted reindex is not finished, it leaves no index flags behind
+        if (fRequestShutdown)
+        {
+            LogPrintf("[AppInit2] Shutdown requested. Exiting.\n");
+            return false;
+        }
+
+        // Neither -reindex nor a rebuild brings deleted block files back
+        if (HavePrunedBlockFiles())
+            return InitError(_("Error loading blkindex.dat. Block files have been pruned, see debug.log for whether a full resync is required"));
+
         return InitError(_("Error loading blkindex.dat"));
+    }
 
     // As LoadBlockIndex can take several minutes, it's possible the user
     // requested to kill the GUI during the last operation. If so, exit.
@@ -934,6 +1067,51 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     LogPrintf("[AppInit2]  block index %15dms\n", GetTimeMillis() - nStart);
 
+    // The optional indexes have to cover the whole chain, they can only be
+    // switched on for a new database. A reindex sets the flags once it has
+    // finished building them.
+    {
+        CTxDB txdb;
+        const pair<string, bool> indexes[] = {
+            make_pair(string("addressindex"), fAddressIndex),
+            make_pair(string("spentindex"), fSpentIndex),
+            make_pair(string("timestampindex"), fTimestampIndex),
+        };
+
+        BOOST_FOREACH(const PAIRTYPE(string, bool)& index, indexes)
+        {
+            bool fIndexed = false;
+            txdb.ReadFlag(index.first, fIndexed);
+
+            if (index.second && !fIndexed && nBestHeight > 0)
+                return InitError(strprintf(_("You need to rebuild the database using -reindex to enable -%s"), index.first));
+
+            if (index.second != fIndexed)
+                txdb.WriteFlag(index.first, index.second);
+        }
+    }
+
+    if (!nPruneTarget && HavePrunedBlockFiles())
+        return InitError(_("Block files have been pruned, going back to unpruned mode requires a full resync: remove the block files and the database from the data directory, or keep -prune set"));
+
+    if (mapArgs.count("-dumpchainstate"))
+    {
+        CChainStateManifest manifest;
+        string strError;
+
+        if (!DumpChainState(boost::filesystem::system_complete(mapArgs["-dumpchainstate"]), manifest, strError))
+            return InitError(strprintf(_("Cannot dump the chain state: %s"), strError));
+
+        LogPrintf("Chain state snapshot written, content hash %s\n", manifest.hashContent.ToString());
+
+        // Nothing failed, shut down cleanly rather than with an error
+        fRequestShutdown = true;
+        return true;
+    }
+
+    // Write committed block index changes out periodically
+    NewThread(ThreadFlushTxDB, NULL);
+
     if (GetBoolArg("-printblockindex") || GetBoolArg("-printblocktree"))
     {
         PrintBlockTree();
@@ -1115,12 +1293,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         uiInterface.InitMessage(_("Importing blockchain data file."));
 
         BOOST_FOREACH(string strFile, mapMultiArgs["-loadblock"])
-        {
-            FILE *file = fopen(strFile.c_str(), "rb");
-
-            if (file)
-                LoadExternalBlockFile(file);
-        }
+            LoadExternalBlockFile(strFile);
         exit(0);
     }
 
@@ -1129,14 +1302,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (filesystem::exists(pathBootstrap))
     {
         uiInterface.InitMessage(_("Importing bootstrap blockchain data file."));
-        FILE *file = fopen(pathBootstrap.string().c_str(), "rb");
-
-        if (file)
-        {
-            filesystem::path pathBootstrapOld = GetDataDir() / "bootstrap.dat.old";
-            LoadExternalBlockFile(file);
-            RenameOver(pathBootstrap, pathBootstrapOld);
-        }
+        filesystem::path pathBootstrapOld = GetDataDir() / "bootstrap.dat.old";
+        LoadExternalBlockFile(pathBootstrap);
+        RenameOver(pathBootstrap, pathBootstrapOld);
     }
 
     // ********************************************************* Step 10: start node
@@ -498,14 +498,14 @@ bool CheckProofOfStake(CBlockIndex *pindexPrev, const CTransaction& tx, unsigned
     CTransaction txPrev;
     CTxIndex txindex;
 
-    if (!txPrev.ReadFromDisk(txdb, txin.prevout, txindex))
+    if (!txPrev.ReadPrevTx(txdb, txin.prevout, txindex))
     {
         // previous transaction not in main chain, may occur during initial download
         return tx.DoS(1, error("%s : read txPrev failed", __func__));
     }
 
-    // Verify signature
-    if (!VerifySignature(txPrev, tx, 0, 0))
+    // Verify signature, txPrev is only a stand-in if its block file was pruned
+    if (!VerifyScript(txin.scriptSig, txPrev.vout[txin.prevout.n].scriptPubKey, tx, 0, 0))
     {
         return tx.DoS(100, error("%s : VerifySignature failed on coinstake %s",
                                  __func__, tx.GetHash().ToString().c_str()));
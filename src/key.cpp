@@ -7,6 +7,7 @@
 #include <openssl/ecdsa.h>
 #include <openssl/obj_mac.h>
 
+#include "ecverify.h"
 #include "hash.h"
 #include "key.h"
 
@@ -439,6 +440,15 @@ bool CKey::SetCompactSignature(uint256 hash, const std::vector<unsigned char>& v
 }
 
 bool CKey::Verify(uint256 hash, const std::vector<unsigned char>& vchSig)
+{
+    bool fValid;
+    if (fSet && ECDSAVerify(GetPubKey().vchPubKey, hash, vchSig, fValid))
+        return fValid;
+
+    return VerifyOpenSSL(hash, vchSig);
+}
+
+bool CKey::VerifyOpenSSL(uint256 hash, const std::vector<unsigned char>& vchSig)
 {
     // -1 = error, 0 = bad sig, 1 = good
     if (ECDSA_verify(0, (unsigned char*)&hash, sizeof(hash), &vchSig[0], vchSig.size(), pkey) != 1)
@@ -447,6 +457,23 @@ bool CKey::Verify(uint256 hash, const std::vector<unsigned char>& vchSig)
     return true;
 }
 
+bool CPubKey::Verify(const uint256& hash, const std::vector<unsigned char>& vchSig) const
+{
+    if (vchSig.empty())
+        return false;
+
+    bool fValid;
+    if (ECDSAVerify(vchPubKey, hash, vchSig, fValid))
+        return fValid;
+
+    // Encodings left to OpenSSL
+    CKey key;
+    if (!key.SetPubKey(*this))
+        return false;
+
+    return key.VerifyOpenSSL(hash, vchSig);
+}
+
 bool CKey::IsValid()
 {
     if (!fSet)
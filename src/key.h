@@ -100,6 +100,9 @@ public:
         return vchPubKey;
     }
 
+    // Verifies natively where it can, without setting up an OpenSSL key
+    bool Verify(const uint256& hash, const std::vector<unsigned char>& vchSig) const;
+
 
 };
 
@@ -157,6 +160,7 @@ public:
     bool SetCompactSignature(uint256 hash, const std::vector<unsigned char>& vchSig);
 
     bool Verify(uint256 hash, const std::vector<unsigned char>& vchSig);
+    bool VerifyOpenSSL(uint256 hash, const std::vector<unsigned char>& vchSig); // without the native path
 
     bool IsValid();
 
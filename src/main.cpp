@@ -5,16 +5,23 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "addressindex.h"
 #include "alert.h"
 #include "backtrace.h"
+#include "blockdownload.h"
 #include "checkpoints.h"
+#include "coins.h"
 #include "db.h"
 #include "txdb.h"
 #include "net.h"
 #include "init.h"
 #include "ui_interface.h"
 #include "kernel.h"
+#include "orphanblocks.h"
 #include "robinhood.h"
+#include "scriptcheck.h"
+#include "spentindex.h"
+#include "timestampindex.h"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -37,6 +44,7 @@ std::set<CWallet*> setpwalletRegistered;
 CCriticalSection cs_main;
 CTxMemPool mempool;
 unsigned int nTransactionsUpdated = 0;
+std::atomic<uint64_t> nHashesComputed(0); // transaction and block hashes not taken from their cache
 robin_hood::unordered_node_map<uint256, CBlockIndex *> mapBlockIndex;
 std::set<pair<COutPoint, unsigned int> > setStakeSeen;
 
@@ -58,6 +66,7 @@ uint256 nBestInvalidTrust = 0;
 uint256 hashBestChain = 0;
 CBlockIndex* pindexBest = NULL;
 int64_t nTimeBestReceived = 0;
+bool fReindex = false;
 
 #define ENFORCE_MN_PAYMENT_HEIGHT  1100000
 #define ENFORCE_DEV_PAYMENT_HEIGHT 1200000
@@ -65,9 +74,6 @@ int64_t nTimeBestReceived = 0;
 bool fEnforceMnWinner = false;
 
 CMedianFilter<int> cPeerBlockCounts(5, 0); // Amount of blocks that other nodes claim to have
-robin_hood::unordered_node_map<uint256, CBlock*> mapOrphanBlocks;
-multimap<uint256, CBlock*> mapOrphanBlocksByPrev;
-set<pair<COutPoint, unsigned int> > setStakeSeenOrphan;
 map<uint256, CTransaction> mapOrphanTransactions;
 map<uint256, set<uint256> > mapOrphanTransactionsByPrev;
 
@@ -282,6 +288,28 @@ bool CTransaction::ReadFromDisk(COutPoint prevout)
     return ReadFromDisk(txdb, prevout, txindex);
 }
 
+bool CTransaction::ReadPrevTx(CTxDB& txdb, const COutPoint& prevout, CTxIndex& txindexRet)
+{
+    SetNull();
+
+    if (!txdb.ReadTxIndex(prevout.hash, txindexRet))
+        return false;
+
+    if (!IsBlockFilePruned(txindexRet.pos.nFile))
+        return ReadFromDisk(txdb, prevout, txindexRet);
+
+    CCoin coin;
+
+    if (!txdb.GetCoin(prevout, coin))
+        return false;
+
+    SetNull();
+    nTime = coin.nTime;
+    vout.resize(prevout.n + 1);
+    vout[prevout.n] = coin.out;
+    return true;
+}
+
 bool CTransaction::IsStandard() const
 {
     if (nVersion > CTransaction::CURRENT_VERSION)
@@ -630,19 +658,19 @@ bool AcceptableInputs(CTxMemPool& pool, const CTransaction &txo, bool fLimitFree
                 COutPoint prevout = tx.vin[i].prevout;
                 assert(mapInputs.count(prevout.hash) > 0);
                 CTxIndex& txindex = mapInputs[prevout.hash].first;
-                CTransaction& txPrev = mapInputs[prevout.hash].second;
+                const CCoins& coins = mapInputs[prevout.hash].second;
 
-                if (prevout.n >= txPrev.vout.size() || prevout.n >= txindex.vSpent.size())
+                if (prevout.n >= coins.vout.size() || prevout.n >= txindex.vSpent.size())
                 {
                     return error("%s : %s prevout.n out of range %d %u %u prev tx %s\n%s", __func__,
                                  tx.GetHash().ToString().substr(0,10).c_str(), prevout.n,
-                                 txPrev.vout.size(), txindex.vSpent.size(),
+                                 coins.vout.size(), txindex.vSpent.size(),
                                  prevout.hash.ToString().substr(0,10).c_str(),
-                                 txPrev.ToString().c_str());
+                                 coins.ToString().c_str());
                 }
 
                 // If prev is coinbase or coinstake, check that it's matured
-                if (txPrev.IsCoinBase() || txPrev.IsCoinStake())
+                if (coins.IsCoinBase() || coins.IsCoinStake())
                 {
                     for (const CBlockIndex* pindex = pindexBlock; pindex &&
                          pindexBlock->nHeight - pindex->nHeight < nCoinbaseMaturity;
@@ -651,20 +679,20 @@ bool AcceptableInputs(CTxMemPool& pool, const CTransaction &txo, bool fLimitFree
                         if (pindex->nBlockPos == txindex.pos.nBlockPos && pindex->nFile == txindex.pos.nFile)
                         {
                             return error("%s : tried to spend %s at depth %d", __func__,
-                                         txPrev.IsCoinBase() ? "coinbase" : "coinstake",
+                                         coins.IsCoinBase() ? "coinbase" : "coinstake",
                                          pindexBlock->nHeight - pindex->nHeight);
                         }
                     }
                 }
 
                 // ppcoin: check transaction timestamp
-                if (txPrev.nTime > tx.nTime)
+                if (coins.nTime > tx.nTime)
                     return error("%s : transaction timestamp earlier than input transaction", __func__);
 
                 // Check for negative or overflow input values
-                nValueIn += txPrev.vout[prevout.n].nValue;
+                nValueIn += coins.vout[prevout.n].nValue;
 
-                if (!MoneyRange(txPrev.vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+                if (!MoneyRange(coins.vout[prevout.n].nValue) || !MoneyRange(nValueIn))
                     return error("%s : txin values out of range", __func__);
 
             }
@@ -862,7 +890,17 @@ bool CBlock::ReadFromDisk(const CBlockIndex* pindex, bool fReadTransactions)
         return true;
     }
 
-    if (!ReadFromDisk(pindex->nFile, pindex->nBlockPos, fReadTransactions))
+    // Rescans and checks walk the whole chain, they would push the blocks being
+    // served out of the cache, see ReadBlockShared()
+    CBlockRef block = blockcache.Peek(pindex->GetBlockHash());
+
+    if (block)
+    {
+        *this = *block;
+        return true;
+    }
+
+    if (!ReadFromBlockFile(pindex->nFile, pindex->nBlockPos, true))
         return false;
 
     if (GetHash() != pindex->GetBlockHash())
@@ -871,25 +909,6 @@ bool CBlock::ReadFromDisk(const CBlockIndex* pindex, bool fReadTransactions)
     return true;
 }
 
-uint256 static GetOrphanRoot(const CBlock* pblock)
-{
-    // Work back to the first block in the orphan chain
-    while (mapOrphanBlocks.count(pblock->hashPrevBlock))
-        pblock = mapOrphanBlocks[pblock->hashPrevBlock];
-
-    return pblock->GetHash();
-}
-
-// ppcoin: find block wanted by given orphan block
-uint256 WantedByOrphan(const CBlock* pblockOrphan)
-{
-    // Work back to the first block in the orphan chain
-    while (mapOrphanBlocks.count(pblockOrphan->hashPrevBlock))
-        pblockOrphan = mapOrphanBlocks[pblockOrphan->hashPrevBlock];
-
-    return pblockOrphan->hashPrevBlock;
-}
-
 // Miners coin base reward
 int64_t GetProofOfWorkReward(int64_t nFees, int nHeight)
 {
@@ -1092,7 +1111,7 @@ void CBlock::UpdateTime(const CBlockIndex* pindexPrev)
     nTime = max(GetBlockTime(), GetAdjustedTime());
 }
 
-bool CTransaction::DisconnectInputs(CTxDB& txdb)
+bool CTransaction::DisconnectInputs(CTxDB& txdb, const map<COutPoint, CCoin>* pmapUndo)
 {
     // Relinquish previous transactions' spent pointers
     if (!IsCoinBase())
@@ -1116,6 +1135,36 @@ bool CTransaction::DisconnectInputs(CTxDB& txdb)
             // Write back
             if (!txdb.UpdateTxIndex(prevout.hash, txindex))
                 return error("DisconnectInputs() : UpdateTxIndex failed");
+
+            // Return the output to the coins view
+            if (pmapUndo)
+            {
+                auto it = pmapUndo->find(prevout);
+
+                if (it == pmapUndo->end())
+                    return error("DisconnectInputs() : no undo data for %s", prevout.ToString().c_str());
+
+                txdb.AddCoin(prevout, it->second);
+                continue;
+            }
+
+            // Blocks connected before undo data was written for every block,
+            // the output is read back from its block
+            CTransaction txPrev;
+
+            if (!txPrev.ReadFromDisk(txindex.pos))
+                return error("DisconnectInputs() : ReadFromDisk prev tx failed");
+
+            CBlock blockPrev;
+
+            if (!blockPrev.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false))
+                return error("DisconnectInputs() : ReadFromDisk prev block failed");
+
+            auto mi = mapBlockIndex.find(blockPrev.GetHash());
+            int nHeightPrev = mi == mapBlockIndex.end() ? -1 : mi->second->nHeight;
+
+            if (!txPrev.vout[prevout.n].IsEmpty())
+                txdb.AddCoin(prevout, CCoin(txPrev, prevout.n, nHeightPrev));
         }
     }
 
@@ -1125,6 +1174,37 @@ bool CTransaction::DisconnectInputs(CTxDB& txdb)
     // spent, so erasing it would be a no-op anyway.
     txdb.EraseTxIndex(*this);
 
+    uint256 hash = GetHash();
+
+    for (unsigned int i = 0; i < vout.size(); i++)
+        txdb.SpendCoin(COutPoint(hash, i));
+
+    return true;
+}
+
+// Collect the outputs of hashPrev spent by tx from the coins view. Fails if any
+// of them is not an unspent output known to the view.
+bool CTransaction::FetchCoins(CTxDB& txdb, const uint256& hashPrev, unsigned int nOutputs, CCoins& coinsRet) const
+{
+    coinsRet.SetNull();
+    coinsRet.vout.resize(nOutputs);
+
+    BOOST_FOREACH(const CTxIn& txin, vin)
+    {
+        if (txin.prevout.hash != hashPrev || txin.prevout.n >= nOutputs || !coinsRet.vout[txin.prevout.n].IsNull())
+            continue;
+
+        CCoin coin;
+
+        if (!txdb.GetCoin(txin.prevout, coin))
+            return false;
+
+        coinsRet.vout[txin.prevout.n] = coin.out;
+        coinsRet.nTime = coin.nTime;
+        coinsRet.fCoinBase = coin.IsCoinBase();
+        coinsRet.fCoinStake = coin.IsCoinStake();
+    }
+
     return true;
 }
 
@@ -1169,8 +1249,8 @@ bool CTransaction::FetchInputs(CTxDB& txdb, const map<uint256, CTxIndex>& mapTes
                                           prevout.hash.ToString().substr(0,10).c_str());
         }
 
-        // Read txPrev
-        CTransaction& txPrev = inputsRet[prevout.hash].second;
+        // Read the previous outputs
+        CCoins& coins = inputsRet[prevout.hash].second;
 
         if (!fFound || txindex.pos == CDiskTxPos(1,1,1))
         {
@@ -1185,21 +1265,26 @@ bool CTransaction::FetchInputs(CTxDB& txdb, const map<uint256, CTxIndex>& mapTes
                                  prevout.hash.ToString().substr(0,10).c_str());
                 }
 
-                txPrev = mempool.lookup(prevout.hash);
+                coins = CCoins(mempool.lookup(prevout.hash));
             }
 
             if (!fFound)
-                txindex.vSpent.resize(txPrev.vout.size());
+                txindex.vSpent.resize(coins.vout.size());
         }
-        else
+        else if (!FetchCoins(txdb, prevout.hash, txindex.vSpent.size(), coins))
         {
-            // Get prev tx from disk
+            // Not in the coins view (spent, or connected within the current block),
+            // get prev tx from disk
+            CTransaction txPrev;
+
             if (!txPrev.ReadFromDisk(txindex.pos))
             {
                 return error("FetchInputs() : %s ReadFromDisk prev tx %s failed",
                              GetHash().ToString().substr(0,10).c_str(),
                              prevout.hash.ToString().substr(0,10).c_str());
             }
+
+            coins = CCoins(txPrev);
         }
     }
 
@@ -1210,17 +1295,17 @@ bool CTransaction::FetchInputs(CTxDB& txdb, const map<uint256, CTxIndex>& mapTes
         assert(inputsRet.count(prevout.hash) != 0);
 
         const CTxIndex& txindex = inputsRet[prevout.hash].first;
-        const CTransaction& txPrev = inputsRet[prevout.hash].second;
+        const CCoins& coins = inputsRet[prevout.hash].second;
 
-        if (prevout.n >= txPrev.vout.size() || prevout.n >= txindex.vSpent.size())
+        if (prevout.n >= coins.vout.size() || prevout.n >= txindex.vSpent.size())
         {
             // Revisit this if/when transaction replacement is implemented and allows adding inputs
             fInvalid = true;
 
             return DoS(100, error("FetchInputs() : %s prevout.n out of range %d %u %u prev tx %s\n%s",
-                                  GetHash().ToString().substr(0,10).c_str(), prevout.n, txPrev.vout.size(),
+                                  GetHash().ToString().substr(0,10).c_str(), prevout.n, coins.vout.size(),
                                   txindex.vSpent.size(), prevout.hash.ToString().substr(0,10).c_str(),
-                                  txPrev.ToString().c_str()));
+                                  coins.ToString().c_str()));
         }
     }
 
@@ -1234,12 +1319,12 @@ const CTxOut& CTransaction::GetOutputFor(const CTxIn& input, const MapPrevTx& in
     if (mi == inputs.end())
         throw std::runtime_error("CTransaction::GetOutputFor() : prevout.hash not found");
 
-    const CTransaction& txPrev = (mi->second).second;
+    const CCoins& coins = (mi->second).second;
 
-    if (input.prevout.n >= txPrev.vout.size())
+    if (input.prevout.n >= coins.vout.size())
         throw std::runtime_error("CTransaction::GetOutputFor() : prevout.n out of range");
 
-    return txPrev.vout[input.prevout.n];
+    return coins.vout[input.prevout.n];
 }
 
 int64_t CTransaction::GetValueIn(const MapPrevTx& inputs) const
@@ -1274,7 +1359,8 @@ unsigned int CTransaction::GetP2SHSigOpCount(const MapPrevTx& inputs) const
 }
 
 bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx,
-                                 const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool *txAlreadyUsed)
+                                 const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool *txAlreadyUsed,
+                                 vector<CScriptCheck>* pvChecks)
 {
     // Take over previous transactions' spent pointers
     // fBlock is true when this is called from AcceptBlock when a new best-block is added to the blockchain
@@ -1290,18 +1376,18 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
             COutPoint prevout = vin[i].prevout;
             assert(inputs.count(prevout.hash) > 0);
             CTxIndex& txindex = inputs[prevout.hash].first;
-            CTransaction& txPrev = inputs[prevout.hash].second;
+            CCoins& coins = inputs[prevout.hash].second;
 
-            if (prevout.n >= txPrev.vout.size() || prevout.n >= txindex.vSpent.size())
+            if (prevout.n >= coins.vout.size() || prevout.n >= txindex.vSpent.size())
             {
                 return DoS(100, error("%s : %s prevout.n out of range %d %u %u prev tx %s\n%s", __func__,
-                                      GetHash().ToString().substr(0,10).c_str(), prevout.n, txPrev.vout.size(),
+                                      GetHash().ToString().substr(0,10).c_str(), prevout.n, coins.vout.size(),
                                       txindex.vSpent.size(), prevout.hash.ToString().substr(0,10).c_str(),
-                                      txPrev.ToString().c_str()));
+                                      coins.ToString().c_str()));
             }
 
             // If prev is coinbase or coinstake, check that it's matured
-            if (txPrev.IsCoinBase() || txPrev.IsCoinStake())
+            if (coins.IsCoinBase() || coins.IsCoinStake())
             {
                 for (const CBlockIndex* pindex = pindexBlock;
                      pindex && pindexBlock->nHeight - pindex->nHeight < nCoinbaseMaturity; pindex = pindex->pprev)
@@ -1309,20 +1395,20 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
                     if (pindex->nBlockPos == txindex.pos.nBlockPos && pindex->nFile == txindex.pos.nFile)
                     {
                         return error("%s : tried to spend %s at depth %d", __func__,
-                                     txPrev.IsCoinBase() ? "coinbase" : "coinstake",
+                                     coins.IsCoinBase() ? "coinbase" : "coinstake",
                                      pindexBlock->nHeight - pindex->nHeight);
                     }
                 }
             }
 
             // ppcoin: check transaction timestamp
-            if (txPrev.nTime > nTime)
+            if (coins.nTime > nTime)
                 return DoS(100, error("%s : transaction timestamp earlier than input transaction", __func__));
 
             // Check for negative or overflow input values
-            nValueIn += txPrev.vout[prevout.n].nValue;
+            nValueIn += coins.vout[prevout.n].nValue;
 
-            if (!MoneyRange(txPrev.vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            if (!MoneyRange(coins.vout[prevout.n].nValue) || !MoneyRange(nValueIn))
                 return DoS(100, error("%s : txin values out of range", __func__));
 
         }
@@ -1335,7 +1421,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
             COutPoint prevout = vin[i].prevout;
             assert(inputs.count(prevout.hash) > 0);
             CTxIndex& txindex = inputs[prevout.hash].first;
-            CTransaction& txPrev = inputs[prevout.hash].second;
+            const CCoins& coins = inputs[prevout.hash].second;
 
             // Check for conflicts (double-spend)
             // This doesn't trigger the DoS code on purpose; if it did, it would make it easier
@@ -1355,8 +1441,10 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
             // still computed and checked, and any change will be caught at the next checkpoint.
             if (!(fBlock && (nBestHeight < Checkpoints::GetTotalBlocksEstimate())))
             {
-                // Verify signature
-                if (!VerifySignature(txPrev, *this, i, 0))
+                // Verify signature, or leave it to the caller's script check queue
+                if (pvChecks)
+                    pvChecks->push_back(CScriptCheck(coins.vout[prevout.n].scriptPubKey, *this, i, 0));
+                else if (!VerifyScript(vin[i].scriptSig, coins.vout[prevout.n].scriptPubKey, *this, i, 0))
                     return DoS(100,error("%s : %s VerifySignature failed", __func__, GetHash().ToString().substr(0,10).c_str()));
             }
 
@@ -1448,9 +1536,30 @@ bool CTransaction::ClientConnectInputs()
 
 bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndex* pindex)
 {
+    // While the transaction index still has the outputs this block spends
+    if (fAddressIndex && !UpdateAddressIndex(txdb, *this, pindex, false))
+        return error("%s : UpdateAddressIndex failed", __func__);
+
+    if (fSpentIndex && !UpdateSpentIndex(txdb, *this, pindex, false))
+        return error("%s : UpdateSpentIndex failed", __func__);
+
+    if (fTimestampIndex && !UpdateTimestampIndex(txdb, pindex, false))
+        return error("%s : UpdateTimestampIndex failed", __func__);
+
+    // The spent outputs come back from the undo data ConnectBlock() wrote
+    vector<pair<COutPoint, CCoin> > vUndo;
+    map<COutPoint, CCoin> mapUndo;
+    bool fUndo = txdb.ReadBlockUndo(pindex->GetBlockHash(), vUndo);
+
+    if (fUndo)
+    {
+        mapUndo.insert(vUndo.begin(), vUndo.end());
+        txdb.EraseBlockUndo(pindex->GetBlockHash());
+    }
+
     // Disconnect in reverse order
     for (int i = vtx.size() - 1; i >= 0; i--)
-        if (!vtx[i].DisconnectInputs(txdb))
+        if (!vtx[i].DisconnectInputs(txdb, fUndo ? &mapUndo : NULL))
             return false;
 
     // Update block index on disk without changing it in memory.
@@ -1490,6 +1599,11 @@ bool CBlock::CalculateBlockAmounts(CTxDB& txdb, CBlockIndex *pindex, std::map<ui
                  (2 * GetSizeOfCompactSize(0)) + GetSizeOfCompactSize(vtx.size());
     }
 
+    // The scripts are verified by the -par threads while the inputs of the
+    // following transactions are connected
+    CScriptCheckControl control(nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    vector<CScriptCheck> vChecks;
+
     BOOST_FOREACH(CTransaction& tx, vtx)
     {
         uint256 hashTx = tx.GetHash();
@@ -1560,7 +1674,8 @@ bool CBlock::CalculateBlockAmounts(CTxDB& txdb, CBlockIndex *pindex, std::map<ui
 
             bool txAlreadyUsed = false;
 
-            if (connectInputs && !tx.ConnectInputs(txdb, mapInputs, mapQueuedChanges, posThisTx, pindex, true, false, &txAlreadyUsed))
+            if (connectInputs && !tx.ConnectInputs(txdb, mapInputs, mapQueuedChanges, posThisTx, pindex, true, false,
+                                                   &txAlreadyUsed, control.IsParallel() ? &vChecks : NULL))
             {
                 if (skipTxCheck && txAlreadyUsed)
                 {
@@ -1573,11 +1688,17 @@ bool CBlock::CalculateBlockAmounts(CTxDB& txdb, CBlockIndex *pindex, std::map<ui
                     return false;
                 }
             }
+
+            control.Add(vChecks);
+            vChecks.clear();
         }
 
         mapQueuedChanges[hashTx] = CTxIndex(posThisTx, tx.vout.size());
     }
 
+    if (!control.Wait())
+        return DoS(100, error("%s : script verification failed", __func__));
+
     return true;
 }
 
@@ -1833,6 +1954,39 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex *pindex, bool fJustCheck, boo
             return error("%s : UpdateTxIndex failed", __func__);
     }
 
+    // While the coins view still has the outputs this block spends
+    if (fAddressIndex && !UpdateAddressIndex(txdb, *this, pindex, true))
+        return error("%s : UpdateAddressIndex failed", __func__);
+
+    if (fSpentIndex && !UpdateSpentIndex(txdb, *this, pindex, true))
+        return error("%s : UpdateSpentIndex failed", __func__);
+
+    if (fTimestampIndex && !UpdateTimestampIndex(txdb, pindex, true))
+        return error("%s : UpdateTimestampIndex failed", __func__);
+
+    // Spend the inputs and add the outputs in the coins view, in block order.
+    // The spent coins are kept for a disconnect.
+    vector<pair<COutPoint, CCoin> > vUndo;
+
+    BOOST_FOREACH(const CTransaction& tx, vtx)
+    {
+        if (!tx.IsCoinBase())
+        {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            {
+                CCoin coin;
+
+                if (txdb.GetCoin(txin.prevout, coin))
+                    vUndo.push_back(make_pair(txin.prevout, coin));
+            }
+        }
+
+        txdb.UpdateCoins(tx, pindex->nHeight);
+    }
+
+    if (!txdb.WriteBlockUndo(pindex->GetBlockHash(), vUndo))
+        return error("%s : WriteBlockUndo failed", __func__);
+
     // Update block index on disk without changing it in memory.
     // The memory index structure will be changed after the db commits.
     if (pindex->pprev)
@@ -1948,6 +2102,11 @@ bool static Reorganize(CTxDB& txdb, CBlockIndex* pindexNew, int postponedBlocks)
     if (!txdb.TxnCommit())
         return error("%s : TxnCommit failed", __func__);
 
+    // Write the coins right away, so a lagging coins database never sits on a
+    // branch that has been disconnected
+    if (!FlushCoinsTip(txdb, true))
+        return error("%s : FlushCoinsTip failed", __func__);
+
     // Disconnect shorter branch
     BOOST_FOREACH(CBlockIndex* pindex, vDisconnect)
     {
@@ -2176,7 +2335,7 @@ bool CTransaction::GetCoinAge(CTxDB& txdb, uint64_t& nCoinAge) const
         CTransaction txPrev;
         CTxIndex txindex;
 
-        if (!txPrev.ReadFromDisk(txdb, txin.prevout, txindex))
+        if (!txPrev.ReadPrevTx(txdb, txin.prevout, txindex))
             continue;  // Previous transaction not in main chain
 
         if (nTime < txPrev.nTime)
@@ -2320,6 +2479,15 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos, const u
 
 bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) const
 {
+    // Check timestamp, against the clock, so it is not covered by fChecked
+    if (GetBlockTime() > FutureDrift(GetAdjustedTime()))
+        return error("%s : block timestamp too far in the future", __func__);
+
+    // Already passed the checks below with every check enabled, they only
+    // depend on the block itself
+    if (fChecked.IsSet())
+        return true;
+
     // Size limits
     if (vtx.empty() || vtx.size() > MAX_BLOCK_SIZE || ::GetSerializeSize(*this, SER_NETWORK, PROTOCOL_VERSION) > MAX_BLOCK_SIZE)
         return DoS(100, error("%s : size limits failed", __func__));
@@ -2328,10 +2496,6 @@ bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) c
     // if (fCheckPOW && IsProofOfWork() && !CheckProofOfWork(GetPoWHash(), nBits))
     //    return DoS(50, error("CheckBlock() : proof of work failed"));
 
-    // Check timestamp
-    if (GetBlockTime() > FutureDrift(GetAdjustedTime()))
-        return error("%s : block timestamp too far in the future", __func__);
-
     // First transaction must be coinbase, the rest must not be
     if (vtx.empty() || !vtx[0].IsCoinBase())
         return DoS(100, error("%s : first tx is not coinbase", __func__));
@@ -2380,13 +2544,15 @@ bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) c
 
     // Check for duplicate txids. This is caught by ConnectInputs(),
     // but catching it earlier avoids a potential DoS attack:
-    set<uint256> uniqueTx;
+    vector<uint256> vTxHashes;
 
     BOOST_FOREACH(const CTransaction& tx, vtx)
     {
-        uniqueTx.insert(tx.GetHash());
+        vTxHashes.push_back(tx.GetHash());
     }
 
+    set<uint256> uniqueTx(vTxHashes.begin(), vTxHashes.end());
+
     if (uniqueTx.size() != vtx.size())
         return DoS(100, error("%s : duplicate transaction", __func__));
 
@@ -2401,13 +2567,18 @@ bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) c
         return DoS(100, error("%s : out-of-bounds SigOpCount", __func__));
 
     // Check merkle root
-    if (fCheckMerkleRoot && hashMerkleRoot != BuildMerkleTree())
+    if (fCheckMerkleRoot && hashMerkleRoot != BuildMerkleTree(vTxHashes))
         return DoS(100, error("%s : hashMerkleRoot mismatch", __func__));
 
+    if (fCheckPOW && fCheckMerkleRoot && fCheckSig)
+        fChecked.Set(true);
+
     return true;
 }
 
-bool CBlock::AcceptBlock()
+// A block that is already stored at nFileIn:nBlockPosIn, as on -reindex, is
+// indexed where it is instead of being written again
+bool CBlock::AcceptBlock(unsigned int nFileIn, unsigned int nBlockPosIn)
 {
     if (fTestNet && nVersion > CURRENT_VERSION)
         return DoS(10, error("%s : reject unknown block version %d", __func__, nVersion));
@@ -2497,15 +2668,23 @@ bool CBlock::AcceptBlock()
         !std::equal(expect.begin(), expect.end(), vtx[0].vin[0].scriptSig.begin()))
         return DoS(100, error("%s : block height mismatch in coinbase", __func__));
 
+    unsigned int nFile = nFileIn;
+    unsigned int nBlockPos = nBlockPosIn;
+
     // Write block to history file
-    if (!CheckDiskSpace(::GetSerializeSize(*this, SER_DISK, CLIENT_VERSION)))
-        return error("%s : out of disk space", __func__);
+    if (nFile == (unsigned int) -1)
+    {
+        if (!CheckDiskSpace(::GetSerializeSize(*this, SER_DISK, CLIENT_VERSION)))
+            return error("%s : out of disk space", __func__);
 
-    unsigned int nFile = -1;
-    unsigned int nBlockPos = 0;
+        if (!WriteToDisk(nFile, nBlockPos))
+            return error("%s : WriteToDisk failed", __func__);
+    }
 
-    if (!WriteToDisk(nFile, nBlockPos))
-        return error("%s : WriteToDisk failed", __func__);
+    // Peers and RPC clients are most likely to ask for the blocks that just came in
+    std::shared_ptr<CBlock> blockShared = CopyWithHashes();
+    blockShared->CacheHashes();
+    blockcache.Insert(hash, blockShared, nFile, nBlockPos);
 
     if (!AddToBlockIndex(nFile, nBlockPos, hashProof))
         return error("%s : AddToBlockIndex failed", __func__);
@@ -2556,8 +2735,12 @@ bool CBlockIndex::IsSuperMajority(int minVersion, const CBlockIndex* pstart, uns
     return (nFound >= nRequired);
 }
 
-bool ProcessNewBlock(CNode* pfrom, CBlock* pblock)
+bool ProcessNewBlock(CNode* pfrom, CBlock* pblock, unsigned int nFile, unsigned int nBlockPos)
 {
+    // The block is not changed from here on, the checks and connecting it use
+    // the hashes instead of serializing again
+    pblock->CacheHashes();
+
     // Check for duplicate
     uint256 hash = pblock->GetHash();
 
@@ -2567,14 +2750,14 @@ bool ProcessNewBlock(CNode* pfrom, CBlock* pblock)
                      mapBlockIndex[hash]->nHeight, hash.ToString().substr(0,20).c_str());
     }
 
-    if (mapOrphanBlocks.count(hash))
+    if (orphanblocks.Contains(hash))
         return error("%s : already have block (orphan) %s", __func__, hash.ToString().substr(0,20).c_str());
 
     // ppcoin: check proof-of-stake
     // Limited duplicity on stake: prevents block flood attack
     // Duplicate stake allowed only when there is orphan child block
     if (!IsInitialBlockDownload() && pblock->IsProofOfStake() && setStakeSeen.count(pblock->GetProofOfStake()) &&
-        !mapOrphanBlocksByPrev.count(hash) && !Checkpoints::WantedByPendingSyncCheckpoint(hash))
+        !orphanblocks.HasChildren(hash) && !Checkpoints::WantedByPendingSyncCheckpoint(hash))
     {
         return error("%s : duplicate proof-of-stake (%s, %d) for block %s", __func__,
                      pblock->GetProofOfStake().first.ToString().c_str(),
@@ -2638,56 +2821,57 @@ bool ProcessNewBlock(CNode* pfrom, CBlock* pblock)
     // If don't already have its previous block, shunt it off to holding area until we get it
     if (!mapBlockIndex.count(pblock->hashPrevBlock))
     {
+        // Blocks of the header chain wait for their parent in the download instead
+        if (StoreDownloadedBlock(*pblock))
+            return true;
+
         if (fDebug)
         {
             LogPrintf("%s : Missing orphan block with hash %s\n", __func__,
                       pblock->hashPrevBlock.ToString().c_str());
         }
 
-        CBlock* pblock2 = new CBlock(*pblock);
-
         // ppcoin: check proof-of-stake
-        if (pblock2->IsProofOfStake())
+        if (pblock->IsProofOfStake())
         {
             // Limited duplicity on stake: prevents block flood attack
             // Duplicate stake allowed only when there is orphan child block
-            if (setStakeSeenOrphan.count(pblock2->GetProofOfStake()) && !mapOrphanBlocksByPrev.count(hash) &&
+            if (orphanblocks.IsStakeSeen(pblock->GetProofOfStake()) && !orphanblocks.HasChildren(hash) &&
                 !Checkpoints::WantedByPendingSyncCheckpoint(hash))
             {
                 return error("%s : duplicate proof-of-stake (%s, %d) for orphan block %s", __func__,
-                             pblock2->GetProofOfStake().first.ToString().c_str(),
-                             pblock2->GetProofOfStake().second, hash.ToString().c_str());
+                             pblock->GetProofOfStake().first.ToString().c_str(),
+                             pblock->GetProofOfStake().second, hash.ToString().c_str());
             }
-            else
-                setStakeSeenOrphan.insert(pblock2->GetProofOfStake());
         }
 
-        mapOrphanBlocks.emplace(hash, pblock2);
-        mapOrphanBlocksByPrev.insert(make_pair(pblock2->hashPrevBlock, pblock2));
+        orphanblocks.Add(*pblock, pfrom ? pfrom->GetId() : -1);
 
-        // Ask this guy to fill in what we're missing
-        if (pfrom)
+        // Ask this guy to fill in what we're missing, unless the header chain already covers it
+        if (pfrom && !(fHeadersFirst && IsInitialBlockDownload()))
         {
             if (fDebug)
             {
                 LogPrintf("%s : Asking for missing blocks between index %d to hash %s\n", __func__,
-                          pindexBest->nHeight, GetOrphanRoot(pblock2).ToString().c_str());
+                          pindexBest->nHeight, orphanblocks.GetRoot(hash).ToString().c_str());
             }
 
-            pfrom->PushGetBlocks(pindexBest, GetOrphanRoot(pblock2));
+            pfrom->PushGetBlocks(pindexBest, orphanblocks.GetRoot(hash));
 
             // ppcoin: getblocks may not obtain the ancestor block rejected
             // earlier by duplicate-stake check so we ask for it again directly
             if (!IsInitialBlockDownload())
-                pfrom->AskFor(CInv(MSG_BLOCK, WantedByOrphan(pblock2)));
+                pfrom->AskFor(CInv(MSG_BLOCK, orphanblocks.GetWanted(hash)));
         }
 
         return true;
     }
 
     // Store to disk
-    if (!pblock->AcceptBlock())
+    if (!pblock->AcceptBlock(nFile, nBlockPos))
     {
+        BlockDownloadFailed(hash);
+
         std::stringstream msg;
         msg << boost::format("%s : AcceptBlock for %s with parent %s FAILED") % __func__ %
             hash.ToString().c_str() % pblock->hashPrevBlock.ToString().c_str();
@@ -2706,20 +2890,27 @@ bool ProcessNewBlock(CNode* pfrom, CBlock* pblock)
     {
         uint256 hashPrev = vWorkQueue[i];
 
-        for (multimap<uint256, CBlock*>::iterator mi = mapOrphanBlocksByPrev.lower_bound(hashPrev);
-             mi != mapOrphanBlocksByPrev.upper_bound(hashPrev); ++mi)
-        {
-            CBlock* pblockOrphan = (*mi).second;
+        vector<CBlock*> vOrphans = orphanblocks.TakeChildren(hashPrev);
 
+        BOOST_FOREACH(CBlock* pblockOrphan, vOrphans)
+        {
             if (pblockOrphan->AcceptBlock())
                 vWorkQueue.push_back(pblockOrphan->GetHash());
 
-            mapOrphanBlocks.erase(pblockOrphan->GetHash());
-            setStakeSeenOrphan.erase(pblockOrphan->GetProofOfStake());
             delete pblockOrphan;
         }
 
-        mapOrphanBlocksByPrev.erase(hashPrev);
+        CBlock* pblockDownloaded = TakeDownloadedBlock(hashPrev);
+
+        if (pblockDownloaded)
+        {
+            if (pblockDownloaded->AcceptBlock())
+                vWorkQueue.push_back(pblockDownloaded->GetHash());
+            else
+                BlockDownloadFailed(pblockDownloaded->GetHash());
+
+            delete pblockDownloaded;
+        }
     }
 
     // ppcoin: if responsible for sync-checkpoint send it
@@ -2859,12 +3050,9 @@ bool CBlock::CheckBlockSignature() const
     if (whichType == TX_PUBKEY)
     {
         valtype& vchPubKey = vSolutions[0];
-        CKey key;
-        if (!key.SetPubKey(vchPubKey))
-            return false;
         if (vchBlockSig.empty())
             return false;
-        return key.Verify(GetHash(), vchBlockSig);
+        return CPubKey(vchPubKey).Verify(GetHash(), vchBlockSig);
     }
 
     return false;
@@ -2917,6 +3105,23 @@ bool LoadBlockIndex(bool fAllowNew)
     if (!txdb.LoadBlockIndex())
         return false;
 
+    //
+    // Rebuild the index from the blocks already on disk, or carry on with it
+    //
+    if (fReindex)
+    {
+        // Cleared by ReindexBlockFiles() once done, a restart before resumes
+        if (!txdb.WriteFlag("reindex", true) || !txdb.Flush(true))
+            return error("LoadBlockIndex() : cannot record the reindex");
+
+        if (!ReindexBlockFiles())
+            return error("LoadBlockIndex() : reindexing the block files failed");
+
+        if (!mapBlockIndex.empty() &&
+            !Checkpoints::WriteSyncCheckpoint((!fTestNet ? hashGenesisBlock : hashGenesisBlockTestNet)))
+            return error("LoadBlockIndex() : failed to init sync checkpoint");
+    }
+
     //
     // Init with genesis block
     //
@@ -3107,79 +3312,6 @@ void PrintBlockInfo()
               mapBlockIndex.size(), Checkpoints::GetTotalBlocksEstimate());
 }
 
-bool LoadExternalBlockFile(FILE* fileIn)
-{
-    int64_t nStart = GetTimeMillis();
-
-    int nLoaded = 0;
-    {
-        LOCK(cs_main);
-
-        try {
-            CAutoFile blkdat(fileIn, SER_DISK, CLIENT_VERSION);
-            unsigned int nPos = 0;
-
-            while (nPos != (unsigned int)-1 && blkdat.good() && !fRequestShutdown)
-            {
-                unsigned char pchData[65536];
-
-                do {
-                    fseek(blkdat, nPos, SEEK_SET);
-                    int nRead = fread(pchData, 1, sizeof(pchData), blkdat);
-
-                    if (nRead <= 8)
-                    {
-                        nPos = (unsigned int)-1;
-                        break;
-                    }
-
-                    void* nFind = memchr(pchData, pchMessageStart[0], nRead+1-sizeof(pchMessageStart));
-
-                    if (nFind)
-                    {
-                        if (memcmp(nFind, pchMessageStart, sizeof(pchMessageStart))==0)
-                        {
-                            nPos += ((unsigned char*)nFind - pchData) + sizeof(pchMessageStart);
-                            break;
-                        }
-
-                        nPos += ((unsigned char*)nFind - pchData) + 1;
-                    }
-                    else
-                        nPos += sizeof(pchData) - sizeof(pchMessageStart) + 1;
-                }
-                while(!fRequestShutdown);
-
-                if (nPos == (unsigned int)-1)
-                    break;
-
-                fseek(blkdat, nPos, SEEK_SET);
-                unsigned int nSize;
-                blkdat >> nSize;
-
-                if (nSize > 0 && nSize <= MAX_BLOCK_SIZE)
-                {
-                    CBlock block;
-                    blkdat >> block;
-
-                    if (ProcessNewBlock(NULL,&block))
-                    {
-                        nLoaded++;
-                        nPos += 4 + nSize;
-                    }
-                }
-            }
-        }
-        catch (std::exception &e)
-        {
-            LogPrintf("%s : Deserialize or I/O error caught during load\n", __func__);
-        }
-    }
-
-    LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
-    return nLoaded > 0;
-}
-
 //////////////////////////////////////////////////////////////////////////////
 //
 // CAlert
@@ -3254,7 +3386,8 @@ bool static AlreadyHave(CTxDB& txdb, const CInv& inv)
 
     case MSG_BLOCK:
         return mapBlockIndex.count(inv.hash) ||
-                mapOrphanBlocks.count(inv.hash);
+                orphanblocks.Contains(inv.hash) ||
+                IsBlockInFlight(inv.hash);
 
     case MSG_SPORK:
         return mapSporks.count(inv.hash);
@@ -3290,11 +3423,17 @@ void static ProcessGetData(CNode* pfrom)
                 // Send block from disk
                 auto mi = mapBlockIndex.find(inv.hash);
 
-                if (mi != mapBlockIndex.end())
+                if (mi != mapBlockIndex.end() && IsBlockPruned((*mi).second))
+                {
+                    // Not ours to give any more
+                    vNotFound.push_back(inv);
+                }
+                else if (mi != mapBlockIndex.end())
                 {
-                    CBlock block;
-                    block.ReadFromDisk((*mi).second);
-                    pfrom->PushMessage(NetMsgType::BLOCK, block);
+                    CBlockRef block = ReadBlockShared((*mi).second);
+
+                    if (block)
+                        pfrom->PushMessage(NetMsgType::BLOCK, *block);
 
                     // Trigger them to send a getblocks request for the next batch of inventory
                     if (inv.hash == pfrom->hashContinue)
@@ -3531,7 +3670,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         // Ask the first connected node for block updates
         static int nAskedForBlocks = 0;
 
-        if (!pfrom->fClient && !pfrom->fOneShot && (pfrom->nStartingHeight > (nBestHeight - 144)) &&
+        // With headers-first the initial download is driven by SendBlockDownloadRequests()
+        bool fHeadersSync = fHeadersFirst && IsInitialBlockDownload();
+
+        if (!fHeadersSync && !pfrom->fClient && !pfrom->fOneShot && (pfrom->nStartingHeight > (nBestHeight - 144)) &&
             (pfrom->nVersion < NOBLKS_VERSION_START || pfrom->nVersion >= NOBLKS_VERSION_END) &&
             (nAskedForBlocks < 1 || vNodes.size() <= 1))
         {
@@ -3574,7 +3716,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         // to new node if waited longer than MAX_TIME_SINCE_BEST_BLOCK.
         int64_t timeSinceBestBlock = GetTime() - nTimeBestReceived;
 
-        if (timeSinceBestBlock > MAX_TIME_SINCE_BEST_BLOCK)
+        if (!fHeadersSync && timeSinceBestBlock > MAX_TIME_SINCE_BEST_BLOCK)
         {
             LogPrintf("%s : Waiting %ld sec which is too long. Sending GetBlocks(0)\n", __func__, timeSinceBestBlock);
             pfrom->PushGetBlocks(pindexBest, uint256(0));
@@ -3732,9 +3874,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
             if (!fAlreadyHave)
                 pfrom->AskFor(inv);
-            else if (inv.type == MSG_BLOCK && mapOrphanBlocks.count(inv.hash))
-                pfrom->PushGetBlocks(pindexBest, GetOrphanRoot(mapOrphanBlocks[inv.hash]));
-            else if (nInv == nLastBlock)
+            else if (inv.type == MSG_BLOCK && orphanblocks.Contains(inv.hash))
+                pfrom->PushGetBlocks(pindexBest, orphanblocks.GetRoot(inv.hash));
+            else if (nInv == nLastBlock && mapBlockIndex.count(inv.hash))
             {
                 // In case we are on a very long side-chain, it is possible that we already have
                 // the last block in an inv bundle sent in response to getblocks. Try to detect
@@ -3807,6 +3949,15 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 break;
             }
 
+            // Files are pruned oldest first, none of the following blocks are here either
+            if (IsBlockPruned(pindex))
+            {
+                if (fDebug)
+                    LogPrintf("%s : getblocks stopping at pruned block %d\n", __func__, pindex->nHeight);
+
+                break;
+            }
+
             pfrom->PushInventory(CInv(MSG_BLOCK, pindex->GetBlockHash()));
 
             if (--nLimit <= 0)
@@ -3885,6 +4036,34 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         pfrom->PushMessage(NetMsgType::HEADERS, vHeaders);
     }
+    else if (strCommand == NetMsgType::HEADERS)
+    {
+        vector<CBlock> vHeaders;
+        vRecv >> vHeaders;
+
+        LOCK(cs_main);
+        ProcessBlockHeaders(pfrom, vHeaders);
+    }
+    else if (strCommand == NetMsgType::NOTFOUND)
+    {
+        vector<CInv> vInv;
+        vRecv >> vInv;
+
+        if (vInv.size() > MAX_INV_SZ)
+        {
+            std::stringstream msg;
+            msg << boost::format("%s : message notfound size() = %u") % __func__ % vInv.size();
+
+            pfrom->Misbehaving(msg.str(), 20);
+            return error(msg.str().c_str());
+        }
+
+        BOOST_FOREACH(const CInv& inv, vInv)
+        {
+            if (inv.type == MSG_BLOCK)
+                BlockNotFound(pfrom, inv.hash);
+        }
+    }
     else if (strCommand == NetMsgType::TX || strCommand == NetMsgType::DSTX)
     {
         vector<uint256> vWorkQueue;
@@ -4010,7 +4189,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         CInv inv(MSG_BLOCK, block.GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        if (ProcessNewBlock(pfrom, &block))
+        bool fAccepted = ProcessNewBlock(pfrom, &block);
+        MarkBlockReceived(inv.hash);
+
+        if (fAccepted)
             mapAlreadyAskedFor.erase(inv);
         else
         {
@@ -4508,6 +4690,9 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
     if (!vGetData.empty())
         pto->PushMessage(NetMsgType::GETDATA, vGetData);
 
+    // Message: getheaders, getdata of the headers-first download
+    SendBlockDownloadRequests(pto);
+
     return true;
 }
 
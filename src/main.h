@@ -9,10 +9,13 @@
 #define NEUTRON_MAIN_H
 
 #include "amount.h"
+#include "blockcache.h"
+#include "blockfile.h"
 #include "clientversion.h"
 #include "bignum.h"
 #include "sync.h"
 #include "net.h"
+#include "prune.h"
 #include "script.h"
 #include "scrypt.h"
 #include "streams.h"
@@ -22,6 +25,7 @@
 #include "utilstrencodings.h"
 #include "robinhood.h"
 
+#include <atomic>
 #include <iostream>
 #include <list>
 
@@ -38,6 +42,7 @@ class CAddress;
 class CInv;
 class CRequestTracker;
 class CNode;
+class CScriptCheck;
 
 class CTxIn;
 class CTxMemPool;
@@ -113,13 +118,14 @@ extern CBlockIndex* pindexBest;
 extern unsigned int nTransactionsUpdated;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
+extern std::atomic<uint64_t> nHashesComputed;
 extern int64_t nLastCoinStakeSearchInterval;
 extern const std::string strMessageMagic;
 extern int64_t nTimeBestReceived;
+extern bool fReindex;
 extern CCriticalSection cs_setpwalletRegistered;
 extern std::set<CWallet*> setpwalletRegistered;
 extern unsigned char pchMessageStart[4];
-extern robin_hood::unordered_node_map<uint256, CBlock*> mapOrphanBlocks;
 
 // Settings
 extern int64_t nTransactionFee;
@@ -136,13 +142,15 @@ static const uint64_t nMinDiskSpace = 52428800;
 class CReserveKey;
 class CTxDB;
 class CTxIndex;
+class CCoin;
+class CCoins;
 
 void RegisterWallet(CWallet* pwalletIn);
 void UnregisterWallet(CWallet* pwalletIn);
 void SyncWithWallets(const CTransaction& tx, const CBlock* pblock = NULL, bool fUpdate = false, bool fConnect = true);
-bool ProcessNewBlock(CNode* pfrom, CBlock* pblock);
+// A block already stored at nFile:nBlockPos is indexed there rather than written again
+bool ProcessNewBlock(CNode* pfrom, CBlock* pblock, unsigned int nFile = -1, unsigned int nBlockPos = 0);
 bool CheckDiskSpace(uint64_t nAdditionalBytes=0);
-bool LoadExternalBlockFile(FILE* fileIn);
 bool LoadBlockIndex(bool fAllowNew=true);
 void PrintBlockTree();
 void PrintBlockInfo();
@@ -160,7 +168,6 @@ unsigned int ComputeMinStake(int height, unsigned int nBase, int64_t nTime, unsi
 int GetNumBlocksOfPeers();
 std::string GetWarnings(std::string strFor);
 bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock);
-uint256 WantedByOrphan(const CBlock* pblockOrphan);
 const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfStake);
 
 void ResendWalletTransactions(bool fForce = false);
@@ -399,7 +406,7 @@ public:
         scriptPubKey.clear();
     }
 
-    bool IsNull()
+    bool IsNull() const
     {
         return (nValue == -1);
     }
@@ -455,7 +462,28 @@ enum GetMinFee_mode
     GMF_SEND,
 };
 
-typedef std::map<uint256, std::pair<CTxIndex, CTransaction> > MapPrevTx;
+typedef std::map<uint256, std::pair<CTxIndex, CCoins> > MapPrevTx;
+
+/** A value worked out from the object holding it, kept until the object is
+ * changed. Copies start out without it, as they are often made to be changed.
+ */
+template <typename T>
+class CCachedValue
+{
+private:
+    T value;
+    bool fSet;
+
+public:
+    CCachedValue() : value(), fSet(false) {}
+    CCachedValue(const CCachedValue&) : value(), fSet(false) {}
+    CCachedValue& operator=(const CCachedValue&) { fSet = false; return *this; }
+
+    bool IsSet() const { return fSet; }
+    const T& Get() const { return value; }
+    void Set(const T& valueIn) { value = valueIn; fSet = true; }
+    void Clear() { fSet = false; }
+};
 
 /** The basic transaction that is broadcasted on the network and contained in
  * blocks.  A transaction can contain multiple inputs and outputs.
@@ -474,6 +502,11 @@ public:
     mutable int nDoS;
     bool DoS(int nDoSIn, bool fIn) const { nDoS += nDoSIn; return fIn; }
 
+    // memory only
+    // Set by CacheHash() once the transaction can't change anymore, as in a
+    // block being connected. Copies and deserialization drop it.
+    mutable CCachedValue<uint256> hashCached;
+
     CTransaction()
     {
         SetNull();
@@ -486,6 +519,9 @@ public:
 
     IMPLEMENT_SERIALIZE
     (
+        if (fRead)
+            hashCached.Clear();
+
         READWRITE(this->nVersion);
         nVersion = this->nVersion;
         READWRITE(nTime);
@@ -502,6 +538,7 @@ public:
         vout.clear();
         nLockTime = 0;
         nDoS = 0;  // Denial-of-service prevention
+        hashCached.Clear();
     }
 
     bool IsNull() const
@@ -511,9 +548,19 @@ public:
 
     uint256 GetHash() const
     {
+        if (hashCached.IsSet())
+            return hashCached.Get();
+
+        nHashesComputed++;
         return SerializeHash(*this);
     }
 
+    void CacheHash() const
+    {
+        if (!hashCached.IsSet())
+            hashCached.Set(GetHash());
+    }
+
     bool IsFinal(int nBlockHeight=0, int64_t nBlockTime=0) const
     {
         // Time based nLockTime implemented in 0.1.6
@@ -627,6 +674,23 @@ public:
 
     bool ReadFromDisk(CDiskTxPos pos, FILE** pfileRet=NULL)
     {
+        if (!pfileRet)
+        {
+            CBlockFileData data;
+
+            if (!ReadBlockFileData(pos.nFile, pos.nBlockPos, pos.nTxPos, data))
+                return error("CTransaction::ReadFromDisk() : ReadBlockFileData failed");
+
+            try {
+                CBufferReader(data.begin(), data.end(), SER_DISK, CLIENT_VERSION) >> *this;
+            }
+            catch (std::exception &e) {
+                return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
+            }
+
+            return true;
+        }
+
         CAutoFile filein = CAutoFile(OpenBlockFile(pos.nFile, 0, pfileRet ? "rb+" : "rb"), SER_DISK, CLIENT_VERSION);
         if (!filein)
             return error("CTransaction::ReadFromDisk() : OpenBlockFile failed");
@@ -700,7 +764,15 @@ public:
     bool ReadFromDisk(CTxDB& txdb, COutPoint prevout, CTxIndex& txindexRet);
     bool ReadFromDisk(CTxDB& txdb, COutPoint prevout);
     bool ReadFromDisk(COutPoint prevout);
-    bool DisconnectInputs(CTxDB& txdb);
+
+    // Like ReadFromDisk(txdb, prevout, txindexRet), but if the block file of the
+    // transaction has been pruned, rebuild what staking looks at from the coins
+    // view: nTime and the unspent output prevout.n. The result has the wrong hash.
+    bool ReadPrevTx(CTxDB& txdb, const COutPoint& prevout, CTxIndex& txindexRet);
+
+    // The spent outputs are returned to the coins view from mapUndo where given,
+    // otherwise from the transactions on disk
+    bool DisconnectInputs(CTxDB& txdb, const std::map<COutPoint, CCoin>* pmapUndo = NULL);
 
     /** Fetch from memory and/or disk. inputsRet keys are transaction hashes.
 
@@ -708,7 +780,7 @@ public:
      @param[in] mapTestPool List of pending changes to the transaction index database
      @param[in] fBlock  True if being called to add a new best-block to the chain
      @param[in] fMiner  True if being called by CreateNewBlock
-     @param[out] inputsRet  Pointers to this transaction's inputs
+     @param[out] inputsRet  Index entries and previous outputs spent by this transaction's inputs
      @param[out] fInvalid   returns true if transaction is invalid
      @return    Returns true if all inputs are in txdb or mapTestPool
      */
@@ -718,17 +790,19 @@ public:
     /** Sanity check previous transactions, then, if all checks succeed,
         mark them as spent by this transaction.
 
-        @param[in] inputs   Previous transactions (from FetchInputs)
+        @param[in] inputs   Previous outputs (from FetchInputs)
         @param[out] mapTestPool Keeps track of inputs that need to be updated on disk
         @param[in] posThisTx    Position of this transaction on disk
         @param[in] pindexBlock
         @param[in] fBlock   true if called from ConnectBlock
         @param[in] fMiner   true if called from CreateNewBlock
+        @param[out] pvChecks    If given, the script checks are appended to it instead of being run
         @return Returns true if all checks succeed
      */
     bool ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
                        std::map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx,
-                       const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool *txAlreadyUsed=nullptr);
+                       const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool *txAlreadyUsed=nullptr,
+                       std::vector<CScriptCheck>* pvChecks=NULL);
     bool ClientConnectInputs();
     bool CheckTransaction() const;
     bool AcceptToMemoryPool(CTxDB& txdb, bool fCheckInputs=true, bool* pfMissingInputs=NULL);
@@ -736,6 +810,216 @@ public:
 
 protected:
     const CTxOut& GetOutputFor(const CTxIn& input, const MapPrevTx& inputs) const;
+    bool FetchCoins(CTxDB& txdb, const uint256& hashPrev, unsigned int nOutputs, CCoins& coinsRet) const;
+};
+
+/** The outputs of a previous transaction that inputs being validated refer to,
+ * together with the parts of the transaction itself that input validation needs.
+ * Outputs that were not requested are left null, so the whole transaction does
+ * not have to be read from disk when the outputs are available in the coins view.
+ */
+class CCoins
+{
+public:
+    unsigned int nTime;
+    bool fCoinBase;
+    bool fCoinStake;
+    std::vector<CTxOut> vout;
+
+    CCoins()
+    {
+        SetNull();
+    }
+
+    CCoins(const CTransaction& tx)
+    {
+        nTime = tx.nTime;
+        fCoinBase = tx.IsCoinBase();
+        fCoinStake = tx.IsCoinStake();
+        vout = tx.vout;
+    }
+
+    void SetNull()
+    {
+        nTime = 0;
+        fCoinBase = false;
+        fCoinStake = false;
+        vout.clear();
+    }
+
+    bool IsCoinBase() const
+    {
+        return fCoinBase;
+    }
+
+    bool IsCoinStake() const
+    {
+        return fCoinStake;
+    }
+
+    std::string ToString() const
+    {
+        std::string str;
+        str += strprintf("CCoins(%s, nTime=%d, vout.size=%u)\n", IsCoinBase() ? "coinbase" :
+                         (IsCoinStake() ? "coinstake" : "normal"), nTime, vout.size());
+
+        for (unsigned int i = 0; i < vout.size(); i++)
+        {
+            if (!vout[i].IsNull())
+                str += "    " + vout[i].ToString() + "\n";
+        }
+
+        return str;
+    }
+};
+
+/** An unspent transaction output as stored in the coins database, keyed by its
+ * outpoint. It carries the timestamp and kind of the transaction that created it
+ * so that spends can be validated without reading that transaction from disk.
+ */
+class CCoin
+{
+public:
+    enum
+    {
+        COIN_COINBASE = (1 << 0),
+        COIN_COINSTAKE = (1 << 1),
+    };
+
+    CTxOut out;
+    unsigned int nTime;
+    int nHeight;
+    unsigned char nFlags;
+
+    CCoin()
+    {
+        SetNull();
+    }
+
+    CCoin(const CTransaction& tx, unsigned int n, int nHeightIn)
+    {
+        out = tx.vout[n];
+        nTime = tx.nTime;
+        nHeight = nHeightIn;
+        nFlags = (tx.IsCoinBase() ? COIN_COINBASE : 0) | (tx.IsCoinStake() ? COIN_COINSTAKE : 0);
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(out);
+        READWRITE(nTime);
+        READWRITE(nHeight);
+        READWRITE(nFlags);
+    )
+
+    void SetNull()
+    {
+        out.SetNull();
+        nTime = 0;
+        nHeight = -1;
+        nFlags = 0;
+    }
+
+    bool IsSpent() const
+    {
+        return out.IsNull();
+    }
+
+    bool IsCoinBase() const
+    {
+        return nFlags & COIN_COINBASE;
+    }
+
+    bool IsCoinStake() const
+    {
+        return nFlags & COIN_COINSTAKE;
+    }
+};
+
+/** Set in the version field of CTxIndex records that store vSpent as a bitmap */
+static const int TXINDEX_SPENT_BITMAP = 0x40000000;
+
+/** Compact encoding of CTxIndex::vSpent. Rather than a full CDiskTxPos for every
+ * output, it stores one bit per output and the position of the spending
+ * transaction for the outputs that are spent. The block file number and the
+ * offset of the transaction within its block are written as compact sizes, as
+ * both are small in practice.
+ */
+class CSpentBitmap
+{
+protected:
+    std::vector<CDiskTxPos>& vSpent;
+
+public:
+    CSpentBitmap(std::vector<CDiskTxPos>& vSpentIn) : vSpent(vSpentIn) {}
+
+    unsigned int GetSerializeSize(int, int=0) const
+    {
+        unsigned int nSize = GetSizeOfCompactSize(vSpent.size()) + (vSpent.size() + 7) / 8;
+
+        BOOST_FOREACH(const CDiskTxPos& pos, vSpent)
+        {
+            if (!pos.IsNull())
+                nSize += GetSizeOfCompactSize(pos.nFile) + sizeof(pos.nBlockPos) +
+                         GetSizeOfCompactSize(pos.nTxPos - pos.nBlockPos);
+        }
+
+        return nSize;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int, int=0) const
+    {
+        std::vector<unsigned char> vBits((vSpent.size() + 7) / 8, 0);
+
+        for (unsigned int i = 0; i < vSpent.size(); i++)
+        {
+            if (!vSpent[i].IsNull())
+                vBits[i / 8] |= 1 << (i % 8);
+        }
+
+        WriteCompactSize(s, vSpent.size());
+
+        if (!vBits.empty())
+            s.write((const char*) &vBits[0], vBits.size());
+
+        BOOST_FOREACH(const CDiskTxPos& pos, vSpent)
+        {
+            if (pos.IsNull())
+                continue;
+
+            WriteCompactSize(s, pos.nFile);
+            WRITEDATA(s, pos.nBlockPos);
+            WriteCompactSize(s, pos.nTxPos - pos.nBlockPos);
+        }
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int, int=0)
+    {
+        uint64_t nOutputs = ReadCompactSize(s);
+
+        if (nOutputs > MAX_BLOCK_SIZE)
+            throw std::ios_base::failure("CSpentBitmap::Unserialize : too many outputs");
+
+        std::vector<unsigned char> vBits((nOutputs + 7) / 8);
+
+        if (!vBits.empty())
+            s.read((char*) &vBits[0], vBits.size());
+
+        vSpent.assign(nOutputs, CDiskTxPos());
+
+        for (unsigned int i = 0; i < nOutputs; i++)
+        {
+            if (!(vBits[i / 8] & (1 << (i % 8))))
+                continue;
+
+            CDiskTxPos& pos = vSpent[i];
+            pos.nFile = ReadCompactSize(s);
+            READDATA(s, pos.nBlockPos);
+            pos.nTxPos = pos.nBlockPos + ReadCompactSize(s);
+        }
+    }
 };
 
 /**  A txdb record that contains the disk location of a transaction and the
@@ -759,12 +1043,18 @@ public:
         vSpent.resize(nOutputs);
     }
 
+    // Records written before TXINDEX_SPENT_BITMAP was introduced are still read
+    // in their original form, with a full position for every output
     IMPLEMENT_SERIALIZE
     (
+        int nFormat = nVersion | TXINDEX_SPENT_BITMAP;
         if (!(nType & SER_GETHASH))
-            READWRITE(nVersion);
+            READWRITE(nFormat);
         READWRITE(pos);
-        READWRITE(vSpent);
+        if (nFormat & TXINDEX_SPENT_BITMAP)
+            READWRITE(REF(CSpentBitmap(REF(vSpent))));
+        else
+            READWRITE(vSpent);
     )
 
     void SetNull()
@@ -825,6 +1115,13 @@ public:
     // memory only
     mutable std::vector<uint256> vMerkleTree;
 
+    // Set once CheckBlock() has passed with all checks enabled, covers the
+    // checks that do not depend on the time. Like the hash, copies drop it.
+    mutable CCachedValue<bool> fChecked;
+
+    // Header hash kept by CacheHashes(), see CTransaction::hashCached
+    mutable CCachedValue<uint256> hashCached;
+
     // Denial-of-service detection:
     mutable int nDoS;
     bool DoS(int nDoSIn, bool fIn) const { nDoS += nDoSIn; return fIn; }
@@ -836,6 +1133,12 @@ public:
 
     IMPLEMENT_SERIALIZE
     (
+        if (fRead)
+        {
+            fChecked.Clear();
+            hashCached.Clear();
+        }
+
         READWRITE(this->nVersion);
         nVersion = this->nVersion;
         READWRITE(hashPrevBlock);
@@ -869,6 +1172,8 @@ public:
         vchBlockSig.clear();
         vMerkleTree.clear();
         nDoS = 0;
+        fChecked.Clear();
+        hashCached.Clear();
     }
 
     bool IsNull() const
@@ -878,9 +1183,42 @@ public:
 
     uint256 GetHash() const
     {
+        if (hashCached.IsSet())
+            return hashCached.Get();
+
+        nHashesComputed++;
         return GetPoWHash();
     }
 
+    // Keeps the hashes of the block and its transactions, which must not be
+    // modified afterwards. Only for the owner of the block, before it is shared.
+    void CacheHashes() const
+    {
+        if (!hashCached.IsSet())
+            hashCached.Set(GetHash());
+
+        BOOST_FOREACH(const CTransaction& tx, vtx)
+            tx.CacheHash();
+    }
+
+    // A plain copy drops the cached hashes, this one keeps them for sharing a
+    // block whose hashes are already known
+    std::shared_ptr<CBlock> CopyWithHashes() const
+    {
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>(*this);
+
+        if (hashCached.IsSet())
+            pblock->hashCached.Set(hashCached.Get());
+
+        for (unsigned int i = 0; i < vtx.size(); i++)
+        {
+            if (vtx[i].hashCached.IsSet())
+                pblock->vtx[i].hashCached.Set(vtx[i].hashCached.Get());
+        }
+
+        return pblock;
+    }
+
     uint256 GetPoWHash() const
     {
         return Hash(BEGIN(nVersion), END(nNonce));
@@ -932,14 +1270,22 @@ public:
 
     uint256 BuildMerkleTree() const
     {
-        vMerkleTree.clear();
+        std::vector<uint256> vTxHashes;
 
         BOOST_FOREACH(const CTransaction& tx, vtx)
-            vMerkleTree.push_back(tx.GetHash());
+            vTxHashes.push_back(tx.GetHash());
+
+        return BuildMerkleTree(vTxHashes);
+    }
+
+    // Same from the transaction hashes, when the caller has them already
+    uint256 BuildMerkleTree(const std::vector<uint256>& vTxHashes) const
+    {
+        vMerkleTree = vTxHashes;
 
         int j = 0;
 
-        for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+        for (int nSize = vTxHashes.size(); nSize > 1; nSize = (nSize + 1) / 2)
         {
             for (int i = 0; i < nSize; i += 2)
             {
@@ -1011,19 +1357,50 @@ public:
         fileout << *this;
         fflush(fileout);
 
-        if (!IsInitialBlockDownload() || (nBestHeight+1) % 500 == 0)
-            FileCommit(fileout);
+        // Synced together with the index records that refer to it, see CTxDB::Flush()
+        MarkBlockFileDirty(nFileRet);
 
         return true;
     }
 
     bool ReadFromDisk(unsigned int nFile, unsigned int nBlockPos, bool fReadTransactions=true)
+    {
+        CBlockRef blockCached = blockcache.Peek(nFile, nBlockPos);
+
+        if (!blockCached)
+            return ReadFromBlockFile(nFile, nBlockPos, fReadTransactions);
+
+        if (fReadTransactions)
+            *this = *blockCached;
+        else
+        {
+            SetNull();
+            nVersion       = blockCached->nVersion;
+            hashPrevBlock  = blockCached->hashPrevBlock;
+            hashMerkleRoot = blockCached->hashMerkleRoot;
+            nTime          = blockCached->nTime;
+            nBits          = blockCached->nBits;
+            nNonce         = blockCached->nNonce;
+        }
+
+        return true;
+    }
+
+    // Deserialize the block from its file, bypassing the block cache
+    bool ReadFromBlockFile(unsigned int nFile, unsigned int nBlockPos, bool fReadTransactions=true)
     {
         SetNull();
-        CAutoFile filein = CAutoFile(OpenBlockFile(nFile, nBlockPos, "rb"), SER_DISK, CLIENT_VERSION);
 
-        if (!filein)
-            return error("CBlock::ReadFromDisk() : OpenBlockFile failed");
+        // The block index still has the headers of pruned blocks
+        if (!fReadTransactions && IsBlockFilePruned(nFile))
+            return ReadPrunedBlockHeader(nFile, nBlockPos, *this);
+
+        CBlockFileData data;
+
+        if (!ReadBlockFileData(nFile, nBlockPos, nBlockPos, data))
+            return error("CBlock::ReadFromDisk() : ReadBlockFileData failed");
+
+        CBufferReader filein(data.begin(), data.end(), SER_DISK, CLIENT_VERSION);
 
         if (!fReadTransactions)
             filein.nType |= SER_BLOCKHEADERONLY;
@@ -1080,7 +1457,7 @@ public:
     bool SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew);
     bool AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos, const uint256& hashProof);
     bool CheckBlock(bool fCheckPOW=true, bool fCheckMerkleRoot=true, bool fCheckSig=true) const;
-    bool AcceptBlock();
+    bool AcceptBlock(unsigned int nFileIn=-1, unsigned int nBlockPosIn=0);
     bool GetCoinAge(uint64_t& nCoinAge) const; // ppcoin: calculate total coin age spent in block
     bool SignBlock(CWallet& keystore, int64_t nFees);
     bool SignBlock_POW(const CKeyStore& keystore);
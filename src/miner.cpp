@@ -209,6 +209,16 @@ CBlock* CreateNewBlock(CWallet* pwallet, bool fProofOfStake, int64_t* pFees)
 
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
             {
+                // Take the value and depth from the coins view when possible
+                CCoin coin;
+
+                if (txdb.GetCoin(txin.prevout, coin) && coin.nHeight >= 0)
+                {
+                    nTotalIn += coin.out.nValue;
+                    dPriority += (double)coin.out.nValue * (nBestHeight - coin.nHeight + 1);
+                    continue;
+                }
+
                 // Read prev transaction
                 CTransaction txPrev;
                 CTxIndex txindex;
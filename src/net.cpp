@@ -7,6 +7,7 @@
 
 #include "net.h"
 #include "addrman.h"
+#include "blockdownload.h"
 #include "clientversion.h"
 #include "db.h"
 #include "init.h"
@@ -988,6 +989,9 @@ void CConnman::ThreadSocketHandler2()
                     pnode->CloseSocketDisconnect();
                     pnode->Cleanup();
 
+                    // hand its block requests to the other peers
+                    BlockDownloadPeerDisconnected(pnode->GetId());
+
                     // hold in disconnected pool until all refs are released
                     if (pnode->fNetworkNode || pnode->fInbound)
                         pnode->Release();
@@ -0,0 +1,243 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "orphanblocks.h"
+#include "main.h"
+#include "util.h"
+#include "version.h"
+
+using namespace std;
+
+COrphanBlockPool orphanblocks(DEFAULT_MAX_ORPHAN_BLOCKS * 1048576);
+
+COrphanBlockPool::COrphanBlockPool(size_t nMaxBytesIn) : nBytes(0), nMaxBytes(nMaxBytesIn), nEvicted(0)
+{
+}
+
+COrphanBlockPool::~COrphanBlockPool()
+{
+    for (map<uint256, COrphan>::iterator it = mapOrphans.begin(); it != mapOrphans.end(); ++it)
+        delete it->second.pblock;
+}
+
+uint256 COrphanBlockPool::GetRootLocked(const uint256& hash)
+{
+    map<uint256, COrphan>::iterator it = mapOrphans.find(hash);
+
+    if (it == mapOrphans.end())
+        return 0;
+
+    // The cached root stays valid until the root is connected, only then is the
+    // chain walked again
+    map<uint256, COrphan>::const_iterator itRoot = mapOrphans.find(it->second.hashRoot);
+
+    if (itRoot != mapOrphans.end() && !mapOrphans.count(itRoot->second.pblock->hashPrevBlock))
+        return it->second.hashRoot;
+
+    uint256 hashRoot = hash;
+
+    for (map<uint256, COrphan>::const_iterator itPrev = it; itPrev != mapOrphans.end();
+         itPrev = mapOrphans.find(itPrev->second.pblock->hashPrevBlock))
+        hashRoot = itPrev->first;
+
+    it->second.hashRoot = hashRoot;
+
+    return hashRoot;
+}
+
+CBlock* COrphanBlockPool::Remove(map<uint256, COrphan>::iterator it)
+{
+    const uint256 hash = it->first;
+    const COrphan& orphan = it->second;
+    CBlock* pblock = orphan.pblock;
+
+    for (multimap<uint256, uint256>::iterator mi = mapOrphansByPrev.lower_bound(pblock->hashPrevBlock);
+         mi != mapOrphansByPrev.upper_bound(pblock->hashPrevBlock); ++mi)
+    {
+        if (mi->second == hash)
+        {
+            mapOrphansByPrev.erase(mi);
+            break;
+        }
+    }
+
+    setByTime.erase(make_pair(orphan.nTimeReceived, hash));
+
+    set<pair<int64_t, uint256> >& setPeer = mapByPeer[orphan.nPeer];
+    setPeer.erase(make_pair(orphan.nTimeReceived, hash));
+
+    if (setPeer.empty())
+        mapByPeer.erase(orphan.nPeer);
+
+    if ((mapPeerBytes[orphan.nPeer] -= orphan.nSize) == 0)
+        mapPeerBytes.erase(orphan.nPeer);
+
+    nBytes -= orphan.nSize;
+
+    if (pblock->IsProofOfStake())
+        setStakeSeen.erase(pblock->GetProofOfStake());
+
+    mapOrphans.erase(it);
+
+    return pblock;
+}
+
+void COrphanBlockPool::EvictWithDescendants(const uint256& hash)
+{
+    // The orphans built on an evicted one could not be connected either
+    vector<uint256> vQueue(1, hash);
+
+    for (unsigned int i = 0; i < vQueue.size(); i++)
+    {
+        for (multimap<uint256, uint256>::const_iterator mi = mapOrphansByPrev.lower_bound(vQueue[i]);
+             mi != mapOrphansByPrev.upper_bound(vQueue[i]); ++mi)
+            vQueue.push_back(mi->second);
+    }
+
+    BOOST_FOREACH(const uint256& hashEvict, vQueue)
+    {
+        map<uint256, COrphan>::iterator it = mapOrphans.find(hashEvict);
+
+        if (it != mapOrphans.end())
+        {
+            delete Remove(it);
+            nEvicted++;
+        }
+    }
+
+    if (fDebug)
+        LogPrintf("%s : evicted %u orphan blocks from %s\n", __func__, vQueue.size(), vQueue[0].ToString());
+}
+
+void COrphanBlockPool::Add(const CBlock& block, NodeId nPeer)
+{
+    uint256 hash = block.GetHash();
+    size_t nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    int64_t nNow = GetTime();
+    LOCK(cs_orphanblocks);
+
+    if (mapOrphans.count(hash))
+        return;
+
+    while (!setByTime.empty() && setByTime.begin()->first < nNow - ORPHAN_BLOCK_EXPIRE_TIME)
+        EvictWithDescendants(setByTime.begin()->second);
+
+    // Make room at the expense of the peer that takes up the most of it
+    while (!mapOrphans.empty() && nBytes + nSize > nMaxBytes)
+    {
+        map<NodeId, size_t>::const_iterator itMax = mapPeerBytes.begin();
+
+        for (map<NodeId, size_t>::const_iterator mi = mapPeerBytes.begin(); mi != mapPeerBytes.end(); ++mi)
+        {
+            if (mi->second > itMax->second)
+                itMax = mi;
+        }
+
+        EvictWithDescendants(mapByPeer[itMax->first].begin()->second);
+    }
+
+    COrphan orphan;
+    orphan.pblock = new CBlock(block);
+    orphan.nPeer = nPeer;
+    orphan.nTimeReceived = nNow;
+    orphan.nSize = nSize;
+    orphan.hashRoot = mapOrphans.count(block.hashPrevBlock) ? GetRootLocked(block.hashPrevBlock) : hash;
+
+    mapOrphans[hash] = orphan;
+    mapOrphansByPrev.insert(make_pair(block.hashPrevBlock, hash));
+    setByTime.insert(make_pair(nNow, hash));
+    mapByPeer[nPeer].insert(make_pair(nNow, hash));
+    mapPeerBytes[nPeer] += nSize;
+    nBytes += nSize;
+
+    if (block.IsProofOfStake())
+        setStakeSeen.insert(block.GetProofOfStake());
+
+    // The orphans that were waiting for this block now hang off its chain
+    vector<uint256> vQueue(1, hash);
+
+    for (unsigned int i = 0; i < vQueue.size(); i++)
+    {
+        for (multimap<uint256, uint256>::const_iterator mi = mapOrphansByPrev.lower_bound(vQueue[i]);
+             mi != mapOrphansByPrev.upper_bound(vQueue[i]); ++mi)
+        {
+            mapOrphans[mi->second].hashRoot = orphan.hashRoot;
+            vQueue.push_back(mi->second);
+        }
+    }
+}
+
+bool COrphanBlockPool::Contains(const uint256& hash) const
+{
+    LOCK(cs_orphanblocks);
+
+    return mapOrphans.count(hash);
+}
+
+bool COrphanBlockPool::HasChildren(const uint256& hashPrev) const
+{
+    LOCK(cs_orphanblocks);
+
+    return mapOrphansByPrev.count(hashPrev);
+}
+
+bool COrphanBlockPool::IsStakeSeen(const pair<COutPoint, unsigned int>& proofOfStake) const
+{
+    LOCK(cs_orphanblocks);
+
+    return setStakeSeen.count(proofOfStake);
+}
+
+uint256 COrphanBlockPool::GetRoot(const uint256& hash)
+{
+    LOCK(cs_orphanblocks);
+
+    return GetRootLocked(hash);
+}
+
+uint256 COrphanBlockPool::GetWanted(const uint256& hash)
+{
+    LOCK(cs_orphanblocks);
+
+    map<uint256, COrphan>::const_iterator it = mapOrphans.find(GetRootLocked(hash));
+
+    return it == mapOrphans.end() ? uint256(0) : it->second.pblock->hashPrevBlock;
+}
+
+vector<CBlock*> COrphanBlockPool::TakeChildren(const uint256& hashPrev)
+{
+    LOCK(cs_orphanblocks);
+
+    vector<uint256> vChildren;
+
+    for (multimap<uint256, uint256>::const_iterator mi = mapOrphansByPrev.lower_bound(hashPrev);
+         mi != mapOrphansByPrev.upper_bound(hashPrev); ++mi)
+        vChildren.push_back(mi->second);
+
+    vector<CBlock*> vBlocks;
+
+    BOOST_FOREACH(const uint256& hash, vChildren)
+        vBlocks.push_back(Remove(mapOrphans.find(hash)));
+
+    return vBlocks;
+}
+
+void COrphanBlockPool::SetMaxBytes(size_t nMaxBytesIn)
+{
+    LOCK(cs_orphanblocks);
+
+    nMaxBytes = nMaxBytesIn;
+}
+
+void COrphanBlockPool::GetStats(size_t& nEntriesRet, size_t& nBytesRet, size_t& nMaxBytesRet,
+                                uint64_t& nEvictedRet) const
+{
+    LOCK(cs_orphanblocks);
+
+    nEntriesRet = mapOrphans.size();
+    nBytesRet = nBytes;
+    nMaxBytesRet = nMaxBytes;
+    nEvictedRet = nEvicted;
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NEUTRON_ORPHANBLOCKS_H
+#define NEUTRON_ORPHANBLOCKS_H
+
+#include <stdint.h>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "net.h"
+#include "sync.h"
+#include "uint256.h"
+
+class CBlock;
+class COutPoint;
+
+static const int64_t DEFAULT_MAX_ORPHAN_BLOCKS = 64; // MiB
+
+/** Orphans older than this are dropped when the pool is next added to */
+static const int64_t ORPHAN_BLOCK_EXPIRE_TIME = 30 * 60;
+
+/** Blocks whose parent is not known yet, bounded by their serialized size.
+ * When full, the oldest orphan of the peer holding the most bytes is evicted
+ * together with the orphans built on it. Every orphan caches the first block
+ * of its orphan chain.
+ */
+class COrphanBlockPool
+{
+private:
+    struct COrphan
+    {
+        CBlock* pblock;
+        NodeId nPeer;
+        int64_t nTimeReceived;
+        size_t nSize;
+        uint256 hashRoot;
+    };
+
+    mutable CCriticalSection cs_orphanblocks;
+    std::map<uint256, COrphan> mapOrphans;
+    std::multimap<uint256, uint256> mapOrphansByPrev;
+    std::set<std::pair<int64_t, uint256> > setByTime;
+    std::map<NodeId, std::set<std::pair<int64_t, uint256> > > mapByPeer;
+    std::map<NodeId, size_t> mapPeerBytes;
+    std::set<std::pair<COutPoint, unsigned int> > setStakeSeen;
+    size_t nBytes;
+    size_t nMaxBytes;
+    uint64_t nEvicted;
+
+    uint256 GetRootLocked(const uint256& hash);
+    CBlock* Remove(std::map<uint256, COrphan>::iterator it);
+    void EvictWithDescendants(const uint256& hash);
+
+public:
+    COrphanBlockPool(size_t nMaxBytesIn);
+    ~COrphanBlockPool();
+
+    /** Add a copy of block, received from nPeer (-1 if local), making room first */
+    void Add(const CBlock& block, NodeId nPeer);
+
+    bool Contains(const uint256& hash) const;
+    bool HasChildren(const uint256& hashPrev) const;
+    bool IsStakeSeen(const std::pair<COutPoint, unsigned int>& proofOfStake) const;
+
+    /** Hash of the first orphan of the chain hash belongs to, 0 if hash is not an orphan */
+    uint256 GetRoot(const uint256& hash);
+
+    /** The missing block the chain of orphan hash waits for, 0 if hash is not an orphan */
+    uint256 GetWanted(const uint256& hash);
+
+    /** Remove the orphans built on hashPrev, the caller takes ownership */
+    std::vector<CBlock*> TakeChildren(const uint256& hashPrev);
+
+    void SetMaxBytes(size_t nMaxBytesIn);
+    void GetStats(size_t& nEntriesRet, size_t& nBytesRet, size_t& nMaxBytesRet, uint64_t& nEvictedRet) const;
+};
+
+extern COrphanBlockPool orphanblocks;
+
+#endif // NEUTRON_ORPHANBLOCKS_H
@@ -0,0 +1,216 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "prune.h"
+#include "blockcache.h"
+#include "blockfile.h"
+#include "main.h"
+#include "sync.h"
+#include "txdb.h"
+#include "util.h"
+#include "validation.h"
+
+#include <atomic>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+using namespace std;
+
+uint64_t nPruneTarget = 0;
+
+static CCriticalSection cs_prune;
+static set<unsigned int> setPrunedFiles;
+static map<pair<unsigned int, unsigned int>, const CBlockIndex*> mapPrunedBlocks;
+static std::atomic<bool> fHavePruned(false);
+
+bool IsBlockFilePruned(unsigned int nFile)
+{
+    if (!fHavePruned)
+        return false;
+
+    LOCK(cs_prune);
+    return setPrunedFiles.count(nFile) != 0;
+}
+
+bool IsBlockPruned(const CBlockIndex* pindex)
+{
+    return IsBlockFilePruned(pindex->nFile);
+}
+
+bool HavePrunedBlockFiles()
+{
+    return fHavePruned;
+}
+
+bool ReadPrunedBlockHeader(unsigned int nFile, unsigned int nBlockPos, CBlock& block)
+{
+    LOCK(cs_prune);
+    auto it = mapPrunedBlocks.find(make_pair(nFile, nBlockPos));
+
+    if (it == mapPrunedBlocks.end())
+        return error("%s : no block at %u in pruned blk%04u.dat", __func__, nBlockPos, nFile);
+
+    block = it->second->GetBlockHeader();
+    return true;
+}
+
+// Index the blocks of the given pruned files by position, the caller holds cs_prune
+static void IndexPrunedBlocks(const set<unsigned int>& setFiles)
+{
+    for (auto& item : mapBlockIndex)
+    {
+        if (setFiles.count(item.second->nFile))
+            mapPrunedBlocks[make_pair(item.second->nFile, item.second->nBlockPos)] = item.second;
+    }
+}
+
+static void RemoveBlockFile(unsigned int nFile)
+{
+    boost::system::error_code ec;
+    boost::filesystem::remove(BlockFilePath(nFile), ec);
+
+    if (ec)
+        LogPrintf("%s : cannot remove blk%04u.dat: %s\n", __func__, nFile, ec.message());
+}
+
+bool LoadPrunedBlockFiles(CTxDB& txdb)
+{
+    set<unsigned int> setFiles;
+    txdb.ReadPrunedFiles(setFiles);
+
+    if (setFiles.empty())
+        return true;
+
+    {
+        LOCK2(cs_main, cs_prune);
+        setPrunedFiles = setFiles;
+        IndexPrunedBlocks(setFiles);
+        fHavePruned = true;
+    }
+
+    // Files are marked as pruned before they are deleted, finish what a
+    // previous run may have left behind
+    BOOST_FOREACH(unsigned int nFile, setFiles)
+    {
+        if (boost::filesystem::exists(BlockFilePath(nFile)))
+            RemoveBlockFile(nFile);
+    }
+
+    LogPrintf("%s : %u block files pruned, first kept is blk%04u.dat\n", __func__, setFiles.size(),
+              *setFiles.rbegin() + 1);
+    return true;
+}
+
+void PruneBlockFiles()
+{
+    if (nPruneTarget == 0)
+        return;
+
+    // Sizes of the files that could go, never the one still being appended to
+    unsigned int nCurrentFile = GetCurrentBlockFile();
+    vector<pair<unsigned int, uint64_t> > vFiles;
+    uint64_t nTotal = 0;
+
+    for (unsigned int nFile = 1; nFile <= nCurrentFile; nFile++)
+    {
+        boost::system::error_code ec;
+        uint64_t nSize = boost::filesystem::file_size(BlockFilePath(nFile), ec);
+
+        if (ec)
+            continue;
+
+        nTotal += nSize;
+
+        if (nFile < nCurrentFile)
+            vFiles.push_back(make_pair(nFile, nSize));
+    }
+
+    if (nTotal <= nPruneTarget)
+        return;
+
+    set<unsigned int> setPrune;
+    vector<const CBlockIndex*> vBlocks;
+
+    {
+        LOCK(cs_main);
+
+        // Highest block of every file, a file goes only once all its blocks
+        // are deep enough
+        map<unsigned int, int> mapMaxHeight;
+
+        for (auto& item : mapBlockIndex)
+        {
+            int& nMaxHeight = mapMaxHeight[item.second->nFile];
+            nMaxHeight = max(nMaxHeight, item.second->nHeight);
+        }
+
+        for (unsigned int i = 0; i < vFiles.size() && nTotal > nPruneTarget; i++)
+        {
+            if (mapMaxHeight[vFiles[i].first] > nBestHeight - MIN_BLOCKS_TO_KEEP)
+                break;
+
+            setPrune.insert(vFiles[i].first);
+            nTotal -= vFiles[i].second;
+        }
+
+        if (setPrune.empty())
+            return;
+
+        for (auto& item : mapBlockIndex)
+        {
+            if (setPrune.count(item.second->nFile))
+                vBlocks.push_back(item.second);
+        }
+
+        // Mark the files as pruned on disk before they are deleted. Their undo
+        // records are no longer needed either, the blocks are far too deep to
+        // be disconnected.
+        set<unsigned int> setFiles;
+
+        {
+            LOCK(cs_prune);
+            setFiles = setPrunedFiles;
+        }
+
+        setFiles.insert(setPrune.begin(), setPrune.end());
+
+        CTxDB txdb;
+
+        if (!txdb.TxnBegin())
+            return;
+
+        txdb.WritePrunedFiles(setFiles);
+
+        BOOST_FOREACH(const CBlockIndex* pindex, vBlocks)
+            txdb.EraseBlockUndo(pindex->GetBlockHash());
+
+        if (!txdb.TxnCommit() || !txdb.Flush(true))
+        {
+            LogPrintf("%s : cannot record the pruned files\n", __func__);
+            return;
+        }
+
+        {
+            LOCK(cs_prune);
+            setPrunedFiles = setFiles;
+            IndexPrunedBlocks(setPrune);
+            fHavePruned = true;
+        }
+    }
+
+    // Let go of cached blocks and of open or mapped files, so the space is
+    // freed right away
+    blockcache.Clear();
+    CloseBlockFileReaders();
+
+    BOOST_FOREACH(unsigned int nFile, setPrune)
+        RemoveBlockFile(nFile);
+
+    LogPrintf("%s : pruned %u block files (%u blocks) up to blk%04u.dat, %uMiB of block files left\n", __func__,
+              setPrune.size(), vBlocks.size(), *setPrune.rbegin(), (unsigned int) (nTotal / 1048576));
+}
@@ -0,0 +1,45 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NEUTRON_PRUNE_H
+#define NEUTRON_PRUNE_H
+
+#include <stdint.h>
+
+class CBlock;
+class CBlockIndex;
+class CTxDB;
+
+/** Smallest -prune target in MiB */
+static const uint64_t MIN_PRUNE_TARGET_MB = 512;
+
+/** Blocks this far below the best block are never pruned. Reorganizations,
+ * -checkblocks and the undo records of disconnects stay within this depth.
+ */
+static const int MIN_BLOCKS_TO_KEEP = 2880;
+
+/** Block files written in prune mode are kept small, whole files are pruned */
+static const unsigned int PRUNE_BLOCKFILE_SIZE = 128 * 1048576;
+
+/** Bytes of block files to keep (-prune), 0 if pruning is off */
+extern uint64_t nPruneTarget;
+
+/** Whether the block data stored in blkNNNN.dat has been deleted */
+bool IsBlockFilePruned(unsigned int nFile);
+bool IsBlockPruned(const CBlockIndex* pindex);
+
+/** Whether any block file has ever been pruned */
+bool HavePrunedBlockFiles();
+
+/** The header of a block in a pruned file, rebuilt from the block index */
+bool ReadPrunedBlockHeader(unsigned int nFile, unsigned int nBlockPos, CBlock& block);
+
+/** Load the set of pruned files, after the block index has been loaded */
+bool LoadPrunedBlockFiles(CTxDB& txdb);
+
+/** Delete the oldest block files until their total size is within the target */
+void PruneBlockFiles();
+
+#endif // NEUTRON_PRUNE_H
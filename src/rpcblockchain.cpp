@@ -5,8 +5,13 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "addressindex.h"
+#include "chainstate.h"
 #include "checkpoints.h"
 #include "main.h"
+#include "sigcache.h"
+#include "spentindex.h"
+#include "timestampindex.h"
 #include "utiltime.h"
 #include "bitcoinrpc.h"
 #include "wallet.h"
@@ -262,11 +267,16 @@ UniValue getblock(const UniValue& params, bool fHelp)
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
-    block.ReadFromDisk(pblockindex, true);
+    if (IsBlockPruned(pblockindex))
+        throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
+
+    CBlockRef block = ReadBlockShared(pblockindex);
 
-    return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
+    if (!block)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
+    return blockToJSON(*block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
 }
 
 UniValue getblockbynumber(const UniValue& params, bool fHelp)
@@ -282,11 +292,16 @@ UniValue getblockbynumber(const UniValue& params, bool fHelp)
     if (nHeight < 0 || nHeight > nBestHeight)
         throw runtime_error("Block number out of range.");
 
-    CBlock block;
     CBlockIndex* pblockindex = FindBlockByHeight(nHeight);
-    block.ReadFromDisk(pblockindex, true);
+    if (IsBlockPruned(pblockindex))
+        throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
 
-    return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
+    CBlockRef block = ReadBlockShared(pblockindex);
+
+    if (!block)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
+    return blockToJSON(*block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
 }
 
 UniValue getblockbyrange(const UniValue& params, bool fHelp)
@@ -306,20 +321,553 @@ UniValue getblockbyrange(const UniValue& params, bool fHelp)
     if (high - low >= 1000)
         throw runtime_error("Block range can be at most 1000 blocks.");
 
-    CBlock block;
     CBlockIndex* pblockindex = FindBlockByHeight(low);
     UniValue blocks(UniValue::VARR);
 
     while (pblockindex != nullptr && pblockindex->nHeight <= high)
     {
-        block.ReadFromDisk(pblockindex, true);
-        blocks.push_back(blockToJSON(block, pblockindex, params.size() > 2 ? params[2].get_bool() : false));
+        if (IsBlockPruned(pblockindex))
+            throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
+
+        CBlockRef block = ReadBlockShared(pblockindex);
+
+        if (!block)
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
+        blocks.push_back(blockToJSON(*block, pblockindex, params.size() > 2 ? params[2].get_bool() : false));
         pblockindex = pblockindex->pnext;
     }
 
     return blocks;
 }
 
+UniValue getblockcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getblockcacheinfo\n"
+            "Returns statistics of the in-memory cache of recently used blocks.");
+
+    uint64_t nHits, nMisses;
+    size_t nEntries, nBytes, nMaxBytes;
+    blockcache.GetStats(nHits, nMisses, nEntries, nBytes, nMaxBytes);
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("hits",     (uint64_t) nHits));
+    obj.push_back(Pair("misses",   (uint64_t) nMisses));
+    obj.push_back(Pair("blocks",   (uint64_t) nEntries));
+    obj.push_back(Pair("bytes",    (uint64_t) nBytes));
+    obj.push_back(Pair("maxbytes", (uint64_t) nMaxBytes));
+    return obj;
+}
+
+UniValue getsigcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "Returns statistics of the cache of valid signatures.");
+
+    uint64_t nHits, nMisses, nEvicted;
+    size_t nEntries, nMaxEntries, nMaxBytes;
+    sigcache.GetStats(nHits, nMisses, nEvicted, nEntries, nMaxEntries, nMaxBytes);
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("hits",       (uint64_t) nHits));
+    obj.push_back(Pair("misses",     (uint64_t) nMisses));
+    obj.push_back(Pair("hitrate",    nHits + nMisses ? (double) nHits / (nHits + nMisses) : 0.0));
+    obj.push_back(Pair("evicted",    (uint64_t) nEvicted));
+    obj.push_back(Pair("entries",    (uint64_t) nEntries));
+    obj.push_back(Pair("maxentries", (uint64_t) nMaxEntries));
+    obj.push_back(Pair("maxbytes",   (uint64_t) nMaxBytes));
+    return obj;
+}
+
+UniValue getdbstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getdbstats\n"
+            "Returns statistics of the transaction database: cache usage, LevelDB's own\n"
+            "statistics and, per key space, how often each operation was answered from the\n"
+            "open transaction (batch), the write cache (cache), LevelDB (disk) or found\n"
+            "nothing (missing), with a latency histogram where bucket i counts operations\n"
+            "below 2^i microseconds.");
+
+    static const char* const pszOps[TXDB_OP_COUNT] = { "read", "write", "erase", "exists" };
+    static const char* const pszSources[TXDB_SOURCE_COUNT] = { "batch", "cache", "disk", "missing" };
+
+    CTxDB txdb("r");
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("backend", GetTxDBBackend().GetName()));
+    obj.push_back(Pair("bulkload", IsTxDBBulkLoad()));
+
+    size_t nBlockCache, nBlockCacheMax, nWriteCache, nWriteCacheMax;
+    txdb.GetCacheUsage(nBlockCache, nBlockCacheMax, nWriteCache, nWriteCacheMax);
+    obj.push_back(Pair("blockcachebytes", (uint64_t) nBlockCache));
+    obj.push_back(Pair("blockcachemaxbytes", (uint64_t) nBlockCacheMax));
+    obj.push_back(Pair("writecachebytes", (uint64_t) nWriteCache));
+    obj.push_back(Pair("writecachemaxbytes", (uint64_t) nWriteCacheMax));
+
+    string strValue;
+    UniValue levels(UniValue::VARR);
+
+    for (int nLevel = 0; txdb.GetProperty(strprintf("leveldb.num-files-at-level%d", nLevel), strValue); nLevel++)
+        levels.push_back(atoi(strValue));
+
+    obj.push_back(Pair("filesperlevel", levels));
+
+    if (txdb.GetProperty("leveldb.approximate-memory-usage", strValue))
+        obj.push_back(Pair("memoryusage", atoi64(strValue)));
+
+    if (txdb.GetProperty("leveldb.stats", strValue))
+        obj.push_back(Pair("stats", strValue));
+
+    if (txdb.GetProperty("leveldb.sstables", strValue))
+        obj.push_back(Pair("sstables", strValue));
+
+    UniValue keyspaces(UniValue::VOBJ);
+
+    BOOST_FOREACH(const CTxDBKeyspaceStats& stats, GetTxDBStats())
+    {
+        UniValue keyspace(UniValue::VOBJ);
+
+        for (int op = 0; op < TXDB_OP_COUNT; op++)
+        {
+            uint64_t nTotal = 0;
+            UniValue entry(UniValue::VOBJ);
+
+            for (int source = 0; source < TXDB_SOURCE_COUNT; source++)
+            {
+                entry.push_back(Pair(pszSources[source], stats.nOps[op][source]));
+                nTotal += stats.nOps[op][source];
+            }
+
+            if (nTotal == 0)
+                continue;
+
+            UniValue latency(UniValue::VARR);
+
+            for (int nBucket = 0; nBucket < TXDB_LATENCY_BUCKETS; nBucket++)
+                latency.push_back(stats.nLatency[op][nBucket]);
+
+            entry.push_back(Pair("count", nTotal));
+            entry.push_back(Pair("totalmicros", stats.nMicros[op]));
+            entry.push_back(Pair("latency", latency));
+            keyspace.push_back(Pair(pszOps[op], entry));
+        }
+
+        keyspace.push_back(Pair("bytesread", stats.nBytesRead));
+        keyspace.push_back(Pair("byteswritten", stats.nBytesWritten));
+        keyspaces.push_back(Pair(stats.strName, keyspace));
+    }
+
+    obj.push_back(Pair("keyspaces", keyspaces));
+    return obj;
+}
+
+static UniValue ChainStateManifestToJSON(const CChainStateManifest& manifest)
+{
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("bestblockhash", manifest.hashBestChain.GetHex()));
+    result.push_back(Pair("height", manifest.nHeight));
+    result.push_back(Pair("time", manifest.nTime));
+    result.push_back(Pair("records", (uint64_t) manifest.nRecords));
+    result.push_back(Pair("blockfiles", (uint64_t) manifest.vBlockFileSizes.size()));
+    result.push_back(Pair("blockfilebytes", (uint64_t) manifest.GetBlockFileBytes()));
+    result.push_back(Pair("contenthash", manifest.hashContent.GetHex()));
+    return result;
+}
+
+UniValue dumpchainstate(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumpchainstate <directory>\n"
+            "Writes a snapshot of the transaction database and of the block files at the\n"
+            "current best block to <directory>, which must not hold a snapshot yet. The\n"
+            "content hash returned identifies the snapshot for loadchainstate and\n"
+            "-assumechainstate. Not available in prune mode.");
+
+    CChainStateManifest manifest;
+    string strError;
+
+    if (!DumpChainState(boost::filesystem::system_complete(params[0].get_str()), manifest, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, "Cannot dump the chain state: " + strError);
+
+    return ChainStateManifestToJSON(manifest);
+}
+
+UniValue loadchainstate(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "loadchainstate <directory> [contenthash]\n"
+            "Verifies the chain state snapshot in <directory> against the compiled-in\n"
+            "snapshot checkpoints, or against [contenthash] if given, by reading and\n"
+            "hashing all of it. The database of a running node cannot be replaced, a\n"
+            "verified snapshot is loaded by restarting with -loadchainstate=<directory>\n"
+            "and the same hash in -assumechainstate.");
+
+    uint256 hashAssumed = 0;
+
+    if (params.size() > 1)
+        hashAssumed.SetHex(params[1].get_str());
+
+    CChainStateManifest manifest;
+    string strError;
+
+    if (!VerifyChainState(boost::filesystem::system_complete(params[0].get_str()), hashAssumed, manifest, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, "Invalid chain state snapshot: " + strError);
+
+    UniValue result = ChainStateManifestToJSON(manifest);
+    result.push_back(Pair("verified", true));
+    return result;
+}
+
+// The addresses of a {"addresses": [...]} object or of a single address string
+static vector<pair<unsigned char, uint160> > ParseAddresses(const UniValue& param)
+{
+    vector<pair<unsigned char, uint160> > vAddresses;
+    vector<string> vStrAddresses;
+
+    if (param.isStr())
+        vStrAddresses.push_back(param.get_str());
+    else if (param.isObject())
+    {
+        const UniValue& addresses = find_value(param.get_obj(), "addresses");
+
+        if (!addresses.isArray())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Addresses is expected to be an array");
+
+        for (unsigned int i = 0; i < addresses.size(); i++)
+            vStrAddresses.push_back(addresses[i].get_str());
+    }
+    else
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Expected an address or an object with addresses");
+
+    BOOST_FOREACH(const string& strAddress, vStrAddresses)
+    {
+        CBitcoinAddress address(strAddress);
+        CTxDestination dest = address.Get();
+
+        if (const CKeyID* keyID = boost::get<CKeyID>(&dest))
+            vAddresses.push_back(make_pair((unsigned char) ADDRESS_PUBKEYHASH, (uint160) *keyID));
+        else if (const CScriptID* scriptID = boost::get<CScriptID>(&dest))
+            vAddresses.push_back(make_pair((unsigned char) ADDRESS_SCRIPTHASH, (uint160) *scriptID));
+        else
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address: " + strAddress);
+    }
+
+    return vAddresses;
+}
+
+static string AddressToString(unsigned char nType, const uint160& hashBytes)
+{
+    if (nType == ADDRESS_SCRIPTHASH)
+        return CBitcoinAddress(CScriptID(hashBytes)).ToString();
+
+    return CBitcoinAddress(CKeyID(hashBytes)).ToString();
+}
+
+// The optional height range of a query, 0 meaning unbounded
+static void ParseHeightRange(const UniValue& param, int& nStart, int& nEnd)
+{
+    nStart = 0;
+    nEnd = 0;
+
+    if (!param.isObject())
+        return;
+
+    const UniValue& start = find_value(param.get_obj(), "start");
+    const UniValue& end = find_value(param.get_obj(), "end");
+
+    if (!start.isNull())
+        nStart = start.get_int();
+
+    if (!end.isNull())
+        nEnd = end.get_int();
+
+    if (nStart < 0 || nEnd < 0 || (nEnd > 0 && nEnd < nStart))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid height range");
+}
+
+// The optional page of a query's results, a limit of 0 meaning all of them
+static void ParsePage(const UniValue& param, unsigned int& nOffset, unsigned int& nLimit)
+{
+    nOffset = 0;
+    nLimit = 0;
+
+    if (!param.isObject())
+        return;
+
+    const UniValue& offset = find_value(param.get_obj(), "offset");
+    const UniValue& limit = find_value(param.get_obj(), "limit");
+
+    if ((!offset.isNull() && offset.get_int() < 0) || (!limit.isNull() && limit.get_int() < 0))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid offset or limit");
+
+    if (!offset.isNull())
+        nOffset = offset.get_int();
+
+    if (!limit.isNull())
+        nLimit = limit.get_int();
+}
+
+// Whether the result at position i of a query falls on the requested page
+static bool IsOnPage(size_t i, unsigned int nOffset, unsigned int nLimit)
+{
+    return i >= nOffset && (nLimit == 0 || i - nOffset < nLimit);
+}
+
+static void CheckAddressIndex()
+{
+    if (!fAddressIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled, restart with -addressindex -reindex");
+}
+
+// The records of the addresses, one address after the other; no more than
+// nMaxEntries of them if that is not 0
+static vector<CAddressIndexEntry> ReadAddressIndex(const UniValue& param, size_t nMaxEntries = 0)
+{
+    vector<pair<unsigned char, uint160> > vAddresses = ParseAddresses(param);
+    vector<CAddressIndexEntry> vEntries;
+    int nStart, nEnd;
+    ParseHeightRange(param, nStart, nEnd);
+
+    CTxDB txdb("r");
+
+    for (unsigned int i = 0; i < vAddresses.size(); i++)
+    {
+        if (nMaxEntries != 0 && vEntries.size() >= nMaxEntries)
+            break;
+
+        if (!txdb.ReadAddressIndex(vAddresses[i].first, vAddresses[i].second, nStart, nEnd, vEntries, nMaxEntries))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot read the address index");
+    }
+
+    return vEntries;
+}
+
+UniValue getaddressbalance(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance {\"addresses\": [\"address\", ...]}\n"
+            "Returns the balance of the addresses and the total they received, in satoshis.\n"
+            "Requires -addressindex.");
+
+    CheckAddressIndex();
+
+    int64_t nBalance = 0;
+    int64_t nReceived = 0;
+
+    BOOST_FOREACH(const CAddressIndexEntry& entry, ReadAddressIndex(params[0]))
+    {
+        nBalance += entry.second;
+
+        if (!entry.first.fSpending)
+            nReceived += entry.second;
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("balance", nBalance));
+    result.push_back(Pair("received", nReceived));
+    return result;
+}
+
+UniValue getaddressdeltas(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressdeltas {\"addresses\": [\"address\", ...], \"start\": n, \"end\": n, \"offset\": n, \"limit\": n}\n"
+            "Returns every output received (positive) or spent (negative) by the addresses, in\n"
+            "satoshis, optionally limited to the blocks from height start to end.\n"
+            "Skips the first offset results and returns at most limit of them, if given.\n"
+            "Requires -addressindex.");
+
+    CheckAddressIndex();
+
+    unsigned int nOffset, nLimit;
+    ParsePage(params[0], nOffset, nLimit);
+
+    // Results come in index order, the records past the page need not be read
+    vector<CAddressIndexEntry> vEntries = ReadAddressIndex(params[0], nLimit ? (size_t) nOffset + nLimit : 0);
+    UniValue result(UniValue::VARR);
+
+    for (size_t i = nOffset; i < vEntries.size(); i++)
+    {
+        const CAddressIndexEntry& entry = vEntries[i];
+        UniValue delta(UniValue::VOBJ);
+        delta.push_back(Pair("satoshis", entry.second));
+        delta.push_back(Pair("txid", entry.first.txhash.GetHex()));
+        delta.push_back(Pair("index", (int) entry.first.nIndex));
+        delta.push_back(Pair("height", entry.first.nHeight));
+        delta.push_back(Pair("address", AddressToString(entry.first.nType, entry.first.hashBytes)));
+        result.push_back(delta);
+    }
+
+    return result;
+}
+
+UniValue getaddresstxids(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddresstxids {\"addresses\": [\"address\", ...], \"start\": n, \"end\": n, \"offset\": n, \"limit\": n}\n"
+            "Returns the ids of the transactions involving the addresses, ordered by height and\n"
+            "optionally limited to the blocks from height start to end.\n"
+            "Skips the first offset results and returns at most limit of them, if given.\n"
+            "Requires -addressindex.");
+
+    CheckAddressIndex();
+
+    unsigned int nOffset, nLimit;
+    ParsePage(params[0], nOffset, nLimit);
+
+    vector<CAddressIndexEntry> vEntries = ReadAddressIndex(params[0]);
+    set<pair<int, uint256> > setTxids;
+
+    BOOST_FOREACH(const CAddressIndexEntry& entry, vEntries)
+        setTxids.insert(make_pair(entry.first.nHeight, entry.first.txhash));
+
+    UniValue result(UniValue::VARR);
+    size_t i = 0;
+
+    for (set<pair<int, uint256> >::const_iterator it = setTxids.begin(); it != setTxids.end(); ++it, i++)
+    {
+        if (IsOnPage(i, nOffset, nLimit))
+            result.push_back(it->second.GetHex());
+    }
+
+    return result;
+}
+
+UniValue getaddressutxos(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressutxos {\"addresses\": [\"address\", ...], \"start\": n, \"end\": n, \"offset\": n, \"limit\": n}\n"
+            "Returns the unspent outputs of the addresses, ordered by height and optionally\n"
+            "limited to outputs created from height start to end.\n"
+            "Skips the first offset results and returns at most limit of them, if given.\n"
+            "Requires -addressindex.");
+
+    CheckAddressIndex();
+
+    unsigned int nOffset, nLimit;
+    ParsePage(params[0], nOffset, nLimit);
+
+    vector<pair<unsigned char, uint160> > vAddresses = ParseAddresses(params[0]);
+    vector<CAddressUnspentEntry> vEntries;
+    int nStart, nEnd;
+    ParseHeightRange(params[0], nStart, nEnd);
+
+    CTxDB txdb("r");
+
+    for (unsigned int i = 0; i < vAddresses.size(); i++)
+    {
+        if (!txdb.ReadAddressUnspent(vAddresses[i].first, vAddresses[i].second, vEntries))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot read the address index");
+    }
+
+    multimap<int, const CAddressUnspentEntry*> mapByHeight;
+
+    BOOST_FOREACH(const CAddressUnspentEntry& entry, vEntries)
+    {
+        if (entry.second.nHeight >= nStart && (nEnd == 0 || entry.second.nHeight <= nEnd))
+            mapByHeight.insert(make_pair(entry.second.nHeight, &entry));
+    }
+
+    UniValue result(UniValue::VARR);
+    size_t i = 0;
+
+    for (multimap<int, const CAddressUnspentEntry*>::const_iterator it = mapByHeight.begin(); it != mapByHeight.end(); ++it, i++)
+    {
+        if (!IsOnPage(i, nOffset, nLimit))
+            continue;
+
+        const CAddressUnspentEntry& entry = *it->second;
+        UniValue output(UniValue::VOBJ);
+        output.push_back(Pair("address", AddressToString(entry.first.nType, entry.first.hashBytes)));
+        output.push_back(Pair("txid", entry.first.txhash.GetHex()));
+        output.push_back(Pair("outputIndex", (int) entry.first.nIndex));
+        output.push_back(Pair("script", HexStr(entry.second.script.begin(), entry.second.script.end())));
+        output.push_back(Pair("satoshis", entry.second.nValue));
+        output.push_back(Pair("height", entry.second.nHeight));
+        result.push_back(output);
+    }
+
+    return result;
+}
+
+UniValue getspentinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1 || !params[0].isObject())
+        throw runtime_error(
+            "getspentinfo {\"txid\": \"txid\", \"index\": n}\n"
+            "Returns the input that spends output index of transaction txid.\n"
+            "Requires -spentindex.");
+
+    if (!fSpentIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Spent index not enabled, restart with -spentindex -reindex");
+
+    const UniValue& txid = find_value(params[0].get_obj(), "txid");
+    const UniValue& index = find_value(params[0].get_obj(), "index");
+
+    if (!txid.isStr() || !index.isNum() || index.get_int() < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid txid or index");
+
+    CSpentIndexKey key(uint256(txid.get_str()), index.get_int());
+    CSpentIndexValue value;
+    CTxDB txdb("r");
+
+    if (!txdb.ReadSpentIndex(key, value))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get spent info");
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("txid", value.txid.GetHex()));
+    result.push_back(Pair("index", (int) value.nInputIndex));
+    result.push_back(Pair("height", value.nHeight));
+    result.push_back(Pair("satoshis", value.nValue));
+
+    if (value.nAddressType != ADDRESS_NONE)
+        result.push_back(Pair("address", AddressToString(value.nAddressType, value.addressHash)));
+
+    return result;
+}
+
+UniValue getblockhashes(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "getblockhashes high low\n"
+            "Returns the hashes of the blocks with a timestamp from low up to but not including high.\n"
+            "Requires -timestampindex.");
+
+    if (!fTimestampIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Timestamp index not enabled, restart with -timestampindex -reindex");
+
+    int64_t nHigh = params[0].get_int64();
+    int64_t nLow = params[1].get_int64();
+
+    if (nLow < 0 || nHigh < nLow || nHigh > std::numeric_limits<unsigned int>::max())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid timestamp range");
+
+    vector<CTimestampIndexKey> vKeys;
+    CTxDB txdb("r");
+
+    if (!txdb.ReadTimestampIndex(nLow, nHigh, vKeys))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the timestamp index");
+
+    UniValue result(UniValue::VARR);
+
+    BOOST_FOREACH(const CTimestampIndexKey& key, vKeys)
+        result.push_back(key.blockHash.GetHex());
+
+    return result;
+}
+
 // ppcoin: get information of sync-checkpoint
 UniValue getcheckpoint(const UniValue& params, bool fHelp)
 {
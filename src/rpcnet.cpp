@@ -7,6 +7,7 @@
 #include "netbase.h"
 #include "net.h"
 #include "bitcoinrpc.h"
+#include "blockdownload.h"
 #include "alert.h"
 #include "wallet.h"
 #include "db.h"
@@ -56,6 +57,7 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
         obj.push_back(Pair("subver", pnode->strSubVer));
         obj.push_back(Pair("inbound", pnode->fInbound));
         obj.push_back(Pair("startingheight", pnode->nStartingHeight));
+        obj.push_back(Pair("inflight", GetBlocksInFlight(pnode->GetId())));
         obj.push_back(Pair("banscore", pnode->nMisbehavior));
 
         UniValue marray(UniValue::VARR);
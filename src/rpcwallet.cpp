@@ -8,8 +8,10 @@
 #include "wallet.h"
 #include "walletdb.h"
 #include "bitcoinrpc.h"
+#include "blockdownload.h"
 #include "init.h"
 #include "netbase.h"
+#include "orphanblocks.h"
 #include "base58.h"
 #include "utiltime.h"
 #include "masternode.h"
@@ -105,6 +107,15 @@ UniValue getinfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("stake",         ValueFromAmount(pwalletMain->GetStake())));
     obj.push_back(Pair("total",         ValueFromAmount(pwalletMain->GetTotal())));
     obj.push_back(Pair("blocks",        (int) nBestHeight));
+    obj.push_back(Pair("headers",       GetBestHeaderHeight()));
+
+    size_t nOrphans, nOrphanBytes, nOrphanMaxBytes;
+    uint64_t nOrphansEvicted;
+    orphanblocks.GetStats(nOrphans, nOrphanBytes, nOrphanMaxBytes, nOrphansEvicted);
+
+    obj.push_back(Pair("orphanblocks",  (uint64_t) nOrphans));
+    obj.push_back(Pair("orphanbytes",   (uint64_t) nOrphanBytes));
+    obj.push_back(Pair("orphanevicted", nOrphansEvicted));
     obj.push_back(Pair("timeoffset",    (int64_t) GetTimeOffset()));
     obj.push_back(Pair("moneysupply",   ValueFromAmount(pindexBest->nMoneySupply)));
     obj.push_back(Pair("connections",   (int) vNodes.size()));
@@ -0,0 +1,174 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "scriptcheck.h"
+#include "main.h"
+#include "util.h"
+
+#include <algorithm>
+
+#include <boost/thread/locks.hpp>
+
+using namespace std;
+
+int nScriptCheckThreads = 0;
+CScriptCheckQueue scriptcheckqueue;
+
+bool CScriptCheck::operator()() const
+{
+    return VerifyScript(ptxTo->vin[nIn].scriptSig, scriptPubKey, *ptxTo, nIn, nHashType);
+}
+
+bool CScriptCheckQueue::Loop(bool fMaster)
+{
+    boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+    vector<CScriptCheck> vChecks;
+    vChecks.reserve(SCRIPTCHECK_BATCH_SIZE);
+    unsigned int nNow = 0;
+    bool fOk = true;
+
+    while (true)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+
+            // Account for the batch finished in the previous round
+            if (nNow)
+            {
+                fAllOk &= fOk;
+                nTodo -= nNow;
+
+                if (nTodo == 0 && !fMaster)
+                    condMaster.notify_one();
+            }
+            else
+                nTotal++;
+
+            while (queue.empty())
+            {
+                if (fMaster && nTodo == 0)
+                {
+                    nTotal--;
+                    bool fRet = fAllOk;
+                    fAllOk = true;
+
+                    return fRet;
+                }
+
+                nIdle++;
+                cond.wait(lock); // interruption point for the workers
+                nIdle--;
+            }
+
+            // Smaller batches as the queue runs down, so that every thread
+            // gets a share of the last checks
+            nNow = max(1U, min(SCRIPTCHECK_BATCH_SIZE, (unsigned int) queue.size() / (nTotal + nIdle + 1)));
+            vChecks.resize(nNow);
+
+            for (unsigned int i = 0; i < nNow; i++)
+            {
+                vChecks[i].swap(queue.back());
+                queue.pop_back();
+            }
+
+            // Once a check failed the remaining ones only need to be drained
+            fOk = fAllOk;
+        }
+
+        BOOST_FOREACH(const CScriptCheck& check, vChecks)
+        {
+            if (fOk)
+                fOk = check();
+        }
+
+        vChecks.clear();
+    }
+}
+
+void CScriptCheckQueue::Thread()
+{
+    Loop(false);
+}
+
+void CScriptCheckQueue::Add(vector<CScriptCheck>& vChecks)
+{
+    unsigned int nAdded = vChecks.size();
+
+    if (nAdded == 0)
+        return;
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+
+        BOOST_FOREACH(CScriptCheck& check, vChecks)
+        {
+            queue.push_back(CScriptCheck());
+            check.swap(queue.back());
+        }
+
+        nTodo += nAdded;
+    }
+
+    vChecks.clear();
+
+    if (nAdded == 1)
+        condWorker.notify_one();
+    else
+        condWorker.notify_all();
+}
+
+bool CScriptCheckQueue::Wait()
+{
+    return Loop(true);
+}
+
+CScriptCheckControl::CScriptCheckControl(CScriptCheckQueue* pqueueIn) : pqueue(pqueueIn), fDone(false), fOk(true)
+{
+    if (pqueue)
+        pqueue->mutexControl.lock();
+}
+
+CScriptCheckControl::~CScriptCheckControl()
+{
+    // The checks refer to transactions of the caller, none may be left running
+    if (!fDone)
+        Wait();
+
+    if (pqueue)
+        pqueue->mutexControl.unlock();
+}
+
+void CScriptCheckControl::Add(vector<CScriptCheck>& vChecks)
+{
+    if (pqueue)
+    {
+        pqueue->Add(vChecks);
+        return;
+    }
+
+    BOOST_FOREACH(const CScriptCheck& check, vChecks)
+    {
+        if (fOk)
+            fOk = check();
+    }
+
+    vChecks.clear();
+}
+
+bool CScriptCheckControl::Wait()
+{
+    if (pqueue)
+        fOk = pqueue->Wait() && fOk;
+
+    fDone = true;
+
+    return fOk;
+}
+
+void ThreadScriptCheck()
+{
+    RenameThread("neutron-scriptch");
+    scriptcheckqueue.Thread();
+}
@@ -0,0 +1,111 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NEUTRON_SCRIPTCHECK_H
+#define NEUTRON_SCRIPTCHECK_H
+
+#include <utility>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "script.h"
+
+class CTransaction;
+
+/** Script verification threads besides the one connecting the block (-par) */
+static const int MAX_SCRIPTCHECK_THREADS = 16;
+static const int DEFAULT_SCRIPTCHECK_THREADS = 0; // 0 = one per core
+extern int nScriptCheckThreads;
+
+/** Checks are handed to a worker in batches of at most this many */
+static const unsigned int SCRIPTCHECK_BATCH_SIZE = 128;
+
+/** Verification of one input, queued by CTransaction::ConnectInputs() while a
+ * block is connected. The spending transaction must outlive the check, the
+ * output it spends is copied.
+ */
+class CScriptCheck
+{
+private:
+    CScript scriptPubKey;
+    const CTransaction* ptxTo;
+    unsigned int nIn;
+    int nHashType;
+
+public:
+    CScriptCheck() : ptxTo(NULL), nIn(0), nHashType(0) {}
+    CScriptCheck(const CScript& scriptPubKeyIn, const CTransaction& txTo, unsigned int nInIn, int nHashTypeIn) :
+        scriptPubKey(scriptPubKeyIn), ptxTo(&txTo), nIn(nInIn), nHashType(nHashTypeIn) {}
+
+    bool operator()() const;
+
+    void swap(CScriptCheck& check)
+    {
+        scriptPubKey.swap(check.scriptPubKey);
+        std::swap(ptxTo, check.ptxTo);
+        std::swap(nIn, check.nIn);
+        std::swap(nHashType, check.nHashType);
+    }
+};
+
+/** Queue of script checks shared by the worker threads (ThreadScriptCheck())
+ * and the thread that added them, which works along while it waits for the
+ * result. Used through CScriptCheckControl, one block at a time.
+ */
+class CScriptCheckQueue
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable condWorker;
+    boost::condition_variable condMaster;
+    std::vector<CScriptCheck> queue;
+    int nIdle;
+    int nTotal;
+    bool fAllOk;
+    unsigned int nTodo; // checks added and not finished yet
+
+    bool Loop(bool fMaster);
+
+public:
+    boost::mutex mutexControl;
+
+    CScriptCheckQueue() : nIdle(0), nTotal(0), fAllOk(true), nTodo(0) {}
+
+    /** Worker thread body, returns when the thread is interrupted */
+    void Thread();
+
+    /** Queue the checks in vChecks, leaving it empty */
+    void Add(std::vector<CScriptCheck>& vChecks);
+
+    /** Work on the queue until every check is done, returns whether all passed */
+    bool Wait();
+};
+
+extern CScriptCheckQueue scriptcheckqueue;
+
+/** Verifies the checks added to it on the queue, or right away without one.
+ * Waits for the outstanding checks when it goes out of scope.
+ */
+class CScriptCheckControl
+{
+private:
+    CScriptCheckQueue* pqueue;
+    bool fDone;
+    bool fOk;
+
+public:
+    CScriptCheckControl(CScriptCheckQueue* pqueueIn);
+    ~CScriptCheckControl();
+
+    bool IsParallel() const { return pqueue != NULL; }
+    void Add(std::vector<CScriptCheck>& vChecks);
+    bool Wait();
+};
+
+void ThreadScriptCheck();
+
+#endif // NEUTRON_SCRIPTCHECK_H
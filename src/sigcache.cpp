@@ -0,0 +1,143 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sigcache.h"
+#include "random.h"
+
+#include <openssl/sha.h>
+
+using namespace std;
+
+CSignatureCache sigcache(DEFAULT_MAX_SIG_CACHE_SIZE * 1048576);
+
+static size_t GetShardEntries(size_t nMaxBytes, unsigned int nShards, unsigned int nBucketSize)
+{
+    return nMaxBytes / sizeof(uint256) / nShards / nBucketSize * nBucketSize;
+}
+
+CSignatureCache::CSignatureCache(size_t nMaxBytesIn) : nMaxBytes(nMaxBytesIn), nHits(0), nMisses(0), nEvicted(0)
+{
+    GetRandBytes(salt, sizeof(salt));
+
+    // Not locked, the global instance is built before the locks can be used
+    for (unsigned int i = 0; i < SHARDS; i++)
+        shards[i].vEntries.resize(GetShardEntries(nMaxBytesIn, SHARDS, BUCKET_SIZE));
+}
+
+uint256 CSignatureCache::GetDigest(const uint256& sighash, const vector<unsigned char>& vchSig,
+                                   const vector<unsigned char>& vchPubKey) const
+{
+    // The lengths keep (signature, public key) pairs with the same
+    // concatenation apart
+    uint32_t nSigSize = vchSig.size();
+    uint256 digest;
+    SHA256_CTX ctx;
+
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, salt, sizeof(salt));
+    SHA256_Update(&ctx, sighash.begin(), sighash.size());
+    SHA256_Update(&ctx, &nSigSize, sizeof(nSigSize));
+    SHA256_Update(&ctx, vchSig.data(), vchSig.size());
+    SHA256_Update(&ctx, vchPubKey.data(), vchPubKey.size());
+    SHA256_Final(digest.begin(), &ctx);
+
+    return digest;
+}
+
+bool CSignatureCache::Get(const uint256& sighash, const vector<unsigned char>& vchSig,
+                          const vector<unsigned char>& vchPubKey)
+{
+    uint256 digest = GetDigest(sighash, vchSig, vchPubKey);
+    CShard& shard = shards[digest.Get64(1) % SHARDS];
+    bool fFound = false;
+
+    {
+        LOCK(shard.cs);
+
+        // A digest of 0 would match an unused slot, it is simply never found
+        if (!shard.vEntries.empty() && digest != 0)
+        {
+            size_t nBucket = digest.Get64(0) % (shard.vEntries.size() / BUCKET_SIZE) * BUCKET_SIZE;
+
+            for (unsigned int i = 0; i < BUCKET_SIZE && !fFound; i++)
+                fFound = shard.vEntries[nBucket + i] == digest;
+        }
+    }
+
+    if (fFound)
+        nHits++;
+    else
+        nMisses++;
+
+    return fFound;
+}
+
+void CSignatureCache::Set(const uint256& sighash, const vector<unsigned char>& vchSig,
+                          const vector<unsigned char>& vchPubKey)
+{
+    uint256 digest = GetDigest(sighash, vchSig, vchPubKey);
+    CShard& shard = shards[digest.Get64(1) % SHARDS];
+    LOCK(shard.cs);
+
+    if (shard.vEntries.empty() || digest == 0)
+        return;
+
+    size_t nBucket = digest.Get64(0) % (shard.vEntries.size() / BUCKET_SIZE) * BUCKET_SIZE;
+    size_t nFree = BUCKET_SIZE;
+
+    for (unsigned int i = 0; i < BUCKET_SIZE; i++)
+    {
+        if (shard.vEntries[nBucket + i] == digest)
+            return;
+
+        if (nFree == BUCKET_SIZE && shard.vEntries[nBucket + i] == 0)
+            nFree = i;
+    }
+
+    if (nFree == BUCKET_SIZE)
+    {
+        // Evict an entry chosen by the salted digest, i.e. at random
+        nFree = digest.Get64(2) % BUCKET_SIZE;
+        nEvicted++;
+    }
+    else
+        shard.nUsed++;
+
+    shard.vEntries[nBucket + nFree] = digest;
+}
+
+void CSignatureCache::SetMaxBytes(size_t nMaxBytesIn)
+{
+    size_t nShardEntries = GetShardEntries(nMaxBytesIn, SHARDS, BUCKET_SIZE);
+
+    for (unsigned int i = 0; i < SHARDS; i++)
+    {
+        LOCK(shards[i].cs);
+
+        vector<uint256>(nShardEntries).swap(shards[i].vEntries);
+        shards[i].nUsed = 0;
+    }
+
+    nMaxBytes = nMaxBytesIn;
+}
+
+void CSignatureCache::GetStats(uint64_t& nHitsRet, uint64_t& nMissesRet, uint64_t& nEvictedRet,
+                               size_t& nEntriesRet, size_t& nMaxEntriesRet, size_t& nMaxBytesRet) const
+{
+    nHitsRet = nHits;
+    nMissesRet = nMisses;
+    nEvictedRet = nEvicted;
+    nEntriesRet = 0;
+    nMaxEntriesRet = 0;
+    nMaxBytesRet = nMaxBytes;
+
+    for (unsigned int i = 0; i < SHARDS; i++)
+    {
+        LOCK(shards[i].cs);
+
+        nEntriesRet += shards[i].nUsed;
+        nMaxEntriesRet += shards[i].vEntries.size();
+    }
+}
@@ -0,0 +1,69 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NEUTRON_SIGCACHE_H
+#define NEUTRON_SIGCACHE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#include "sync.h"
+#include "uint256.h"
+
+static const int64_t DEFAULT_MAX_SIG_CACHE_SIZE = 32; // MiB
+static const int64_t MAX_SIG_CACHE_SIZE = 1024; // MiB, -maxsigcachesize used to count entries
+
+/** Signatures found valid before, so that a transaction seen in the memory
+ * pool is not verified again when its block comes in. Entries are salted
+ * 32 byte digests of (signature hash, signature, public key) in a table of
+ * fixed size, split into shards that are locked separately so that the
+ * script check threads rarely wait for each other. A new entry that finds
+ * its bucket full replaces one picked by its digest, which the salt keeps
+ * out of reach of anyone trying to flush the cache.
+ */
+class CSignatureCache
+{
+private:
+    static const unsigned int SHARDS = 16;
+    static const unsigned int BUCKET_SIZE = 4;
+
+    struct CShard
+    {
+        mutable CCriticalSection cs;
+        std::vector<uint256> vEntries; // 0 marks an unused slot
+        size_t nUsed;
+
+        CShard() : nUsed(0) {}
+    };
+
+    CShard shards[SHARDS];
+    unsigned char salt[32];
+    std::atomic<size_t> nMaxBytes;
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+    std::atomic<uint64_t> nEvicted;
+
+    uint256 GetDigest(const uint256& sighash, const std::vector<unsigned char>& vchSig,
+                      const std::vector<unsigned char>& vchPubKey) const;
+
+public:
+    CSignatureCache(size_t nMaxBytesIn);
+
+    bool Get(const uint256& sighash, const std::vector<unsigned char>& vchSig,
+             const std::vector<unsigned char>& vchPubKey);
+    void Set(const uint256& sighash, const std::vector<unsigned char>& vchSig,
+             const std::vector<unsigned char>& vchPubKey);
+
+    // Resizing drops every entry
+    void SetMaxBytes(size_t nMaxBytesIn);
+
+    void GetStats(uint64_t& nHitsRet, uint64_t& nMissesRet, uint64_t& nEvictedRet,
+                  size_t& nEntriesRet, size_t& nMaxEntriesRet, size_t& nMaxBytesRet) const;
+};
+
+extern CSignatureCache sigcache;
+
+#endif // NEUTRON_SIGCACHE_H
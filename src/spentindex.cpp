@@ -0,0 +1,68 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "spentindex.h"
+#include "addressindex.h"
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <map>
+
+using namespace std;
+
+bool fSpentIndex = DEFAULT_SPENTINDEX;
+
+bool UpdateSpentIndex(CTxDB& txdb, const CBlock& block, const CBlockIndex* pindex, bool fConnect)
+{
+    map<uint256, const CTransaction*> mapBlockTx;
+
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+    {
+        uint256 txhash = tx.GetHash();
+
+        if (!tx.IsCoinBase())
+        {
+            for (unsigned int i = 0; i < tx.vin.size(); i++)
+            {
+                const COutPoint& prevout = tx.vin[i].prevout;
+                CSpentIndexKey key(prevout.hash, prevout.n);
+
+                if (!fConnect)
+                {
+                    txdb.EraseSpentIndex(key);
+                    continue;
+                }
+
+                // Outputs of the same block, then the coins view, which still
+                // has every output the block spends
+                CTxOut out;
+                auto it = mapBlockTx.find(prevout.hash);
+                CCoin coin;
+
+                if (it != mapBlockTx.end() && prevout.n < it->second->vout.size())
+                    out = it->second->vout[prevout.n];
+                else if (txdb.GetCoin(prevout, coin))
+                    out = coin.out;
+                else
+                {
+                    return error("%s : cannot find output %s:%u spent by %s", __func__,
+                                 prevout.hash.ToString(), prevout.n, txhash.ToString());
+                }
+
+                unsigned char nType = ADDRESS_NONE;
+                uint160 hashBytes(0);
+                GetAddressKey(out.scriptPubKey, nType, hashBytes);
+
+                if (!txdb.WriteSpentIndex(key, CSpentIndexValue(txhash, i, pindex->nHeight, out.nValue, nType, hashBytes)))
+                    return error("%s : cannot update the spent index", __func__);
+            }
+        }
+
+        mapBlockTx[txhash] = &tx;
+    }
+
+    return true;
+}
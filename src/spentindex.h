@@ -0,0 +1,73 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NEUTRON_SPENTINDEX_H
+#define NEUTRON_SPENTINDEX_H
+
+#include <stdint.h>
+
+#include "serialize.h"
+#include "uint256.h"
+
+class CBlock;
+class CBlockIndex;
+class CTxDB;
+
+/** Maintain the spent index (-spentindex) */
+static const bool DEFAULT_SPENTINDEX = false;
+extern bool fSpentIndex;
+
+/** An output of the best chain that has been spent */
+class CSpentIndexKey
+{
+public:
+    uint256 txid;
+    unsigned int nIndex;
+
+    CSpentIndexKey() : txid(0), nIndex(0) {}
+    CSpentIndexKey(const uint256& txidIn, unsigned int nIndexIn) : txid(txidIn), nIndex(nIndexIn) {}
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(txid);
+        READWRITE(nIndex);
+    )
+};
+
+/** The input that spends it, with the value and address of the output */
+class CSpentIndexValue
+{
+public:
+    uint256 txid;
+    unsigned int nInputIndex;
+    int nHeight;
+    int64_t nValue;
+    unsigned char nAddressType;
+    uint160 addressHash;
+
+    CSpentIndexValue() : txid(0), nInputIndex(0), nHeight(0), nValue(0), nAddressType(0), addressHash(0) {}
+
+    CSpentIndexValue(const uint256& txidIn, unsigned int nInputIndexIn, int nHeightIn, int64_t nValueIn,
+                     unsigned char nAddressTypeIn, const uint160& addressHashIn) :
+        txid(txidIn), nInputIndex(nInputIndexIn), nHeight(nHeightIn), nValue(nValueIn),
+        nAddressType(nAddressTypeIn), addressHash(addressHashIn) {}
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(txid);
+        READWRITE(nInputIndex);
+        READWRITE(nHeight);
+        READWRITE(nValue);
+        READWRITE(nAddressType);
+        READWRITE(addressHash);
+    )
+};
+
+/** Add (fConnect) or remove the spent index records of a block, in the
+ * transaction of txdb. Has to run before the spent outputs leave the coins view.
+ */
+bool UpdateSpentIndex(CTxDB& txdb, const CBlock& block, const CBlockIndex* pindex, bool fConnect);
+
+#endif // NEUTRON_SPENTINDEX_H
@@ -319,6 +319,48 @@ public:
 };
 
 
+/** Read-only stream over a range of memory owned by someone else, for
+ * deserializing without copying the bytes into a CDataStream first.
+ */
+class CBufferReader
+{
+private:
+    const char* pcur;
+    const char* pend;
+
+public:
+    int nType;
+    int nVersion;
+
+    CBufferReader(const char* pbegin, const char* pendIn, int nTypeIn, int nVersionIn) :
+        pcur(pbegin), pend(pendIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    bool empty() const           { return pcur == pend; }
+    size_t size() const          { return pend - pcur; }
+
+    int GetType()                { return nType; }
+    int GetVersion()             { return nVersion; }
+
+    CBufferReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > (size_t) (pend - pcur))
+            throw std::ios_base::failure("CBufferReader::read : end of data");
+
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+        return (*this);
+    }
+
+    template<typename T>
+    CBufferReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+
 /** RAII wrapper for FILE*.
  *
  * Will automatically close the file when it goes out of scope if not null.
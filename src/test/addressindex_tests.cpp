@@ -0,0 +1,146 @@
+#include <boost/test/unit_test.hpp>
+
+#include "addressindex.h"
+#include "main.h"
+#include "timestampindex.h"
+#include "txdb.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(addressindex_tests)
+
+static string KeyBytes(const CAddressIndexKey& key)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << make_pair(string("addr"), key);
+    return ss.str();
+}
+
+BOOST_AUTO_TEST_CASE(key_roundtrip)
+{
+    CAddressIndexKey key(ADDRESS_SCRIPTHASH, uint160(12345), 654321, uint256(777), 3, true);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << key;
+    BOOST_CHECK_EQUAL(ss.size(), key.GetSerializeSize(SER_DISK, CLIENT_VERSION));
+
+    CAddressIndexKey key2;
+    ss >> key2;
+
+    BOOST_CHECK_EQUAL(key2.nType, key.nType);
+    BOOST_CHECK(key2.hashBytes == key.hashBytes);
+    BOOST_CHECK_EQUAL(key2.nHeight, key.nHeight);
+    BOOST_CHECK(key2.txhash == key.txhash);
+    BOOST_CHECK_EQUAL(key2.nIndex, key.nIndex);
+    BOOST_CHECK_EQUAL(key2.fSpending, key.fSpending);
+}
+
+BOOST_AUTO_TEST_CASE(keys_sort_by_height)
+{
+    // LevelDB orders keys bytewise, height ranges are scanned in that order
+    int heights[] = { 0, 1, 255, 256, 65535, 65536, 1000000, 16777216 };
+    string strPrev;
+
+    BOOST_FOREACH(int nHeight, heights)
+    {
+        string strKey = KeyBytes(CAddressIndexKey(ADDRESS_PUBKEYHASH, uint160(1), nHeight, uint256(~0), 0, false));
+        BOOST_CHECK(strPrev < strKey);
+        strPrev = strKey;
+    }
+
+    // The records of one address are contiguous
+    string strOther = KeyBytes(CAddressIndexKey(ADDRESS_PUBKEYHASH, uint160(2), 0, uint256(0), 0, false));
+    BOOST_CHECK(strPrev < strOther);
+}
+
+BOOST_AUTO_TEST_CASE(timestamp_keys_sort_by_time)
+{
+    unsigned int times[] = { 0, 255, 256, 1500000000, 1500000001, 0xffffffff };
+    string strPrev;
+
+    BOOST_FOREACH(unsigned int nTime, times)
+    {
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << make_pair(string("timestamp"), CTimestampIndexKey(nTime, uint256(~0)));
+        BOOST_CHECK(strPrev < ss.str());
+        strPrev = ss.str();
+
+        CTimestampIndexKey key;
+        string strIndex;
+        ss >> strIndex >> key;
+        BOOST_CHECK_EQUAL(key.nTimestamp, nTime);
+        BOOST_CHECK(key.blockHash == uint256(~0));
+    }
+}
+
+static CAddressIndexKey RecordKey(const uint160& hashBytes, int nHeight)
+{
+    return CAddressIndexKey(ADDRESS_PUBKEYHASH, hashBytes, nHeight, uint256(nHeight), 0, false);
+}
+
+BOOST_AUTO_TEST_CASE(cached_records_are_scanned)
+{
+    CTxDB txdb;
+    uint160 hashBytes(0x5a5a5a);
+
+    // Two records on disk, then changes that are still in the write cache
+    BOOST_CHECK(txdb.TxnBegin());
+    BOOST_CHECK(txdb.WriteAddressIndex(RecordKey(hashBytes, 10), 100));
+    BOOST_CHECK(txdb.WriteAddressIndex(RecordKey(hashBytes, 20), 200));
+    BOOST_CHECK(txdb.TxnCommit());
+    BOOST_CHECK(txdb.Flush(true));
+
+    BOOST_CHECK(txdb.TxnBegin());
+    BOOST_CHECK(txdb.EraseAddressIndex(RecordKey(hashBytes, 10)));
+    BOOST_CHECK(txdb.WriteAddressIndex(RecordKey(hashBytes, 15), 150));
+    BOOST_CHECK(txdb.WriteAddressIndex(RecordKey(hashBytes + 1, 12), 1));
+    BOOST_CHECK(txdb.TxnCommit());
+
+    vector<CAddressIndexEntry> vEntries;
+    BOOST_CHECK(txdb.ReadAddressIndex(ADDRESS_PUBKEYHASH, hashBytes, 0, 0, vEntries));
+    BOOST_CHECK_EQUAL(vEntries.size(), 2);
+
+    if (vEntries.size() == 2)
+    {
+        BOOST_CHECK_EQUAL(vEntries[0].first.nHeight, 15);
+        BOOST_CHECK_EQUAL(vEntries[0].second, 150);
+        BOOST_CHECK_EQUAL(vEntries[1].first.nHeight, 20);
+    }
+
+    vEntries.clear();
+    BOOST_CHECK(txdb.ReadAddressIndex(ADDRESS_PUBKEYHASH, hashBytes, 16, 0, vEntries));
+    BOOST_CHECK(vEntries.size() == 1 && vEntries[0].first.nHeight == 20);
+
+    BOOST_CHECK(txdb.Flush(true));
+}
+
+BOOST_AUTO_TEST_CASE(cached_timestamps_in_range)
+{
+    CTxDB txdb;
+
+    BOOST_CHECK(txdb.TxnBegin());
+    BOOST_CHECK(txdb.WriteTimestampIndex(CTimestampIndexKey(4000000100U, uint256(1))));
+    BOOST_CHECK(txdb.WriteTimestampIndex(CTimestampIndexKey(4000000300U, uint256(3))));
+    BOOST_CHECK(txdb.TxnCommit());
+    BOOST_CHECK(txdb.Flush(true));
+
+    BOOST_CHECK(txdb.TxnBegin());
+    BOOST_CHECK(txdb.WriteTimestampIndex(CTimestampIndexKey(4000000200U, uint256(2))));
+    BOOST_CHECK(txdb.WriteTimestampIndex(CTimestampIndexKey(4000000400U, uint256(4))));
+    BOOST_CHECK(txdb.TxnCommit());
+
+    // The end of the range is not included
+    vector<CTimestampIndexKey> vKeys;
+    BOOST_CHECK(txdb.ReadTimestampIndex(4000000150U, 4000000400U, vKeys));
+    BOOST_CHECK_EQUAL(vKeys.size(), 2);
+
+    if (vKeys.size() == 2)
+    {
+        BOOST_CHECK_EQUAL(vKeys[0].nTimestamp, 4000000200U);
+        BOOST_CHECK_EQUAL(vKeys[1].nTimestamp, 4000000300U);
+    }
+
+    BOOST_CHECK(txdb.Flush(true));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,15 @@
+#ifndef BITCOIN_TEST_BENCH_H
+#define BITCOIN_TEST_BENCH_H
+
+#include <boost/test/unit_test.hpp>
+#include <boost/version.hpp>
+
+// Timing cases go in a suite of their own that is left out of the normal
+// run and only runs when selected, e.g. test_bitcoin --run_test=sighash_bench
+#if BOOST_VERSION >= 105900
+#define BOOST_AUTO_BENCH_SUITE(name) BOOST_AUTO_TEST_SUITE(name, *boost::unit_test::disabled())
+#else
+#define BOOST_AUTO_BENCH_SUITE(name) BOOST_AUTO_TEST_SUITE(name)
+#endif
+
+#endif
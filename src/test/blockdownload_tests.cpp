@@ -0,0 +1,175 @@
+#include <boost/test/unit_test.hpp>
+
+#include "blockdownload.h"
+#include "main.h"
+#include "random.h"
+#include "utiltime.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(blockdownload_tests)
+
+BOOST_AUTO_TEST_CASE(nothing_requested)
+{
+    CBlock block;
+    block.hashPrevBlock = uint256(1);
+    block.nTime = 1500000000;
+
+    BOOST_CHECK(!IsBlockInFlight(block.GetHash()));
+    BOOST_CHECK(!MarkBlockReceived(block.GetHash()));
+    BOOST_CHECK_EQUAL(GetBlocksInFlight(0), 0);
+
+    // Blocks nobody asked for go to the orphan pool as before
+    BOOST_CHECK(!StoreDownloadedBlock(block));
+    BOOST_CHECK(!IsBlockInFlight(block.GetHash()));
+    BOOST_CHECK(TakeDownloadedBlock(block.hashPrevBlock) == NULL);
+
+    // Rejecting a block outside the header chain changes nothing
+    BlockDownloadFailed(block.GetHash());
+    BlockDownloadPeerDisconnected(0);
+    BOOST_CHECK_EQUAL(GetBlocksInFlight(0), 0);
+}
+
+// A peer to download from, messages pushed to it go nowhere
+struct CTestPeer
+{
+    CNode node;
+
+    CTestPeer(int nHeight) : node(INVALID_SOCKET, CAddress(CService("127.0.0.1", GetDefaultPort())), "", true)
+    {
+        node.fSuccessfullyConnected = true;
+        node.nServices = NODE_NETWORK;
+        node.nStartingHeight = nHeight;
+
+        // Queued behind this, messages are never written to the missing socket
+        node.vSendMsg.push_back(CSerializeData(1));
+    }
+
+    ~CTestPeer()
+    {
+        BlockDownloadPeerDisconnected(node.GetId());
+    }
+
+    // Whether the download disconnects the peer
+    bool SendRequests()
+    {
+        LOCK(cs_main);
+        SendBlockDownloadRequests(&node);
+        bool fDisconnect = node.fDisconnect;
+        node.fDisconnect = false;
+        return fDisconnect;
+    }
+
+    void ProcessHeaders(const vector<CBlock>& vHeaders)
+    {
+        LOCK(cs_main);
+        ProcessBlockHeaders(&node, vHeaders);
+    }
+};
+
+// Headers of stake blocks on the best block, which only fail once their blocks arrive
+static vector<CBlock> MakeHeaders(unsigned int nCount, uint256 hashPrev)
+{
+    vector<CBlock> vHeaders;
+
+    for (unsigned int i = 0; i < nCount; i++)
+    {
+        CBlock header;
+        header.hashPrevBlock = hashPrev;
+        header.hashMerkleRoot = GetRandHash();
+        header.nTime = pindexBest->nTime + 60 * (i + 1);
+        header.nBits = GetPOSLimit(pindexBest->nHeight + i + 1).GetCompact();
+        header.nNonce = 0;
+        vHeaders.push_back(header);
+        hashPrev = header.GetHash();
+    }
+
+    return vHeaders;
+}
+
+BOOST_AUTO_TEST_CASE(headers_need_work)
+{
+    int nHeight = pindexBest->nHeight;
+    CTestPeer peer(nHeight + 10);
+    peer.SendRequests();
+
+    // A nonce other than 0 claims proof of work, which has to be there
+    vector<CBlock> vHeaders = MakeHeaders(1, pindexBest->GetBlockHash());
+    vHeaders[0].nBits = 0x1c00ffff;
+    vHeaders[0].nNonce = 1;
+    peer.ProcessHeaders(vHeaders);
+    BOOST_CHECK_EQUAL(GetBestHeaderHeight(), nHeight);
+
+    // The same header made as a stake block is checked when the block arrives
+    CTestPeer next(nHeight + 10);
+    next.SendRequests();
+    vHeaders[0].nNonce = 0;
+    next.ProcessHeaders(vHeaders);
+    BOOST_CHECK_EQUAL(GetBestHeaderHeight(), nHeight + 1);
+}
+
+BOOST_AUTO_TEST_CASE(not_found_and_stalling)
+{
+    int nHeight = pindexBest->nHeight;
+    int64_t nNow = GetTime();
+    SetMockTime(nNow);
+
+    CTestPeer announcer(nHeight + 3);
+    CTestPeer other(nHeight + 3);
+
+    announcer.SendRequests();
+    vector<CBlock> vHeaders = MakeHeaders(3, pindexBest->GetBlockHash());
+    announcer.ProcessHeaders(vHeaders);
+    BOOST_CHECK_EQUAL(GetBestHeaderHeight(), nHeight + 3);
+
+    BOOST_CHECK(!other.SendRequests());
+    BOOST_CHECK_EQUAL(GetBlocksInFlight(other.node.GetId()), 3);
+    BOOST_CHECK(IsBlockInFlight(vHeaders[0].GetHash()));
+
+    // A peer that did not announce a block may not have it, ask the announcer
+    BlockNotFound(&other.node, vHeaders[0].GetHash());
+    BOOST_CHECK_EQUAL(GetBlocksInFlight(other.node.GetId()), 2);
+    BOOST_CHECK(!IsBlockInFlight(vHeaders[0].GetHash()));
+
+    BOOST_CHECK(!other.SendRequests());
+    BOOST_CHECK_EQUAL(GetBlocksInFlight(other.node.GetId()), 2);
+    announcer.SendRequests();
+    BOOST_CHECK_EQUAL(GetBlocksInFlight(announcer.node.GetId()), 1);
+
+    // Timing out is only held against the announcer
+    SetMockTime(nNow + BLOCK_DOWNLOAD_TIMEOUT + 1);
+    BOOST_CHECK(!other.SendRequests());
+    BOOST_CHECK_EQUAL(GetBlocksInFlight(other.node.GetId()), 0);
+    BOOST_CHECK(announcer.SendRequests());
+
+    // The announcer not having its own block drops its headers
+    BlockNotFound(&announcer.node, vHeaders[0].GetHash());
+    BOOST_CHECK_EQUAL(GetBestHeaderHeight(), nHeight);
+    BOOST_CHECK_EQUAL(GetBlocksInFlight(announcer.node.GetId()), 0);
+    BOOST_CHECK(!IsBlockInFlight(vHeaders[1].GetHash()));
+
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(announcer_disconnects)
+{
+    int nHeight = pindexBest->nHeight;
+    CTestPeer other(nHeight + 2);
+    vector<CBlock> vHeaders = MakeHeaders(2, pindexBest->GetBlockHash());
+
+    {
+        CTestPeer announcer(nHeight + 2);
+        announcer.SendRequests();
+        announcer.ProcessHeaders(vHeaders);
+        BOOST_CHECK_EQUAL(GetBestHeaderHeight(), nHeight + 2);
+
+        other.SendRequests();
+        BOOST_CHECK_EQUAL(GetBlocksInFlight(other.node.GetId()), 2);
+    }
+
+    // Nothing vouches for the headers any more
+    BOOST_CHECK_EQUAL(GetBestHeaderHeight(), nHeight);
+    BOOST_CHECK_EQUAL(GetBlocksInFlight(other.node.GetId()), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
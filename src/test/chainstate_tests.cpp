@@ -0,0 +1,73 @@
+#include <boost/test/unit_test.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include "chainstate.h"
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(chainstate_tests)
+
+BOOST_AUTO_TEST_CASE(manifest_roundtrip)
+{
+    CChainStateManifest manifest;
+    manifest.hashBestChain = uint256(1234);
+    manifest.nHeight = 1000;
+    manifest.nTime = 1500000000;
+    manifest.nRecords = 42;
+    manifest.vBlockFileSizes.push_back(2000000000);
+    manifest.vBlockFileSizes.push_back(5);
+    manifest.hashContent = uint256(5678);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << manifest;
+
+    CChainStateManifest manifest2;
+    ss >> manifest2;
+
+    BOOST_CHECK_EQUAL(manifest2.nVersion, CHAINSTATE_SNAPSHOT_VERSION);
+    BOOST_CHECK(manifest2.hashBestChain == manifest.hashBestChain);
+    BOOST_CHECK_EQUAL(manifest2.nHeight, 1000);
+    BOOST_CHECK_EQUAL(manifest2.nTime, 1500000000);
+    BOOST_CHECK_EQUAL(manifest2.nRecords, 42U);
+    BOOST_CHECK(manifest2.vBlockFileSizes == manifest.vBlockFileSizes);
+    BOOST_CHECK_EQUAL(manifest2.GetBlockFileBytes(), 2000000005U);
+    BOOST_CHECK(manifest2.hashContent == manifest.hashContent);
+}
+
+BOOST_AUTO_TEST_CASE(dump_and_verify)
+{
+    boost::filesystem::path dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    CChainStateManifest manifest;
+    CChainStateManifest manifest2;
+    string strError;
+
+    BOOST_CHECK(DumpChainState(dir, manifest, strError));
+    BOOST_CHECK(manifest.hashBestChain == hashBestChain);
+    BOOST_CHECK(manifest.nRecords > 0);
+
+    // A directory is never overwritten
+    BOOST_CHECK(!DumpChainState(dir, manifest2, strError));
+
+    // Only a known content hash is accepted
+    BOOST_CHECK(!VerifyChainState(dir, 0, manifest2, strError));
+    BOOST_CHECK(VerifyChainState(dir, manifest.hashContent, manifest2, strError));
+    BOOST_CHECK(manifest2.hashContent == manifest.hashContent);
+
+    // Any change to the records shows up in the content hash
+    FILE* file = fopen((dir / "txdb.dat").string().c_str(), "r+b");
+    BOOST_REQUIRE(file);
+    fseek(file, -1, SEEK_END);
+    int ch = fgetc(file);
+    fseek(file, -1, SEEK_END);
+    fputc(ch ^ 1, file);
+    fclose(file);
+
+    BOOST_CHECK(!VerifyChainState(dir, manifest.hashContent, manifest2, strError));
+
+    boost::filesystem::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
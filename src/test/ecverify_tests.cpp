@@ -0,0 +1,245 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bench.h"
+#include "ecverify.h"
+#include "key.h"
+#include "random.h"
+#include "utiltime.h"
+
+using namespace std;
+
+static const unsigned char ORDER[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE,
+    0xBA, 0xAE, 0xDC, 0xE6, 0xAF, 0x48, 0xA0, 0x3B, 0xBF, 0xD2, 0x5E, 0x8C, 0xD0, 0x36, 0x41, 0x41
+};
+
+// 32 byte big endian values of a DER signature
+static void SplitSig(const vector<unsigned char>& vchSig, vector<unsigned char>& vchR, vector<unsigned char>& vchS)
+{
+    unsigned int nLenR = vchSig[3];
+    unsigned int nLenS = vchSig[5 + nLenR];
+    vector<unsigned char> r(vchSig.begin() + 4, vchSig.begin() + 4 + nLenR);
+    vector<unsigned char> s(vchSig.begin() + 6 + nLenR, vchSig.begin() + 6 + nLenR + nLenS);
+
+    vchR.assign(32, 0);
+    vchS.assign(32, 0);
+    for (unsigned int i = 0; i < r.size() && i < 32; i++)
+        vchR[31 - i] = r[r.size() - 1 - i];
+    for (unsigned int i = 0; i < s.size() && i < 32; i++)
+        vchS[31 - i] = s[s.size() - 1 - i];
+}
+
+static void PushInteger(vector<unsigned char>& vchSig, vector<unsigned char> vch)
+{
+    while (vch.size() > 1 && vch[0] == 0 && !(vch[1] & 0x80))
+        vch.erase(vch.begin());
+    if (vch[0] & 0x80)
+        vch.insert(vch.begin(), 0);
+
+    vchSig.push_back(0x02);
+    vchSig.push_back(vch.size());
+    vchSig.insert(vchSig.end(), vch.begin(), vch.end());
+}
+
+static vector<unsigned char> JoinSig(const vector<unsigned char>& vchR, const vector<unsigned char>& vchS)
+{
+    vector<unsigned char> vchBody;
+    PushInteger(vchBody, vchR);
+    PushInteger(vchBody, vchS);
+
+    vector<unsigned char> vchSig;
+    vchSig.push_back(0x30);
+    vchSig.push_back(vchBody.size());
+    vchSig.insert(vchSig.end(), vchBody.begin(), vchBody.end());
+
+    return vchSig;
+}
+
+// a - b or a + b on 32 byte big endian values, a carry adds a byte in front
+static vector<unsigned char> SubBytes(const vector<unsigned char>& a, const vector<unsigned char>& b)
+{
+    vector<unsigned char> r(32);
+    int nBorrow = 0;
+    for (int i = 31; i >= 0; i--)
+    {
+        int n = a[i] - b[i] - nBorrow;
+        nBorrow = n < 0;
+        r[i] = n & 0xff;
+    }
+    return r;
+}
+
+static vector<unsigned char> AddBytes(const vector<unsigned char>& a, const vector<unsigned char>& b)
+{
+    vector<unsigned char> r(32);
+    int nCarry = 0;
+    for (int i = 31; i >= 0; i--)
+    {
+        int n = a[i] + b[i] + nCarry;
+        nCarry = n >> 8;
+        r[i] = n & 0xff;
+    }
+    if (nCarry)
+        r.insert(r.begin(), 1);
+    return r;
+}
+
+// The native result must be the one OpenSSL gives
+static void CheckSame(const vector<unsigned char>& vchPubKey, const uint256& hash, const vector<unsigned char>& vchSig)
+{
+    CKey key;
+    if (!key.SetPubKey(CPubKey(vchPubKey)))
+    {
+        BOOST_CHECK(!CPubKey(vchPubKey).Verify(hash, vchSig));
+        return;
+    }
+
+    bool fValid = key.VerifyOpenSSL(hash, vchSig);
+    BOOST_CHECK_EQUAL(CPubKey(vchPubKey).Verify(hash, vchSig), fValid);
+    BOOST_CHECK_EQUAL(key.Verify(hash, vchSig), fValid);
+}
+
+static bool IsDecided(const vector<unsigned char>& vchPubKey, const uint256& hash, const vector<unsigned char>& vchSig)
+{
+    bool fValid;
+    return ECDSAVerify(vchPubKey, hash, vchSig, fValid);
+}
+
+BOOST_AUTO_TEST_SUITE(ecverify_tests)
+
+BOOST_AUTO_TEST_CASE(ecverify_matches_openssl)
+{
+    seed_insecure_rand(false);
+    vector<unsigned char> vchOrder(ORDER, ORDER + 32);
+    vector<unsigned char> vchZero(32, 0);
+
+    for (int i = 0; i < 200; i++)
+    {
+        CKey key;
+        key.MakeNewKey(i % 2);
+        vector<unsigned char> vchPubKey = key.GetPubKey().vchPubKey;
+        uint256 hash = GetRandHash();
+        if (i % 10 == 0)
+            hash = ~uint256(0);
+
+        vector<unsigned char> vchSig;
+        BOOST_CHECK(key.Sign(hash, vchSig));
+        BOOST_CHECK(IsDecided(vchPubKey, hash, vchSig));
+        BOOST_CHECK(CPubKey(vchPubKey).Verify(hash, vchSig));
+        CheckSame(vchPubKey, hash, vchSig);
+
+        // Any changed bit of the signature or the hash
+        vector<unsigned char> vchTampered(vchSig);
+        vchTampered[4 + insecure_rand() % (vchSig.size() - 4)] ^= 1 << (insecure_rand() % 8);
+        CheckSame(vchPubKey, hash, vchTampered);
+
+        uint256 hashTampered(hash);
+        *(hashTampered.begin() + insecure_rand() % 32) ^= 1 << (insecure_rand() % 8);
+        BOOST_CHECK(IsDecided(vchPubKey, hashTampered, vchSig));
+        CheckSame(vchPubKey, hashTampered, vchSig);
+
+        // Values around the group order
+        vector<unsigned char> vchR, vchS;
+        SplitSig(vchSig, vchR, vchS);
+
+        vector<unsigned char> vchHighS = JoinSig(vchR, SubBytes(vchOrder, vchS));
+        BOOST_CHECK(IsDecided(vchPubKey, hash, vchHighS));
+        BOOST_CHECK(CPubKey(vchPubKey).Verify(hash, vchHighS));
+        CheckSame(vchPubKey, hash, vchHighS);
+
+        CheckSame(vchPubKey, hash, JoinSig(vchZero, vchS));
+        CheckSame(vchPubKey, hash, JoinSig(vchR, vchZero));
+        CheckSame(vchPubKey, hash, JoinSig(vchOrder, vchS));
+        CheckSame(vchPubKey, hash, JoinSig(vchR, vchOrder));
+        CheckSame(vchPubKey, hash, JoinSig(AddBytes(vchR, vchOrder), vchS));
+
+        // Encodings left to OpenSSL
+        vector<unsigned char> vchTrailing(vchSig);
+        vchTrailing.push_back(0);
+        BOOST_CHECK(!IsDecided(vchPubKey, hash, vchTrailing));
+        CheckSame(vchPubKey, hash, vchTrailing);
+
+        vector<unsigned char> vchPadded(vchSig);
+        vchPadded.insert(vchPadded.begin() + 4, 0);
+        vchPadded[1]++;
+        vchPadded[3]++;
+        BOOST_CHECK(!IsDecided(vchPubKey, hash, vchPadded));
+        CheckSame(vchPubKey, hash, vchPadded);
+
+        // Public keys that are not on the curve, or not in a plain encoding
+        vector<unsigned char> vchOffCurve(vchPubKey);
+        vchOffCurve.back() ^= 1;
+        CheckSame(vchOffCurve, hash, vchSig);
+
+        vector<unsigned char> vchOther(vchPubKey);
+        if (vchOther.size() == 33)
+            vchOther[0] ^= 1;
+        else
+            vchOther[0] = 0x06 | (vchOther[64] & 1);
+        CheckSame(vchOther, hash, vchSig);
+    }
+
+    CKey key;
+    key.MakeNewKey(true);
+    uint256 hash = GetRandHash();
+    vector<unsigned char> vchSig;
+    key.Sign(hash, vchSig);
+
+    vector<unsigned char> vchLargeX(33, 0xff);
+    vchLargeX[0] = 0x02;
+    BOOST_CHECK(!IsDecided(vchLargeX, hash, vchSig));
+    BOOST_CHECK(!CPubKey(vchLargeX).Verify(hash, vchSig));
+    BOOST_CHECK(!CPubKey(key.GetPubKey()).Verify(hash, vector<unsigned char>()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_BENCH_SUITE(ecverify_bench)
+
+BOOST_AUTO_TEST_CASE(ecverify_benchmark)
+{
+    static const unsigned int nKeys = 500;
+
+    vector<CPubKey> vPubKeys;
+    vector<uint256> vHashes;
+    vector<vector<unsigned char> > vSigs;
+
+    for (unsigned int i = 0; i < nKeys; i++)
+    {
+        CKey key;
+        key.MakeNewKey(true);
+        vPubKeys.push_back(key.GetPubKey());
+        vHashes.push_back(GetRandHash());
+        vSigs.push_back(vector<unsigned char>());
+        key.Sign(vHashes.back(), vSigs.back());
+    }
+
+    // As CheckSig() did, with a key set up for every signature
+    int64_t nStart = GetTimeMicros();
+    unsigned int nValidOld = 0;
+
+    for (unsigned int i = 0; i < nKeys; i++)
+    {
+        CKey key;
+        if (key.SetPubKey(vPubKeys[i]) && key.VerifyOpenSSL(vHashes[i], vSigs[i]))
+            nValidOld++;
+    }
+
+    int64_t nOld = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    unsigned int nValid = 0;
+
+    for (unsigned int i = 0; i < nKeys; i++)
+    {
+        if (vPubKeys[i].Verify(vHashes[i], vSigs[i]))
+            nValid++;
+    }
+
+    int64_t nNew = GetTimeMicros() - nStart;
+
+    BOOST_TEST_MESSAGE("Verifying " << nKeys << " signatures: " << nOld << "us OpenSSL, " << nNew << "us native");
+    BOOST_CHECK_EQUAL(nValidOld, nKeys);
+    BOOST_CHECK_EQUAL(nValid, nKeys);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
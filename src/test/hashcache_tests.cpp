@@ -0,0 +1,140 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bench.h"
+#include "main.h"
+#include "version.h"
+
+using namespace std;
+
+static CBlock MakeBlock(unsigned int nTx)
+{
+    CBlock block;
+    block.nTime = 1500000000;
+    block.nBits = 0x1e0fffff;
+
+    CTransaction txCoinbase;
+    txCoinbase.nTime = block.nTime;
+    txCoinbase.vin.resize(1);
+    txCoinbase.vin[0].prevout.SetNull();
+    txCoinbase.vin[0].scriptSig = CScript() << 1 << 2;
+    txCoinbase.vout.resize(1);
+    txCoinbase.vout[0].nValue = 1;
+    block.vtx.push_back(txCoinbase);
+
+    for (unsigned int i = 1; i < nTx; i++)
+    {
+        CTransaction tx;
+        tx.nTime = block.nTime;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(uint256(i), 0);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = i;
+        block.vtx.push_back(tx);
+    }
+
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    return block;
+}
+
+// The hash lookups connecting a block does for each transaction after
+// CheckBlock(): CalculateBlockAmounts(), ConnectBlock()'s queued changes,
+// SyncWithWallets() and the memory pool removal
+static void ConnectLookups(const CBlock& block)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            tx.GetHash();
+    }
+
+    block.GetHash();
+}
+
+BOOST_AUTO_TEST_SUITE(hashcache_tests)
+
+BOOST_AUTO_TEST_CASE(hash_cache_invalidation)
+{
+    CBlock block = MakeBlock(3);
+    uint256 hashBlock = block.GetHash();
+    uint256 hashTx = block.vtx[1].GetHash();
+
+    // Checking leaves the hashes alone, the owner of the block caches them
+    BOOST_CHECK(block.CheckBlock());
+    BOOST_CHECK(!block.hashCached.IsSet() && !block.vtx[1].hashCached.IsSet());
+
+    block.CacheHashes();
+    BOOST_CHECK(block.hashCached.IsSet() && block.vtx[1].hashCached.IsSet());
+    BOOST_CHECK(block.GetHash() == hashBlock);
+    BOOST_CHECK(block.vtx[1].GetHash() == hashTx);
+
+    // Copies drop the hashes and the check, so a changed copy is hashed and
+    // checked again
+    CBlock blockCopy = block;
+    BOOST_CHECK(!blockCopy.hashCached.IsSet() && !blockCopy.vtx[1].hashCached.IsSet());
+    BOOST_CHECK(!blockCopy.fChecked.IsSet());
+
+    blockCopy.nNonce++;
+    blockCopy.vtx[1].vout[0].nValue++;
+    BOOST_CHECK(blockCopy.GetHash() != hashBlock);
+    BOOST_CHECK(blockCopy.vtx[1].GetHash() != hashTx);
+    BOOST_CHECK(!blockCopy.CheckBlock());
+
+    CTransaction txCopy;
+    txCopy = block.vtx[1];
+    BOOST_CHECK(!txCopy.hashCached.IsSet() && txCopy.GetHash() == hashTx);
+
+    // Sharing the finished block keeps them without hashing again
+    uint64_t nStart = nHashesComputed;
+    std::shared_ptr<CBlock> blockShared = block.CopyWithHashes();
+    blockShared->CacheHashes();
+    BOOST_CHECK_EQUAL(nHashesComputed - nStart, 0);
+    BOOST_CHECK(blockShared->GetHash() == hashBlock);
+    BOOST_CHECK(blockShared->vtx[1].GetHash() == hashTx);
+
+    // Reading them back in computes them again
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    CBlock blockRead;
+    ss >> blockRead;
+    BOOST_CHECK(!blockRead.hashCached.IsSet() && !blockRead.vtx[1].hashCached.IsSet());
+    BOOST_CHECK(blockRead.GetHash() == hashBlock);
+    BOOST_CHECK(blockRead.vtx[1].GetHash() == hashTx);
+
+    txCopy.CacheHash();
+    txCopy.SetNull();
+    BOOST_CHECK(!txCopy.hashCached.IsSet());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_BENCH_SUITE(hashcache_bench)
+
+BOOST_AUTO_TEST_CASE(hash_cache_benchmark)
+{
+    // About as many transactions as a full block holds
+    static const unsigned int nTx = 2000;
+
+    // Without CacheHashes() every lookup hashes again, as before
+    CBlock block = MakeBlock(nTx);
+    uint64_t nStart = nHashesComputed;
+    BOOST_CHECK(block.CheckBlock(false));
+    ConnectLookups(block);
+    uint64_t nUncached = nHashesComputed - nStart;
+
+    CBlock blockCached = MakeBlock(nTx);
+    nStart = nHashesComputed;
+    blockCached.CacheHashes();
+    BOOST_CHECK(blockCached.CheckBlock());
+    ConnectLookups(blockCached);
+    uint64_t nCached = nHashesComputed - nStart;
+
+    BOOST_TEST_MESSAGE("SHA-256d per block connect of " << nTx << " transactions: "
+                       << nUncached << " uncached, " << nCached << " cached");
+
+    // Each transaction and the header are hashed once, by CacheHashes()
+    BOOST_CHECK_EQUAL(nUncached, 5 * nTx + 1);
+    BOOST_CHECK_EQUAL(nCached, nTx + 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,98 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "orphanblocks.h"
+#include "version.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(orphanblocks_tests)
+
+static CBlock MakeBlock(const uint256& hashPrev, unsigned int nNonce)
+{
+    CBlock block;
+    block.hashPrevBlock = hashPrev;
+    block.nTime = 1500000000;
+    block.nNonce = nNonce;
+
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(orphan_roots)
+{
+    COrphanBlockPool pool(1048576);
+    uint256 hashMissing(1);
+
+    CBlock block1 = MakeBlock(hashMissing, 1);
+    CBlock block2 = MakeBlock(block1.GetHash(), 2);
+    CBlock block3 = MakeBlock(block2.GetHash(), 3);
+
+    // Received newest first, every arrival moves the root back
+    pool.Add(block3, 1);
+    BOOST_CHECK(pool.GetRoot(block3.GetHash()) == block3.GetHash());
+    pool.Add(block2, 1);
+    pool.Add(block1, 2);
+
+    BOOST_CHECK(pool.GetRoot(block3.GetHash()) == block1.GetHash());
+    BOOST_CHECK(pool.GetRoot(block2.GetHash()) == block1.GetHash());
+    BOOST_CHECK(pool.GetWanted(block3.GetHash()) == hashMissing);
+    BOOST_CHECK(pool.HasChildren(block1.GetHash()));
+    BOOST_CHECK(pool.GetRoot(hashMissing) == 0);
+
+    // Connecting the root leaves the rest of the chain rooted at its child
+    vector<CBlock*> vBlocks = pool.TakeChildren(hashMissing);
+    BOOST_REQUIRE_EQUAL(vBlocks.size(), 1U);
+    BOOST_CHECK(vBlocks[0]->GetHash() == block1.GetHash());
+    delete vBlocks[0];
+
+    BOOST_CHECK(!pool.Contains(block1.GetHash()));
+    BOOST_CHECK(pool.GetRoot(block3.GetHash()) == block2.GetHash());
+    BOOST_CHECK(pool.GetWanted(block3.GetHash()) == block1.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(orphan_eviction)
+{
+    size_t nSize = ::GetSerializeSize(MakeBlock(0, 0), SER_NETWORK, PROTOCOL_VERSION);
+    COrphanBlockPool pool(3 * nSize);
+
+    CBlock blockA1 = MakeBlock(uint256(1), 1);
+    CBlock blockA2 = MakeBlock(blockA1.GetHash(), 2);
+    CBlock blockB1 = MakeBlock(uint256(2), 3);
+    CBlock blockB2 = MakeBlock(uint256(3), 4);
+    CBlock blockC1 = MakeBlock(uint256(4), 5);
+    CBlock blockC2 = MakeBlock(uint256(5), 6);
+
+    pool.Add(blockA1, 1);
+    pool.Add(blockB1, 2);
+    pool.Add(blockB2, 2);
+
+    // Peer 2 holds the most, one of its orphans makes room
+    pool.Add(blockC1, 3);
+
+    size_t nEntries, nBytes, nMaxBytes;
+    uint64_t nEvicted;
+    pool.GetStats(nEntries, nBytes, nMaxBytes, nEvicted);
+
+    BOOST_CHECK(pool.Contains(blockA1.GetHash()));
+    BOOST_CHECK(pool.Contains(blockC1.GetHash()));
+    BOOST_CHECK(pool.Contains(blockB1.GetHash()) != pool.Contains(blockB2.GetHash()));
+    BOOST_CHECK_EQUAL(nEntries, 3U);
+    BOOST_CHECK_EQUAL(nBytes, 3 * nSize);
+    BOOST_CHECK_EQUAL(nEvicted, 1U);
+
+    // The orphans built on an evicted one go along with it
+    pool.SetMaxBytes(4 * nSize);
+    pool.Add(blockA2, 1);
+    pool.SetMaxBytes(3 * nSize);
+    pool.Add(blockC2, 3);
+
+    pool.GetStats(nEntries, nBytes, nMaxBytes, nEvicted);
+
+    BOOST_CHECK(!pool.Contains(blockA1.GetHash()));
+    BOOST_CHECK(!pool.Contains(blockA2.GetHash()));
+    BOOST_CHECK(pool.Contains(blockC2.GetHash()));
+    BOOST_CHECK_EQUAL(nEntries, 3U);
+    BOOST_CHECK_EQUAL(nEvicted, 3U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,49 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "prune.h"
+#include "txdb.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(prune_tests)
+
+BOOST_AUTO_TEST_CASE(nothing_pruned)
+{
+    BOOST_CHECK(!HavePrunedBlockFiles());
+    BOOST_CHECK(!IsBlockFilePruned(1));
+
+    CBlock block;
+    BOOST_CHECK(!ReadPrunedBlockHeader(1, 8, block));
+}
+
+BOOST_AUTO_TEST_CASE(undo_roundtrip)
+{
+    CTransaction tx;
+    tx.nTime = 1500000000;
+    tx.vout.resize(2);
+    tx.vout[1].nValue = 5 * COIN;
+    tx.vout[1].scriptPubKey = CScript() << OP_TRUE;
+
+    vector<pair<COutPoint, CCoin> > vUndo;
+    vUndo.push_back(make_pair(COutPoint(uint256(1), 1), CCoin(tx, 1, 100)));
+    vUndo.push_back(make_pair(COutPoint(uint256(2), 0), CCoin()));
+
+    CTxDB txdb;
+    uint256 hashBlock(12345);
+    BOOST_CHECK(txdb.WriteBlockUndo(hashBlock, vUndo));
+
+    vector<pair<COutPoint, CCoin> > vRead;
+    BOOST_CHECK(txdb.ReadBlockUndo(hashBlock, vRead));
+    BOOST_CHECK_EQUAL(vRead.size(), 2U);
+    BOOST_CHECK(vRead[0].first == vUndo[0].first);
+    BOOST_CHECK(vRead[0].second.out == tx.vout[1]);
+    BOOST_CHECK_EQUAL(vRead[0].second.nTime, tx.nTime);
+    BOOST_CHECK_EQUAL(vRead[0].second.nHeight, 100);
+    BOOST_CHECK(vRead[1].first == vUndo[1].first);
+
+    BOOST_CHECK(txdb.EraseBlockUndo(hashBlock));
+    BOOST_CHECK(!txdb.ReadBlockUndo(hashBlock, vRead));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
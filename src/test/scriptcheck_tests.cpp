@@ -0,0 +1,58 @@
+#include <boost/test/unit_test.hpp>
+
+#include <boost/thread.hpp>
+
+#include "main.h"
+#include "scriptcheck.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(scriptcheck_tests)
+
+static bool VerifyWith(CScriptCheckQueue* pqueue, const CTransaction& tx, unsigned int nChecks, int nFailAt)
+{
+    CScriptCheckControl control(pqueue);
+    vector<CScriptCheck> vChecks;
+
+    for (unsigned int i = 0; i < nChecks; i++)
+    {
+        vChecks.push_back(CScriptCheck(CScript() << ((int) i == nFailAt ? OP_FALSE : OP_TRUE), tx, 0, 0));
+
+        // Added in pieces like ConnectBlock adds each transaction's checks
+        if (vChecks.size() == 7)
+            control.Add(vChecks);
+    }
+
+    control.Add(vChecks);
+    BOOST_CHECK(vChecks.empty());
+
+    return control.Wait();
+}
+
+BOOST_AUTO_TEST_CASE(queue_results)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+
+    CScriptCheckQueue queue;
+    boost::thread_group threadGroup;
+
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread(boost::bind(&CScriptCheckQueue::Thread, &queue));
+
+    for (int nRound = 0; nRound < 10; nRound++)
+    {
+        BOOST_CHECK(VerifyWith(&queue, tx, 1000, -1));
+        BOOST_CHECK(!VerifyWith(&queue, tx, 1000, nRound * 97));
+        BOOST_CHECK(VerifyWith(&queue, tx, 0, -1));
+    }
+
+    // Without a queue the checks run on the calling thread
+    BOOST_CHECK(VerifyWith(NULL, tx, 100, -1));
+    BOOST_CHECK(!VerifyWith(NULL, tx, 100, 50));
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,107 @@
+#include <boost/test/unit_test.hpp>
+
+#include <boost/thread.hpp>
+
+#include "sigcache.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(sigcache_tests)
+
+static vector<unsigned char> MakeSig(unsigned int n)
+{
+    vector<unsigned char> vchSig(72, 0x30);
+    vchSig[1] = n & 0xff;
+    vchSig[2] = (n >> 8) & 0xff;
+    vchSig[3] = (n >> 16) & 0xff;
+
+    return vchSig;
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_lookup)
+{
+    CSignatureCache cache(1048576);
+    vector<unsigned char> vchPubKey(33, 0x02);
+    uint256 sighash(1);
+
+    BOOST_CHECK(!cache.Get(sighash, MakeSig(1), vchPubKey));
+    cache.Set(sighash, MakeSig(1), vchPubKey);
+    BOOST_CHECK(cache.Get(sighash, MakeSig(1), vchPubKey));
+
+    // Any part of the entry differing is a miss
+    BOOST_CHECK(!cache.Get(uint256(2), MakeSig(1), vchPubKey));
+    BOOST_CHECK(!cache.Get(sighash, MakeSig(2), vchPubKey));
+    BOOST_CHECK(!cache.Get(sighash, MakeSig(1), vector<unsigned char>(33, 0x03)));
+
+    uint64_t nHits, nMisses, nEvicted;
+    size_t nEntries, nMaxEntries, nMaxBytes;
+    cache.GetStats(nHits, nMisses, nEvicted, nEntries, nMaxEntries, nMaxBytes);
+
+    BOOST_CHECK_EQUAL(nHits, 1U);
+    BOOST_CHECK_EQUAL(nMisses, 4U);
+    BOOST_CHECK_EQUAL(nEntries, 1U);
+    BOOST_CHECK_EQUAL(nMaxEntries, 1048576U / 32);
+
+    // Without room nothing is kept
+    cache.SetMaxBytes(0);
+    cache.Set(sighash, MakeSig(1), vchPubKey);
+    BOOST_CHECK(!cache.Get(sighash, MakeSig(1), vchPubKey));
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_bounded)
+{
+    CSignatureCache cache(4096);
+    vector<unsigned char> vchPubKey(33, 0x02);
+
+    for (unsigned int i = 0; i < 10000; i++)
+        cache.Set(uint256(i), MakeSig(i), vchPubKey);
+
+    uint64_t nHits, nMisses, nEvicted;
+    size_t nEntries, nMaxEntries, nMaxBytes;
+    cache.GetStats(nHits, nMisses, nEvicted, nEntries, nMaxEntries, nMaxBytes);
+
+    BOOST_CHECK_EQUAL(nMaxEntries, 128U);
+    BOOST_CHECK(nEntries <= nMaxEntries);
+    BOOST_CHECK_EQUAL(nEntries + nEvicted, 10000U);
+
+    // The latest entry is always kept
+    BOOST_CHECK(cache.Get(uint256(9999), MakeSig(9999), vchPubKey));
+}
+
+static void SetAndGet(CSignatureCache* pcache, unsigned int nThread, unsigned int* pnFound)
+{
+    vector<unsigned char> vchPubKey(33, nThread);
+
+    for (unsigned int i = 0; i < 5000; i++)
+    {
+        pcache->Set(uint256(i), MakeSig(i), vchPubKey);
+
+        if (pcache->Get(uint256(i), MakeSig(i), vchPubKey))
+            (*pnFound)++;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_threads)
+{
+    CSignatureCache cache(16 * 1048576);
+    boost::thread_group threadGroup;
+    unsigned int nFound[4] = {0, 0, 0, 0};
+
+    for (unsigned int i = 0; i < 4; i++)
+        threadGroup.create_thread(boost::bind(&SetAndGet, &cache, i, &nFound[i]));
+
+    threadGroup.join_all();
+
+    uint64_t nHits, nMisses, nEvicted;
+    size_t nEntries, nMaxEntries, nMaxBytes;
+    cache.GetStats(nHits, nMisses, nEvicted, nEntries, nMaxEntries, nMaxBytes);
+
+    BOOST_CHECK_EQUAL(nHits, nFound[0] + nFound[1] + nFound[2] + nFound[3]);
+    BOOST_CHECK_EQUAL(nHits + nMisses, 20000U);
+    BOOST_CHECK_EQUAL(nEntries + nEvicted, 20000U);
+
+    // Only an entry evicted by another thread in between can be missing
+    BOOST_CHECK(nHits + nEvicted >= 20000U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,161 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bench.h"
+#include "main.h"
+#include "random.h"
+#include "script.h"
+#include "utiltime.h"
+
+using namespace std;
+
+extern uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+
+// The copying SignatureHash() the serializer replaced, as reference
+static uint256 SignatureHashOld(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+{
+    if (nIn >= txTo.vin.size())
+        return 1;
+
+    CTransaction txTmp(txTo);
+
+    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+
+    for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+        txTmp.vin[i].scriptSig = CScript();
+    txTmp.vin[nIn].scriptSig = scriptCode;
+
+    if ((nHashType & 0x1f) == SIGHASH_NONE)
+    {
+        txTmp.vout.clear();
+
+        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+            if (i != nIn)
+                txTmp.vin[i].nSequence = 0;
+    }
+    else if ((nHashType & 0x1f) == SIGHASH_SINGLE)
+    {
+        unsigned int nOut = nIn;
+        if (nOut >= txTmp.vout.size())
+            return 1;
+        txTmp.vout.resize(nOut+1);
+        for (unsigned int i = 0; i < nOut; i++)
+            txTmp.vout[i].SetNull();
+
+        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+            if (i != nIn)
+                txTmp.vin[i].nSequence = 0;
+    }
+
+    if (nHashType & SIGHASH_ANYONECANPAY)
+    {
+        txTmp.vin[0] = txTmp.vin[nIn];
+        txTmp.vin.resize(1);
+    }
+
+    CDataStream ss(SER_GETHASH, 0);
+    ss.reserve(10000);
+    ss << txTmp << nHashType;
+    return Hash(ss.begin(), ss.end());
+}
+
+static void RandomScript(CScript& script)
+{
+    static const opcodetype oplist[] = {OP_FALSE, OP_1, OP_2, OP_3, OP_CHECKSIG, OP_IF, OP_VERIF, OP_RETURN, OP_CODESEPARATOR};
+    script = CScript();
+    int ops = (insecure_rand() % 10);
+    for (int i = 0; i < ops; i++)
+        script << oplist[insecure_rand() % (sizeof(oplist)/sizeof(oplist[0]))];
+}
+
+static void RandomTransaction(CTransaction& tx, unsigned int nInputs, unsigned int nOutputs)
+{
+    tx.nVersion = insecure_rand();
+    tx.nTime = insecure_rand();
+    tx.vin.clear();
+    tx.vout.clear();
+    tx.nLockTime = (insecure_rand() % 2) ? insecure_rand() : 0;
+
+    for (unsigned int in = 0; in < nInputs; in++)
+    {
+        tx.vin.push_back(CTxIn());
+        CTxIn& txin = tx.vin.back();
+        txin.prevout.hash = GetRandHash();
+        txin.prevout.n = insecure_rand() % 4;
+        RandomScript(txin.scriptSig);
+        txin.nSequence = (insecure_rand() % 2) ? insecure_rand() : (unsigned int) -1;
+    }
+
+    for (unsigned int out = 0; out < nOutputs; out++)
+    {
+        tx.vout.push_back(CTxOut());
+        CTxOut& txout = tx.vout.back();
+        txout.nValue = insecure_rand() % 100000000;
+        RandomScript(txout.scriptPubKey);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(sighash_tests)
+
+BOOST_AUTO_TEST_CASE(sighash_matches_copy)
+{
+    seed_insecure_rand(false);
+
+    for (int i = 0; i < 20000; i++)
+    {
+        int nHashType = insecure_rand();
+        CTransaction txTo;
+        RandomTransaction(txTo, 1 + insecure_rand() % 4, insecure_rand() % 4);
+        CScript scriptCode;
+        RandomScript(scriptCode);
+        unsigned int nIn = insecure_rand() % txTo.vin.size();
+
+        BOOST_CHECK(SignatureHash(scriptCode, txTo, nIn, nHashType) == SignatureHashOld(scriptCode, txTo, nIn, nHashType));
+    }
+
+    // Separators ahead of a push that runs past the end of the script
+    CTransaction txTo;
+    RandomTransaction(txTo, 2, 2);
+    CScript scriptCode = CScript() << OP_CODESEPARATOR << OP_1 << OP_CODESEPARATOR << OP_CODESEPARATOR;
+    scriptCode.push_back(OP_PUSHDATA1);
+    scriptCode.push_back(10);
+    scriptCode.push_back(OP_CODESEPARATOR);
+
+    for (int nHashType = 0; nHashType < 0x100; nHashType++)
+    {
+        BOOST_CHECK(SignatureHash(scriptCode, txTo, 1, nHashType) == SignatureHashOld(scriptCode, txTo, 1, nHashType));
+        BOOST_CHECK(SignatureHash(scriptCode, txTo, 2, nHashType) == 1);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_BENCH_SUITE(sighash_bench)
+
+BOOST_AUTO_TEST_CASE(sighash_benchmark)
+{
+    static const unsigned int nInputs = 1000;
+
+    CTransaction txTo;
+    RandomTransaction(txTo, nInputs, 2);
+    CScript scriptCode = CScript() << OP_DUP << OP_HASH160 << vector<unsigned char>(20, 0x11) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    // Every input signed, as when verifying the whole transaction
+    vector<uint256> vHashes(nInputs), vHashesOld(nInputs);
+    int64_t nStart = GetTimeMicros();
+
+    for (unsigned int i = 0; i < nInputs; i++)
+        vHashesOld[i] = SignatureHashOld(scriptCode, txTo, i, SIGHASH_ALL);
+
+    int64_t nOld = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+
+    for (unsigned int i = 0; i < nInputs; i++)
+        vHashes[i] = SignatureHash(scriptCode, txTo, i, SIGHASH_ALL);
+
+    int64_t nNew = GetTimeMicros() - nStart;
+
+    BOOST_TEST_MESSAGE("SignatureHash of " << nInputs << " inputs: " << nOld << "us copying, " << nNew << "us streaming");
+    BOOST_CHECK(vHashes == vHashesOld);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
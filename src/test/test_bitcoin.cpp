@@ -3,6 +3,7 @@
 
 #include "db.h"
 #include "main.h"
+#include "txdb.h"
 #include "wallet.h"
 
 CWallet* pwalletMain;
@@ -16,6 +17,7 @@ struct TestingSetup {
         fPrintToDebugger = true; // don't want to write to debug.log file
         noui_connect();
         bitdb.MakeMock();
+        SetTxDBBackend("memory");
         LoadBlockIndex(true);
         bool fFirstRun;
         pwalletMain = new CWallet("wallet.dat");
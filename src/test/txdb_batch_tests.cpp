@@ -0,0 +1,192 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bench.h"
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+#include "utiltime.h"
+
+using namespace std;
+
+// Answers lookups by replaying a whole leveldb::WriteBatch, the way reads inside
+// a transaction were served before CTxDBBatch kept an index of its keys
+class CBatchScanner : public leveldb::WriteBatch::Handler
+{
+public:
+    string needle;
+    bool* deleted;
+    string* foundValue;
+    bool foundEntry;
+
+    CBatchScanner() : foundEntry(false) {}
+
+    virtual void Put(const leveldb::Slice& key, const leveldb::Slice& value)
+    {
+        if (key.ToString() == needle)
+        {
+            foundEntry = true;
+            *deleted = false;
+            *foundValue = value.ToString();
+        }
+    }
+
+    virtual void Delete(const leveldb::Slice& key)
+    {
+        if (key.ToString() == needle)
+        {
+            foundEntry = true;
+            *deleted = true;
+        }
+    }
+};
+
+static bool ScanLookup(const leveldb::WriteBatch& batch, const string& key, string* value, bool* deleted)
+{
+    *deleted = false;
+    CBatchScanner scanner;
+    scanner.needle = key;
+    scanner.deleted = deleted;
+    scanner.foundValue = value;
+    batch.Iterate(&scanner);
+
+    return scanner.foundEntry;
+}
+
+// Applies the same change to both representations
+static void Put(CTxDBBatch& batch, leveldb::WriteBatch& batchScan, const string& key, const string& value)
+{
+    batch.Put(key, value);
+    batchScan.Put(key, value);
+}
+
+static void Delete(CTxDBBatch& batch, leveldb::WriteBatch& batchScan, const string& key)
+{
+    batch.Delete(key);
+    batchScan.Delete(key);
+}
+
+static string TxIndexKey(const uint256& hash)
+{
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << make_pair(string("tx"), hash);
+    return ssKey.str();
+}
+
+// Replays the txdb traffic ConnectBlock generates for a block in which every
+// transaction spends the first output of the one before it: read the previous
+// transaction's index entry, mark the output spent, then add the new entry.
+// Returns the number of index entries that were found in the batch.
+static unsigned int ConnectSyntheticBlock(CTxDBBatch& batch, leveldb::WriteBatch& batchScan,
+                                          unsigned int nTx, bool fOverlay)
+{
+    unsigned int nFound = 0;
+    uint256 hashPrev = 0;
+
+    for (unsigned int i = 0; i < nTx; i++)
+    {
+        uint256 hash = Hash(BEGIN(i), END(i));
+        CDiskTxPos posThisTx(1, 1000, 100 + i * 250);
+
+        if (i > 0)
+        {
+            string strKey = TxIndexKey(hashPrev);
+            string strValue;
+            bool fDeleted = false;
+            bool fFound = fOverlay ? batch.Lookup(strKey, &strValue, &fDeleted) :
+                                     ScanLookup(batchScan, strKey, &strValue, &fDeleted);
+
+            if (fFound && !fDeleted)
+            {
+                CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+                CTxIndex txindex;
+                ssValue >> txindex;
+                txindex.vSpent[0] = posThisTx;
+
+                CDataStream ssNew(SER_DISK, CLIENT_VERSION);
+                ssNew << txindex;
+
+                if (fOverlay)
+                    batch.Put(strKey, ssNew.str());
+                else
+                    batchScan.Put(strKey, ssNew.str());
+
+                nFound++;
+            }
+        }
+
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue << CTxIndex(posThisTx, 2);
+
+        if (fOverlay)
+            batch.Put(TxIndexKey(hash), ssValue.str());
+        else
+            batchScan.Put(TxIndexKey(hash), ssValue.str());
+
+        hashPrev = hash;
+    }
+
+    return nFound;
+}
+
+BOOST_AUTO_TEST_SUITE(txdb_batch_tests)
+
+BOOST_AUTO_TEST_CASE(overlay_matches_batch)
+{
+    CTxDBBatch batch;
+    leveldb::WriteBatch batchScan;
+    string strValue;
+    bool fDeleted;
+
+    Put(batch, batchScan, "a", "1");
+    Put(batch, batchScan, "b", "2");
+    Delete(batch, batchScan, "a");
+    Put(batch, batchScan, "b", "3");
+    Delete(batch, batchScan, "c");
+    Put(batch, batchScan, "c", "4");
+
+    const char* keys[] = { "a", "b", "c", "d" };
+
+    BOOST_FOREACH(const char* key, keys)
+    {
+        string strOverlay, strScan;
+        bool fOverlayDeleted, fScanDeleted;
+
+        BOOST_CHECK_EQUAL(batch.Lookup(key, &strOverlay, &fOverlayDeleted),
+                          ScanLookup(batchScan, key, &strScan, &fScanDeleted));
+        BOOST_CHECK_EQUAL(fOverlayDeleted, fScanDeleted);
+        BOOST_CHECK_EQUAL(strOverlay, strScan);
+    }
+
+    BOOST_CHECK(batch.Lookup("a", &strValue, &fDeleted) && fDeleted);
+    BOOST_CHECK(batch.Lookup("b", &strValue, &fDeleted) && !fDeleted && strValue == "3");
+    BOOST_CHECK(!batch.Lookup("d", &strValue, &fDeleted));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_BENCH_SUITE(txdb_batch_bench)
+
+BOOST_AUTO_TEST_CASE(connect_block_benchmark)
+{
+    const unsigned int nTx = 5000;
+
+    CTxDBBatch batch;
+    leveldb::WriteBatch batchScan;
+
+    int64_t nStart = GetTimeMicros();
+    unsigned int nFoundScan = ConnectSyntheticBlock(batch, batchScan, nTx, false);
+    int64_t nTimeScan = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    unsigned int nFoundOverlay = ConnectSyntheticBlock(batch, batchScan, nTx, true);
+    int64_t nTimeOverlay = GetTimeMicros() - nStart;
+
+    BOOST_CHECK_EQUAL(nFoundScan, nTx - 1);
+    BOOST_CHECK_EQUAL(nFoundOverlay, nTx - 1);
+    BOOST_CHECK_EQUAL(batch.GetPending().size(), nTx);
+
+    BOOST_TEST_MESSAGE(strprintf("connect %u transactions: batch scan %.2fms, indexed overlay %.2fms",
+                                 nTx, nTimeScan * 0.001, nTimeOverlay * 0.001));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
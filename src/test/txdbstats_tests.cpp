@@ -0,0 +1,66 @@
+#include <boost/test/unit_test.hpp>
+
+#include "txdbstats.h"
+#include "main.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(txdbstats_tests)
+
+static string SerializedKey(const string& strKeyspace, const uint256& hash)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << make_pair(strKeyspace, hash);
+    return ss.str();
+}
+
+static const CTxDBKeyspaceStats* FindStats(const vector<CTxDBKeyspaceStats>& vStats, const string& strName)
+{
+    BOOST_FOREACH(const CTxDBKeyspaceStats& stats, vStats)
+    {
+        if (stats.strName == strName)
+            return &stats;
+    }
+
+    return NULL;
+}
+
+BOOST_AUTO_TEST_CASE(keyspace_names)
+{
+    BOOST_CHECK_EQUAL(TxDBKeyspace(SerializedKey("tx", uint256(1))), "tx");
+    BOOST_CHECK_EQUAL(TxDBKeyspace(SerializedKey("blockindex", uint256(1))), "blockindex");
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << string("version");
+    BOOST_CHECK_EQUAL(TxDBKeyspace(ss.str()), "version");
+
+    BOOST_CHECK_EQUAL(TxDBKeyspace(""), "");
+    BOOST_CHECK_EQUAL(TxDBKeyspace(string("\x05" "ab", 3)), "?");
+}
+
+BOOST_AUTO_TEST_CASE(counters)
+{
+    string strKey = SerializedKey("statstest", uint256(7));
+
+    RecordTxDBAccess(strKey, TXDB_READ, TXDB_SOURCE_DISK, 0, 100);
+    RecordTxDBAccess(strKey, TXDB_READ, TXDB_SOURCE_MISSING, 3, 0);
+    RecordTxDBAccess(strKey, TXDB_WRITE, TXDB_SOURCE_BATCH, 1000000, 40);
+
+    vector<CTxDBKeyspaceStats> vStats = GetTxDBStats();
+    const CTxDBKeyspaceStats* pstats = FindStats(vStats, "statstest");
+    BOOST_REQUIRE(pstats);
+
+    BOOST_CHECK_EQUAL(pstats->nOps[TXDB_READ][TXDB_SOURCE_DISK], 1U);
+    BOOST_CHECK_EQUAL(pstats->nOps[TXDB_READ][TXDB_SOURCE_MISSING], 1U);
+    BOOST_CHECK_EQUAL(pstats->nOps[TXDB_WRITE][TXDB_SOURCE_BATCH], 1U);
+    BOOST_CHECK_EQUAL(pstats->nBytesRead, 100U);
+    BOOST_CHECK_EQUAL(pstats->nBytesWritten, 40U);
+
+    // 0us lands in the first bucket, 3us below 2^2, a second in the last one
+    BOOST_CHECK_EQUAL(pstats->nLatency[TXDB_READ][0], 1U);
+    BOOST_CHECK_EQUAL(pstats->nLatency[TXDB_READ][2], 1U);
+    BOOST_CHECK_EQUAL(pstats->nLatency[TXDB_WRITE][TXDB_LATENCY_BUCKETS - 1], 1U);
+    BOOST_CHECK_EQUAL(pstats->nMicros[TXDB_READ], 3U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,103 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bench.h"
+#include "main.h"
+#include "util.h"
+#include "utiltime.h"
+
+using namespace std;
+
+// Serializes a CTxIndex the way records were written before the spent bitmap
+static CDataStream LegacyRecord(const CTxIndex& txindex)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << CLIENT_VERSION << txindex.pos << txindex.vSpent;
+    return ss;
+}
+
+static CTxIndex PayoutIndex(unsigned int nOutputs)
+{
+    CTxIndex txindex(CDiskTxPos(3, 1200000, 1200250), nOutputs);
+
+    for (unsigned int i = 0; i < nOutputs; i += 3)
+        txindex.vSpent[i] = CDiskTxPos(4 + i % 2, 800000 + i * 1000, 800081 + i * 1300);
+
+    return txindex;
+}
+
+BOOST_AUTO_TEST_SUITE(txindex_tests)
+
+BOOST_AUTO_TEST_CASE(bitmap_roundtrip)
+{
+    for (unsigned int nOutputs = 0; nOutputs < 20; nOutputs++)
+    {
+        CTxIndex txindex = PayoutIndex(nOutputs);
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << txindex;
+
+        BOOST_CHECK_EQUAL(ss.size(), ::GetSerializeSize(txindex, SER_DISK, CLIENT_VERSION));
+
+        CTxIndex txindexRead;
+        ss >> txindexRead;
+
+        BOOST_CHECK(txindexRead == txindex);
+        BOOST_CHECK(ss.empty());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(legacy_records_still_read)
+{
+    CTxIndex txindex = PayoutIndex(11);
+    CDataStream ss = LegacyRecord(txindex);
+
+    CTxIndex txindexRead;
+    ss >> txindexRead;
+
+    BOOST_CHECK(txindexRead == txindex);
+    BOOST_CHECK(ss.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_BENCH_SUITE(txindex_bench)
+
+// Spends the outputs of a payout transaction one at a time and rewrites its
+// index entry after every spend, the way UpdateTxIndex does while connecting
+BOOST_AUTO_TEST_CASE(spend_payout_benchmark)
+{
+    const unsigned int nOutputs = 500;
+
+    CTxIndex txindex(CDiskTxPos(3, 1200000, 1200250), nOutputs);
+    uint64_t nBytesLegacy = 0, nBytesBitmap = 0;
+    int64_t nTimeLegacy = 0, nTimeBitmap = 0;
+
+    for (unsigned int i = 0; i < nOutputs; i++)
+    {
+        txindex.vSpent[i] = CDiskTxPos(4, 900000 + i * 400, 900081 + i * 400);
+
+        int64_t nStart = GetTimeMicros();
+        CDataStream ssLegacy = LegacyRecord(txindex);
+        nTimeLegacy += GetTimeMicros() - nStart;
+        nBytesLegacy += ssLegacy.size();
+
+        nStart = GetTimeMicros();
+        CDataStream ssBitmap(SER_DISK, CLIENT_VERSION);
+        ssBitmap << txindex;
+        nTimeBitmap += GetTimeMicros() - nStart;
+        nBytesBitmap += ssBitmap.size();
+    }
+
+    // A freshly created entry for the same transaction
+    CTxIndex txindexNew(CDiskTxPos(3, 1200000, 1200250), nOutputs);
+
+    BOOST_CHECK(nBytesBitmap < nBytesLegacy);
+    BOOST_CHECK(::GetSerializeSize(txindexNew, SER_DISK, CLIENT_VERSION) < LegacyRecord(txindexNew).size() / 10);
+
+    BOOST_TEST_MESSAGE(strprintf("new entry with %u outputs: legacy %u bytes, bitmap %u bytes", nOutputs,
+                                 LegacyRecord(txindexNew).size(),
+                                 ::GetSerializeSize(txindexNew, SER_DISK, CLIENT_VERSION)));
+    BOOST_TEST_MESSAGE(strprintf("spending all outputs: legacy %u bytes in %.2fms, bitmap %u bytes in %.2fms",
+                                 nBytesLegacy, nTimeLegacy * 0.001, nBytesBitmap, nTimeBitmap * 0.001));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
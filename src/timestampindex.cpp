@@ -0,0 +1,21 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "timestampindex.h"
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+bool fTimestampIndex = DEFAULT_TIMESTAMPINDEX;
+
+bool UpdateTimestampIndex(CTxDB& txdb, const CBlockIndex* pindex, bool fConnect)
+{
+    CTimestampIndexKey key(pindex->nTime, pindex->GetBlockHash());
+
+    if (!(fConnect ? txdb.WriteTimestampIndex(key) : txdb.EraseTimestampIndex(key)))
+        return error("%s : cannot update the timestamp index", __func__);
+
+    return true;
+}
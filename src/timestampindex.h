@@ -0,0 +1,61 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NEUTRON_TIMESTAMPINDEX_H
+#define NEUTRON_TIMESTAMPINDEX_H
+
+#include "addressindex.h"
+#include "uint256.h"
+
+class CBlockIndex;
+class CTxDB;
+
+/** Maintain the timestamp index (-timestampindex) */
+static const bool DEFAULT_TIMESTAMPINDEX = false;
+extern bool fTimestampIndex;
+
+/** A block of the best chain by its timestamp. The time is stored big-endian,
+ * so a time range is a contiguous range of keys.
+ */
+class CTimestampIndexKey
+{
+public:
+    unsigned int nTimestamp;
+    uint256 blockHash;
+
+    CTimestampIndexKey() : nTimestamp(0), blockHash(0) {}
+    CTimestampIndexKey(unsigned int nTimestampIn, const uint256& blockHashIn) :
+        nTimestamp(nTimestampIn), blockHash(blockHashIn) {}
+
+    unsigned int GetSerializeSize(int, int=0) const
+    {
+        return 4 + 32;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int, int=0) const
+    {
+        unsigned char buf[4];
+        WriteAddressIndexBE32(buf, nTimestamp);
+        s.write((const char*) buf, 4);
+        s.write((const char*) blockHash.begin(), 32);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int, int=0)
+    {
+        unsigned char buf[4];
+        s.read((char*) buf, 4);
+        nTimestamp = ReadAddressIndexBE32(buf);
+        s.read((char*) blockHash.begin(), 32);
+    }
+};
+
+/** Add (fConnect) or remove the timestamp index record of a block, in the
+ * transaction of txdb
+ */
+bool UpdateTimestampIndex(CTxDB& txdb, const CBlockIndex* pindex, bool fConnect);
+
+#endif // NEUTRON_TIMESTAMPINDEX_H
@@ -6,24 +6,32 @@
 // file license.txt or http://www.opensource.org/licenses/mit-license.php.
 
 #include <map>
+#include <set>
 #include <boost/version.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include <leveldb/env.h>
 #include <leveldb/cache.h>
 #include <leveldb/filter_policy.h>
 #include <memenv/memenv.h>
 #include <chrono>
+#include <memory>
 
 #include "backtrace.h"
 #include "collectionhashing.h"
 #include "robinhood.h"
 #include "kernel.h"
+#include "leveldb/util/crc32c.h"
 #include "checkpoints.h"
+#include "coins.h"
 #include "txdb.h"
 #include "util.h"
 #include "utiltime.h"
 #include "main.h"
+#include "prune.h"
+#include "validation.h"
 
 using namespace std;
 using namespace boost;
@@ -32,31 +40,147 @@ using namespace std::chrono;
 extern std::atomic<bool> fRequestShutdown;
 
 leveldb::DB *txdb; // global pointer for LevelDB object instance
+static leveldb::Cache* txdbBlockCache; // block cache of txdb, for getdbstats
+int64_t nDBFlushInterval = DEFAULT_DB_FLUSH_INTERVAL;
 
-static leveldb::Options GetOptions() {
+// The -dbcache budget is split between the in-memory coins view (half of it),
+// the LevelDB block cache and the write cache (a quarter each)
+static int64_t GetCacheSizeBytes() {
+    return GetArg("-dbcache", 64) * 1048576;
+}
+
+// Bulk-load profile, used while the node is far behind the network and the
+// database takes little but writes. Larger memtables and table files mean far
+// fewer level-0 files and compactions competing with validation; the write
+// cache is only flushed when full. The database is compacted once at the tip.
+static const size_t BULK_LOAD_WRITE_BUFFER = 256 * 1048576;
+static const size_t BULK_LOAD_MAX_FILE_SIZE = 32 * 1048576;
+
+// A best block older than this opens the database with the bulk-load profile
+static const int64_t BULK_LOAD_TIP_AGE = 24 * 60 * 60;
+
+static std::atomic<bool> fBulkLoad(false);
+
+static leveldb::Options GetOptions(bool fBulk = false) {
     leveldb::Options options;
-    int nCacheSizeMB = GetArg("-dbcache", 64);
 
-    options.block_cache = leveldb::NewLRUCache(nCacheSizeMB * 1048576);
+    options.block_cache = leveldb::NewLRUCache(GetCacheSizeBytes() / 4);
     options.filter_policy = leveldb::NewBloomFilterPolicy(16);
     options.max_open_files =  16384;
     options.write_buffer_size = 64 * 1024 * 1024;
     options.reuse_logs = true;
+
+    if (fBulk)
+    {
+        options.write_buffer_size = BULK_LOAD_WRITE_BUFFER;
+        options.max_file_size = BULK_LOAD_MAX_FILE_SIZE;
+    }
+
     return options;
 }
 
-void init_blockindex(leveldb::Options& options, bool fRemoveOld = false) {
-    // First time init.
-    filesystem::path directory = GetDataDir() / "txleveldb";
+bool IsTxDBBulkLoad()
+{
+    return fBulkLoad;
+}
+
+class CTxDBDiskBackend : public CTxDBBackend
+{
+public:
+    const char* GetName() const { return "leveldb"; }
+
+    leveldb::Status Open(leveldb::Options& options, bool fWipe, leveldb::DB** ppdb)
+    {
+        filesystem::path directory = GetDataDir() / "txleveldb";
+
+        if (fWipe)
+            filesystem::remove_all(directory);
+
+        filesystem::create_directory(directory);
+        LogPrintf("Opening LevelDB in %s\n", directory.string().c_str());
+        return leveldb::DB::Open(options, directory.string(), ppdb);
+    }
+
+    bool IsPersistent() const { return true; }
+};
+
+class CTxDBMemoryBackend : public CTxDBBackend
+{
+private:
+    // Holds the files of the database, it has to outlive every DB opened on it
+    std::unique_ptr<leveldb::Env> env;
+
+    // The block files go to a temporary directory that is removed with the
+    // backend, they would otherwise mix with those of the data directory
+    filesystem::path dirBlocks;
+
+public:
+    CTxDBMemoryBackend() : env(leveldb::NewMemEnv(leveldb::Env::Default()))
+    {
+        dirBlocks = filesystem::temp_directory_path() / filesystem::unique_path("neutron-blocks-%%%%-%%%%-%%%%");
+        filesystem::create_directories(dirBlocks);
+        SetBlockFileDir(dirBlocks);
+        LogPrintf("Keeping block files in %s\n", dirBlocks.string().c_str());
+    }
+
+    ~CTxDBMemoryBackend()
+    {
+        boost::system::error_code ec;
+        filesystem::remove_all(dirBlocks, ec);
+    }
 
+    const char* GetName() const { return "memory"; }
+
+    leveldb::Status Open(leveldb::Options& options, bool fWipe, leveldb::DB** ppdb)
+    {
+        options.env = env.get();
+
+        if (fWipe)
+            leveldb::DestroyDB("txleveldb", options);
+
+        LogPrintf("Opening LevelDB in memory\n");
+        return leveldb::DB::Open(options, "txleveldb", ppdb);
+    }
+
+    bool IsPersistent() const { return false; }
+};
+
+static std::unique_ptr<CTxDBBackend> txdbBackend;
+
+bool SetTxDBBackend(const string& strName)
+{
+    assert(!txdb);
+
+    // Back to the data directory unless the new backend says otherwise
+    SetBlockFileDir(filesystem::path());
+
+    if (strName == "leveldb")
+        txdbBackend.reset(new CTxDBDiskBackend());
+    else if (strName == "memory")
+        txdbBackend.reset(new CTxDBMemoryBackend());
+    else
+        return false;
+
+    return true;
+}
+
+CTxDBBackend& GetTxDBBackend()
+{
+    if (!txdbBackend)
+        txdbBackend.reset(new CTxDBDiskBackend());
+
+    return *txdbBackend;
+}
+
+void init_blockindex(leveldb::Options& options, bool fRemoveOld = false, bool fRemoveBlockFiles = true) {
+    // First time init.
     if (fRemoveOld)
     {
-        filesystem::remove_all(directory); // remove directory
         unsigned int nFile = 1;
 
-        while (true)
+        while (fRemoveBlockFiles)
         {
-            filesystem::path strBlockFile = GetDataDir() / strprintf("blk%04u.dat", nFile);
+            filesystem::path strBlockFile = BlockFilePath(nFile);
 
             // Break if no such file
             if (!filesystem::exists( strBlockFile))
@@ -68,9 +192,8 @@ void init_blockindex(leveldb::Options& options, bool fRemoveOld = false) {
         }
     }
 
-    filesystem::create_directory(directory);
-    LogPrintf("Opening LevelDB in %s\n", directory.string().c_str());
-    leveldb::Status status = leveldb::DB::Open(options, directory.string(), &txdb);
+    leveldb::Status status = GetTxDBBackend().Open(options, fRemoveOld, &txdb);
+    txdbBlockCache = status.ok() ? options.block_cache : NULL;
 
     if (!status.ok())
     {
@@ -79,6 +202,217 @@ void init_blockindex(leveldb::Options& options, bool fRemoveOld = false) {
     }
 }
 
+// Key spaces that ScanPrefix() reads in key order. The write cache keeps their
+// pending keys sorted, so a scan does not have to walk the whole cache.
+static const char* const pszScannedKeyspaces[] = { "addr", "addrutxo", "timestamp" };
+
+static bool IsScannedKey(const string& key)
+{
+    // Keys start with the serialized key space name, a length byte and the name
+    if (key.empty())
+        return false;
+
+    size_t nLen = (unsigned char) key[0];
+
+    BOOST_FOREACH(const char* pszKeyspace, pszScannedKeyspaces)
+    {
+        if (strlen(pszKeyspace) == nLen && key.compare(1, nLen, pszKeyspace) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+class CTxDBWriteCache
+{
+public:
+    // cs guards the members and is only held briefly; cs_flush is held while a
+    // flush writes to disk, and is taken before cs
+    CCriticalSection cs;
+    CCriticalSection cs_flush;
+    CTxDBBatch::PendingMap mapPending;
+    CTxDBBatch::PendingMap mapFlushing; // being written, still visible to readers
+    std::set<string> setPendingScanned;  // keys of mapPending in a scanned key space
+    std::set<string> setFlushingScanned; // the same for mapFlushing
+    size_t nBytes;
+    size_t nMaxBytes;
+    int64_t nLastFlush;
+
+    CTxDBWriteCache() : nBytes(0), nMaxBytes(16 * 1048576), nLastFlush(0) {}
+
+    static size_t EntryBytes(const string& key, const CTxDBBatch::CPendingWrite& pending)
+    {
+        size_t nEntry = sizeof(CTxDBBatch::PendingMap::value_type) + key.capacity() + pending.strValue.capacity();
+
+        // The sorted copy of the key, in a tree node of about four pointers
+        if (IsScannedKey(key))
+            nEntry += 4 * sizeof(void*) + sizeof(string) + key.capacity();
+
+        return nEntry;
+    }
+
+    void Merge(const CTxDBBatch& batch)
+    {
+        BOOST_FOREACH(const CTxDBBatch::PendingMap::value_type& item, batch.GetPending())
+        {
+            auto it = mapPending.find(item.first);
+
+            if (it != mapPending.end())
+            {
+                nBytes -= EntryBytes(it->first, it->second);
+                it->second = item.second;
+            }
+            else
+            {
+                it = mapPending.emplace(item.first, item.second).first;
+
+                if (IsScannedKey(item.first))
+                    setPendingScanned.insert(item.first);
+            }
+
+            nBytes += EntryBytes(it->first, it->second);
+        }
+    }
+
+    bool IsFlushDue() const
+    {
+        if (fBulkLoad)
+            return nBytes > nMaxBytes;
+
+        return nBytes > nMaxBytes || (!mapPending.empty() && GetTime() - nLastFlush >= nDBFlushInterval);
+    }
+
+    bool Lookup(const string& key, string* value, bool* deleted)
+    {
+        LOCK(cs);
+        auto it = mapPending.find(key);
+
+        if (it == mapPending.end())
+        {
+            it = mapFlushing.find(key);
+
+            if (it == mapFlushing.end())
+                return false;
+        }
+
+        *deleted = it->second.fDeleted;
+
+        if (!it->second.fDeleted)
+            *value = it->second.strValue;
+
+        return true;
+    }
+
+    // Copies the changes to keys from strStart on, and before strEnd if that is
+    // not empty, that start with strPrefix into mapOut, over what is already
+    // there. The caller holds cs.
+    void CollectPrefix(const string& strPrefix, const string& strStart, const string& strEnd,
+                       map<string, CTxDBBatch::CPendingWrite>& mapOut) const
+    {
+        const CTxDBBatch::PendingMap* maps[] = { &mapFlushing, &mapPending };
+        const std::set<string>* sets[] = { &setFlushingScanned, &setPendingScanned };
+
+        for (int i = 0; i < 2; i++)
+        {
+            // Other key spaces have no sorted keys, look at every change
+            if (!IsScannedKey(strPrefix))
+            {
+                BOOST_FOREACH(const CTxDBBatch::PendingMap::value_type& item, *maps[i])
+                {
+                    if (item.first >= strStart && (strEnd.empty() || item.first < strEnd) &&
+                        item.first.compare(0, strPrefix.size(), strPrefix) == 0)
+                        mapOut[item.first] = item.second;
+                }
+
+                continue;
+            }
+
+            for (auto it = sets[i]->lower_bound(strStart);
+                 it != sets[i]->end() && it->compare(0, strPrefix.size(), strPrefix) == 0 &&
+                 (strEnd.empty() || *it < strEnd); ++it)
+            {
+                mapOut[*it] = maps[i]->find(*it)->second;
+            }
+        }
+    }
+
+    // Writes the cached changes, followed by the operations in batchExtra, as a
+    // single synchronous batch. Readers are only held up while the changes are
+    // taken out of the cache; they find them in mapFlushing until written.
+    bool Write(leveldb::DB* pdb, const leveldb::WriteBatch& batchExtra)
+    {
+        LOCK(cs_flush);
+
+        {
+            LOCK(cs);
+            mapFlushing.swap(mapPending);
+            setFlushingScanned.swap(setPendingScanned);
+            nBytes = 0;
+        }
+
+        // Only this thread changes mapFlushing, reading it needs no lock
+        leveldb::WriteBatch batch;
+
+        BOOST_FOREACH(const CTxDBBatch::PendingMap::value_type& item, mapFlushing)
+        {
+            if (item.second.fDeleted)
+                batch.Delete(item.first);
+            else
+                batch.Put(item.first, item.second.strValue);
+        }
+
+        batch.Append(batchExtra);
+
+        // The block data the batch refers to has to be on disk first
+        bool fSynced = FlushBlockFiles();
+        leveldb::Status status;
+
+        if (fSynced)
+        {
+            leveldb::WriteOptions options;
+            options.sync = true;
+            status = pdb->Write(options, &batch);
+        }
+
+        {
+            LOCK(cs);
+
+            if (fSynced && status.ok())
+            {
+                mapFlushing.clear();
+                setFlushingScanned.clear();
+                nLastFlush = GetTime();
+                return true;
+            }
+
+            // Keep what was not written, unless it has been changed since
+            BOOST_FOREACH(const CTxDBBatch::PendingMap::value_type& item, mapFlushing)
+            {
+                if (mapPending.emplace(item.first, item.second).second)
+                {
+                    nBytes += EntryBytes(item.first, item.second);
+
+                    if (IsScannedKey(item.first))
+                        setPendingScanned.insert(item.first);
+                }
+            }
+
+            mapFlushing.clear();
+            setFlushingScanned.clear();
+        }
+
+        if (!fSynced)
+            return error("%s : failed to sync block files", __func__);
+
+        return error("%s : leveldb write failure: %s", __func__, status.ToString().c_str());
+    }
+};
+
+static CTxDBWriteCache writeCache;
+
+// Held by ThreadFlushTxDB() while it uses the database and by Close()
+static CCriticalSection cs_txdbClose;
+
 // CDB subclasses are created and destroyed VERY OFTEN. That's why
 // we shouldn't treat this as a free operations.
 
@@ -86,6 +420,7 @@ CTxDB::CTxDB(const char* pszMode)
 {
     assert(pszMode);
     activeBatch = NULL;
+    activeCoins = NULL;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
 
     if (txdb)
@@ -100,17 +435,37 @@ CTxDB::CTxDB(const char* pszMode)
     options.create_if_missing = fCreate;
     options.filter_policy = leveldb::NewBloomFilterPolicy(10);
 
-    init_blockindex(options); // Init directory
+    init_blockindex(options, false, false); // Init directory
     pdb = txdb;
 
+    // An interrupted reindex carries on with the blocks it has, -reindex starts
+    // over from an empty database, but keeps the block files
+    bool fReindexing = false;
+
+    if (ReadFlag("reindex", fReindexing) && fReindexing)
+    {
+        LogPrintf("%s : resuming the interrupted reindex\n", __func__);
+        fReindex = true;
+    }
+    else if (fReindex)
+    {
+        LogPrintf("%s : reindexing, removing old database\n", __func__);
+
+        delete txdb;
+        txdb = pdb = NULL;
+
+        init_blockindex(options, true, false);
+        pdb = txdb;
+    }
+
     if (Exists(string("version")))
     {
         ReadVersion(nVersion);
         LogPrintf("%s : transaction index version is %d\n", __func__, nVersion);
 
-        if (nVersion < DATABASE_VERSION)
+        if (nVersion < DATABASE_MIGRATE_VERSION)
         {
-            LogPrintf("%s : required index version is %d, removing old database\n", DATABASE_VERSION);
+            LogPrintf("%s : required index version is %d, removing old database\n", __func__, DATABASE_VERSION);
 
             delete txdb;
             txdb = pdb = NULL;
@@ -125,6 +480,13 @@ CTxDB::CTxDB(const char* pszMode)
             WriteVersion(DATABASE_VERSION); // Save transaction index version
             fReadOnly = fTmp;
         }
+        else if (nVersion < DATABASE_VERSION && MigrateTxIndex())
+        {
+            bool fTmp = fReadOnly;
+            fReadOnly = false;
+            WriteVersion(DATABASE_VERSION);
+            fReadOnly = fTmp;
+        }
     }
     else if (fCreate)
     {
@@ -134,17 +496,75 @@ CTxDB::CTxDB(const char* pszMode)
         fReadOnly = fTmp;
     }
 
-    LogPrintf("%s : opened leveldb successfully\n", __func__);
+    // Options only take effect when the database is opened, nothing else uses
+    // it yet, so reopen it with the bulk-load profile right away
+    if (!fReadOnly && (fReindex || !HasRecentTip()))
+    {
+        delete txdb;
+        txdb = pdb = NULL;
+        delete options.filter_policy;
+        delete options.block_cache;
+
+        options = GetOptions(true);
+        options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+
+        init_blockindex(options, false, false);
+        pdb = txdb;
+        fBulkLoad = true;
+
+        LogPrintf("%s : bulk-load profile on, write buffer %uMiB, table files %uMiB\n", __func__,
+                  (unsigned int) (options.write_buffer_size / 1048576), (unsigned int) (options.max_file_size / 1048576));
+    }
+
+    {
+        LOCK(writeCache.cs);
+        writeCache.nMaxBytes = GetCacheSizeBytes() / 4;
+        writeCache.nLastFlush = GetTime();
+    }
+
+    nCoinCacheUsage = GetCacheSizeBytes() / 2;
+    pcoinsTip = new CCoinsViewCache();
+
+    LogPrintf("%s : opened leveldb successfully, backend %s\n", __func__, GetTxDBBackend().GetName());
+}
+
+CTxDB::~CTxDB()
+{
+    delete activeCoins;
+    delete activeBatch;
 }
 
 void CTxDB::Close()
 {
+    LOCK(cs_txdbClose);
+
+    // Write back the unspent outputs still held in memory
+    if (pcoinsTip)
+    {
+        if (!fReadOnly)
+            FlushCoinsTip(*this, true);
+
+        delete pcoinsTip;
+        pcoinsTip = NULL;
+    }
+
+    // And whatever committed changes are still held back
+    if (!fReadOnly)
+    {
+        Flush(true);
+
+        if (GetTxDBBackend().IsPersistent())
+            WriteBlockIndexSnapshot();
+    }
+
+
     // Free these, otherwise we get memory leaks on shutdown
     for (auto i : mapBlockIndex)
         delete i.second;
 
     delete txdb;
     txdb = pdb = NULL;
+    txdbBlockCache = NULL;
 
     delete options.filter_policy;
     options.filter_policy = NULL;
@@ -154,127 +574,446 @@ void CTxDB::Close()
 
     delete activeBatch;
     activeBatch = NULL;
+
+    delete activeCoins;
+    activeCoins = NULL;
 }
 
 bool CTxDB::TxnBegin()
 {
     assert(!activeBatch);
-    activeBatch = new leveldb::WriteBatch();
+    activeBatch = new CTxDBBatch();
+
+    if (pcoinsTip)
+        activeCoins = new CCoinsViewCache(pcoinsTip);
+
     return true;
 }
 
 bool CTxDB::TxnCommit()
 {
     assert(activeBatch);
-    leveldb::Status status = pdb->Write(leveldb::WriteOptions(), activeBatch);
-    delete activeBatch;
 
+    {
+        LOCK(writeCache.cs);
+        writeCache.Merge(*activeBatch);
+    }
+
+    delete activeBatch;
     activeBatch = NULL;
 
-    if (!status.ok())
+    if (!Flush(false))
     {
-        LogPrintf("%s : leveldb batch commit failure: %s\n", __func__, status.ToString().c_str());
+        delete activeCoins;
+        activeCoins = NULL;
+
+        LogPrintf("%s : leveldb batch commit failure\n", __func__);
         return false;
     }
 
+    // The transaction index is on disk, now let the coins catch up. They are
+    // written back lazily; on startup a lagging coins database is replayed.
+    if (activeCoins)
+    {
+        activeCoins->Flush(*this);
+        delete activeCoins;
+        activeCoins = NULL;
+
+        if (!FlushCoinsTip(*this, false))
+            return false;
+    }
+
     return true;
 }
 
-class CBatchScanner : public leveldb::WriteBatch::Handler
+bool CTxDB::Flush(bool fForce)
 {
-public:
-    std::string needle;
-    bool *deleted;
-    std::string *foundValue;
-    bool foundEntry;
+    // Most commits have nothing to write yet, they need not wait for a flush
+    // in progress
+    if (!fForce)
+    {
+        LOCK(writeCache.cs);
+
+        if (!writeCache.IsFlushDue())
+            return true;
+    }
 
-    CBatchScanner() : foundEntry(false) {}
+    LOCK(writeCache.cs_flush);
+    unsigned int nKeys;
+    size_t nBytes;
 
-    virtual void Put(const leveldb::Slice& key, const leveldb::Slice& value)
     {
-        if (key.ToString() == needle)
-        {
-            foundEntry = true;
-            *deleted = false;
-            *foundValue = value.ToString();
-        }
+        LOCK(writeCache.cs);
+        nKeys = writeCache.mapPending.size();
+        nBytes = writeCache.nBytes;
+
+        // Another flush may have got here first
+        if (!fForce && !writeCache.IsFlushDue())
+            return true;
     }
 
-    virtual void Delete(const leveldb::Slice& key)
+    // Blocks may have been written that nothing refers to yet, sync them anyway
+    // when asked to, e.g. at shutdown
+    if (nKeys == 0)
+        return !fForce || FlushBlockFiles();
+
+    int64_t nStart = GetTimeMillis();
+
+    if (!writeCache.Write(pdb, leveldb::WriteBatch()))
+        return false;
+
+    if (fDebug)
     {
-        if (key.ToString() == needle)
-        {
-            foundEntry = true;
-            *deleted = true;
-        }
+        LogPrintf("%s : wrote %u records (%uKiB) in %dms\n", __func__, nKeys,
+                  (unsigned int) (nBytes / 1024), GetTimeMillis() - nStart);
     }
-};
 
-// When performing a read, if we have an active batch we need to check it first
-// before reading from the database, as the rest of the code assumes that once
-// a database transaction begins reads are consistent with it. It would be good
-// to change that assumption in future and avoid the performance hit, though in
-// practice it does not appear to be large.
+    return true;
+}
 
-bool CTxDB::ScanBatch(const CDataStream &key, string *value, bool *deleted) const
+bool CTxDB::HasRecentTip()
 {
-    assert(activeBatch);
-    *deleted = false;
-    CBatchScanner scanner;
-    scanner.needle = key.str();
-    scanner.deleted = deleted;
-    scanner.foundValue = value;
-    leveldb::Status status = activeBatch->Iterate(&scanner);
+    uint256 hashBest;
+    CDiskBlockIndex diskindex;
 
-    if (!status.ok())
-        throw runtime_error(status.ToString());
+    if (!ReadHashBestChain(hashBest) || !Read(make_pair(string("blockindex"), hashBest), diskindex))
+        return false;
 
-    return scanner.foundEntry;
+    return GetTime() - (int64_t) diskindex.nTime < BULK_LOAD_TIP_AGE;
 }
 
-bool CTxDB::ReadTxIndex(uint256 hash, CTxIndex& txindex)
+void CTxDB::EndBulkLoad()
 {
-    assert(!fClient);
-    txindex.SetNull();
+    if (!fBulkLoad.exchange(false))
+        return;
 
-    return Read(make_pair(string("tx"), hash), txindex);
+    LogPrintf("%s : reached the tip, bulk-load profile off\n", __func__);
+
+    // Regular flushes from now on, and whatever the bulk load left in the
+    // write cache goes into the compaction below
+    if (!Flush(true))
+        LogPrintf("%s : flush failed\n", __func__);
+
+    string strStats;
+
+    if (pdb->GetProperty("leveldb.stats", &strStats))
+        LogPrintf("%s : before compaction\n%s", __func__, strStats);
+
+    int64_t nStart = GetTimeMillis();
+    pdb->CompactRange(NULL, NULL);
+    LogPrintf("%s : compacted the database in %dms\n", __func__, GetTimeMillis() - nStart);
+
+    if (pdb->GetProperty("leveldb.stats", &strStats))
+        LogPrintf("%s : after compaction\n%s", __func__, strStats);
 }
 
-bool CTxDB::UpdateTxIndex(uint256 hash, const CTxIndex& txindex)
+bool CTxDB::GetProperty(const string& strName, string& strValue)
 {
-    assert(!fClient);
-    return Write(make_pair(string("tx"), hash), txindex);
+    return pdb->GetProperty(strName, &strValue);
 }
 
-bool CTxDB::AddTxIndex(const CTransaction& tx, const CDiskTxPos& pos, int nHeight)
+void CTxDB::GetCacheUsage(size_t& nBlockCache, size_t& nBlockCacheMax, size_t& nWriteCache, size_t& nWriteCacheMax)
 {
-    assert(!fClient);
-
-    // Add to tx index
-    uint256 hash = tx.GetHash();
-    CTxIndex txindex(pos, tx.vout.size());
+    nBlockCache = txdbBlockCache ? txdbBlockCache->TotalCharge() : 0;
+    nBlockCacheMax = GetCacheSizeBytes() / 4;
 
-    return Write(make_pair(string("tx"), hash), txindex);
+    LOCK(writeCache.cs);
+    nWriteCache = writeCache.nBytes;
+    nWriteCacheMax = writeCache.nMaxBytes;
 }
 
-bool CTxDB::EraseTxIndex(const CTransaction& tx)
+const leveldb::Snapshot* CTxDB::GetSnapshot()
 {
-    assert(!fClient);
-    uint256 hash = tx.GetHash();
+    if (!Flush(true))
+        return NULL;
 
-    return Erase(make_pair(string("tx"), hash));
+    return pdb->GetSnapshot();
 }
 
-bool CTxDB::ContainsTx(uint256 hash)
+bool CTxDB::ScanSnapshot(const leveldb::Snapshot* snapshot,
+                         const std::function<bool(const leveldb::Slice&, const leveldb::Slice&)>& fn)
 {
-    assert(!fClient);
-    return Exists(make_pair(string("tx"), hash));
-}
+    // A one-off pass over the whole database, keep it out of the block cache
+    leveldb::ReadOptions options;
+    options.snapshot = snapshot;
+    options.fill_cache = false;
 
-bool CTxDB::ReadDiskTx(uint256 hash, CTransaction& tx, CTxIndex& txindex)
-{
-    assert(!fClient);
-    tx.SetNull();
+    leveldb::Iterator* it = pdb->NewIterator(options);
+
+    for (it->SeekToFirst(); it->Valid(); it->Next())
+    {
+        if (!fn(it->key(), it->value()))
+            break;
+    }
+
+    bool fOk = it->status().ok();
+    delete it;
+    pdb->ReleaseSnapshot(snapshot);
+
+    if (!fOk)
+        return error("%s : leveldb iterator failure", __func__);
+
+    return true;
+}
+
+// Batches written by CTxDBBulkWriter
+static const size_t BULK_WRITER_BATCH_BYTES = 16 * 1048576;
+
+CTxDBBulkWriter::CTxDBBulkWriter() : pdb(NULL), nBatchBytes(0)
+{
+    assert(!txdb);
+
+    options = GetOptions(true);
+    options.create_if_missing = true;
+
+    // The same filter as CTxDB::init() uses, the tables are kept as they are
+    delete options.filter_policy;
+    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+
+    leveldb::Status status = GetTxDBBackend().Open(options, true, &pdb);
+
+    if (!status.ok())
+    {
+        LogPrintf("%s : cannot create the database: %s\n", __func__, status.ToString());
+        pdb = NULL;
+    }
+}
+
+CTxDBBulkWriter::~CTxDBBulkWriter()
+{
+    Close();
+}
+
+void CTxDBBulkWriter::Close()
+{
+    delete pdb;
+    pdb = NULL;
+
+    delete options.filter_policy;
+    options.filter_policy = NULL;
+
+    delete options.block_cache;
+    options.block_cache = NULL;
+}
+
+bool CTxDBBulkWriter::WriteBatch(bool fSync)
+{
+    leveldb::WriteOptions writeOptions;
+    writeOptions.sync = fSync;
+    leveldb::Status status = pdb->Write(writeOptions, &batch);
+
+    if (!status.ok())
+        return error("%s : leveldb write failure: %s", __func__, status.ToString());
+
+    batch.Clear();
+    nBatchBytes = 0;
+    return true;
+}
+
+bool CTxDBBulkWriter::Put(const string& key, const string& value)
+{
+    if (!pdb)
+        return false;
+
+    batch.Put(key, value);
+    nBatchBytes += key.size() + value.size();
+
+    return nBatchBytes < BULK_WRITER_BATCH_BYTES || WriteBatch(false);
+}
+
+bool CTxDBBulkWriter::Commit()
+{
+    if (!pdb || !WriteBatch(true))
+        return false;
+
+    int64_t nStart = GetTimeMillis();
+    pdb->CompactRange(NULL, NULL);
+    LogPrintf("%s : compacted the database in %dms\n", __func__, GetTimeMillis() - nStart);
+
+    Close();
+    return true;
+}
+
+void CTxDBBulkWriter::Abort()
+{
+    if (!pdb)
+        return;
+
+    batch.Clear();
+    Close();
+
+    // Opening it wiped will remove what has been written
+    leveldb::DB* pdbWipe = NULL;
+    options = GetOptions();
+    options.create_if_missing = true;
+
+    if (GetTxDBBackend().Open(options, true, &pdbWipe).ok())
+        delete pdbWipe;
+
+    Close();
+}
+
+bool CTxDB::LookupWriteCache(const string& key, string* value, bool* deleted) const
+{
+    *deleted = false;
+    return writeCache.Lookup(key, value, deleted);
+}
+
+bool CTxDB::WriteDirect(const string& key, const string* value)
+{
+    // Hold the locks across the write, a flush in between would otherwise
+    // overwrite the new value with the cached one
+    LOCK2(writeCache.cs_flush, writeCache.cs);
+    leveldb::Status status;
+
+    if (value)
+        status = pdb->Put(leveldb::WriteOptions(), key, *value);
+    else
+        status = pdb->Delete(leveldb::WriteOptions(), key);
+
+    if (!status.ok() && !(value == NULL && status.IsNotFound()))
+    {
+        LogPrintf("%s : leveldb write failure: %s\n", __func__, status.ToString().c_str());
+        return false;
+    }
+
+    auto it = writeCache.mapPending.find(key);
+
+    if (it != writeCache.mapPending.end())
+    {
+        writeCache.nBytes -= CTxDBWriteCache::EntryBytes(it->first, it->second);
+        writeCache.mapPending.erase(it);
+        writeCache.setPendingScanned.erase(key);
+    }
+
+    return true;
+}
+
+void ThreadFlushTxDB(void* parg)
+{
+    // Make this thread recognisable as the txdb flushing thread
+    RenameThread("neutron-txdb");
+
+    static bool fOneThread;
+
+    if (fOneThread)
+        return;
+
+    fOneThread = true;
+    int64_t nLastPrune = 0;
+
+    while (!fShutdown)
+    {
+        MilliSleep(1000);
+
+        // Close() waits for this, the database stays open until the end of the round
+        LOCK(cs_txdbClose);
+
+        if (fShutdown || !txdb)
+            break;
+
+        if (fBulkLoad && !IsInitialBlockDownload())
+            CTxDB().EndBulkLoad();
+
+        CTxDB().Flush(false);
+
+        // Block files only fill up slowly, no need to look at them every second
+        if (nPruneTarget && GetTime() - nLastPrune >= 10)
+        {
+            PruneBlockFiles();
+            nLastPrune = GetTime();
+        }
+    }
+}
+
+bool CTxDB::TxnAbort()
+{
+    delete activeBatch;
+    activeBatch = NULL;
+
+    delete activeCoins;
+    activeCoins = NULL;
+
+    return true;
+}
+
+void CTxDBBatch::Put(const string& key, const string& value)
+{
+    CPendingWrite& pending = mapPending[key];
+    pending.fDeleted = false;
+    pending.strValue = value;
+}
+
+void CTxDBBatch::Delete(const string& key)
+{
+    CPendingWrite& pending = mapPending[key];
+    pending.fDeleted = true;
+    pending.strValue.clear();
+}
+
+// When performing a read, if we have an active batch we need to check it first
+// before reading from the database, as the rest of the code assumes that once
+// a database transaction begins reads are consistent with it.
+
+bool CTxDBBatch::Lookup(const string& key, string* value, bool* deleted) const
+{
+    *deleted = false;
+    auto it = mapPending.find(key);
+
+    if (it == mapPending.end())
+        return false;
+
+    if (it->second.fDeleted)
+        *deleted = true;
+    else
+        *value = it->second.strValue;
+
+    return true;
+}
+
+bool CTxDB::ReadTxIndex(uint256 hash, CTxIndex& txindex)
+{
+    assert(!fClient);
+    txindex.SetNull();
+
+    return Read(make_pair(string("tx"), hash), txindex);
+}
+
+bool CTxDB::UpdateTxIndex(uint256 hash, const CTxIndex& txindex)
+{
+    assert(!fClient);
+    return Write(make_pair(string("tx"), hash), txindex);
+}
+
+bool CTxDB::AddTxIndex(const CTransaction& tx, const CDiskTxPos& pos, int nHeight)
+{
+    assert(!fClient);
+
+    // Add to tx index
+    uint256 hash = tx.GetHash();
+    CTxIndex txindex(pos, tx.vout.size());
+
+    return Write(make_pair(string("tx"), hash), txindex);
+}
+
+bool CTxDB::EraseTxIndex(const CTransaction& tx)
+{
+    assert(!fClient);
+    uint256 hash = tx.GetHash();
+
+    return Erase(make_pair(string("tx"), hash));
+}
+
+bool CTxDB::ContainsTx(uint256 hash)
+{
+    assert(!fClient);
+    return Exists(make_pair(string("tx"), hash));
+}
+
+bool CTxDB::ReadDiskTx(uint256 hash, CTransaction& tx, CTxIndex& txindex)
+{
+    assert(!fClient);
+    tx.SetNull();
 
     if (!ReadTxIndex(hash, txindex))
         return false;
@@ -311,6 +1050,9 @@ bool CTxDB::ReadHashBestChain(uint256& hashBestChain)
 
 bool CTxDB::WriteHashBestChain(uint256 hashBestChain)
 {
+    if (activeCoins)
+        activeCoins->SetBestBlock(hashBestChain);
+
     return Write(string("hashBestChain"), hashBestChain);
 }
 
@@ -326,22 +1068,409 @@ bool CTxDB::WriteBestInvalidTrust(CBigNum bnBestInvalidTrust)
 
 bool CTxDB::ReadSyncCheckpoint(uint256& hashCheckpoint)
 {
-    return Read(string("hashSyncCheckpoint"), hashCheckpoint);
+    return Read(string("hashSyncCheckpoint"), hashCheckpoint);
+}
+
+bool CTxDB::WriteSyncCheckpoint(uint256 hashCheckpoint)
+{
+    return Write(string("hashSyncCheckpoint"), hashCheckpoint);
+}
+
+bool CTxDB::ReadCheckpointPubKey(string& strPubKey)
+{
+    return Read(string("strCheckpointPubKey"), strPubKey);
+}
+
+bool CTxDB::WriteCheckpointPubKey(const string& strPubKey)
+{
+    return Write(string("strCheckpointPubKey"), strPubKey);
+}
+
+bool CTxDB::GetCoin(const COutPoint& outpoint, CCoin& coin)
+{
+    CCoinsViewCache* view = activeCoins ? activeCoins : pcoinsTip;
+
+    if (!view)
+        return false;
+
+    return view->GetCoin(*this, outpoint, coin);
+}
+
+void CTxDB::UpdateCoins(const CTransaction& tx, int nHeight)
+{
+    if (activeCoins)
+        activeCoins->UpdateCoins(tx, nHeight);
+}
+
+void CTxDB::AddCoin(const COutPoint& outpoint, const CCoin& coin)
+{
+    if (activeCoins)
+        activeCoins->AddCoin(outpoint, coin);
+}
+
+void CTxDB::SpendCoin(const COutPoint& outpoint)
+{
+    if (activeCoins)
+        activeCoins->SpendCoin(outpoint);
+}
+
+bool CTxDB::ReadCoin(const COutPoint& outpoint, CCoin& coin)
+{
+    coin.SetNull();
+    return Read(make_pair(string("coin"), outpoint), coin);
+}
+
+bool CTxDB::WriteCoins(const vector<pair<COutPoint, CCoin> >& vWrite, const vector<COutPoint>& vErase,
+                       const uint256& hashBlock)
+{
+    if (fReadOnly)
+        assert(!"WriteCoins called on database in read-only mode");
+
+    // Coins bypass activeBatch. They are written together with the pending
+    // committed changes, so the coins never get ahead of the transaction index.
+    leveldb::WriteBatch batch;
+
+    for (vector<pair<COutPoint, CCoin> >::const_iterator it = vWrite.begin(); it != vWrite.end(); ++it)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << make_pair(string("coin"), it->first);
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue << it->second;
+        batch.Put(ssKey.str(), ssValue.str());
+    }
+
+    for (vector<COutPoint>::const_iterator it = vErase.begin(); it != vErase.end(); ++it)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << make_pair(string("coin"), *it);
+        batch.Delete(ssKey.str());
+    }
+
+    if (hashBlock != 0)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << string("coinsBestChain");
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue << hashBlock;
+        batch.Put(ssKey.str(), ssValue.str());
+    }
+
+    return writeCache.Write(pdb, batch);
+}
+
+bool CTxDB::ReadCoinsBestChain(uint256& hashBlock)
+{
+    return Read(string("coinsBestChain"), hashBlock);
+}
+
+bool CTxDB::ReadFlag(const string& strName, bool& fValue)
+{
+    fValue = false;
+    return Read(make_pair(string("flag"), strName), fValue);
+}
+
+bool CTxDB::WriteFlag(const string& strName, bool fValue)
+{
+    return Write(make_pair(string("flag"), strName), fValue);
+}
+
+bool CTxDB::ScanPrefix(const string& strPrefix, const string& strStart,
+                       const std::function<bool(const string&, const string&)>& fn,
+                       const string& strEnd)
+{
+    // The iterator only sees what is on disk, the changes not written yet are
+    // merged in. Taking both under the cache lock keeps them consistent: a
+    // flush in progress has its changes in the cache until it is done.
+    map<string, CTxDBBatch::CPendingWrite> mapChanges;
+    leveldb::Iterator* it;
+
+    {
+        LOCK(writeCache.cs);
+        writeCache.CollectPrefix(strPrefix, strStart, strEnd, mapChanges);
+        it = pdb->NewIterator(leveldb::ReadOptions());
+    }
+
+    if (activeBatch)
+    {
+        BOOST_FOREACH(const CTxDBBatch::PendingMap::value_type& item, activeBatch->GetPending())
+        {
+            if (item.first >= strStart && (strEnd.empty() || item.first < strEnd) &&
+                item.first.compare(0, strPrefix.size(), strPrefix) == 0)
+                mapChanges[item.first] = item.second;
+        }
+    }
+
+    auto mi = mapChanges.begin();
+    it->Seek(strStart);
+
+    while (true)
+    {
+        bool fDisk = it->Valid() && it->key().starts_with(strPrefix) &&
+                     (strEnd.empty() || it->key().compare(strEnd) < 0);
+
+        if (!fDisk && mi == mapChanges.end())
+            break;
+
+        string strKey, strValue;
+
+        if (fDisk && (mi == mapChanges.end() || it->key().compare(mi->first) < 0))
+        {
+            strKey = it->key().ToString();
+            strValue = it->value().ToString();
+            it->Next();
+        }
+        else
+        {
+            // A change replaces the record on disk with the same key
+            if (fDisk && it->key().compare(mi->first) == 0)
+                it->Next();
+
+            bool fDeleted = mi->second.fDeleted;
+            strKey = mi->first;
+            strValue = mi->second.strValue;
+            ++mi;
+
+            if (fDeleted)
+                continue;
+        }
+
+        if (!fn(strKey, strValue))
+            break;
+    }
+
+    bool fOk = it->status().ok();
+    delete it;
+
+    if (!fOk)
+        return error("%s : leveldb iterator failure", __func__);
+
+    return true;
+}
+
+bool CTxDB::WriteAddressIndex(const CAddressIndexKey& key, int64_t nValue)
+{
+    return Write(make_pair(string("addr"), key), nValue);
+}
+
+bool CTxDB::EraseAddressIndex(const CAddressIndexKey& key)
+{
+    return Erase(make_pair(string("addr"), key));
+}
+
+bool CTxDB::WriteAddressUnspent(const CAddressUnspentKey& key, const CAddressUnspentValue& value)
+{
+    return Write(make_pair(string("addrutxo"), key), value);
+}
+
+bool CTxDB::EraseAddressUnspent(const CAddressUnspentKey& key)
+{
+    return Erase(make_pair(string("addrutxo"), key));
+}
+
+// Key prefix of the records of an address in the index named strIndex
+static string AddressKeyPrefix(const string& strIndex, unsigned char nType, const uint160& hashBytes)
+{
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << strIndex;
+    ssKey << nType;
+    ssKey.write((const char*) hashBytes.begin(), 20);
+    return ssKey.str();
+}
+
+bool CTxDB::ReadAddressIndex(unsigned char nType, const uint160& hashBytes, int nStart, int nEnd,
+                             vector<CAddressIndexEntry>& vEntries, size_t nMaxEntries)
+{
+    string strPrefix = AddressKeyPrefix("addr", nType, hashBytes);
+    string strStart = strPrefix;
+    bool fOk = true;
+
+    // Records are ordered by height, start right at the first one in range
+    if (nStart > 0)
+    {
+        unsigned char buf[4];
+        WriteAddressIndexBE32(buf, nStart);
+        strStart.append((const char*) buf, 4);
+    }
+
+    bool fScanned = ScanPrefix(strPrefix, strStart, [&](const string& strKey, const string& strValue) -> bool {
+        try
+        {
+            CDataStream ssKey(strKey.data(), strKey.data() + strKey.size(), SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+            string strIndex;
+            CAddressIndexEntry entry;
+            ssKey >> strIndex >> entry.first;
+            ssValue >> entry.second;
+
+            if (nEnd > 0 && entry.first.nHeight > nEnd)
+                return false;
+
+            vEntries.push_back(entry);
+            return nMaxEntries == 0 || vEntries.size() < nMaxEntries;
+        }
+        catch (const std::exception& e)
+        {
+            fOk = false;
+            return false;
+        }
+    });
+
+    if (!fOk)
+        return error("%s : deserialize error", __func__);
+
+    return fScanned;
+}
+
+bool CTxDB::ReadAddressUnspent(unsigned char nType, const uint160& hashBytes, vector<CAddressUnspentEntry>& vEntries)
+{
+    bool fOk = true;
+
+    string strPrefix = AddressKeyPrefix("addrutxo", nType, hashBytes);
+
+    bool fScanned = ScanPrefix(strPrefix, strPrefix, [&](const string& strKey, const string& strValue) -> bool {
+        try
+        {
+            CDataStream ssKey(strKey.data(), strKey.data() + strKey.size(), SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+            string strIndex;
+            CAddressUnspentEntry entry;
+            ssKey >> strIndex >> entry.first;
+            ssValue >> entry.second;
+            vEntries.push_back(entry);
+            return true;
+        }
+        catch (const std::exception& e)
+        {
+            fOk = false;
+            return false;
+        }
+    });
+
+    if (!fOk)
+        return error("%s : deserialize error", __func__);
+
+    return fScanned;
+}
+
+bool CTxDB::WriteAddressIndexBatch(const vector<CAddressIndexEntry>& vIndex, const vector<CAddressUnspentEntry>& vUnspent)
+{
+    if (fReadOnly)
+        assert(!"WriteAddressIndexBatch called on database in read-only mode");
+
+    leveldb::WriteBatch batch;
+
+    BOOST_FOREACH(const CAddressIndexEntry& entry, vIndex)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << make_pair(string("addr"), entry.first);
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue << entry.second;
+        batch.Put(ssKey.str(), ssValue.str());
+    }
+
+    BOOST_FOREACH(const CAddressUnspentEntry& entry, vUnspent)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << make_pair(string("addrutxo"), entry.first);
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue << entry.second;
+        batch.Put(ssKey.str(), ssValue.str());
+    }
+
+    leveldb::Status status = pdb->Write(leveldb::WriteOptions(), &batch);
+
+    if (!status.ok())
+        return error("%s : leveldb write failure: %s", __func__, status.ToString().c_str());
+
+    return true;
+}
+
+bool CTxDB::ReadPrunedFiles(set<unsigned int>& setFiles)
+{
+    setFiles.clear();
+    return Read(string("prunedfiles"), setFiles);
+}
+
+bool CTxDB::WritePrunedFiles(const set<unsigned int>& setFiles)
+{
+    return Write(string("prunedfiles"), setFiles);
+}
+
+bool CTxDB::WriteBlockUndo(const uint256& hashBlock, const vector<pair<COutPoint, CCoin> >& vUndo)
+{
+    return Write(make_pair(string("undo"), hashBlock), vUndo);
+}
+
+bool CTxDB::ReadBlockUndo(const uint256& hashBlock, vector<pair<COutPoint, CCoin> >& vUndo)
+{
+    return Read(make_pair(string("undo"), hashBlock), vUndo);
+}
+
+bool CTxDB::EraseBlockUndo(const uint256& hashBlock)
+{
+    return Erase(make_pair(string("undo"), hashBlock));
+}
+
+bool CTxDB::WriteSpentIndex(const CSpentIndexKey& key, const CSpentIndexValue& value)
+{
+    return Write(make_pair(string("spent"), key), value);
+}
+
+bool CTxDB::EraseSpentIndex(const CSpentIndexKey& key)
+{
+    return Erase(make_pair(string("spent"), key));
+}
+
+bool CTxDB::ReadSpentIndex(const CSpentIndexKey& key, CSpentIndexValue& value)
+{
+    return Read(make_pair(string("spent"), key), value);
 }
 
-bool CTxDB::WriteSyncCheckpoint(uint256 hashCheckpoint)
+bool CTxDB::WriteTimestampIndex(const CTimestampIndexKey& key)
 {
-    return Write(string("hashSyncCheckpoint"), hashCheckpoint);
+    return Write(make_pair(string("timestamp"), key), '\0');
 }
 
-bool CTxDB::ReadCheckpointPubKey(string& strPubKey)
+bool CTxDB::EraseTimestampIndex(const CTimestampIndexKey& key)
 {
-    return Read(string("strCheckpointPubKey"), strPubKey);
+    return Erase(make_pair(string("timestamp"), key));
 }
 
-bool CTxDB::WriteCheckpointPubKey(const string& strPubKey)
+bool CTxDB::ReadTimestampIndex(unsigned int nLow, unsigned int nHigh, vector<CTimestampIndexKey>& vKeys)
 {
-    return Write(string("strCheckpointPubKey"), strPubKey);
+    CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+    ssPrefix << string("timestamp");
+    string strPrefix = ssPrefix.str();
+
+    // Keys are ordered by time, only the range asked for is read
+    unsigned char buf[4];
+    WriteAddressIndexBE32(buf, nLow);
+    string strStart = strPrefix + string((const char*) buf, 4);
+    WriteAddressIndexBE32(buf, nHigh);
+    string strEnd = strPrefix + string((const char*) buf, 4);
+    bool fOk = true;
+
+    bool fScanned = ScanPrefix(strPrefix, strStart, [&](const string& strKey, const string& strValue) -> bool {
+        try
+        {
+            CDataStream ssKey(strKey.data(), strKey.data() + strKey.size(), SER_DISK, CLIENT_VERSION);
+            string strIndex;
+            CTimestampIndexKey key;
+            ssKey >> strIndex >> key;
+            vKeys.push_back(key);
+            return true;
+        }
+        catch (const std::exception& e)
+        {
+            fOk = false;
+            return false;
+        }
+    }, strEnd);
+
+    if (!fOk)
+        return error("%s : deserialize error", __func__);
+
+    return fScanned;
 }
 
 static CBlockIndex *InsertBlockIndex(uint256 hash)
@@ -364,16 +1493,306 @@ static CBlockIndex *InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
-bool CTxDB::LoadBlockIndex()
+// Flat copy of the block index written at clean shutdown. Each entry is a fixed
+// size record in native byte order; links between entries are stored as record
+// numbers so that loading needs no hash lookups, and the chain trust and stake
+// modifier checksum are cached so they need not be recomputed for the whole chain.
+static const uint32_t BLOCKINDEX_SNAPSHOT_MAGIC = 0x4e424958; // "NBIX"
+static const uint32_t BLOCKINDEX_SNAPSHOT_VERSION = 1;
+
+struct CBlockIndexSnapshotHeader
+{
+    uint32_t nMagic;
+    uint32_t nVersion;
+    uint32_t nRecordSize;
+    uint32_t nChecksum; // crc32c of hashBestChain and the records
+    uint64_t nRecords;
+    unsigned char hashBestChain[32];
+};
+
+struct CBlockIndexSnapshotRecord
+{
+    unsigned char hashBlock[32];
+    int32_t nPrev; // record number, -1 for none
+    int32_t nNext;
+    uint32_t nFile;
+    uint32_t nBlockPos;
+    int32_t nHeight;
+    uint32_t nFlags;
+    int64_t nMint;
+    int64_t nMoneySupply;
+    uint64_t nStakeModifier;
+    uint32_t nStakeModifierChecksum;
+    uint32_t nStakeTime;
+    unsigned char hashPrevoutStake[32];
+    uint32_t nPrevoutStake;
+    int32_t nVersion;
+    unsigned char hashProof[32];
+    unsigned char hashMerkleRoot[32];
+    uint32_t nTime;
+    uint32_t nBits;
+    uint32_t nNonce;
+    uint32_t nReserved;
+    unsigned char nChainTrust[32];
+};
+
+static_assert(sizeof(CBlockIndexSnapshotHeader) == 56, "unexpected snapshot header layout");
+static_assert(sizeof(CBlockIndexSnapshotRecord) == 240, "unexpected snapshot record layout");
+
+static filesystem::path GetBlockIndexSnapshotPath()
+{
+    return GetDataDir() / "blkindex.snapshot";
+}
+
+static uint32_t BlockIndexSnapshotChecksum(const unsigned char* hashBestChain, const char* pRecords, size_t nSize)
+{
+    uint32_t nChecksum = leveldb::crc32c::Value((const char*) hashBestChain, 32);
+    return leveldb::crc32c::Extend(nChecksum, pRecords, nSize);
+}
+
+static void ClearBlockIndex()
+{
+    for (auto i : mapBlockIndex)
+        delete i.second;
+
+    mapBlockIndex.clear();
+    setStakeSeen.clear();
+    pindexGenesisBlock = NULL;
+}
+
+bool CTxDB::WriteBlockIndexSnapshot()
 {
+    uint256 hashBest;
+
+    // Only a fully loaded index that agrees with the database is worth keeping
+    if (!pindexBest || !ReadHashBestChain(hashBest) || pindexBest->GetBlockHash() != hashBest)
+        return false;
+
     auto start = high_resolution_clock::now();
 
-    if (mapBlockIndex.size() > 0)
+    vector<CBlockIndex*> vIndex;
+    robin_hood::unordered_flat_map<const CBlockIndex*, int32_t> mapRecord;
+    vIndex.reserve(mapBlockIndex.size());
+    mapRecord.reserve(mapBlockIndex.size());
+
+    for (auto& item : mapBlockIndex)
     {
-        // Already loaded once in this session. It can happen during migration from BDB
-        return true;
+        mapRecord[item.second] = vIndex.size();
+        vIndex.push_back(item.second);
+    }
+
+    vector<CBlockIndexSnapshotRecord> vRecords(vIndex.size());
+
+    for (unsigned int i = 0; i < vIndex.size(); i++)
+    {
+        const CBlockIndex* pindex = vIndex[i];
+        CBlockIndexSnapshotRecord& record = vRecords[i];
+        memset(&record, 0, sizeof(record));
+
+        memcpy(record.hashBlock, pindex->phashBlock->begin(), 32);
+        record.nPrev = pindex->pprev ? mapRecord[pindex->pprev] : -1;
+        record.nNext = pindex->pnext ? mapRecord[pindex->pnext] : -1;
+        record.nFile = pindex->nFile;
+        record.nBlockPos = pindex->nBlockPos;
+        record.nHeight = pindex->nHeight;
+        record.nFlags = pindex->nFlags;
+        record.nMint = pindex->nMint;
+        record.nMoneySupply = pindex->nMoneySupply;
+        record.nStakeModifier = pindex->nStakeModifier;
+        record.nStakeModifierChecksum = pindex->nStakeModifierChecksum;
+        record.nStakeTime = pindex->nStakeTime;
+        memcpy(record.hashPrevoutStake, pindex->prevoutStake.hash.begin(), 32);
+        record.nPrevoutStake = pindex->prevoutStake.n;
+        record.nVersion = pindex->nVersion;
+        memcpy(record.hashProof, pindex->hashProof.begin(), 32);
+        memcpy(record.hashMerkleRoot, pindex->hashMerkleRoot.begin(), 32);
+        record.nTime = pindex->nTime;
+        record.nBits = pindex->nBits;
+        record.nNonce = pindex->nNonce;
+        memcpy(record.nChainTrust, pindex->nChainTrust.begin(), 32);
+    }
+
+    CBlockIndexSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.nMagic = BLOCKINDEX_SNAPSHOT_MAGIC;
+    header.nVersion = BLOCKINDEX_SNAPSHOT_VERSION;
+    header.nRecordSize = sizeof(CBlockIndexSnapshotRecord);
+    header.nRecords = vRecords.size();
+    memcpy(header.hashBestChain, hashBest.begin(), 32);
+    header.nChecksum = BlockIndexSnapshotChecksum(header.hashBestChain, (const char*) vRecords.data(),
+                                                  vRecords.size() * sizeof(CBlockIndexSnapshotRecord));
+
+    // Write to a temporary file first, a torn snapshot must never replace a good one
+    filesystem::path pathSnapshot = GetBlockIndexSnapshotPath();
+    filesystem::path pathTmp = pathSnapshot;
+    pathTmp += ".new";
+
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+
+    if (!file)
+        return error("%s : failed to open %s", __func__, pathTmp.string().c_str());
+
+    bool fOk = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    if (fOk && !vRecords.empty())
+        fOk = fwrite(vRecords.data(), sizeof(CBlockIndexSnapshotRecord), vRecords.size(), file) == vRecords.size();
+
+    if (fOk)
+        FileCommit(file);
+
+    fclose(file);
+
+    if (!fOk || !RenameOver(pathTmp, pathSnapshot))
+    {
+        filesystem::remove(pathTmp);
+        return error("%s : failed to write %s", __func__, pathSnapshot.string().c_str());
+    }
+
+    auto duration = duration_cast<milliseconds>(high_resolution_clock::now() - start);
+    LogPrintf("%s : wrote %u entries in %ld ms\n", __func__, vRecords.size(), duration.count());
+    return true;
+}
+
+bool CTxDB::LoadBlockIndexSnapshot()
+{
+    filesystem::path pathSnapshot = GetBlockIndexSnapshotPath();
+
+    // A snapshot left behind by an on-disk database does not describe a fresh one in memory
+    if (!GetTxDBBackend().IsPersistent() || !filesystem::exists(pathSnapshot))
+        return false;
+
+    bool fLoaded = false;
+
+    try
+    {
+        interprocess::file_mapping mapping(pathSnapshot.string().c_str(), interprocess::read_only);
+        interprocess::mapped_region region(mapping, interprocess::read_only);
+        const char* pBegin = (const char*) region.get_address();
+        size_t nSize = region.get_size();
+
+        fLoaded = ReadBlockIndexSnapshot(pBegin, nSize);
+    }
+    catch (const std::exception& e)
+    {
+        LogPrintf("%s : cannot map %s: %s\n", __func__, pathSnapshot.string().c_str(), e.what());
+    }
+
+    // The snapshot only describes the state at the last clean shutdown. Anything
+    // written to the block index from now on would make it stale, so it is thrown
+    // away and written again when this session ends cleanly.
+    boost::system::error_code ec;
+    filesystem::remove(pathSnapshot, ec);
+
+    return fLoaded;
+}
+
+bool CTxDB::ReadBlockIndexSnapshot(const char* pBegin, size_t nSize)
+{
+    auto start = high_resolution_clock::now();
+
+    CBlockIndexSnapshotHeader header;
+    uint256 hashBest;
+
+    if (nSize < sizeof(header))
+        return error("%s : snapshot truncated", __func__);
+
+    memcpy(&header, pBegin, sizeof(header));
+
+    if (header.nMagic != BLOCKINDEX_SNAPSHOT_MAGIC || header.nVersion != BLOCKINDEX_SNAPSHOT_VERSION ||
+        header.nRecordSize != sizeof(CBlockIndexSnapshotRecord))
+    {
+        LogPrintf("%s : ignoring snapshot of an unknown format\n", __func__);
+        return false;
+    }
+
+    if (header.nRecords > (uint64_t) numeric_limits<int32_t>::max() ||
+        nSize != sizeof(header) + header.nRecords * sizeof(CBlockIndexSnapshotRecord))
+        return error("%s : snapshot size mismatch", __func__);
+
+    if (!ReadHashBestChain(hashBest) || memcmp(header.hashBestChain, hashBest.begin(), 32) != 0)
+    {
+        LogPrintf("%s : snapshot does not match the best chain, ignoring it\n", __func__);
+        return false;
+    }
+
+    const char* pRecords = pBegin + sizeof(header);
+    size_t nRecordBytes = nSize - sizeof(header);
+
+    if (BlockIndexSnapshotChecksum(header.hashBestChain, pRecords, nRecordBytes) != header.nChecksum)
+        return error("%s : snapshot checksum mismatch", __func__);
+
+    // Records are not necessarily aligned in the mapping, copy them out one by one
+    int32_t nRecords = header.nRecords;
+    vector<CBlockIndex*> vIndex(nRecords);
+    mapBlockIndex.reserve(nRecords);
+
+    for (int32_t i = 0; i < nRecords; i++)
+    {
+        CBlockIndexSnapshotRecord record;
+        memcpy(&record, pRecords + i * sizeof(record), sizeof(record));
+
+        uint256 hashBlock;
+        memcpy(hashBlock.begin(), record.hashBlock, 32);
+
+        if (record.nPrev < -1 || record.nPrev >= nRecords || record.nNext < -1 || record.nNext >= nRecords ||
+            mapBlockIndex.count(hashBlock))
+        {
+            ClearBlockIndex();
+            return error("%s : snapshot entry %d is invalid", __func__, i);
+        }
+
+        CBlockIndex* pindexNew = InsertBlockIndex(hashBlock);
+        pindexNew->nFile                  = record.nFile;
+        pindexNew->nBlockPos              = record.nBlockPos;
+        pindexNew->nHeight                = record.nHeight;
+        pindexNew->nMint                  = record.nMint;
+        pindexNew->nMoneySupply           = record.nMoneySupply;
+        pindexNew->nFlags                 = record.nFlags;
+        pindexNew->nStakeModifier         = record.nStakeModifier;
+        pindexNew->nStakeModifierChecksum = record.nStakeModifierChecksum;
+        pindexNew->nStakeTime             = record.nStakeTime;
+        pindexNew->nVersion               = record.nVersion;
+        pindexNew->nTime                  = record.nTime;
+        pindexNew->nBits                  = record.nBits;
+        pindexNew->nNonce                 = record.nNonce;
+        pindexNew->prevoutStake.n         = record.nPrevoutStake;
+        memcpy(pindexNew->prevoutStake.hash.begin(), record.hashPrevoutStake, 32);
+        memcpy(pindexNew->hashProof.begin(), record.hashProof, 32);
+        memcpy(pindexNew->hashMerkleRoot.begin(), record.hashMerkleRoot, 32);
+        memcpy(pindexNew->nChainTrust.begin(), record.nChainTrust, 32);
+        vIndex[i] = pindexNew;
+
+        // Watch for genesis block
+        if (pindexGenesisBlock == NULL && hashBlock == (!fTestNet ? hashGenesisBlock : hashGenesisBlockTestNet))
+            pindexGenesisBlock = pindexNew;
+
+        if (!CheckStakeModifierCheckpoints(pindexNew->nHeight, pindexNew->nStakeModifierChecksum))
+        {
+            ClearBlockIndex();
+            return error("%s : failed stake modifier checkpoint height=%d, modifier=0x%016" PRIx64,
+                         __func__, pindexNew->nHeight, pindexNew->nStakeModifier);
+        }
+
+        if (pindexNew->IsProofOfStake())
+            setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
     }
 
+    for (int32_t i = 0; i < nRecords; i++)
+    {
+        CBlockIndexSnapshotRecord record;
+        memcpy(&record, pRecords + i * sizeof(record), sizeof(record));
+
+        vIndex[i]->pprev = record.nPrev >= 0 ? vIndex[record.nPrev] : NULL;
+        vIndex[i]->pnext = record.nNext >= 0 ? vIndex[record.nNext] : NULL;
+    }
+
+    auto duration = duration_cast<milliseconds>(high_resolution_clock::now() - start);
+    LogPrintf("%s : loaded %d entries from the snapshot in %ld ms\n", __func__, nRecords, duration.count());
+    return true;
+}
+
+bool CTxDB::LoadBlockIndexGuts()
+{
     // The block index is an in-memory structure that maps hashes to on-disk
     // locations where the contents of the block can be found. Here, we scan it
     // out of the DB and into mapBlockIndex.
@@ -427,47 +1846,293 @@ bool CTxDB::LoadBlockIndex()
         if (pindexGenesisBlock == NULL && blockHash == (!fTestNet ? hashGenesisBlock : hashGenesisBlockTestNet))
             pindexGenesisBlock = pindexNew;
 
-        if (!pindexNew->CheckIndex())
+        if (!pindexNew->CheckIndex())
+        {
+            delete iterator;
+            return error("%s : CheckIndex failed at %d", __func__, pindexNew->nHeight);
+        }
+
+        if (pindexNew->IsProofOfStake())
+            setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+
+        iterator->Next();
+    }
+
+    delete iterator;
+
+    if (fRequestShutdown)
+        return true;
+
+    // Calculate nChainTrust
+    vector<pair<int, CBlockIndex*> > vSortedByHeight;
+    vSortedByHeight.reserve(mapBlockIndex.size());
+
+    for (auto& item : mapBlockIndex)
+    {
+        CBlockIndex* pindex = item.second;
+        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+    }
+
+    sort(vSortedByHeight.begin(), vSortedByHeight.end());
+
+    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
+    {
+        CBlockIndex* pindex = item.second;
+        pindex->nChainTrust = (pindex->pprev ? pindex->pprev->nChainTrust : 0) + pindex->GetBlockTrust();
+        pindex->nStakeModifierChecksum = GetStakeModifierChecksum(pindex);
+
+        if (!CheckStakeModifierCheckpoints(pindex->nHeight, pindex->nStakeModifierChecksum))
+        {
+            return error("%s : failed stake modifier checkpoint height=%d, modifier=0x%016" PRIx64,
+                         __func__, pindex->nHeight, pindex->nStakeModifier);
+        }
+    }
+
+    return true;
+}
+
+// Outcome of verifying one block of the -checkblocks range
+struct CBlockCheck
+{
+    CBlockIndex* pindex;
+    bool fReadFailed;
+    bool fBad;
+
+    // Spends recorded in the index entries of the block's transactions. Whether
+    // they happened within the checked part of the main chain (level 4) can only
+    // be answered once every block of the range is known.
+    vector<pair<CDiskTxPos, pair<uint256, unsigned int> > > vSpent;
+
+    CBlockCheck(CBlockIndex* pindexIn) : pindex(pindexIn), fReadFailed(false), fBad(false) {}
+};
+
+// Time spent per check level, summed over all threads. Slot 0 is reading blocks,
+// signatures (level 7) are checked along with the rest of the block in slot 1.
+static const int CHECKLEVEL_MAX = 6;
+
+// Runs the checks that only need the block itself and the database: block
+// validity (level 1) and signature (level 7), transaction index lookups (level 2),
+// transaction positions (level 3), spending transactions (level 6) and prevouts
+// (level 5).
+static void CheckBlockForIndex(CTxDB& txdb, CBlockCheck& check, int nCheckLevel, std::atomic<int64_t>* pnTime)
+{
+    CBlockIndex* pindex = check.pindex;
+    CBlock block;
+
+    int64_t nStart = GetTimeMicros();
+
+    if (!block.ReadFromDisk(pindex))
+    {
+        check.fReadFailed = true;
+        return;
+    }
+
+    int64_t nNow = GetTimeMicros();
+    pnTime[0] += nNow - nStart;
+    nStart = nNow;
+
+    // check level 1: verify block validity
+    // check level 7: verify block signature too
+    if (nCheckLevel>0 && !block.CheckBlock(true, true, (nCheckLevel>6)))
+    {
+        LogPrintf("%s : [WARNING] found bad block at %d, hash=%s\n", __func__,
+                  pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
+
+        check.fBad = true;
+    }
+
+    nNow = GetTimeMicros();
+    pnTime[1] += nNow - nStart;
+
+    if (nCheckLevel < 2)
+        return;
+
+    BOOST_FOREACH(const CTransaction &tx, block.vtx)
+    {
+        uint256 hashTx = tx.GetHash();
+        CTxIndex txindex;
+
+        // check level 2: verify transaction index validity
+        nStart = GetTimeMicros();
+        bool fFound = txdb.ReadTxIndex(hashTx, txindex);
+        nNow = GetTimeMicros();
+        pnTime[2] += nNow - nStart;
+
+        if (fFound)
+        {
+            // check level 3: checker transaction hashes
+            if (nCheckLevel > 2 || pindex->nFile != txindex.pos.nFile || pindex->nBlockPos != txindex.pos.nBlockPos)
+            {
+                nStart = nNow;
+
+                // either an error or a duplicate transaction
+                CTransaction txFound;
+
+                if (!txFound.ReadFromDisk(txindex.pos))
+                {
+                    LogPrintf("%s : [WARNING] cannot read mislocated transaction %s\n",
+                              __func__, hashTx.ToString().c_str());
+
+                    check.fBad = true;
+                }
+                else if (txFound.GetHash() != hashTx) // not a duplicate tx
+                {
+                    LogPrintf("%s : [WARNING] invalid tx position for %s\n",
+                              __func__, hashTx.ToString().c_str());
+
+                    check.fBad = true;
+                }
+
+                pnTime[3] += GetTimeMicros() - nStart;
+            }
+
+            // check level 4: collect spent txouts, see MergeBlockChecks()
+            unsigned int nOutput = 0;
+
+            if (nCheckLevel > 3)
+            {
+                BOOST_FOREACH(const CDiskTxPos &txpos, txindex.vSpent)
+                {
+                    if (!txpos.IsNull())
+                    {
+                        check.vSpent.push_back(make_pair(txpos, make_pair(hashTx, nOutput)));
+
+                        // check level 6: check whether spent txouts were spent by a valid transaction that consume them
+                        if (nCheckLevel > 5)
+                        {
+                            nStart = GetTimeMicros();
+                            CTransaction txSpend;
+
+                            if (!txSpend.ReadFromDisk(txpos))
+                            {
+                                LogPrintf("%s : [WARNING] cannot read spending transaction of %s:%i from disk\n",
+                                          __func__, hashTx.ToString().c_str(), nOutput);
+
+                                check.fBad = true;
+                            }
+                            else if (!txSpend.CheckTransaction())
+                            {
+                                LogPrintf("%s : [WARNING] spending transaction of %s:%i is invalid\n",
+                                          __func__, hashTx.ToString().c_str(), nOutput);
+
+                                check.fBad = true;
+                            }
+                            else
+                            {
+                                bool fFound = false;
+
+                                BOOST_FOREACH(const CTxIn &txin, txSpend.vin)
+                                {
+                                    if (txin.prevout.hash == hashTx && txin.prevout.n == nOutput)
+                                        fFound = true;
+                                }
+
+                                if (!fFound)
+                                {
+                                    LogPrintf("%s : [WARNING] spending transaction of %s:%i does not spend it\n",
+                                              __func__, hashTx.ToString().c_str(), nOutput);
+
+                                    check.fBad = true;
+                                }
+                            }
+
+                            pnTime[6] += GetTimeMicros() - nStart;
+                        }
+                    }
+
+                    nOutput++;
+                }
+            }
+        }
+
+        // check level 5: check whether all prevouts are marked spent
+        if (nCheckLevel > 4)
+        {
+            nStart = GetTimeMicros();
+
+            BOOST_FOREACH(const CTxIn &txin, tx.vin)
+            {
+                CTxIndex txindex;
+
+                if (txdb.ReadTxIndex(txin.prevout.hash, txindex))
+                {
+                    if (txindex.vSpent.size() - 1 < txin.prevout.n || txindex.vSpent[txin.prevout.n].IsNull())
+                    {
+                        LogPrintf("%s : [WARNING] found unspent prevout %s:%i in %s\n",
+                                  __func__, txin.prevout.hash.ToString().c_str(), txin.prevout.n,
+                                  hashTx.ToString().c_str());
+
+                        check.fBad = true;
+                    }
+                }
+            }
+
+            pnTime[5] += GetTimeMicros() - nStart;
+        }
+    }
+}
+
+// Runs the cross-block part of the verification (level 4) over the results of
+// CheckBlockForIndex() and returns the block the best chain has to move back to,
+// that is the parent of the lowest bad block, or NULL if all of them are fine
+static CBlockIndex* MergeBlockChecks(vector<CBlockCheck>& vChecks, int nCheckLevel, std::atomic<int64_t>* pnTime)
+{
+    int64_t nStart = GetTimeMicros();
+    map<pair<unsigned int, unsigned int>, CBlockIndex*> mapBlockPos;
+
+    BOOST_FOREACH(const CBlockCheck& check, vChecks)
+        mapBlockPos[make_pair(check.pindex->nFile, check.pindex->nBlockPos)] = check.pindex;
+
+    CBlockIndex* pindexFork = NULL;
+
+    // vChecks runs from the best block down, so the lowest bad block is found last
+    BOOST_FOREACH(CBlockCheck& check, vChecks)
+    {
+        CBlockIndex* pindex = check.pindex;
+
+        for (unsigned int i = 0; i < check.vSpent.size(); i++)
         {
-            delete iterator;
-            return error("%s : CheckIndex failed at %d", __func__, pindexNew->nHeight);
-        }
+            const CDiskTxPos& txpos = check.vSpent[i].first;
+            auto mi = mapBlockPos.find(make_pair(txpos.nFile, txpos.nBlockPos));
 
-        if (pindexNew->IsProofOfStake())
-            setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+            // The spend has to be in this block or one above it in the checked range
+            if (mi == mapBlockPos.end() || mi->second->nHeight < pindex->nHeight)
+            {
+                LogPrintf("%s : [WARNING] found bad spend at %d, hashBlock=%s, hashTx=%s\n",
+                          __func__, pindex->nHeight, pindex->GetBlockHash().ToString().c_str(),
+                          check.vSpent[i].second.first.ToString().c_str());
 
-        iterator->Next();
+                check.fBad = true;
+            }
+        }
+
+        if (check.fBad)
+            pindexFork = pindex->pprev;
     }
 
-    delete iterator;
+    if (nCheckLevel > 3)
+        pnTime[4] += GetTimeMicros() - nStart;
 
-    if (fRequestShutdown)
-        return true;
+    return pindexFork;
+}
 
-    // Calculate nChainTrust
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
+bool CTxDB::LoadBlockIndex()
+{
+    auto start = high_resolution_clock::now();
 
-    for (auto& item : mapBlockIndex)
+    if (mapBlockIndex.size() > 0)
     {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+        // Already loaded once in this session. It can happen during migration from BDB
+        return true;
     }
 
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-
-    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
-    {
-        CBlockIndex* pindex = item.second;
-        pindex->nChainTrust = (pindex->pprev ? pindex->pprev->nChainTrust : 0) + pindex->GetBlockTrust();
-        pindex->nStakeModifierChecksum = GetStakeModifierChecksum(pindex);
+    // Start from the snapshot written at the last clean shutdown, fall back
+    // to scanning the records in the database when there is none
+    if (!LoadBlockIndexSnapshot() && !LoadBlockIndexGuts())
+        return false;
 
-        if (!CheckStakeModifierCheckpoints(pindex->nHeight, pindex->nStakeModifierChecksum))
-        {
-            return error("%s : failed stake modifier checkpoint height=%d, modifier=0x%016" PRIx64,
-                         __func__, pindex->nHeight, pindex->nStakeModifier);
-        }
-    }
+    if (fRequestShutdown)
+        return true;
 
     // Load hashBestChain pointer to end of best chain
     if (!ReadHashBestChain(hashBestChain))
@@ -501,6 +2166,17 @@ bool CTxDB::LoadBlockIndex()
     ReadBestInvalidTrust(bnBestInvalidTrust);
     nBestInvalidTrust = bnBestInvalidTrust.getuint256();
 
+    // Before anything below reads blocks
+    if (!LoadPrunedBlockFiles(*this))
+        return error("%s : failed to load the pruned block files", __func__);
+
+    // Bring the unspent output set in line with the transaction index
+    if (!LoadCoins())
+        return error("%s : failed to load the coins database", __func__);
+
+    if (fRequestShutdown)
+        return true;
+
     // Verify blocks in the best chain
     int nCheckLevel = GetArg("-checklevel", 1);
     int nCheckDepth = GetArg( "-checkblocks", 500);
@@ -513,168 +2189,395 @@ bool CTxDB::LoadBlockIndex()
 
     LogPrintf("%s : verifying last %i blocks at level %i\n", __func__, nCheckDepth, nCheckLevel);
 
-    CBlockIndex* pindexFork = NULL;
-    map<pair<unsigned int, unsigned int>, CBlockIndex*> mapBlockPos;
+    // Blocks are handed out to the workers one at a time, the merge step below
+    // expects them ordered from the best block down
+    vector<CBlockCheck> vChecks;
 
     for (CBlockIndex* pindex = pindexBest; pindex && pindex->pprev; pindex = pindex->pprev)
     {
-        if (fRequestShutdown || pindex->nHeight < nBestHeight-nCheckDepth)
+        if (pindex->nHeight < nBestHeight-nCheckDepth || IsBlockPruned(pindex))
             break;
 
+        vChecks.push_back(CBlockCheck(pindex));
+    }
+
+    int nThreads = max(1, min((int) boost::thread::hardware_concurrency(), 16));
+    std::atomic<unsigned int> nNext(0);
+    std::atomic<int64_t> nTime[CHECKLEVEL_MAX + 1];
+    int64_t nStart = GetTimeMillis();
+
+    for (int i = 0; i <= CHECKLEVEL_MAX; i++)
+        nTime[i] = 0;
+
+    boost::thread_group threadGroup;
+
+    for (int i = 0; i < nThreads; i++)
+    {
+        threadGroup.create_thread([&]() {
+            RenameThread("neutron-checkblocks");
+
+            for (unsigned int n = nNext++; n < vChecks.size() && !fRequestShutdown; n = nNext++)
+                CheckBlockForIndex(*this, vChecks[n], nCheckLevel, nTime);
+        });
+    }
+
+    threadGroup.join_all();
+
+    if (fRequestShutdown)
+        return true;
+
+    BOOST_FOREACH(const CBlockCheck& check, vChecks)
+    {
+        if (check.fReadFailed)
+            return error("%s : block.ReadFromDisk failed at %d", __func__, check.pindex->nHeight);
+    }
+
+    CBlockIndex* pindexFork = MergeBlockChecks(vChecks, nCheckLevel, nTime);
+
+    LogPrintf("%s : verified %u blocks with %d threads in %d ms\n", __func__,
+              vChecks.size(), nThreads, GetTimeMillis() - nStart);
+
+    // Summed over all threads, so these can add up to more than the wall time
+    LogPrintf("%s : reading blocks took %d ms\n", __func__, nTime[0] / 1000);
+
+    for (int i = 1; i <= min(nCheckLevel, CHECKLEVEL_MAX); i++)
+        LogPrintf("%s : check level %d took %d ms\n", __func__, i, nTime[i] / 1000);
+
+    if (pindexFork && !fRequestShutdown)
+    {
+        // Reorg back to the fork
+        LogPrintf("%s : [WARNING] moving best chain pointer back to block %d\n",
+                  __func__, pindexFork->nHeight);
+
+        CBlock block;
+
+        if (!block.ReadFromDisk(pindexFork))
+            return error("%s : block.ReadFromDisk failed", __func__);
+
+        CTxDB txdb;
+        block.SetBestChain(txdb, pindexFork);
+    }
+
+    auto duration = duration_cast<milliseconds>(high_resolution_clock::now() - start);
+    LogPrintf("%s : Loading took %ld ms\n", __func__, duration.count());
+    return true;
+}
+
+bool CTxDB::LoadCoins()
+{
+    uint256 hashCoins;
+
+    if (!ReadCoinsBestChain(hashCoins))
+    {
+        LogPrintf("%s : no coins database found\n", __func__);
+        return RebuildCoins();
+    }
+
+    if (hashCoins == hashBestChain)
+    {
+        pcoinsTip->SetBestBlock(hashCoins);
+        return true;
+    }
+
+    auto mi = mapBlockIndex.find(hashCoins);
+
+    if (mi == mapBlockIndex.end() || !mi->second->IsInMainChain())
+    {
+        LogPrintf("%s : coins database is not on the best chain\n", __func__);
+        return RebuildCoins();
+    }
+
+    // The coins lag behind the transaction index, which happens when the node
+    // stops between the two commits. Replay the missing blocks.
+    LogPrintf("%s : replaying %d blocks into the coins database\n", __func__, nBestHeight - mi->second->nHeight);
+
+    for (CBlockIndex* pindex = mi->second->pnext; pindex; pindex = pindex->pnext)
+    {
+        if (IsBlockPruned(pindex))
+            return error("%s : block %d to replay has been pruned, a full resync is required", __func__, pindex->nHeight);
+    }
+
+    for (CBlockIndex* pindex = mi->second->pnext; pindex; pindex = pindex->pnext)
+    {
         CBlock block;
 
         if (!block.ReadFromDisk(pindex))
             return error("%s : block.ReadFromDisk failed", __func__);
 
-        // check level 1: verify block validity
-        // check level 7: verify block signature too
-        if (nCheckLevel>0 && !block.CheckBlock(true, true, (nCheckLevel>6)))
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            pcoinsTip->UpdateCoins(tx, pindex->nHeight);
+
+        pcoinsTip->SetBestBlock(pindex->GetBlockHash());
+
+        if (!FlushCoinsTip(*this, false))
+            return false;
+
+        if (pindex == pindexBest)
+            break;
+    }
+
+    return FlushCoinsTip(*this, true);
+}
+
+// Rewrites the transaction index entries of a version 70509 database with the
+// spent bitmap encoding. Entries are converted independently of each other, so an
+// interrupted migration simply picks up where it left off on the next start.
+bool CTxDB::MigrateTxIndex()
+{
+    auto start = high_resolution_clock::now();
+
+    LogPrintf("%s : converting the transaction index to the spent bitmap format\n", __func__);
+
+    leveldb::WriteBatch batch;
+    unsigned int nTx = 0;
+    unsigned int nConverted = 0;
+    uint64_t nBytesBefore = 0;
+    uint64_t nBytesAfter = 0;
+
+    leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+    CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
+    ssStartKey << make_pair(string("tx"), uint256(0));
+
+    for (iterator->Seek(ssStartKey.str()); iterator->Valid(); iterator->Next())
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.write(iterator->key().data(), iterator->key().size());
+        string strType;
+        ssKey >> strType;
+
+        if (fRequestShutdown || strType != "tx")
+            break;
+
+        nTx++;
+        nBytesBefore += iterator->value().size();
+
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue.write(iterator->value().data(), iterator->value().size());
+        int nFormat;
+        ssValue >> nFormat;
+
+        if (nFormat & TXINDEX_SPENT_BITMAP)
         {
-            LogPrintf("%s : [WARNING] found bad block at %d, hash=%s\n", __func__,
-                      pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
+            nBytesAfter += iterator->value().size();
+            continue;
+        }
 
-            pindexFork = pindex->pprev;
+        CTxIndex txindex;
+
+        try
+        {
+            ssValue.Rewind(sizeof(nFormat));
+            ssValue >> txindex;
+        }
+        catch (std::exception &e)
+        {
+            delete iterator;
+            return error("%s : deserialize error: %s", __func__, e.what());
         }
 
-        // check level 2: verify transaction index validity
-        if (nCheckLevel > 1)
+        CDataStream ssNew(SER_DISK, CLIENT_VERSION);
+        ssNew.reserve(GetSerializeSize(txindex, SER_DISK, CLIENT_VERSION));
+        ssNew << txindex;
+        batch.Put(iterator->key(), ssNew.str());
+        nBytesAfter += ssNew.size();
+
+        if (++nConverted % 100000 == 0)
         {
-            pair<unsigned int, unsigned int> pos = make_pair(pindex->nFile, pindex->nBlockPos);
-            mapBlockPos[pos] = pindex;
+            leveldb::Status status = pdb->Write(leveldb::WriteOptions(), &batch);
+            batch.Clear();
 
-            BOOST_FOREACH(const CTransaction &tx, block.vtx)
+            if (!status.ok())
             {
-                uint256 hashTx = tx.GetHash();
-                CTxIndex txindex;
+                delete iterator;
+                return error("%s : leveldb write failure: %s", __func__, status.ToString().c_str());
+            }
 
-                if (ReadTxIndex(hashTx, txindex))
-                {
-                    // check level 3: checker transaction hashes
-                    if (nCheckLevel > 2 || pindex->nFile != txindex.pos.nFile || pindex->nBlockPos != txindex.pos.nBlockPos)
-                    {
-                        // either an error or a duplicate transaction
-                        CTransaction txFound;
+            LogPrintf("%s : %u transactions converted\n", __func__, nConverted);
+        }
+    }
 
-                        if (!txFound.ReadFromDisk(txindex.pos))
-                        {
-                            LogPrintf("%s : [WARNING] cannot read mislocated transaction %s\n",
-                                      __func__, hashTx.ToString().c_str());
+    delete iterator;
 
-                            pindexFork = pindex->pprev;
-                        }
-                        else if (txFound.GetHash() != hashTx) // not a duplicate tx
-                        {
-                            LogPrintf("%s : [WARNING] invalid tx position for %s\n",
-                                      __func__, hashTx.ToString().c_str());
+    leveldb::Status status = pdb->Write(leveldb::WriteOptions(), &batch);
 
-                            pindexFork = pindex->pprev;
-                        }
-                    }
+    if (!status.ok())
+        return error("%s : leveldb write failure: %s", __func__, status.ToString().c_str());
 
-                    // check level 4: check whether spent txouts were spent within the main chain
-                    unsigned int nOutput = 0;
+    if (fRequestShutdown)
+        return false;
 
-                    if (nCheckLevel > 3)
-                    {
-                        BOOST_FOREACH(const CDiskTxPos &txpos, txindex.vSpent)
-                        {
-                            if (!txpos.IsNull())
-                            {
-                                pair<unsigned int, unsigned int> posFind = make_pair(txpos.nFile, txpos.nBlockPos);
+    auto duration = duration_cast<milliseconds>(high_resolution_clock::now() - start);
+    LogPrintf("%s : converted %u of %u transactions in %ld ms, index entries take %u KiB instead of %u KiB\n",
+              __func__, nConverted, nTx, duration.count(), (unsigned int) (nBytesAfter / 1024),
+              (unsigned int) (nBytesBefore / 1024));
 
-                                if (!mapBlockPos.count(posFind))
-                                {
-                                    LogPrintf("%s : [WARNING] found bad spend at %d, hashBlock=%s, hashTx=%s\n",
-                                              __func__, pindex->nHeight, pindex->GetBlockHash().ToString().c_str(),
-                                              hashTx.ToString().c_str());
+    return true;
+}
 
-                                    pindexFork = pindex->pprev;
-                                }
+bool CTxDB::RebuildCoins()
+{
+    auto start = high_resolution_clock::now();
 
-                                // check level 6: check whether spent txouts were spent by a valid transaction that consume them
-                                if (nCheckLevel > 5)
-                                {
-                                    CTransaction txSpend;
-                                    if (!txSpend.ReadFromDisk(txpos))
-                                    {
-                                        LogPrintf("%s : [WARNING] cannot read spending transaction of %s:%i from disk\n",
-                                                  __func__, hashTx.ToString().c_str(), nOutput);
-
-                                        pindexFork = pindex->pprev;
-                                    }
-                                    else if (!txSpend.CheckTransaction())
-                                    {
-                                        LogPrintf("%s : [WARNING] spending transaction of %s:%i is invalid\n",
-                                                  __func__, hashTx.ToString().c_str(), nOutput);
-
-                                        pindexFork = pindex->pprev;
-                                    }
-                                    else
-                                    {
-                                        bool fFound = false;
-
-                                        BOOST_FOREACH(const CTxIn &txin, txSpend.vin)
-                                        {
-                                            if (txin.prevout.hash == hashTx && txin.prevout.n == nOutput)
-                                                fFound = true;
-                                        }
-
-                                        if (!fFound)
-                                        {
-                                            LogPrintf("%s : [WARNING] spending transaction of %s:%i does not spend it\n",
-                                                      __func__, hashTx.ToString().c_str(), nOutput);
-
-                                            pindexFork = pindex->pprev;
-                                        }
-                                    }
-                                }
-                            }
+    // The rebuild reads every transaction with unspent outputs from its block,
+    // refuse before anything is deleted if some of those blocks are gone
+    if (HavePrunedBlockFiles())
+        return error("%s : the coins database has to be rebuilt but block files have been pruned, a full resync is required", __func__);
 
-                            nOutput++;
-                        }
-                    }
-                }
+    LogPrintf("%s : rebuilding the coins database from the transaction index\n", __func__);
 
-                // check level 5: check whether all prevouts are marked spent
-                if (nCheckLevel > 4)
-                {
-                     BOOST_FOREACH(const CTxIn &txin, tx.vin)
-                     {
-                          CTxIndex txindex;
-
-                          if (ReadTxIndex(txin.prevout.hash, txindex))
-                          {
-                              if (txindex.vSpent.size() - 1 < txin.prevout.n || txindex.vSpent[txin.prevout.n].IsNull())
-                              {
-                                  LogPrintf("%s : [WARNING] found unspent prevout %s:%i in %s\n",
-                                            __func__, txin.prevout.hash.ToString().c_str(), txin.prevout.n,
-                                            hashTx.ToString().c_str());
-
-                                  pindexFork = pindex->pprev;
-                              }
-                          }
-                     }
-                }
+    // The scan below reads the database directly
+    if (!Flush(true))
+        return false;
+
+    // Heights of the blocks in the main chain by their position on disk
+    robin_hood::unordered_flat_map<uint64_t, int> mapBlockHeight;
+
+    for (CBlockIndex* pindex = pindexBest; pindex; pindex = pindex->pprev)
+        mapBlockHeight[((uint64_t) pindex->nFile << 32) | pindex->nBlockPos] = pindex->nHeight;
+
+    leveldb::WriteBatch batch;
+    unsigned int nBatched = 0;
+
+    // Drop the marker first so that an interrupted rebuild starts over
+    CDataStream ssMarker(SER_DISK, CLIENT_VERSION);
+    ssMarker << string("coinsBestChain");
+    batch.Delete(ssMarker.str());
+
+    // Remove what is left of a previous coins database
+    leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+    CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
+    ssStartKey << make_pair(string("coin"), COutPoint(0, 0));
+
+    for (iterator->Seek(ssStartKey.str()); iterator->Valid(); iterator->Next())
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.write(iterator->key().data(), iterator->key().size());
+        string strType;
+        ssKey >> strType;
+
+        if (strType != "coin")
+            break;
+
+        batch.Delete(iterator->key());
+
+        if (++nBatched % 100000 == 0)
+        {
+            leveldb::Status status = pdb->Write(leveldb::WriteOptions(), &batch);
+
+            if (!status.ok())
+            {
+                delete iterator;
+                return error("%s : leveldb write failure: %s", __func__, status.ToString().c_str());
             }
+
+            batch.Clear();
         }
     }
 
-    if (pindexFork && !fRequestShutdown)
+    bool fIterOk = iterator->status().ok();
+    delete iterator;
+
+    if (!fIterOk)
+        return error("%s : leveldb iterator failure", __func__);
+
+    // Every transaction index entry with unspent outputs contributes those outputs
+    unsigned int nTx = 0;
+    unsigned int nCoins = 0;
+
+    iterator = pdb->NewIterator(leveldb::ReadOptions());
+    ssStartKey.clear();
+    ssStartKey << make_pair(string("tx"), uint256(0));
+
+    for (iterator->Seek(ssStartKey.str()); iterator->Valid(); iterator->Next())
     {
-        // Reorg back to the fork
-        LogPrintf("%s : [WARNING] moving best chain pointer back to block %d\n",
-                  __func__, pindexFork->nHeight);
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.write(iterator->key().data(), iterator->key().size());
+        string strType;
+        ssKey >> strType;
 
-        CBlock block;
+        if (fRequestShutdown || strType != "tx")
+            break;
 
-        if (!block.ReadFromDisk(pindexFork))
-            return error("%s : block.ReadFromDisk failed", __func__);
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue.write(iterator->value().data(), iterator->value().size());
+        CTxIndex txindex;
+        ssValue >> txindex;
 
-        CTxDB txdb;
-        block.SetBestChain(txdb, pindexFork);
+        bool fUnspent = false;
+
+        BOOST_FOREACH(const CDiskTxPos& pos, txindex.vSpent)
+            fUnspent |= pos.IsNull();
+
+        if (!fUnspent)
+            continue;
+
+        CTransaction tx;
+
+        if (!tx.ReadFromDisk(txindex.pos))
+        {
+            delete iterator;
+            return error("%s : ReadFromDisk failed for %s", __func__, txindex.pos.ToString().c_str());
+        }
+
+        auto mi = mapBlockHeight.find(((uint64_t) txindex.pos.nFile << 32) | txindex.pos.nBlockPos);
+        int nHeight = mi == mapBlockHeight.end() ? -1 : mi->second;
+        uint256 hashTx = tx.GetHash();
+
+        for (unsigned int i = 0; i < tx.vout.size() && i < txindex.vSpent.size(); i++)
+        {
+            if (!txindex.vSpent[i].IsNull() || tx.vout[i].IsEmpty())
+                continue;
+
+            CDataStream ssCoinKey(SER_DISK, CLIENT_VERSION);
+            ssCoinKey << make_pair(string("coin"), COutPoint(hashTx, i));
+            CDataStream ssCoin(SER_DISK, CLIENT_VERSION);
+            ssCoin << CCoin(tx, i, nHeight);
+            batch.Put(ssCoinKey.str(), ssCoin.str());
+            nCoins++;
+
+            if (++nBatched % 100000 == 0)
+            {
+                leveldb::Status status = pdb->Write(leveldb::WriteOptions(), &batch);
+
+                if (!status.ok())
+                {
+                    delete iterator;
+                    return error("%s : leveldb write failure: %s", __func__, status.ToString().c_str());
+                }
+
+                batch.Clear();
+            }
+        }
+
+        if (++nTx % 100000 == 0)
+            LogPrintf("%s : %u transactions scanned, %u coins\n", __func__, nTx, nCoins);
     }
 
+    fIterOk = iterator->status().ok();
+    delete iterator;
+
+    if (!fIterOk)
+        return error("%s : leveldb iterator failure", __func__);
+
+    // Without the marker the rebuild starts over on the next start
+    if (fRequestShutdown)
+        return error("%s : interrupted by shutdown", __func__);
+
+    ssMarker.clear();
+    ssMarker << string("coinsBestChain");
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    ssValue << hashBestChain;
+    batch.Put(ssMarker.str(), ssValue.str());
+
+    leveldb::Status status = pdb->Write(leveldb::WriteOptions(), &batch);
+
+    if (!status.ok())
+        return error("%s : leveldb write failure: %s", __func__, status.ToString().c_str());
+
+    pcoinsTip->SetBestBlock(hashBestChain);
+
     auto duration = duration_cast<milliseconds>(high_resolution_clock::now() - start);
-    LogPrintf("%s : Loading took %ld ms\n", __func__, duration.count());
+    LogPrintf("%s : %u coins from %u transactions rebuilt in %ld ms\n", __func__, nCoins, nTx, duration.count());
+
     return true;
 }
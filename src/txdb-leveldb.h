@@ -6,16 +6,129 @@
 #ifndef BITCOIN_LEVELDB_H
 #define BITCOIN_LEVELDB_H
 
+#include "addressindex.h"
 #include "main.h"
+#include "robinhood.h"
+#include "spentindex.h"
 #include "streams.h"
+#include "timestampindex.h"
+#include "txdbstats.h"
 
+#include <functional>
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+class CCoinsViewCache;
+
+// The pending writes and deletes of a transaction, indexed by key. Reads made
+// while a transaction is open have to see its pending changes; the index
+// answers them in constant time instead of replaying a leveldb::WriteBatch.
+class CTxDBBatch
+{
+public:
+    struct CPendingWrite
+    {
+        bool fDeleted;
+        std::string strValue;
+    };
+
+    typedef robin_hood::unordered_node_map<std::string, CPendingWrite> PendingMap;
+
+    void Put(const std::string& key, const std::string& value);
+    void Delete(const std::string& key);
+
+    // Returns true and sets (value, false) if the batch writes the given key,
+    // or leaves value alone and sets deleted = true if it deletes it.
+    bool Lookup(const std::string& key, std::string* value, bool* deleted) const;
+
+    // The final state of every key touched by the batch
+    const PendingMap& GetPending() const { return mapPending; }
+
+private:
+    PendingMap mapPending;
+};
+
+// Committed transactions are not written to LevelDB right away. They are
+// collected in a process-wide write cache, bounded by a share of -dbcache, and
+// written out in one batch when the cache grows too large, when it has not been
+// flushed for -dbflushinterval seconds, and at shutdown. Because a flush writes
+// everything committed so far atomically, hashBestChain on disk never gets ahead
+// of the transaction and block index records it depends on.
+//
+// The same flush is the only point where appended block data is synced: the
+// block files written since the last flush are synced right before the batch
+// that indexes them, so any number of blocks share a single pair of syncs.
+//
+// While the node is far behind the network the database is opened with a
+// bulk-load profile instead, and the write cache is only flushed when full.
+// The flush thread switches it off and compacts the database once
+// IsInitialBlockDownload() turns false.
+static const int64_t DEFAULT_DB_FLUSH_INTERVAL = 60;
+extern int64_t nDBFlushInterval;
+
+bool IsTxDBBulkLoad();
+
+void ThreadFlushTxDB(void* parg);
+
+// Where the LevelDB database behind CTxDB is kept, selected with -dbbackend.
+// "leveldb" is the txleveldb directory in the data directory. "memory" keeps
+// the whole database in RAM through LevelDB's in-memory environment; it is
+// gone when the process exits, which is what benchmarks that should not
+// measure I/O and unit tests that need a throwaway chain want.
+class CTxDBBackend
+{
+public:
+    virtual ~CTxDBBackend() {}
+
+    virtual const char* GetName() const = 0;
+
+    // Open the database, removing the existing one first if fWipe
+    virtual leveldb::Status Open(leveldb::Options& options, bool fWipe, leveldb::DB** ppdb) = 0;
+
+    // Whether the database outlives the process
+    virtual bool IsPersistent() const = 0;
+};
+
+static const char* const DEFAULT_TXDB_BACKEND = "leveldb";
+
+// Select the backend used the next time the database is opened, returns false
+// for an unknown name
+bool SetTxDBBackend(const std::string& strName);
+CTxDBBackend& GetTxDBBackend();
+
+// Fills a new, empty transaction database in place of the existing one, for
+// LoadChainState(). Records are written in large unsynced batches under the
+// bulk-load profile rather than through CTxDB; Commit() syncs and compacts the
+// result. Has to be done before the database is opened by CTxDB.
+class CTxDBBulkWriter
+{
+private:
+    leveldb::Options options;
+    leveldb::DB* pdb;
+    leveldb::WriteBatch batch;
+    size_t nBatchBytes;
+
+    bool WriteBatch(bool fSync);
+    void Close();
+
+public:
+    CTxDBBulkWriter();
+    ~CTxDBBulkWriter();
+
+    bool IsOpen() const { return pdb != NULL; }
+
+    bool Put(const std::string& key, const std::string& value);
+    bool Commit();
+
+    // Remove the partly written database again
+    void Abort();
+};
+
 // Class that provides access to a LevelDB. Note that this class is frequently
 // instantiated on the stack and then destroyed again, so instantiation has to
 // be very cheap. Unfortunately that means, a CTxDB instance is actually just a
@@ -32,11 +145,10 @@ class CTxDB
 {
 public:
     CTxDB(const char* pszMode="r+");
-    ~CTxDB() {
-        // Note that this is not the same as Close() because it deletes only
-        // data scoped to this TxDB object.
-        delete activeBatch;
-    }
+
+    // Note that this is not the same as Close() because it deletes only
+    // data scoped to this TxDB object.
+    ~CTxDB();
 
     // Destroys the underlying shared global state accessed by this TxDB.
     void Close();
@@ -46,23 +158,32 @@ private:
 
     // A batch stores up writes and deletes for atomic application. When this
     // field is non-NULL, writes/deletes go there instead of directly to disk.
-    leveldb::WriteBatch *activeBatch;
+    CTxDBBatch *activeBatch;
+
+    // Coin changes made while activeBatch is open. They only reach the shared
+    // pcoinsTip view once the batch has been committed.
+    CCoinsViewCache *activeCoins;
+
     leveldb::Options options;
     bool fReadOnly;
     int nVersion;
 
-protected:
-    // Returns true and sets (value,false) if activeBatch contains the given key
-    // or leaves value alone and sets deleted = true if activeBatch contains a
-    // delete for it.
-    bool ScanBatch(const CDataStream &key, std::string *value, bool *deleted) const;
+    // Answers a read from the process-wide write cache, see Read()
+    bool LookupWriteCache(const std::string& key, std::string* value, bool* deleted) const;
 
+    // Writes (or, with a NULL value, deletes) a key on disk right away,
+    // superseding whatever the write cache holds for it
+    bool WriteDirect(const std::string& key, const std::string* value);
+
+protected:
     template<typename K, typename T>
     bool Read(const K& key, T& value)
     {
+        CTxDBTimer timer;
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+        std::string strKey = ssKey.str();
         std::string strValue;
 
         bool readFromDb = true;
@@ -70,21 +191,37 @@ protected:
             // First we must search for it in the currently pending set of
             // changes to the db. If not found in the batch, go on to read disk.
             bool deleted = false;
-            readFromDb = ScanBatch(ssKey, &strValue, &deleted) == false;
+            readFromDb = activeBatch->Lookup(strKey, &strValue, &deleted) == false;
             if (deleted) {
+                RecordTxDBAccess(strKey, TXDB_READ, TXDB_SOURCE_MISSING, timer.Micros(), 0);
                 return false;
             }
+            if (!readFromDb)
+                RecordTxDBAccess(strKey, TXDB_READ, TXDB_SOURCE_BATCH, timer.Micros(), strValue.size());
+        }
+        if (readFromDb) {
+            // Then committed changes that have not been flushed yet
+            bool deleted = false;
+            readFromDb = LookupWriteCache(strKey, &strValue, &deleted) == false;
+            if (deleted) {
+                RecordTxDBAccess(strKey, TXDB_READ, TXDB_SOURCE_MISSING, timer.Micros(), 0);
+                return false;
+            }
+            if (!readFromDb)
+                RecordTxDBAccess(strKey, TXDB_READ, TXDB_SOURCE_CACHE, timer.Micros(), strValue.size());
         }
         if (readFromDb) {
             leveldb::Status status = pdb->Get(leveldb::ReadOptions(),
-                                              ssKey.str(), &strValue);
+                                              strKey, &strValue);
             if (!status.ok()) {
+                RecordTxDBAccess(strKey, TXDB_READ, TXDB_SOURCE_MISSING, timer.Micros(), 0);
                 if (status.IsNotFound())
                     return false;
                 // Some unexpected error.
                 printf("LevelDB read failure: %s\n", status.ToString().c_str());
                 return false;
             }
+            RecordTxDBAccess(strKey, TXDB_READ, TXDB_SOURCE_DISK, timer.Micros(), strValue.size());
         }
         // Unserialize value
         try {
@@ -104,23 +241,24 @@ protected:
         if (fReadOnly)
             assert(!"Write called on database in read-only mode");
 
+        CTxDBTimer timer;
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+        std::string strKey = ssKey.str();
         CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-        ssValue.reserve(10000);
+        ssValue.reserve(::GetSerializeSize(value, SER_DISK, CLIENT_VERSION));
         ssValue << value;
 
         if (activeBatch) {
-            activeBatch->Put(ssKey.str(), ssValue.str());
+            activeBatch->Put(strKey, ssValue.str());
+            RecordTxDBAccess(strKey, TXDB_WRITE, TXDB_SOURCE_BATCH, timer.Micros(), ssValue.size());
             return true;
         }
-        leveldb::Status status = pdb->Put(leveldb::WriteOptions(), ssKey.str(), ssValue.str());
-        if (!status.ok()) {
-            printf("LevelDB write failure: %s\n", status.ToString().c_str());
-            return false;
-        }
-        return true;
+        std::string strValue = ssValue.str();
+        bool fOk = WriteDirect(strKey, &strValue);
+        RecordTxDBAccess(strKey, TXDB_WRITE, TXDB_SOURCE_DISK, timer.Micros(), strValue.size());
+        return fOk;
     }
 
     template<typename K>
@@ -131,47 +269,79 @@ protected:
         if (fReadOnly)
             assert(!"Erase called on database in read-only mode");
 
+        CTxDBTimer timer;
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+        std::string strKey = ssKey.str();
         if (activeBatch) {
-            activeBatch->Delete(ssKey.str());
+            activeBatch->Delete(strKey);
+            RecordTxDBAccess(strKey, TXDB_ERASE, TXDB_SOURCE_BATCH, timer.Micros(), 0);
             return true;
         }
-        leveldb::Status status = pdb->Delete(leveldb::WriteOptions(), ssKey.str());
-        return (status.ok() || status.IsNotFound());
+        bool fOk = WriteDirect(strKey, NULL);
+        RecordTxDBAccess(strKey, TXDB_ERASE, TXDB_SOURCE_DISK, timer.Micros(), 0);
+        return fOk;
     }
 
     template<typename K>
     bool Exists(const K& key)
     {
+        CTxDBTimer timer;
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+        std::string strKey = ssKey.str();
         std::string unused;
 
         if (activeBatch) {
             bool deleted;
-            if (ScanBatch(ssKey, &unused, &deleted) && !deleted) {
-                return true;
+            if (activeBatch->Lookup(strKey, &unused, &deleted)) {
+                RecordTxDBAccess(strKey, TXDB_EXISTS, deleted ? TXDB_SOURCE_MISSING : TXDB_SOURCE_BATCH,
+                                 timer.Micros(), 0);
+                return !deleted;
             }
         }
 
+        bool deleted;
+        if (LookupWriteCache(strKey, &unused, &deleted)) {
+            RecordTxDBAccess(strKey, TXDB_EXISTS, deleted ? TXDB_SOURCE_MISSING : TXDB_SOURCE_CACHE,
+                             timer.Micros(), 0);
+            return !deleted;
+        }
+
 
-        leveldb::Status status = pdb->Get(leveldb::ReadOptions(), ssKey.str(), &unused);
-        return status.IsNotFound() == false;
+        leveldb::Status status = pdb->Get(leveldb::ReadOptions(), strKey, &unused);
+        bool fFound = status.IsNotFound() == false;
+        RecordTxDBAccess(strKey, TXDB_EXISTS, fFound ? TXDB_SOURCE_DISK : TXDB_SOURCE_MISSING, timer.Micros(), 0);
+        return fFound;
     }
 
 
 public:
     bool TxnBegin();
     bool TxnCommit();
-    bool TxnAbort()
-    {
-        delete activeBatch;
-        activeBatch = NULL;
-        return true;
-    }
+    bool TxnAbort();
+
+    // Write the committed changes held in the write cache to disk. Without
+    // fForce this only happens when the cache is over budget or due by time.
+    bool Flush(bool fForce = true);
+
+    // Leave the bulk-load profile and compact the whole database
+    void EndBulkLoad();
+
+    // A LevelDB property such as "leveldb.stats", false if unknown
+    bool GetProperty(const std::string& strName, std::string& strValue);
+
+    // Bytes held by the LevelDB block cache and by the write cache, and their limits
+    void GetCacheUsage(size_t& nBlockCache, size_t& nBlockCacheMax, size_t& nWriteCache, size_t& nWriteCacheMax);
+
+    // A consistent view of everything committed so far, write cache included.
+    // ScanSnapshot() visits every record of it in key order until fn returns
+    // false, then releases the snapshot.
+    const leveldb::Snapshot* GetSnapshot();
+    bool ScanSnapshot(const leveldb::Snapshot* snapshot,
+                      const std::function<bool(const leveldb::Slice& key, const leveldb::Slice& value)>& fn);
 
     bool ReadVersion(int& nVersion)
     {
@@ -202,9 +372,80 @@ public:
     bool WriteSyncCheckpoint(uint256 hashCheckpoint);
     bool ReadCheckpointPubKey(std::string& strPubKey);
     bool WriteCheckpointPubKey(const std::string& strPubKey);
+
+    // Unspent output set, read through the coins view of the active transaction
+    // (or pcoinsTip outside of one). The raw records are only touched by flushes.
+    bool GetCoin(const COutPoint& outpoint, CCoin& coin);
+    void UpdateCoins(const CTransaction& tx, int nHeight);
+    void AddCoin(const COutPoint& outpoint, const CCoin& coin);
+    void SpendCoin(const COutPoint& outpoint);
+    bool ReadCoin(const COutPoint& outpoint, CCoin& coin);
+    bool WriteCoins(const std::vector<std::pair<COutPoint, CCoin> >& vWrite,
+                    const std::vector<COutPoint>& vErase, const uint256& hashBlock);
+    bool ReadCoinsBestChain(uint256& hashBlock);
+
+    // Database-wide settings that need a -reindex to change, such as -addressindex
+    bool ReadFlag(const std::string& strName, bool& fValue);
+    bool WriteFlag(const std::string& strName, bool fValue);
+
+    // Address index, see addressindex.h. Reads see every committed change.
+    bool WriteAddressIndex(const CAddressIndexKey& key, int64_t nValue);
+    bool EraseAddressIndex(const CAddressIndexKey& key);
+    bool WriteAddressUnspent(const CAddressUnspentKey& key, const CAddressUnspentValue& value);
+    bool EraseAddressUnspent(const CAddressUnspentKey& key);
+    // Appends the records of an address, stopping once vEntries holds nMaxEntries
+    // if that is not 0
+    bool ReadAddressIndex(unsigned char nType, const uint160& hashBytes, int nStart, int nEnd,
+                          std::vector<CAddressIndexEntry>& vEntries, size_t nMaxEntries = 0);
+    bool ReadAddressUnspent(unsigned char nType, const uint160& hashBytes, std::vector<CAddressUnspentEntry>& vEntries);
+
+    // Writes address index records straight to disk, bypassing the transaction
+    // and the write cache. Only for building the index from scratch.
+    bool WriteAddressIndexBatch(const std::vector<CAddressIndexEntry>& vIndex,
+                                const std::vector<CAddressUnspentEntry>& vUnspent);
+
+    // Block files whose data has been deleted by -prune, see prune.h
+    bool ReadPrunedFiles(std::set<unsigned int>& setFiles);
+    bool WritePrunedFiles(const std::set<unsigned int>& setFiles);
+
+    // The coins a block spent, in spending order. Kept in prune mode, when the
+    // block files of the spent outputs may be gone by the time the block is
+    // disconnected.
+    bool WriteBlockUndo(const uint256& hashBlock, const std::vector<std::pair<COutPoint, CCoin> >& vUndo);
+    bool ReadBlockUndo(const uint256& hashBlock, std::vector<std::pair<COutPoint, CCoin> >& vUndo);
+    bool EraseBlockUndo(const uint256& hashBlock);
+
+    // Spent index, see spentindex.h
+    bool WriteSpentIndex(const CSpentIndexKey& key, const CSpentIndexValue& value);
+    bool EraseSpentIndex(const CSpentIndexKey& key);
+    bool ReadSpentIndex(const CSpentIndexKey& key, CSpentIndexValue& value);
+
+    // Timestamp index, see timestampindex.h. Reads see every committed change.
+    bool WriteTimestampIndex(const CTimestampIndexKey& key);
+    bool EraseTimestampIndex(const CTimestampIndexKey& key);
+    bool ReadTimestampIndex(unsigned int nLow, unsigned int nHigh, std::vector<CTimestampIndexKey>& vKeys);
+
     bool LoadBlockIndex();
 private:
+    // Whether the best block is recent enough for the regular profile
+    bool HasRecentTip();
+
+    // Visit the records whose key starts with strPrefix in key order, beginning
+    // at strStart and ending before strEnd if given, until fn returns false.
+    // Changes not flushed yet are included.
+    bool ScanPrefix(const std::string& strPrefix, const std::string& strStart,
+                    const std::function<bool(const std::string& strKey, const std::string& strValue)>& fn,
+                    const std::string& strEnd = std::string());
+
     bool LoadBlockIndexGuts();
+
+    // Memory-mapped copy of the block index, see LoadBlockIndexSnapshot()
+    bool WriteBlockIndexSnapshot();
+    bool LoadBlockIndexSnapshot();
+    bool ReadBlockIndexSnapshot(const char* pBegin, size_t nSize);
+    bool LoadCoins();
+    bool RebuildCoins();
+    bool MigrateTxIndex();
 };
 
 
@@ -0,0 +1,144 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txdbstats.h"
+
+#include <atomic>
+#include <mutex>
+#include <string.h>
+
+using namespace std;
+
+// Upper bound on the number of key spaces counted, the database has a few dozen
+static const unsigned int MAX_TXDB_KEYSPACES = 64;
+static const unsigned int MAX_TXDB_KEYSPACE_NAME = 24;
+
+// Counters are updated from every thread that touches the database. Slots are
+// claimed once and never released, so finding one needs no lock.
+class CTxDBKeyspaceCounters
+{
+public:
+    char pszName[MAX_TXDB_KEYSPACE_NAME + 1];
+    size_t nNameLen;
+    std::atomic<uint64_t> nOps[TXDB_OP_COUNT][TXDB_SOURCE_COUNT];
+    std::atomic<uint64_t> nLatency[TXDB_OP_COUNT][TXDB_LATENCY_BUCKETS];
+    std::atomic<uint64_t> nMicros[TXDB_OP_COUNT];
+    std::atomic<uint64_t> nBytesRead;
+    std::atomic<uint64_t> nBytesWritten;
+};
+
+static CTxDBKeyspaceCounters counters[MAX_TXDB_KEYSPACES];
+static std::atomic<unsigned int> nKeyspaces(0);
+static std::mutex mutexKeyspaces;
+
+// The key space name inside strKey, without copying it
+static const char* KeyspaceName(const string& strKey, size_t& nLen)
+{
+    // Keys are a serialized string, optionally followed by more fields
+    if (strKey.empty())
+    {
+        nLen = 0;
+        return "";
+    }
+
+    unsigned int nSize = (unsigned char) strKey[0];
+
+    if (nSize >= 253 || strKey.size() < 1 + nSize)
+    {
+        nLen = 1;
+        return "?";
+    }
+
+    nLen = min(nSize, MAX_TXDB_KEYSPACE_NAME);
+    return strKey.data() + 1;
+}
+
+string TxDBKeyspace(const string& strKey)
+{
+    size_t nLen;
+    const char* pchName = KeyspaceName(strKey, nLen);
+    return string(pchName, nLen);
+}
+
+static CTxDBKeyspaceCounters* FindKeyspace(const char* pchName, size_t nLen)
+{
+    unsigned int nCount = nKeyspaces.load(std::memory_order_acquire);
+
+    for (unsigned int i = 0; i < nCount; i++)
+    {
+        if (counters[i].nNameLen == nLen && memcmp(counters[i].pszName, pchName, nLen) == 0)
+            return &counters[i];
+    }
+
+    std::lock_guard<std::mutex> lock(mutexKeyspaces);
+    nCount = nKeyspaces.load(std::memory_order_relaxed);
+
+    for (unsigned int i = 0; i < nCount; i++)
+    {
+        if (counters[i].nNameLen == nLen && memcmp(counters[i].pszName, pchName, nLen) == 0)
+            return &counters[i];
+    }
+
+    // Everything past the limit shares the last slot
+    if (nCount == MAX_TXDB_KEYSPACES)
+        return &counters[MAX_TXDB_KEYSPACES - 1];
+
+    CTxDBKeyspaceCounters* pcounters = &counters[nCount];
+    memcpy(pcounters->pszName, pchName, nLen);
+    pcounters->pszName[nLen] = 0;
+    pcounters->nNameLen = nLen;
+    nKeyspaces.store(nCount + 1, std::memory_order_release);
+    return pcounters;
+}
+
+void RecordTxDBAccess(const string& strKey, TxDBOp op, TxDBSource source, int64_t nMicros, size_t nBytes)
+{
+    size_t nLen;
+    const char* pchName = KeyspaceName(strKey, nLen);
+    CTxDBKeyspaceCounters* pcounters = FindKeyspace(pchName, nLen);
+    int nBucket = 0;
+
+    while (nBucket < TXDB_LATENCY_BUCKETS - 1 && nMicros >= (1LL << nBucket))
+        nBucket++;
+
+    pcounters->nOps[op][source].fetch_add(1, std::memory_order_relaxed);
+    pcounters->nLatency[op][nBucket].fetch_add(1, std::memory_order_relaxed);
+    pcounters->nMicros[op].fetch_add(nMicros, std::memory_order_relaxed);
+
+    if (op == TXDB_READ)
+        pcounters->nBytesRead.fetch_add(nBytes, std::memory_order_relaxed);
+    else if (op == TXDB_WRITE)
+        pcounters->nBytesWritten.fetch_add(nBytes, std::memory_order_relaxed);
+}
+
+vector<CTxDBKeyspaceStats> GetTxDBStats()
+{
+    vector<CTxDBKeyspaceStats> vStats;
+    unsigned int nCount = nKeyspaces.load(std::memory_order_acquire);
+
+    for (unsigned int i = 0; i < nCount; i++)
+    {
+        const CTxDBKeyspaceCounters& c = counters[i];
+        CTxDBKeyspaceStats stats;
+        stats.strName = c.pszName;
+
+        for (int op = 0; op < TXDB_OP_COUNT; op++)
+        {
+            for (int source = 0; source < TXDB_SOURCE_COUNT; source++)
+                stats.nOps[op][source] = c.nOps[op][source];
+
+            for (int nBucket = 0; nBucket < TXDB_LATENCY_BUCKETS; nBucket++)
+                stats.nLatency[op][nBucket] = c.nLatency[op][nBucket];
+
+            stats.nMicros[op] = c.nMicros[op];
+        }
+
+        stats.nBytesRead = c.nBytesRead;
+        stats.nBytesWritten = c.nBytesWritten;
+        vStats.push_back(stats);
+    }
+
+    return vStats;
+}
@@ -0,0 +1,76 @@
+// Copyright (c) 2020 The Neutron Developers
+//
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef NEUTRON_TXDBSTATS_H
+#define NEUTRON_TXDBSTATS_H
+
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+enum TxDBOp
+{
+    TXDB_READ = 0,
+    TXDB_WRITE,
+    TXDB_ERASE,
+    TXDB_EXISTS,
+    TXDB_OP_COUNT
+};
+
+// Where an operation was answered. Writes and erases either go to the open
+// transaction or straight to LevelDB.
+enum TxDBSource
+{
+    TXDB_SOURCE_BATCH = 0,
+    TXDB_SOURCE_CACHE,
+    TXDB_SOURCE_DISK,
+    TXDB_SOURCE_MISSING,
+    TXDB_SOURCE_COUNT
+};
+
+// Latency bucket i counts operations that took less than 2^i microseconds,
+// the last bucket everything slower
+static const int TXDB_LATENCY_BUCKETS = 16;
+
+/** Counters of one key space of the transaction database, such as "tx" or
+ * "blockindex". The key space is the string every key starts with.
+ */
+class CTxDBKeyspaceStats
+{
+public:
+    std::string strName;
+    uint64_t nOps[TXDB_OP_COUNT][TXDB_SOURCE_COUNT];
+    uint64_t nLatency[TXDB_OP_COUNT][TXDB_LATENCY_BUCKETS];
+    uint64_t nMicros[TXDB_OP_COUNT];
+    uint64_t nBytesRead;
+    uint64_t nBytesWritten;
+};
+
+/** The key space of a serialized key */
+std::string TxDBKeyspace(const std::string& strKey);
+
+/** Count an operation on strKey that took nMicros and moved nBytes of value */
+void RecordTxDBAccess(const std::string& strKey, TxDBOp op, TxDBSource source, int64_t nMicros, size_t nBytes);
+
+/** The counters of every key space seen so far */
+std::vector<CTxDBKeyspaceStats> GetTxDBStats();
+
+/** Measures the duration of a database operation */
+class CTxDBTimer
+{
+private:
+    std::chrono::steady_clock::time_point start;
+
+public:
+    CTxDBTimer() : start(std::chrono::steady_clock::now()) {}
+
+    int64_t Micros() const
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+#endif // NEUTRON_TXDBSTATS_H
@@ -6,24 +6,46 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "validation.h"
+#include "addressindex.h"
 #include "main.h"
 #include "checkpoints.h"
+#include "collectionhashing.h"
+#include "prune.h"
+#include "spentindex.h"
 #include "timedata.h"
+#include "timestampindex.h"
 #include "tinyformat.h"
+#include "txdb.h"
 #include "script/standard.h"
+#include "streams.h"
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/thread.hpp>
+
+#include <deque>
 
 using namespace std;
 using namespace boost;
 
+extern std::atomic<bool> fRequestShutdown;
+
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 
-static filesystem::path BlockFilePath(unsigned int nFile)
+// Where the block files are kept, the data directory if empty
+static filesystem::path pathBlockFiles;
+
+void SetBlockFileDir(const filesystem::path& dir)
+{
+    pathBlockFiles = dir;
+}
+
+filesystem::path BlockFilePath(unsigned int nFile)
 {
     string strBlockFn = strprintf("blk%04u.dat", nFile);
-    return GetDataDir() / strBlockFn;
+    return (pathBlockFiles.empty() ? GetDataDir() : pathBlockFiles) / strBlockFn;
 }
 
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode)
@@ -56,6 +78,10 @@ FILE* AppendBlockFile(unsigned int& nFileRet)
 
     while (true)
     {
+        // The number of a pruned file is never used again
+        while (IsBlockFilePruned(nCurrentBlockFile))
+            nCurrentBlockFile++;
+
         FILE* file = OpenBlockFile(nCurrentBlockFile, 0, "ab");
 
         if (!file)
@@ -65,7 +91,9 @@ FILE* AppendBlockFile(unsigned int& nFileRet)
             return NULL;
 
         // FAT32 file size max 4GB, fseek and ftell max 2GB, so we must stay under 2GB
-        if (ftell(file) < (long) (0x7F000000 - MAX_SIZE))
+        long nMaxSize = nPruneTarget ? PRUNE_BLOCKFILE_SIZE : (long) (0x7F000000 - MAX_SIZE);
+
+        if (ftell(file) < nMaxSize)
         {
             nFileRet = nCurrentBlockFile;
             return file;
@@ -76,6 +104,741 @@ FILE* AppendBlockFile(unsigned int& nFileRet)
     }
 }
 
+unsigned int GetCurrentBlockFile()
+{
+    return nCurrentBlockFile;
+}
+
+static CCriticalSection cs_dirtyblockfiles;
+static set<unsigned int> setDirtyBlockFiles;
+static unsigned int nDirtyBlocks = 0;
+
+void MarkBlockFileDirty(unsigned int nFile)
+{
+    LOCK(cs_dirtyblockfiles);
+    setDirtyBlockFiles.insert(nFile);
+    nDirtyBlocks++;
+}
+
+bool FlushBlockFiles()
+{
+    set<unsigned int> setFiles;
+    unsigned int nBlocks;
+
+    {
+        LOCK(cs_dirtyblockfiles);
+        setFiles.swap(setDirtyBlockFiles);
+        nBlocks = nDirtyBlocks;
+        nDirtyBlocks = 0;
+    }
+
+    if (setFiles.empty())
+        return true;
+
+    int64_t nStart = GetTimeMillis();
+
+    for (set<unsigned int>::iterator it = setFiles.begin(); it != setFiles.end(); ++it)
+    {
+        FILE* file = OpenBlockFile(*it, 0, "ab");
+
+        if (!file)
+        {
+            // This file and the ones not reached yet are synced with the next flush
+            {
+                LOCK(cs_dirtyblockfiles);
+                setDirtyBlockFiles.insert(it, setFiles.end());
+                nDirtyBlocks += nBlocks;
+            }
+
+            return error("%s : cannot open blk%04u.dat", __func__, *it);
+        }
+
+        FileCommit(file);
+        fclose(file);
+    }
+
+    if (fDebug)
+    {
+        LogPrintf("%s : synced %u blocks in %u files in %dms\n", __func__, nBlocks,
+                  setFiles.size(), GetTimeMillis() - nStart);
+    }
+
+    return true;
+}
+
+// A block framed in an external file, on its way from the reader to the chain.
+// pData points into the mapped file, or to vData when the file is read instead.
+struct CImportBlock
+{
+    std::vector<char> vData;
+    const char* pData;
+    unsigned int nSize;
+    CBlock block;
+    bool fChecked;
+    bool fValid;
+
+    CImportBlock() : pData(NULL), nSize(0), fChecked(false), fValid(false) {}
+};
+
+typedef std::shared_ptr<CImportBlock> CImportBlockRef;
+
+// Blocks read ahead of the one being connected, in file order
+class CImportQueue
+{
+public:
+    boost::mutex mutex;
+    boost::condition_variable condRead;
+    boost::condition_variable condCheck;
+    boost::condition_variable condConnect;
+
+    std::deque<CImportBlockRef> queue;
+    std::deque<CImportBlockRef> queueCheck;
+    size_t nBytes;
+    bool fReaderDone;
+    bool fAbort;
+
+    CImportQueue() : nBytes(0), fReaderDone(false), fAbort(false) {}
+
+    bool Full() const
+    {
+        return nBytes >= MAX_IMPORT_QUEUE_BYTES || queue.size() >= MAX_IMPORT_QUEUE_BLOCKS;
+    }
+};
+
+// Split a file into blocks the way CBlock::WriteToDisk() framed them: the
+// message start, the size of the block and the block itself. Anything between
+// frames is skipped. fn is called with the offset of the block in the file and
+// its bytes, and stops the scan by returning false.
+static void ScanBlockFrames(FILE* file, const std::function<bool(uint64_t, const char*, unsigned int)>& fn,
+                            uint64_t& nFileBytes)
+{
+    std::vector<char> vBuf;
+    uint64_t nBufOffset = 0;
+    size_t nPos = 0;
+    bool fEof = false;
+
+    // Drop what has been consumed and append the next chunk of the file
+    auto fill = [&]() -> bool {
+        if (fEof)
+            return false;
+
+        vBuf.erase(vBuf.begin(), vBuf.begin() + nPos);
+        nBufOffset += nPos;
+        nPos = 0;
+
+        size_t nHave = vBuf.size();
+        vBuf.resize(nHave + IMPORT_READ_CHUNK);
+        size_t nRead = fread(vBuf.data() + nHave, 1, IMPORT_READ_CHUNK, file);
+        vBuf.resize(nHave + nRead);
+        nFileBytes += nRead;
+
+        if (nRead < IMPORT_READ_CHUNK)
+            fEof = true;
+
+        return nRead > 0;
+    };
+
+    const size_t nHeader = sizeof(pchMessageStart) + sizeof(unsigned int);
+
+    while (!fRequestShutdown)
+    {
+        if (vBuf.size() - nPos < nHeader && !fill())
+            break;
+
+        if (vBuf.size() - nPos < nHeader)
+            continue;
+
+        char* pFind = (char*) memchr(vBuf.data() + nPos, pchMessageStart[0], vBuf.size() - nPos - nHeader + 1);
+
+        if (!pFind)
+        {
+            nPos = vBuf.size() - nHeader + 1;
+
+            if (!fill())
+                break;
+
+            continue;
+        }
+
+        nPos = pFind - vBuf.data();
+
+        if (memcmp(pFind, pchMessageStart, sizeof(pchMessageStart)) != 0)
+        {
+            nPos++;
+            continue;
+        }
+
+        unsigned int nSize;
+        memcpy(&nSize, pFind + sizeof(pchMessageStart), sizeof(nSize));
+
+        if (nSize == 0 || nSize > MAX_BLOCK_SIZE)
+        {
+            nPos++;
+            continue;
+        }
+
+        if (vBuf.size() - nPos < nHeader + nSize)
+        {
+            // Truncated block at the end of the file
+            if (!fill() && vBuf.size() - nPos < nHeader + nSize)
+                break;
+
+            continue;
+        }
+
+        uint64_t nBlockPos = nBufOffset + nPos + nHeader;
+        const char* pch = vBuf.data() + nPos + nHeader;
+        nPos += nHeader + nSize;
+
+        if (!fn(nBlockPos, pch, nSize))
+            break;
+    }
+}
+
+// As ScanBlockFrames(), on the nSize bytes of a file mapped at pBegin
+static void ScanMappedBlockFrames(const char* pBegin, size_t nSize,
+                                  const std::function<bool(uint64_t, const char*, unsigned int)>& fn)
+{
+    const size_t nHeader = sizeof(pchMessageStart) + sizeof(unsigned int);
+    size_t nPos = 0;
+
+    while (!fRequestShutdown && nSize - nPos >= nHeader)
+    {
+        const char* pFind = (const char*) memchr(pBegin + nPos, pchMessageStart[0], nSize - nPos - nHeader + 1);
+
+        if (!pFind)
+            break;
+
+        nPos = pFind - pBegin;
+
+        if (memcmp(pFind, pchMessageStart, sizeof(pchMessageStart)) != 0)
+        {
+            nPos++;
+            continue;
+        }
+
+        unsigned int nBlockSize;
+        memcpy(&nBlockSize, pFind + sizeof(pchMessageStart), sizeof(nBlockSize));
+
+        if (nBlockSize == 0 || nBlockSize > MAX_BLOCK_SIZE)
+        {
+            nPos++;
+            continue;
+        }
+
+        // Truncated block at the end of the file
+        if (nSize - nPos - nHeader < nBlockSize)
+            break;
+
+        if (!fn(nPos + nHeader, pFind + nHeader, nBlockSize))
+            break;
+
+        nPos += nHeader + nBlockSize;
+    }
+}
+
+// Frames the blocks of the mapped file if pMapped is set, reading file otherwise
+static void ThreadImportReader(FILE* file, const char* pMapped, size_t nMapped, CImportQueue& import,
+                               uint64_t& nFileBytes)
+{
+    RenameThread("neutron-loadblk");
+
+    auto queue = [&](uint64_t nBlockPos, const char* pch, unsigned int nSize) -> bool {
+        CImportBlockRef item = std::make_shared<CImportBlock>();
+
+        // The mapping outlives the import, only read blocks have to be copied
+        if (pMapped)
+            item->pData = pch;
+        else
+        {
+            item->vData.assign(pch, pch + nSize);
+            item->pData = item->vData.data();
+        }
+
+        item->nSize = nSize;
+
+        boost::unique_lock<boost::mutex> lock(import.mutex);
+
+        while (import.Full() && !import.fAbort)
+            import.condRead.wait(lock);
+
+        if (import.fAbort)
+            return false;
+
+        import.nBytes += nSize;
+        import.queue.push_back(item);
+        import.queueCheck.push_back(item);
+        import.condCheck.notify_one();
+        return true;
+    };
+
+    if (pMapped)
+    {
+        ScanMappedBlockFrames(pMapped, nMapped, queue);
+        nFileBytes = nMapped;
+    }
+    else
+        ScanBlockFrames(file, queue, nFileBytes);
+
+    boost::unique_lock<boost::mutex> lock(import.mutex);
+    import.fReaderDone = true;
+    import.condCheck.notify_all();
+    import.condConnect.notify_all();
+}
+
+// Deserialize and run the context-free checks, which is most of the work that
+// does not depend on the blocks before it
+static void ThreadImportChecker(CImportQueue& import)
+{
+    RenameThread("neutron-loadchk");
+
+    while (true)
+    {
+        CImportBlockRef item;
+
+        {
+            boost::unique_lock<boost::mutex> lock(import.mutex);
+
+            while (import.queueCheck.empty() && !import.fReaderDone && !import.fAbort)
+                import.condCheck.wait(lock);
+
+            if (import.queueCheck.empty() || import.fAbort)
+                return;
+
+            item = import.queueCheck.front();
+            import.queueCheck.pop_front();
+        }
+
+        bool fValid = false;
+
+        try
+        {
+            CBufferReader reader(item->pData, item->pData + item->nSize, SER_DISK, CLIENT_VERSION);
+            reader >> item->block;
+            item->block.CacheHashes();
+            fValid = item->block.CheckBlock();
+        }
+        catch (const std::exception& e)
+        {
+            LogPrintf("%s : cannot deserialize block: %s\n", __func__, e.what());
+        }
+
+        boost::unique_lock<boost::mutex> lock(import.mutex);
+        item->vData = std::vector<char>();
+        item->pData = NULL;
+        item->fValid = fValid;
+        item->fChecked = true;
+        import.condConnect.notify_all();
+    }
+}
+
+bool LoadExternalBlockFile(const filesystem::path& path)
+{
+    FILE* file = fopen(path.string().c_str(), "rb");
+
+    if (!file)
+        return error("%s : cannot open %s", __func__, path.string());
+
+    int64_t nStart = GetTimeMillis();
+    int64_t nLastReport = nStart;
+    int nThreads = max(1, min((int) boost::thread::hardware_concurrency(), 16));
+    int nLoaded = 0;
+    int nRejected = 0;
+    uint64_t nFileBytes = 0;
+    uint64_t nBlockBytes = 0;
+
+    // Map the file so that blocks are deserialized where they are, reading it in
+    // chunks is the fallback, e.g. where the address space is too small
+    std::unique_ptr<boost::interprocess::mapped_region> region;
+
+    try
+    {
+        boost::interprocess::file_mapping mapping(path.string().c_str(), boost::interprocess::read_only);
+        region.reset(new boost::interprocess::mapped_region(mapping, boost::interprocess::read_only));
+        region->advise(boost::interprocess::mapped_region::advice_sequential);
+    }
+    catch (const std::exception& e)
+    {
+        LogPrintf("%s : cannot map %s, reading it instead: %s\n", __func__, path.string(), e.what());
+        region.reset();
+    }
+
+    const char* pMapped = region ? (const char*) region->get_address() : NULL;
+    size_t nMapped = region ? region->get_size() : 0;
+
+    CImportQueue import;
+    boost::thread_group threadGroup;
+
+    threadGroup.create_thread([&]() { ThreadImportReader(file, pMapped, nMapped, import, nFileBytes); });
+
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread([&]() { ThreadImportChecker(import); });
+
+    // Blocks are connected on this thread and in file order, so a block always
+    // finds its parent unless the file itself is out of order
+    while (!fRequestShutdown)
+    {
+        CImportBlockRef item;
+
+        {
+            boost::unique_lock<boost::mutex> lock(import.mutex);
+
+            while (!(!import.queue.empty() && import.queue.front()->fChecked) &&
+                   !(import.queue.empty() && import.fReaderDone))
+            {
+                import.condConnect.wait_for(lock, boost::chrono::milliseconds(500));
+
+                if (fRequestShutdown)
+                    break;
+            }
+
+            if (import.queue.empty() || !import.queue.front()->fChecked)
+                break;
+
+            item = import.queue.front();
+            import.queue.pop_front();
+            import.nBytes -= item->nSize;
+            import.condRead.notify_one();
+        }
+
+        if (!item->fValid)
+        {
+            nRejected++;
+            continue;
+        }
+
+        bool fAccepted;
+
+        {
+            LOCK(cs_main);
+            fAccepted = ProcessNewBlock(NULL, &item->block);
+        }
+
+        if (fAccepted)
+        {
+            nLoaded++;
+            nBlockBytes += item->nSize;
+        }
+        else
+            nRejected++;
+
+        if (GetTimeMillis() - nLastReport >= 10000)
+        {
+            nLastReport = GetTimeMillis();
+            LogPrintf("%s : %d blocks (%.1f MiB) loaded, height %d\n", __func__,
+                      nLoaded, nBlockBytes / 1048576.0, nBestHeight);
+        }
+    }
+
+    {
+        boost::unique_lock<boost::mutex> lock(import.mutex);
+        import.fAbort = true;
+        import.condRead.notify_all();
+        import.condCheck.notify_all();
+    }
+
+    threadGroup.join_all();
+    fclose(file);
+
+    double dSeconds = max(GetTimeMillis() - nStart, (int64_t) 1) / 1000.0;
+
+    LogPrintf("Loaded %i blocks (%d rejected) from external file in %dms with %d threads, "
+              "%.1f blocks/s, %.1f MiB/s\n", nLoaded, nRejected, GetTimeMillis() - nStart, nThreads,
+              nLoaded / dSeconds, nFileBytes / 1048576.0 / dSeconds);
+
+    return nLoaded > 0;
+}
+
+// A block found by ReindexBlockFiles() and where it is stored
+struct CReindexBlock
+{
+    uint256 hash;
+    uint256 hashPrev;
+    unsigned int nFile;
+    unsigned int nBlockPos;
+};
+
+// Find every block stored in blkNNNN.dat, reading the files in parallel
+static bool ScanBlockFiles(std::vector<CReindexBlock>& vBlocks, int nThreads, uint64_t& nFileBytes)
+{
+    unsigned int nFiles = 0;
+
+    while (filesystem::exists(BlockFilePath(nFiles + 1)))
+        nFiles++;
+
+    std::vector<std::vector<CReindexBlock> > vFileBlocks(nFiles);
+    std::atomic<unsigned int> nNext(0);
+    std::atomic<uint64_t> nBytes(0);
+    std::atomic<bool> fFailed(false);
+    boost::thread_group threadGroup;
+
+    for (int i = 0; i < nThreads; i++)
+    {
+        threadGroup.create_thread([&]() {
+            RenameThread("neutron-reindex");
+
+            for (unsigned int n = nNext++; n < nFiles && !fRequestShutdown; n = nNext++)
+            {
+                FILE* file = OpenBlockFile(n + 1, 0);
+
+                if (!file)
+                {
+                    LogPrintf("ReindexBlockFiles : cannot open blk%04u.dat\n", n + 1);
+                    fFailed = true;
+                    continue;
+                }
+
+                uint64_t nRead = 0;
+
+                ScanBlockFrames(file, [&](uint64_t nBlockPos, const char* pch, unsigned int nSize) -> bool {
+                    CBlock block;
+
+                    try
+                    {
+                        CBufferReader reader(pch, pch + nSize, SER_DISK | SER_BLOCKHEADERONLY, CLIENT_VERSION);
+                        reader >> block;
+                    }
+                    catch (const std::exception& e)
+                    {
+                        LogPrintf("ReindexBlockFiles : skipping unreadable block at %u in blk%04u.dat\n",
+                                  (unsigned int) nBlockPos, n + 1);
+                        return true;
+                    }
+
+                    CReindexBlock entry;
+                    entry.hash = block.GetHash();
+                    entry.hashPrev = block.hashPrevBlock;
+                    entry.nFile = n + 1;
+                    entry.nBlockPos = nBlockPos;
+                    vFileBlocks[n].push_back(entry);
+                    return true;
+                }, nRead);
+
+                fclose(file);
+                nBytes += nRead;
+            }
+        });
+    }
+
+    threadGroup.join_all();
+    nFileBytes = nBytes;
+
+    BOOST_FOREACH(const std::vector<CReindexBlock>& v, vFileBlocks)
+        vBlocks.insert(vBlocks.end(), v.begin(), v.end());
+
+    return !fFailed;
+}
+
+bool ReindexBlockFiles()
+{
+    int64_t nStart = GetTimeMillis();
+    int nThreads = max(1, min((int) boost::thread::hardware_concurrency(), 16));
+    uint256 hashGenesis = (!fTestNet ? hashGenesisBlock : hashGenesisBlockTestNet);
+
+    LogPrintf("%s : scanning block files with %d threads\n", __func__, nThreads);
+
+    std::vector<CReindexBlock> vBlocks;
+    uint64_t nFileBytes = 0;
+
+    if (!ScanBlockFiles(vBlocks, nThreads, nFileBytes))
+        return false;
+
+    if (fRequestShutdown)
+        return false;
+
+    LogPrintf("%s : found %u blocks (%.1f MiB) in %dms\n", __func__, vBlocks.size(),
+              nFileBytes / 1048576.0, GetTimeMillis() - nStart);
+
+    // Order the blocks so that every block comes after its parent, keeping to
+    // the order of the files where possible. Blocks that do not link up with the
+    // genesis block, and second copies of a block, are left out.
+    std::multimap<uint256, unsigned int> mapNext;
+    std::vector<unsigned int> vStack;
+    std::vector<unsigned int> vOrder;
+    std::set<uint256> setQueued;
+    unsigned int nIndexed = 0;
+
+    for (unsigned int i = 0; i < vBlocks.size(); i++)
+    {
+        if (vBlocks[i].hash == hashGenesis)
+        {
+            if (vStack.empty())
+                vStack.push_back(i);
+        }
+        else
+            mapNext.insert(std::make_pair(vBlocks[i].hashPrev, i));
+    }
+
+    while (!vStack.empty())
+    {
+        unsigned int i = vStack.back();
+        vStack.pop_back();
+
+        if (!setQueued.insert(vBlocks[i].hash).second)
+            continue;
+
+        // Connected before an interrupted reindex stopped
+        if (!mapBlockIndex.count(vBlocks[i].hash))
+            vOrder.push_back(i);
+        else
+            nIndexed++;
+
+        auto range = mapNext.equal_range(vBlocks[i].hash);
+        std::vector<unsigned int> vNext;
+
+        for (auto it = range.first; it != range.second; ++it)
+            vNext.push_back(it->second);
+
+        // Visit the children in file order
+        vStack.insert(vStack.end(), vNext.rbegin(), vNext.rend());
+    }
+
+    if (nIndexed > 0)
+        LogPrintf("%s : resuming, %u blocks already indexed\n", __func__, nIndexed);
+
+    if (vOrder.size() + nIndexed < vBlocks.size())
+        LogPrintf("%s : skipping %u orphaned or duplicate blocks\n", __func__, vBlocks.size() - vOrder.size() - nIndexed);
+
+    // Read and check blocks on worker threads ahead of the one being connected
+    std::vector<std::shared_ptr<CBlock> > vRead(vOrder.size());
+    std::vector<char> vValid(vOrder.size(), 0);
+    unsigned int nConnected = 0;
+    std::atomic<unsigned int> nNext(0);
+    bool fAbort = false;
+    boost::mutex mutex;
+    boost::condition_variable condRead;
+    boost::condition_variable condConnect;
+    boost::thread_group threadGroup;
+
+    for (int i = 0; i < nThreads; i++)
+    {
+        threadGroup.create_thread([&]() {
+            RenameThread("neutron-reindex");
+
+            for (unsigned int n = nNext++; n < vOrder.size(); n = nNext++)
+            {
+                {
+                    boost::unique_lock<boost::mutex> lock(mutex);
+
+                    while (n >= nConnected + MAX_REINDEX_READ_AHEAD && !fAbort)
+                        condRead.wait(lock);
+
+                    if (fAbort)
+                        return;
+                }
+
+                const CReindexBlock& entry = vBlocks[vOrder[n]];
+                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+                bool fValid = pblock->ReadFromDisk(entry.nFile, entry.nBlockPos);
+
+                if (fValid)
+                {
+                    pblock->CacheHashes();
+                    fValid = pblock->GetHash() == entry.hash && pblock->CheckBlock();
+                }
+
+                boost::unique_lock<boost::mutex> lock(mutex);
+                vRead[n] = pblock;
+                vValid[n] = fValid ? 1 : -1;
+                condConnect.notify_all();
+            }
+        });
+    }
+
+    // The address index is built in one parallel pass once the chain is connected
+    bool fBuildAddressIndex = fAddressIndex;
+    fAddressIndex = false;
+
+    int64_t nStartConnect = GetTimeMillis();
+    int64_t nLastReport = nStartConnect;
+    unsigned int nRejected = 0;
+    uint64_t nBlockBytes = 0;
+
+    for (unsigned int n = 0; n < vOrder.size() && !fRequestShutdown; n++)
+    {
+        const CReindexBlock& entry = vBlocks[vOrder[n]];
+        std::shared_ptr<CBlock> pblock;
+        bool fValid;
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+
+            while (!vValid[n])
+                condConnect.wait(lock);
+
+            pblock.swap(vRead[n]);
+            fValid = vValid[n] > 0;
+            nConnected = n + 1;
+            condRead.notify_all();
+        }
+
+        // The parent has to be in the index, it may have been rejected; the
+        // children of a rejected block are not held as orphans
+        bool fAccepted = false;
+
+        if (fValid)
+        {
+            LOCK(cs_main);
+
+            if (entry.hash == hashGenesis)
+                fAccepted = pblock->AddToBlockIndex(entry.nFile, entry.nBlockPos, hashGenesis);
+            else if (mapBlockIndex.count(entry.hashPrev))
+                fAccepted = ProcessNewBlock(NULL, pblock.get(), entry.nFile, entry.nBlockPos);
+        }
+
+        if (!fAccepted)
+        {
+            nRejected++;
+            continue;
+        }
+
+        nBlockBytes += ::GetSerializeSize(*pblock, SER_DISK, CLIENT_VERSION);
+
+        if (GetTimeMillis() - nLastReport >= 10000)
+        {
+            double dSeconds = (GetTimeMillis() - nStartConnect) / 1000.0;
+            nLastReport = GetTimeMillis();
+
+            LogPrintf("%s : %u/%u blocks, height %d, %.1f blocks/s, %.1f MiB/s\n", __func__, n + 1,
+                      vOrder.size(), nBestHeight, (n + 1) / dSeconds, nBlockBytes / 1048576.0 / dSeconds);
+        }
+    }
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fAbort = true;
+        condRead.notify_all();
+    }
+
+    threadGroup.join_all();
+    fAddressIndex = fBuildAddressIndex;
+
+    if (fRequestShutdown)
+    {
+        LogPrintf("%s : interrupted at height %d\n", __func__, nBestHeight);
+        return false;
+    }
+
+    double dSeconds = max(GetTimeMillis() - nStartConnect, (int64_t) 1) / 1000.0;
+
+    LogPrintf("%s : connected %u blocks (%u rejected) up to height %d in %dms, %.1f blocks/s, %.1f MiB/s\n",
+              __func__, vOrder.size() - nRejected, nRejected, nBestHeight, GetTimeMillis() - nStart,
+              (vOrder.size() - nRejected) / dSeconds, nBlockBytes / 1048576.0 / dSeconds);
+
+    if (fAddressIndex && !BuildAddressIndex(nThreads))
+        return error("%s : building the address index failed", __func__);
+
+    // The optional indexes now cover the whole chain, init only checks them
+    CTxDB txdb;
+
+    if (!txdb.WriteFlag("addressindex", fAddressIndex) || !txdb.WriteFlag("spentindex", fSpentIndex) ||
+        !txdb.WriteFlag("timestampindex", fTimestampIndex) || !txdb.WriteFlag("reindex", false))
+        return error("%s : writing the index flags failed", __func__);
+
+    fReindex = false;
+    return true;
+}
+
 // Once this function has returned false it should remain so most of the time
 static std::atomic<bool> latchToFalse{false};
 
@@ -12,13 +12,53 @@
 #include <stdint.h>
 #include <string>
 
+#include <boost/filesystem/path.hpp>
+
 static const int MAX_INACTIVITY_IBD = 60 * 5; /* 5 minutes */
 static const int64_t DEFAULT_MAX_TIP_AGE = 60 * 60 * 2;
 extern int64_t nMaxTipAge;
 class CBlockIndex;
 
+/** Keep the block files in dir instead of the data directory, an empty path
+ *  restores the default. Has to be called before any block file is opened. */
+void SetBlockFileDir(const boost::filesystem::path& dir);
+
+boost::filesystem::path BlockFilePath(unsigned int nFile);
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode="rb");
 FILE* AppendBlockFile(unsigned int& nFileRet);
+
+/** The block file new blocks are appended to */
+unsigned int GetCurrentBlockFile();
+
+/** Remember that data was appended to a block file without syncing it */
+void MarkBlockFileDirty(unsigned int nFile);
+
+/** Sync every block file appended to since the last call */
+bool FlushBlockFiles();
+
+/** Bound on the blocks read ahead of the one being connected by LoadExternalBlockFile() */
+static const size_t MAX_IMPORT_QUEUE_BYTES = 64 * 1024 * 1024;
+static const size_t MAX_IMPORT_QUEUE_BLOCKS = 4096;
+static const size_t IMPORT_READ_CHUNK = 16 * 1024 * 1024;
+
+/** Import the blocks of a bootstrap.dat style file. The file is mapped into
+ * memory, or read in IMPORT_READ_CHUNK pieces where it cannot be. Framing,
+ * deserializing and checking the blocks is spread over worker threads; blocks
+ * are connected in file order on the calling thread.
+ */
+bool LoadExternalBlockFile(const boost::filesystem::path& path);
+
+/** Bound on the blocks read ahead of the one being connected by ReindexBlockFiles() */
+static const unsigned int MAX_REINDEX_READ_AHEAD = 1024;
+
+/** Rebuild the block index from the blocks stored in blkNNNN.dat, as on -reindex.
+ * The files are scanned in parallel; the blocks are then connected in chain
+ * order through ProcessNewBlock(), with reading and checking spread over worker
+ * threads. Blocks indexed by an interrupted run are skipped. Writes the flags of
+ * the optional indexes and clears the reindex flag once they are complete;
+ * returns false without them if interrupted.
+ */
+bool ReindexBlockFiles();
 void DelatchIsInitialBlockDownload();
 bool IsInitialBlockDownload();
 
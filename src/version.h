@@ -11,7 +11,10 @@
 #include <string>
 
 // database format versioning
-static const int DATABASE_VERSION = 70509;
+static const int DATABASE_VERSION = 70510;
+
+// oldest database format that is upgraded in place rather than rebuilt
+static const int DATABASE_MIGRATE_VERSION = 70509;
 
 // network protocol versioning
 static const int PROTOCOL_VERSION = 60025;